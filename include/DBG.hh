@@ -82,6 +82,17 @@ public:
         return backward_support->get_node_label(v.id);
     }
 
+    // Appends the labels of the given nodes to labels_out, k characters per node.
+    // Faster than calling get_node_label for each node separately.
+    void get_node_labels(const vector<Node>& nodes, string& labels_out) const{
+        vector<int64_t> ids;
+        ids.reserve(nodes.size());
+        for(const Node& v : nodes) ids.push_back(v.id);
+        int64_t old_size = labels_out.size();
+        labels_out.resize(old_size + nodes.size() * get_k());
+        backward_support->get_node_labels(ids.data(), ids.size(), labels_out.data() + old_size);
+    }
+
     int64_t indegree(const Node& v) const{
         assert(v.id != -1);
         int64_t in_neighbors[4]; 
@@ -132,6 +143,15 @@ public:
         return SBWT->number_of_kmers();
     }
 
+    // Number of node ids, including dummy nodes
+    int64_t number_of_subsets() const{
+        return SBWT->number_of_subsets();
+    }
+
+    bool is_dummy(const Node& v) const{
+        return backward_support->get_dummy_marks()[v.id];
+    }
+
     int64_t get_k() const{
         return SBWT->get_k();
     }
@@ -86,6 +86,27 @@ class SBWT_backward_traversal_support{
             else throw std::runtime_error("This should never happen");
         }
 
+        // Writes the labels of the given nodes to labels_out, k characters per node, padded with
+        // dollars like in get_node_label. The backward walks of a batch of nodes are advanced in
+        // lockstep. Every step of a single walk depends on the previous one, but the walks are
+        // independent of each other, so the CPU can overlap their cache misses.
+        void get_node_labels(const int64_t* nodes, int64_t n_nodes, char* labels_out) const{
+            int64_t k = SBWT->get_k();
+            constexpr int64_t batch_size = 32;
+            int64_t current[batch_size];
+            for(int64_t batch_start = 0; batch_start < n_nodes; batch_start += batch_size){
+                int64_t batch_end = std::min(n_nodes, batch_start + batch_size);
+                for(int64_t i = batch_start; i < batch_end; i++) current[i - batch_start] = nodes[i];
+                for(int64_t step = 0; step < k; step++){
+                    for(int64_t i = batch_start; i < batch_end; i++){
+                        int64_t& node = current[i - batch_start];
+                        labels_out[i*k + k-1-step] = get_incoming_character(node);
+                        node = backward_step(node); // The root steps back to itself
+                    }
+                }
+            }
+        }
+
         // Returns the incoming path label of length k to the node.
         // If the node is a dummy node and hence such path does not exist,
         // pads the label with dollars from the left.
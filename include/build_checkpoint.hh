@@ -0,0 +1,103 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+using namespace std;
+
+// Records the completed stages of an index build in a manifest file, so that an interrupted build can be
+// continued with `themisto build --resume`. Checkpointing is enabled with --checkpoint or --resume.
+//
+// The manifest and the stage outputs are kept in the directory themisto-checkpoint-[hash of fingerprint]
+// in the temporary directory, so builds with different configurations do not see each other's files.
+// A completed stage has a list of output files with their sizes, and string values such as counts.
+// Outputs in the temporary directory are moved to stable names in the checkpoint directory, where the
+// temporary file manager does not clean them up. When a stage no longer needs the outputs of an earlier
+// stage, they are released: the release is written to the manifest and then the files are deleted.
+// Outputs of completed stages that are not released stay until the build finishes, so a checkpointed
+// build needs more temporary disk space.
+//
+// On resume, the build continues after the last stage whose live files (outputs that have not been
+// released) all have their recorded sizes. If checksums are enabled, CRC32 checksums of the outputs are
+// also recorded and checked, which reads every output once more. Stages after the resume point are
+// forgotten and their files deleted. The manifest is rewritten atomically after every change, so a
+// crash at any point leaves a consistent manifest.
+//
+// Only files that are recorded in the manifest and are in the checkpoint directory are ever deleted.
+// Files outside it, such as the index files, are recorded so that their stage can be skipped, but
+// they are left alone.
+//
+// A default-constructed checkpoint is disabled: no stage is done, files are kept where they are and
+// nothing is recorded.
+class Build_Checkpoint{
+
+public:
+
+    struct File_Record{
+        string path;
+        int64_t size;
+        int64_t crc; // CRC32, or -1 if checksums were not enabled
+    };
+
+    struct Stage_Record{
+        string name;
+        vector<File_Record> files;
+        map<string, string> values;
+        vector<string> released; // Paths of earlier outputs released when this stage completed
+    };
+
+private:
+
+    bool is_enabled = false;
+    bool checksums = false;
+    string dir; // The checkpoint directory
+    string manifest_file;
+    string fingerprint;
+    vector<Stage_Record> stages; // Completed stages in order
+
+    void write_manifest() const;
+    bool load_manifest(); // Returns false if there is no manifest with the same fingerprint
+    bool live_files_intact(int64_t last_stage) const; // Checks the live files after stages[0..last_stage]
+    const Stage_Record* find(const string& stage) const;
+    bool owns(const string& path) const; // True if the file is in the checkpoint directory
+    void remove_owned(const string& path) const; // Deletes the file if it is in the checkpoint directory
+
+public:
+
+    Build_Checkpoint() = default;
+
+    // The fingerprint describes everything that affects the outputs of the stages. With resume, the
+    // build continues from the stages recorded for the same fingerprint, if any. Without resume, throws
+    // if there already is a checkpoint for the same fingerprint, because its files would be overwritten.
+    Build_Checkpoint(const string& temp_dir, const string& fingerprint, bool resume, bool checksums = false);
+
+    bool enabled() const{ return is_enabled; }
+
+    // The directory of the manifest and the stage outputs
+    string get_dir() const{ return dir; }
+
+    // True if the stage was completed and recorded
+    bool is_done(const string& stage) const;
+
+    // A value recorded for a completed stage. Throws if there is no such value.
+    string get_value(const string& stage, const string& key) const;
+
+    // The i-th output file recorded for a completed stage
+    string get_file(const string& stage, int64_t i) const;
+
+    // Moves a temporary file to a stable name for the output of the stage and returns the new name
+    string keep(const string& stage, const string& file, int64_t index = 0);
+
+    // Records the stage as completed, and then deletes the released files of earlier stages that are in
+    // the checkpoint directory
+    void mark_done(const string& stage, const vector<string>& files, const map<string, string>& values = {}, const vector<string>& released = {});
+
+    // Deletes the manifest, the live outputs in the checkpoint directory, and the directory if it is
+    // then empty. Called when the build is finished.
+    void finish();
+};
+
+// CRC32 of the contents of the file
+uint32_t file_crc32(const string& filename);
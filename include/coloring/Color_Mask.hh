@@ -0,0 +1,111 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include "Color_Set_Storage.hh"
+
+using namespace std;
+
+// Restricts the colors of an index to a subset of the colors (the mask). All distinct color
+// sets of the coloring are intersected with the mask once up front, and the results are
+// deduplicated and stored with the colors renumbered to 0..mask_size-1, so that queries only
+// ever touch small sets over the masked universe. Color sets that have colors but none of them
+// in the mask get the special id DISJOINT, so queries can skip them without a lookup.
+template<typename coloring_t>
+class Color_Mask{
+
+public:
+
+    typedef typename coloring_t::colorset_type colorset_t;
+    typedef typename colorset_t::view_t view_t;
+
+    static constexpr int64_t DISJOINT = -3; // Color set has colors, but none in the mask
+
+private:
+
+    vector<int64_t> mask_colors; // Sorted. Masked color i is color mask_colors[i] of the color set objects of the coloring.
+    vector<int64_t> original_colors; // Masked color i is original color original_colors[i] (see Coloring::reorder_colors)
+    vector<int64_t> masked_set_ids; // Original color set id -> masked set id, DISJOINT or -1 if the original set is empty
+    Color_Set_Storage<colorset_t> masked_sets;
+
+public:
+
+    // The colors are original color ids
+    Color_Mask(const coloring_t& coloring, vector<int64_t> colors, int64_t n_threads) : mask_colors(colors) {
+        std::sort(mask_colors.begin(), mask_colors.end());
+        mask_colors.erase(std::unique(mask_colors.begin(), mask_colors.end()), mask_colors.end());
+        if(mask_colors.size() == 0) throw std::runtime_error("Empty color mask");
+        if(mask_colors[0] < 0 || mask_colors.back() > coloring.largest_color())
+            throw std::runtime_error("Color mask has colors that are not in the index");
+
+        for(int64_t& c : mask_colors) c = coloring.get_internal_color(c);
+        std::sort(mask_colors.begin(), mask_colors.end());
+        for(int64_t c : mask_colors) original_colors.push_back(coloring.get_original_color(c));
+
+        vector<int64_t> original_to_masked(coloring.largest_color() + 1, -1);
+        for(int64_t i = 0; i < (int64_t)mask_colors.size(); i++) original_to_masked[mask_colors[i]] = i;
+        const colorset_t mask_set(mask_colors);
+
+        int64_t n_sets = coloring.number_of_distinct_color_sets();
+        masked_set_ids.resize(n_sets);
+        map<vector<int64_t>, int64_t> distinct_masked_sets; // Masked set -> masked set id
+
+        // The intersections are computed in parallel in blocks and deduplicated sequentially
+        int64_t block_size = 1 << 16;
+        vector<vector<int64_t>> block_results(block_size);
+        for(int64_t block_start = 0; block_start < n_sets; block_start += block_size){
+            int64_t block_end = min(n_sets, block_start + block_size);
+
+            #pragma omp parallel for num_threads(n_threads) schedule(dynamic, 64)
+            for(int64_t id = block_start; id < block_end; id++){
+                colorset_t cs = coloring.get_color_set_by_color_set_id(id);
+                cs.intersection(mask_set);
+                block_results[id - block_start] = cs.get_colors_as_vector();
+            }
+
+            for(int64_t id = block_start; id < block_end; id++){
+                vector<int64_t>& colors = block_results[id - block_start];
+                if(colors.size() == 0){
+                    bool original_is_empty = coloring.get_color_set_by_color_set_id(id).size() == 0;
+                    masked_set_ids[id] = original_is_empty ? -1 : DISJOINT;
+                    continue;
+                }
+                for(int64_t& c : colors) c = original_to_masked[c];
+                auto it = distinct_masked_sets.find(colors);
+                if(it == distinct_masked_sets.end()){
+                    int64_t masked_id = distinct_masked_sets.size();
+                    distinct_masked_sets[colors] = masked_id;
+                    masked_sets.add_set(colors);
+                    masked_set_ids[id] = masked_id;
+                } else masked_set_ids[id] = it->second;
+            }
+        }
+        masked_sets.prepare_for_queries();
+    }
+
+    // Maps an original color set id to a masked set id, DISJOINT, or -1 if the original set is empty.
+    int64_t get_masked_set_id(int64_t color_set_id) const{
+        return masked_set_ids[color_set_id];
+    }
+
+    // Colors in the returned set are masked colors. Use get_original_color to map them back.
+    view_t get_masked_set(int64_t masked_set_id) const{
+        return masked_sets.get_color_set_by_id(masked_set_id);
+    }
+
+    int64_t get_original_color(int64_t masked_color) const{
+        return original_colors[masked_color];
+    }
+
+    int64_t size() const{
+        return mask_colors.size();
+    }
+
+    int64_t number_of_distinct_masked_sets() const{
+        return masked_sets.number_of_sets_stored();
+    }
+
+};
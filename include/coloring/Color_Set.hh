@@ -6,14 +6,18 @@
 #include "Color_Set_Interface.hh"
 #include "SeqIO/SeqIO.hh"
 #include <variant>
+#include <bit>
+#include <cmath>
 
 /*
 
-This file defines a hybrid color set that is either a bit map or an integer array.
+This file defines a hybrid color set that is either a bit map, an integer array, an
+Elias-Fano encoding, a complement or a list of runs of the colors.
 
 To avoid copying stuff around in memory, we have a color set view class that stores
 just the pointer to the data. The pointer is stored as a std::variant, which stores 
-either pointer and contains the bit specifying which type of pointer it is (bitmap or array).
+any of the pointers and contains the index specifying which type of pointer it is (bitmap,
+array, Elias-Fano, complement or runs).
 
 But here is the problem. The user might want a mutable color set, for example when doing
 intersections of the sets. The pointer will go into a static concatenation of sets
@@ -39,8 +43,208 @@ is not an option for performance reasons.
 
 using namespace std;
 
+/*
+
+Elias-Fano encoding of a sorted set of distinct non-negative integers, stored in a range of a
+bit vector. The range starts with a header: the number of low bits l (6 bits), the bit width w of
+the number of elements (6 bits) and the number of elements n (w bits). After the header come the
+l low bits of every element, and then the high parts in unary: the i-th element x has a one at
+position (x >> l) + i of the high part, and the high part ends at the last one. With
+l = floor(log2((max+1)/n)), a set takes about n * (l + 2) bits, which is less than both the
+bitmap and the array for sets of medium density.
+
+*/
+
+// Concatenation of Elias-Fano encoded sets. This is a separate type from sdsl::bit_vector so that
+// it can be an alternative of the data pointer variant of a color set next to the bitmaps.
+struct Elias_Fano_Sets{
+    sdsl::bit_vector bits;
+};
+
+// Number of low bits in the Elias-Fano encoding of a set of n > 0 elements with the given largest element
+static inline int64_t elias_fano_low_bits(int64_t n, int64_t max_element){
+    return std::bit_width((uint64_t)((max_element + 1) / n)) - 1;
+}
+
+// Number of bits in the Elias-Fano encoding of a set of n > 0 elements with the given largest element
+static inline int64_t elias_fano_size_in_bits(int64_t n, int64_t max_element){
+    int64_t l = elias_fano_low_bits(n, max_element);
+    return 12 + std::bit_width((uint64_t)n) + n * l + n + (max_element >> l);
+}
+
+// Encodes a non-empty sorted set of distinct elements
+sdsl::bit_vector elias_fano_encode(const vector<int64_t>& set);
+
+// Decodes an Elias-Fano encoded set one element at a time in increasing order. Skipping forward
+// to a given value moves over the high parts a 64-bit word at a time without decoding the
+// elements in between.
+class Elias_Fano_Iterator{
+
+    const sdsl::bit_vector* bits;
+    int64_t n; // Number of elements
+    int64_t l; // Number of low bits
+    int64_t low_start; // Position of the low bits of the first element
+    int64_t high_start; // Position of the high part
+    int64_t idx = 0; // Index of the current element
+    int64_t high_pos = 0; // Position of the one of the current element
+    int64_t value = 0; // The current element
+
+    // Position of the first one at or after p. There must be one.
+    int64_t next_one(int64_t p) const{
+        while(true){
+            int64_t len = min<int64_t>(64, bits->size() - p);
+            uint64_t word = bits->get_int(p, len);
+            if(word) return p + __builtin_ctzll(word);
+            p += len;
+        }
+    }
+
+    void decode_current(){
+        int64_t high = high_pos - high_start - idx; // Number of zeros before the one
+        int64_t low = l == 0 ? 0 : bits->get_int(low_start + idx * l, l);
+        value = (high << l) | low;
+    }
+
+public:
+
+    // The encoded set starts at position start of bits
+    Elias_Fano_Iterator(const sdsl::bit_vector& bits, int64_t start) : bits(&bits){
+        l = bits.get_int(start, 6);
+        int64_t w = bits.get_int(start + 6, 6);
+        n = w == 0 ? 0 : bits.get_int(start + 12, w);
+        low_start = start + 12 + w;
+        high_start = low_start + n * l;
+        if(n > 0){
+            high_pos = next_one(high_start);
+            decode_current();
+        }
+    }
+
+    int64_t size() const {return n;}
+    bool done() const {return idx >= n;}
+    int64_t get() const {return value;} // The current element. Must not be called if done().
+
+    void next(){
+        if(++idx < n){
+            high_pos = next_one(high_pos + 1);
+            decode_current();
+        }
+    }
+
+    // Moves to the first element that is at least x, or to the end if there is no such element
+    void skip_to(int64_t x){
+        if(done() || value >= x) return;
+
+        // Skip to the first element whose high part is at least that of x. The high part of an
+        // element is the number of zeros before its one.
+        int64_t zeros_needed = (x >> l) - (high_pos - high_start - idx);
+        if(zeros_needed > 0){
+            int64_t p = high_pos + 1;
+            int64_t ones = idx + 1; // Number of ones before p
+            while(true){
+                int64_t len = min<int64_t>(64, bits->size() - p);
+                if(len == 0){ idx = n; return; }
+                uint64_t zero_bits = ~bits->get_int(p, len) & (len == 64 ? ~0ULL : (1ULL << len) - 1);
+                int64_t zeros = __builtin_popcountll(zero_bits);
+                if(zeros >= zeros_needed){
+                    for(int64_t i = 1; i < zeros_needed; i++) zero_bits &= zero_bits - 1; // Clear the lowest zeros
+                    int64_t q = __builtin_ctzll(zero_bits); // Position of the last zero we need in the word
+                    ones += q + 1 - zeros_needed;
+                    p += q + 1;
+                    break;
+                }
+                ones += len - zeros;
+                if(ones >= n){ idx = n; return; } // All elements have a smaller high part
+                zeros_needed -= zeros;
+                p += len;
+            }
+            idx = ones;
+            if(done()) return;
+            high_pos = next_one(p);
+            decode_current();
+        }
+
+        while(!done() && value < x) next();
+    }
+};
+
+// Concatenation of complement encoded sets. A set is stored as the size U of its universe [0, U)
+// followed by the sorted elements of the universe that are not in the set. Sets that have almost
+// all colors are small in this encoding.
+struct Complement_Sets{
+    sdsl::int_vector<> values;
+};
+
+// Concatenation of run-length encoded sets. A set is stored as its maximal runs of consecutive
+// elements in increasing order, each run as the pair (first, last).
+struct Run_Sets{
+    sdsl::int_vector<> values;
+};
+
+// The universe size followed by the missing elements of a non-empty sorted set (see Complement_Sets)
+vector<int64_t> complement_encode(const vector<int64_t>& set);
+
+// The runs of a sorted set as (first, last) pairs (see Run_Sets)
+vector<int64_t> runs_encode(const vector<int64_t>& set);
+
+// Number of maximal runs of consecutive elements in a sorted set
+static inline int64_t count_runs(const vector<int64_t>& set){
+    int64_t runs = 0;
+    for(int64_t i = 0; i < (int64_t)set.size(); i++){
+        if(i == 0 || set[i] != set[i-1] + 1) runs++;
+    }
+    return runs;
+}
+
+// Ways to encode an SDSL_Variant_Color_Set, in the order of the alternatives of its data pointer variant
+enum class Color_Set_Encoding {bitmap = 0, array = 1, elias_fano = 2, complement = 3, runs = 4};
+
+// The encoding that takes the least space for the sorted set of distinct elements
+static inline Color_Set_Encoding choose_color_set_encoding(const vector<int64_t>& set){
+    if(set.empty()) return Color_Set_Encoding::array;
+    int64_t n = set.size();
+    int64_t max_element = set.back();
+    double array_bits = log2(max_element) * n;
+    double bitmap_bits = max_element;
+    double elias_fano_bits = elias_fano_size_in_bits(n, max_element);
+    double complement_bits = log2(max_element) * (max_element + 2 - n); // Universe size and the missing elements
+    double runs_bits = log2(max_element) * 2 * count_runs(set);
+
+    double best = min(elias_fano_bits, min(complement_bits, runs_bits));
+    if(best < min(array_bits, bitmap_bits)){
+        if(best == elias_fano_bits) return Color_Set_Encoding::elias_fano;
+        if(best == complement_bits) return Color_Set_Encoding::complement;
+        return Color_Set_Encoding::runs;
+    }
+    return array_bits > bitmap_bits ? Color_Set_Encoding::bitmap : Color_Set_Encoding::array;
+}
+
+template<typename colorset_t> 
+static inline bool colorset_is_complement(const colorset_t& cs){
+    return cs.data_ptr.index() == 3;
+}
+
+template<typename colorset_t> 
+static inline bool colorset_is_runs(const colorset_t& cs){
+    return cs.data_ptr.index() == 4;
+}
+
+// Index 0 is the universe size and the missing elements start from index 1
+template<typename colorset_t> 
+static inline int64_t colorset_access_complement(const colorset_t& cs, int64_t idx){
+    return std::get<3>(cs.data_ptr)->values[cs.start + idx];
+}
+
+// Run i is the pair at indices 2i and 2i+1
+template<typename colorset_t> 
+static inline int64_t colorset_access_runs(const colorset_t& cs, int64_t idx){
+    return std::get<4>(cs.data_ptr)->values[cs.start + idx];
+}
+
 template<typename colorset_t> 
 static inline bool colorset_is_empty(const colorset_t& cs){
+    if(colorset_is_complement(cs)) // Every element of the universe is missing
+        return cs.length == 0 || colorset_access_complement(cs, 0) == cs.length - 1;
     return cs.length == 0;
 }
 
@@ -50,6 +254,16 @@ static inline bool colorset_is_bitmap(const colorset_t& cs){
     return cs.data_ptr.index() == 0;
 }
 
+template<typename colorset_t> 
+static inline bool colorset_is_elias_fano(const colorset_t& cs){
+    return cs.data_ptr.index() == 2;
+}
+
+template<typename colorset_t> 
+static inline Elias_Fano_Iterator colorset_elias_fano_iterator(const colorset_t& cs){
+    return Elias_Fano_Iterator(std::get<2>(cs.data_ptr)->bits, cs.start);
+}
+
 template<typename colorset_t> 
 static inline bool colorset_access_bitmap(const colorset_t& cs, int64_t idx){
     // Using std::holds_alternative by index because it could have a const or a non-const type
@@ -71,14 +285,26 @@ static inline int64_t colorset_size(const colorset_t& cs){
             count += colorset_access_bitmap(cs, i);
         }
         return count;
+    } else if(colorset_is_elias_fano(cs)){
+        return cs.length == 0 ? 0 : colorset_elias_fano_iterator(cs).size();
+    } else if(colorset_is_complement(cs)){
+        return cs.length == 0 ? 0 : colorset_access_complement(cs, 0) - (cs.length - 1);
+    } else if(colorset_is_runs(cs)){
+        int64_t count = 0;
+        for(int64_t i = 0; i < cs.length; i += 2){
+            count += colorset_access_runs(cs, i+1) - colorset_access_runs(cs, i) + 1;
+        }
+        return count;
     } else return cs.length; // Array
 }
 
 template<typename colorset_t> 
 static inline int64_t colorset_size_in_bits(const colorset_t& cs){
-    if(colorset_is_bitmap(cs)) return cs.length;
+    // Using std::get by index because it could have a const or a non-const type
+    if(colorset_is_bitmap(cs) || colorset_is_elias_fano(cs)) return cs.length;
+    else if(colorset_is_complement(cs)) return cs.length * std::get<3>(cs.data_ptr)->values.width();
+    else if(colorset_is_runs(cs)) return cs.length * std::get<4>(cs.data_ptr)->values.width();
     else return cs.length * std::get<1>(cs.data_ptr)->width();
-    // Using std::holds_alternative by index because it could have a const or a non-const type
 }
 
 template<typename colorset_t> 
@@ -94,6 +320,24 @@ static inline void colorset_push_colors_to_vector(const colorset_t& cs, vector<i
         for(int64_t i = 0; i < cs.length; i++){
             if(colorset_access_bitmap(cs,i)) vec.push_back(i);
         }
+    } else if(colorset_is_elias_fano(cs)){
+        if(cs.length == 0) return;
+        for(Elias_Fano_Iterator it = colorset_elias_fano_iterator(cs); !it.done(); it.next()){
+            vec.push_back(it.get());
+        }
+    } else if(colorset_is_complement(cs)){
+        if(cs.length == 0) return;
+        int64_t universe = colorset_access_complement(cs, 0);
+        int64_t missing_idx = 1;
+        for(int64_t x = 0; x < universe; x++){
+            if(missing_idx < cs.length && colorset_access_complement(cs, missing_idx) == x) missing_idx++;
+            else vec.push_back(x);
+        }
+    } else if(colorset_is_runs(cs)){
+        for(int64_t i = 0; i < cs.length; i += 2){
+            int64_t last = colorset_access_runs(cs, i+1);
+            for(int64_t x = colorset_access_runs(cs, i); x <= last; x++) vec.push_back(x);
+        }
     } else{
         for(int64_t i = 0; i < cs.length; i++){
             vec.push_back(colorset_access_array(cs,i));
@@ -106,6 +350,30 @@ static inline bool colorset_contains(const colorset_t& cs, int64_t color){
     if(colorset_is_bitmap(cs)){
         if(color >= cs.length) return false;
         return colorset_access_bitmap(cs, color);
+    } else if(colorset_is_elias_fano(cs)){
+        if(cs.length == 0) return false;
+        Elias_Fano_Iterator it = colorset_elias_fano_iterator(cs);
+        it.skip_to(color);
+        return !it.done() && it.get() == color;
+    } else if(colorset_is_complement(cs)){
+        if(cs.length == 0 || color >= colorset_access_complement(cs, 0)) return false;
+        // Binary search the missing elements
+        int64_t lo = 1, hi = cs.length;
+        while(lo < hi){
+            int64_t mid = (lo + hi) / 2;
+            if(colorset_access_complement(cs, mid) < color) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo == cs.length || colorset_access_complement(cs, lo) != color;
+    } else if(colorset_is_runs(cs)){
+        // Binary search the last run that starts at or before the color
+        int64_t lo = 0, hi = cs.length / 2;
+        while(lo < hi){
+            int64_t mid = (lo + hi) / 2;
+            if(colorset_access_runs(cs, 2*mid) <= color) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo > 0 && colorset_access_runs(cs, 2*(lo-1) + 1) >= color;
     } else{
         // Linear scan. VERY SLOW
         for(int64_t i = 0; i < cs.length; i++){
@@ -142,6 +410,50 @@ int64_t bitmap_vs_array_intersection(sdsl::bit_vector& bv, int64_t bv_size, cons
 // but the old elements past the end are left in place to avoid memory reallocations.
 int64_t array_vs_array_intersection(sdsl::int_vector<>& A, int64_t A_len, const sdsl::int_vector<>& B, int64_t B_start, int64_t B_len);
 
+// Stores the result into iv and returns the size of the intersection. iv is not resized
+// but the old elements past the end are left in place to avoid memory reallocations.
+// The Elias-Fano encoded set starts at ef_start and is non-empty.
+int64_t array_vs_elias_fano_intersection(sdsl::int_vector<>& iv, int64_t iv_size, const sdsl::bit_vector& ef, int64_t ef_start);
+
+// Stores the intersection into result as an array and returns its size. result must have
+// space for the elements of the Elias-Fano encoded set, which starts at ef_start and is non-empty.
+int64_t elias_fano_vs_bitmap_intersection(sdsl::int_vector<>& result, const sdsl::bit_vector& ef, int64_t ef_start, const sdsl::bit_vector& bv, int64_t bv_start, int64_t bv_size);
+
+// Clears the bits of the missing elements of the complement and returns the new length of the
+// bit vector. This takes time proportional to the number of missing elements.
+int64_t bitmap_vs_complement_intersection(sdsl::bit_vector& bv, int64_t bv_size, const sdsl::int_vector<>& comp, int64_t comp_start, int64_t comp_len);
+
+// Stores the result into iv and returns the size of the intersection. iv is not resized
+// but the old elements past the end are left in place to avoid memory reallocations.
+int64_t array_vs_complement_intersection(sdsl::int_vector<>& iv, int64_t iv_size, const sdsl::int_vector<>& comp, int64_t comp_start, int64_t comp_len);
+
+// Stores the resulting complement into A and returns its length. A must have enough space
+// for the missing elements of both complements.
+int64_t complement_vs_complement_intersection(sdsl::int_vector<>& A, int64_t A_len, const sdsl::int_vector<>& B, int64_t B_start, int64_t B_len);
+
+// Clears the bits between the runs and returns the new length of the bit vector
+int64_t bitmap_vs_runs_intersection(sdsl::bit_vector& bv, int64_t bv_size, const sdsl::int_vector<>& runs, int64_t runs_start, int64_t runs_len);
+
+// Stores the result into iv and returns the size of the intersection. iv is not resized
+// but the old elements past the end are left in place to avoid memory reallocations.
+int64_t array_vs_runs_intersection(sdsl::int_vector<>& iv, int64_t iv_size, const sdsl::int_vector<>& runs, int64_t runs_start, int64_t runs_len);
+
+// Stores the runs of the intersection into result and returns their length. result must have
+// space for A_len + B_len values.
+int64_t runs_vs_runs_intersection(sdsl::int_vector<>& result, const sdsl::int_vector<>& A, int64_t A_len, const sdsl::int_vector<>& B, int64_t B_start, int64_t B_len);
+
+// Stores the runs of the intersection into result and returns their length. result must have
+// space for the runs plus two values for every missing element of the complement.
+int64_t runs_vs_complement_intersection(sdsl::int_vector<>& result, const sdsl::int_vector<>& runs, int64_t runs_len, const sdsl::int_vector<>& comp, int64_t comp_start, int64_t comp_len);
+
+// Stores the complement of the union into result and returns its length. result must have space
+// for the missing elements of both complements and values up to the larger universe size.
+int64_t complement_vs_complement_union(sdsl::int_vector<>& result, const sdsl::int_vector<>& A, int64_t A_len, const sdsl::int_vector<>& B, int64_t B_start, int64_t B_len);
+
+// Stores the runs of the union into result and returns their length. result must have space for
+// A_len + B_len values up to the largest element of the two sets.
+int64_t runs_vs_runs_union(sdsl::int_vector<>& result, const sdsl::int_vector<>& A, int64_t A_len, const sdsl::int_vector<>& B, int64_t B_start, int64_t B_len);
+
 // Stores the result into A and returns the length of the new bit vector. A must have enough
 // space to accommodate the union
 int64_t bitmap_vs_bitmap_union(sdsl::bit_vector& A, int64_t A_size, const sdsl::bit_vector& B, int64_t B_start, int64_t B_size);
@@ -164,17 +476,22 @@ class SDSL_Variant_Color_Set_View{
 
 public:
 
-    std::variant<const sdsl::bit_vector*, const sdsl::int_vector<>*> data_ptr; // Non-owning pointer to external data
+    typedef std::variant<const sdsl::bit_vector*, const sdsl::int_vector<>*, const Elias_Fano_Sets*, const Complement_Sets*, const Run_Sets*> data_ptr_t;
+
+    data_ptr_t data_ptr; // Non-owning pointer to external data
     int64_t start;
-    int64_t length; // Number of bits in case of bit vector, number of elements in case of array
+    int64_t length; // Number of bits in case of bit vector or Elias-Fano, number of values in the other cases
 
-    SDSL_Variant_Color_Set_View(std::variant<const sdsl::bit_vector*, const sdsl::int_vector<>*> data_ptr, int64_t start, int64_t length)
+    SDSL_Variant_Color_Set_View(data_ptr_t data_ptr, int64_t start, int64_t length)
         : data_ptr(data_ptr), start(start), length(length){}
 
     SDSL_Variant_Color_Set_View(const SDSL_Variant_Color_Set& cs); // Defined in the .cpp file because Color_Set is not yet defined at this point of this header
 
     bool empty() const {return colorset_is_empty(*this);};
     bool is_bitmap() const {return colorset_is_bitmap(*this);};
+    bool is_elias_fano() const {return colorset_is_elias_fano(*this);};
+    bool is_complement() const {return colorset_is_complement(*this);};
+    bool is_runs() const {return colorset_is_runs(*this);};
     int64_t size() const {return colorset_size(*this);}
     int64_t size_in_bits() const {return colorset_size_in_bits(*this);}
     bool contains(int64_t color) const {return colorset_contains(*this, color);}
@@ -189,10 +506,29 @@ class SDSL_Variant_Color_Set{
 
     typedef SDSL_Variant_Color_Set_View view_t;
 
-    std::variant<sdsl::bit_vector*, sdsl::int_vector<>*> data_ptr = (sdsl::bit_vector*) nullptr; // Owning pointer
+    std::variant<sdsl::bit_vector*, sdsl::int_vector<>*, Elias_Fano_Sets*, Complement_Sets*, Run_Sets*> data_ptr = (sdsl::bit_vector*) nullptr; // Owning pointer
     int64_t start = 0; // Index of first color element in data_ptr
     int64_t length = 0; // Number of colors stored
 
+    private:
+
+    // Copies values [start, start+length) of from with the same bit width
+    static sdsl::int_vector<> copy_values(const sdsl::int_vector<>& from, int64_t start, int64_t length){
+        sdsl::int_vector<> to(length, 0, from.width());
+        for(int64_t i = 0; i < length; i++) to[i] = from[start + i];
+        return to;
+    }
+
+    // The values in an int vector with just enough bits for the largest value
+    static sdsl::int_vector<> to_int_vector(const vector<int64_t>& values){
+        int64_t max_value = values.empty() ? 1 : *std::max_element(values.begin(), values.end());
+        sdsl::int_vector<> iv(values.size(), 0, std::bit_width((uint64_t)max<int64_t>(1, max_value)));
+        for(int64_t i = 0; i < (int64_t)values.size(); i++) iv[i] = values[i];
+        return iv;
+    }
+
+    public:
+
     SDSL_Variant_Color_Set(){
         data_ptr = new sdsl::bit_vector();
     }
@@ -246,6 +582,21 @@ class SDSL_Variant_Color_Set{
             for(int64_t i = 0; i < view.length; i++){ // TODO: 64 bits at a time
                 (*to)[i] = (*from)[view.start + i];
             }
+        } else if(std::holds_alternative<const Elias_Fano_Sets*>(view.data_ptr)){
+            Elias_Fano_Sets* to = new Elias_Fano_Sets();
+            to->bits.resize(view.length);
+            data_ptr = to;
+
+            // Copy the bits 64 at a time
+            const sdsl::bit_vector& from = std::get<const Elias_Fano_Sets*>(view.data_ptr)->bits;
+            for(int64_t i = 0; i < view.length; i += 64){
+                int64_t len = min<int64_t>(64, view.length - i);
+                to->bits.set_int(i, from.get_int(view.start + i, len), len);
+            }
+        } else if(std::holds_alternative<const Complement_Sets*>(view.data_ptr)){
+            data_ptr = new Complement_Sets{copy_values(std::get<const Complement_Sets*>(view.data_ptr)->values, view.start, view.length)};
+        } else if(std::holds_alternative<const Run_Sets*>(view.data_ptr)){
+            data_ptr = new Run_Sets{copy_values(std::get<const Run_Sets*>(view.data_ptr)->values, view.start, view.length)};
         } else{
             // Array
             int64_t bit_width = std::get<const sdsl::int_vector<>*>(view.data_ptr)->width();
@@ -260,14 +611,31 @@ class SDSL_Variant_Color_Set{
         }
     }
 
+    // The set must be sorted
     SDSL_Variant_Color_Set(const vector<int64_t>& set){
-        int64_t max_element = *std::max_element(set.begin(), set.end());
-        if(log2(max_element) * set.size() > max_element){ // TODO: this if-statement is duplicated in this file
+        Color_Set_Encoding encoding = choose_color_set_encoding(set);
+        if(encoding == Color_Set_Encoding::bitmap){
             // Dense -> bitmap
+            int64_t max_element = set.back();
             sdsl::bit_vector* ptr = new sdsl::bit_vector(max_element+1, 0);
             for(int64_t x : set) (*ptr)[x] = 1;
             length = ptr->size();
             data_ptr = ptr; // Assign to variant
+        } else if(encoding == Color_Set_Encoding::elias_fano){
+            // Medium density -> Elias-Fano
+            Elias_Fano_Sets* ptr = new Elias_Fano_Sets{elias_fano_encode(set)};
+            length = ptr->bits.size();
+            data_ptr = ptr; // Assign to variant
+        } else if(encoding == Color_Set_Encoding::complement){
+            // Almost all colors -> the missing colors
+            Complement_Sets* ptr = new Complement_Sets{to_int_vector(complement_encode(set))};
+            length = ptr->values.size();
+            data_ptr = ptr; // Assign to variant
+        } else if(encoding == Color_Set_Encoding::runs){
+            // Few runs of consecutive colors -> the runs
+            Run_Sets* ptr = new Run_Sets{to_int_vector(runs_encode(set))};
+            length = ptr->values.size();
+            data_ptr = ptr; // Assign to variant
         } else{
             // Sparse -> array
             sdsl::int_vector<>* ptr = new sdsl::int_vector<>(set.size());
@@ -288,15 +656,80 @@ class SDSL_Variant_Color_Set{
 
     bool empty() const {return colorset_is_empty(*this);};
     bool is_bitmap() const {return colorset_is_bitmap(*this);};
+    bool is_elias_fano() const {return colorset_is_elias_fano(*this);};
+    bool is_complement() const {return colorset_is_complement(*this);};
+    bool is_runs() const {return colorset_is_runs(*this);};
     int64_t size() const {return colorset_size(*this);}
     int64_t size_in_bits() const {return colorset_size_in_bits(*this);}
     bool contains(int64_t color) const {return colorset_contains(*this, color);}
     vector<int64_t> get_colors_as_vector() const {return colorset_get_colors_as_vector(*this);}
     void push_colors_to_vector(vector<int64_t>& vec) const {return colorset_push_colors_to_vector(*this, vec);}
 
+    // Frees the current data and takes ownership of ptr, which has the set in its first new_length values
+    template<typename ptr_t>
+    void replace_data(ptr_t ptr, int64_t new_length){
+        auto call_delete = [](auto old_ptr){delete old_ptr;};
+        std::visit(call_delete, data_ptr);
+        data_ptr = ptr;
+        start = 0;
+        length = new_length;
+    }
+
+    // Replaces an Elias-Fano encoding with an array of the same elements
+    void decode_elias_fano_to_array(){
+        vector<int64_t> elements = get_colors_as_vector();
+        replace_data(new sdsl::int_vector<>(to_int_vector(elements)), elements.size());
+    }
+
     // Stores the intersection back to to this object
     void intersection(const SDSL_Variant_Color_Set_View& other){
-        if(is_bitmap() && other.is_bitmap()){
+        // An intersection is never larger than this set, so an Elias-Fano encoding is replaced
+        // with an array that can be modified in place
+        if(is_elias_fano()) decode_elias_fano_to_array();
+
+        if(is_complement() || is_runs()){
+            if(is_complement() && other.is_complement()){
+                sdsl::int_vector<>& A = std::get<Complement_Sets*>(data_ptr)->values;
+                A.resize(this->length + other.length); // Room for the missing elements of both
+                this->length = complement_vs_complement_intersection(A, this->length, std::get<const Complement_Sets*>(other.data_ptr)->values, other.start, other.length);
+            } else if(is_runs() && other.is_runs()){
+                const sdsl::int_vector<>& A = std::get<Run_Sets*>(data_ptr)->values;
+                Run_Sets* result = new Run_Sets{sdsl::int_vector<>(this->length + other.length, 0, A.width())};
+                int64_t result_length = runs_vs_runs_intersection(result->values, A, this->length, std::get<const Run_Sets*>(other.data_ptr)->values, other.start, other.length);
+                replace_data(result, result_length);
+            } else if(is_runs() && other.is_complement()){
+                // Every missing element can split a run in two
+                const sdsl::int_vector<>& A = std::get<Run_Sets*>(data_ptr)->values;
+                Run_Sets* result = new Run_Sets{sdsl::int_vector<>(this->length + 2 * other.length, 0, A.width())};
+                int64_t result_length = runs_vs_complement_intersection(result->values, A, this->length, std::get<const Complement_Sets*>(other.data_ptr)->values, other.start, other.length);
+                replace_data(result, result_length);
+            } else{
+                // The result is a subset of the other set, so intersect a mutable copy of the other
+                // set with this set. This uses the kernels against complements and runs below.
+                SDSL_Variant_Color_Set new_set(other);
+                new_set.intersection(SDSL_Variant_Color_Set_View(*this));
+                *this = std::move(new_set);
+            }
+        } else if(other.is_complement()){
+            // Removes the few missing elements of the other set
+            const sdsl::int_vector<>& comp = std::get<const Complement_Sets*>(other.data_ptr)->values;
+            if(is_bitmap()) this->length = bitmap_vs_complement_intersection(*std::get<sdsl::bit_vector*>(data_ptr), this->length, comp, other.start, other.length);
+            else this->length = array_vs_complement_intersection(*std::get<sdsl::int_vector<>*>(data_ptr), this->length, comp, other.start, other.length);
+        } else if(other.is_runs()){
+            const sdsl::int_vector<>& runs = std::get<const Run_Sets*>(other.data_ptr)->values;
+            if(is_bitmap()) this->length = bitmap_vs_runs_intersection(*std::get<sdsl::bit_vector*>(data_ptr), this->length, runs, other.start, other.length);
+            else this->length = array_vs_runs_intersection(*std::get<sdsl::int_vector<>*>(data_ptr), this->length, runs, other.start, other.length);
+        } else if(other.is_elias_fano() && (empty() || other.empty())){
+            this->length = 0;
+        } else if(other.is_elias_fano() && is_bitmap()){
+            // The result has at most as many elements as the Elias-Fano set, so it becomes an array
+            const sdsl::bit_vector& ef = std::get<const Elias_Fano_Sets*>(other.data_ptr)->bits;
+            sdsl::int_vector<>* result = new sdsl::int_vector<>(other.size(), 0, std::bit_width((uint64_t)this->length));
+            int64_t result_length = elias_fano_vs_bitmap_intersection(*result, ef, other.start, *std::get<sdsl::bit_vector*>(data_ptr), this->start, this->length);
+            replace_data(result, result_length);
+        } else if(other.is_elias_fano()){ // Array vs Elias-Fano
+            this->length = array_vs_elias_fano_intersection(*std::get<sdsl::int_vector<>*>(data_ptr), this->length, std::get<const Elias_Fano_Sets*>(other.data_ptr)->bits, other.start);
+        } else if(is_bitmap() && other.is_bitmap()){
             this->length = bitmap_vs_bitmap_intersection(*std::get<sdsl::bit_vector*>(data_ptr), this->length, *std::get<const sdsl::bit_vector*>(other.data_ptr), other.start, other.length);
         } else if(!is_bitmap() && other.is_bitmap()){
             this->length = array_vs_bitmap_intersection(*std::get<sdsl::int_vector<>*>(data_ptr), this->length, *std::get<const sdsl::bit_vector*>(other.data_ptr), other.start, other.length);
@@ -321,6 +754,23 @@ class SDSL_Variant_Color_Set{
     }
 
     void do_union(const SDSL_Variant_Color_Set_View& other){
+        if(is_complement() && other.is_complement()){
+            // The missing elements of the union are missing from both
+            const sdsl::int_vector<>& A = std::get<Complement_Sets*>(data_ptr)->values;
+            const sdsl::int_vector<>& B = std::get<const Complement_Sets*>(other.data_ptr)->values;
+            int64_t universe = max<int64_t>(A[0], B[other.start]);
+            Complement_Sets* result = new Complement_Sets{sdsl::int_vector<>(this->length + other.length, 0, std::bit_width((uint64_t)universe))};
+            replace_data(result, complement_vs_complement_union(result->values, A, this->length, B, other.start, other.length));
+            return;
+        }
+        if(is_runs() && other.is_runs()){
+            const sdsl::int_vector<>& A = std::get<Run_Sets*>(data_ptr)->values;
+            const sdsl::int_vector<>& B = std::get<const Run_Sets*>(other.data_ptr)->values;
+            Run_Sets* result = new Run_Sets{sdsl::int_vector<>(this->length + other.length, 0, max(A.width(), B.width()))};
+            replace_data(result, runs_vs_runs_union(result->values, A, this->length, B, other.start, other.length));
+            return;
+        }
+
         // TODO: DO PROPERLY
         vector<int64_t> A = this->get_colors_as_vector();
         vector<int64_t> B = other.get_colors_as_vector();
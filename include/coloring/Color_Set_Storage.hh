@@ -3,7 +3,10 @@
 #include <vector>
 #include "Color_Set_Interface.hh"
 #include "Color_Set.hh"
+#include "Roaring_Color_Set.hh"
+#include "delta_parents.hh"
 #include "SeqIO/SeqIO.hh"
+#include "sbwt/globals.hh"
 #include <iostream>
 #include <map>
 
@@ -34,6 +37,16 @@ public:
         sets.push_back(set);
     }
 
+    // Same as calling add_set for each set in order. The sets are encoded in parallel.
+    void add_sets(const vector<vector<int64_t>>& new_sets, int64_t n_threads){
+        vector<colorset_t> encoded(new_sets.size());
+        #pragma omp parallel for num_threads(n_threads) schedule(dynamic, 64)
+        for(int64_t i = 0; i < (int64_t)new_sets.size(); i++){
+            encoded[i] = colorset_t(new_sets[i]);
+        }
+        for(colorset_t& cs : encoded) sets.push_back(std::move(cs));
+    }
+
     // Call this after done with add_set
     void prepare_for_queries(){
         sets.shrink_to_fit();
@@ -95,9 +108,9 @@ overheads associated with allocating each color set from the heap separately.
 Instead, here we concatenate all the color sets and store pointers to the starts
 of the color sets.
 
-Actually, there are two concatenations: a concatenation of bit maps and a concatenation 
-of integer arrays. A color is stored either as a bit map or an integer array, depending
-which one is smaller.
+Actually, there are five concatenations: one for each of the encodings of a color set (bit
+maps, integer arrays, Elias-Fano encodings, complements and runs). A color set is stored in
+the encoding that is smallest for it (see choose_color_set_encoding in Color_Set.hh).
 
 */
 
@@ -112,30 +125,80 @@ class Color_Set_Storage<SDSL_Variant_Color_Set>{
     sdsl::int_vector<> arrays_concat;
     sdsl::int_vector<> arrays_starts; // arrays_starts[i] = starting position of the i-th subarray
 
+    Elias_Fano_Sets elias_fano_concat;
+    sdsl::int_vector<> elias_fano_starts; // elias_fano_starts[i] = starting position of the i-th Elias-Fano encoding
+
+    Complement_Sets complement_concat;
+    sdsl::int_vector<> complement_starts; // complement_starts[i] = starting position of the i-th complement
+
+    Run_Sets runs_concat;
+    sdsl::int_vector<> runs_starts; // runs_starts[i] = starting position of the runs of the i-th run-length encoded set
+
     sdsl::bit_vector is_bitmap_marks;
     sdsl::rank_support_v5<> is_bitmap_marks_rs;
 
+    sdsl::bit_vector is_elias_fano_marks;
+    sdsl::rank_support_v5<> is_elias_fano_marks_rs;
+
+    sdsl::bit_vector is_complement_marks;
+    sdsl::rank_support_v5<> is_complement_marks_rs;
+
+    sdsl::bit_vector is_runs_marks;
+    sdsl::rank_support_v5<> is_runs_marks_rs;
+
+    // If not empty, the sets are delta encoded on disk: set i is stored as the symmetric difference
+    // with set delta_parents[i]-1, or in full if delta_parents[i] is 0. In memory the sets are always
+    // stored in full, so this does not affect queries. See choose_delta_parents.
+    sdsl::int_vector<> delta_parents;
+    static constexpr int64_t delta_block_size = 1 << 16; // Number of consecutive sets in a block of the delta encoded format
+
+    // Optional table with one packed descriptor per set, so that fetching a set takes one lookup instead
+    // of reading the marks, the rank supports and the starts. The lowest 3 bits are the encoding (the
+    // index of the concatenation in the data pointer variant of the view), the next descriptor_length_bits
+    // bits are the length of the set in the concatenation, and the rest is the start. Empty if not built.
+    // Serialized with the sets. See build_descriptor_table.
+    //
+    // The payloads stay in the five concatenations instead of one shared buffer: the views decode
+    // each encoding from its own sdsl container, whose element width fits the values of that
+    // encoding. The encoding bits of the descriptor pick the container without another memory
+    // access, because the containers are members of this class.
+    sdsl::int_vector<> descriptors;
+    int64_t descriptor_length_bits = 0;
+
+    // Flags in the first byte of the serialized sets (format version 5)
+    static constexpr char delta_encoded_flag = 1;
+    static constexpr char descriptor_table_flag = 2;
+
     // Dynamic-length vectors used during construction only
     // TODO: refactor these out of the class to a separate construction class
     vector<bool> temp_bitmap_concat;
     vector<int64_t> temp_arrays_concat;
+    vector<bool> temp_elias_fano_concat;
+    vector<int64_t> temp_complement_concat;
+    vector<int64_t> temp_runs_concat;
     vector<int64_t> temp_bitmap_starts;
     vector<int64_t> temp_arrays_starts;
+    vector<int64_t> temp_elias_fano_starts;
+    vector<int64_t> temp_complement_starts;
+    vector<int64_t> temp_runs_starts;
     vector<bool> temp_is_bitmap_marks;
+    vector<bool> temp_is_elias_fano_marks;
+    vector<bool> temp_is_complement_marks;
+    vector<bool> temp_is_runs_marks;
 
     // Number of bits required to represent x
-    int64_t bits_needed(uint64_t x){
+    int64_t bits_needed(uint64_t x) const{
         return max((int64_t)std::bit_width(x), (int64_t)1); // Need at least 1 bit (for zero)
     }
 
-    sdsl::bit_vector to_sdsl_bit_vector(const vector<bool>& v){
+    sdsl::bit_vector to_sdsl_bit_vector(const vector<bool>& v) const{
         if(v.size() == 0) return sdsl::bit_vector();
         sdsl::bit_vector bv(v.size());
         for(int64_t i = 0; i < v.size(); i++) bv[i] = v[i];
         return bv;
     }
 
-    sdsl::int_vector<> to_sdsl_int_vector(const vector<int64_t>& v){
+    sdsl::int_vector<> to_sdsl_int_vector(const vector<int64_t>& v) const{
         if(v.size() == 0) return sdsl::int_vector<>();
         int64_t max_element = *std::max_element(v.begin(), v.end());
         sdsl::int_vector iv(v.size(), 0, bits_needed(max_element));
@@ -143,10 +206,74 @@ class Color_Set_Storage<SDSL_Variant_Color_Set>{
         return iv;
     }
 
+    // Copies or moves the members of other to this storage, depending on the reference type.
+    // The rank supports are pointed to the mark vectors of this storage.
+    template<typename storage_t>
+    void assign_members(storage_t&& other){
+        bitmap_concat = std::forward<storage_t>(other).bitmap_concat;
+        bitmap_starts = std::forward<storage_t>(other).bitmap_starts;
+        arrays_concat = std::forward<storage_t>(other).arrays_concat;
+        arrays_starts = std::forward<storage_t>(other).arrays_starts;
+        elias_fano_concat = std::forward<storage_t>(other).elias_fano_concat;
+        elias_fano_starts = std::forward<storage_t>(other).elias_fano_starts;
+        complement_concat = std::forward<storage_t>(other).complement_concat;
+        complement_starts = std::forward<storage_t>(other).complement_starts;
+        runs_concat = std::forward<storage_t>(other).runs_concat;
+        runs_starts = std::forward<storage_t>(other).runs_starts;
+        is_bitmap_marks = std::forward<storage_t>(other).is_bitmap_marks;
+        is_bitmap_marks_rs = std::forward<storage_t>(other).is_bitmap_marks_rs;
+        is_elias_fano_marks = std::forward<storage_t>(other).is_elias_fano_marks;
+        is_elias_fano_marks_rs = std::forward<storage_t>(other).is_elias_fano_marks_rs;
+        is_complement_marks = std::forward<storage_t>(other).is_complement_marks;
+        is_complement_marks_rs = std::forward<storage_t>(other).is_complement_marks_rs;
+        is_runs_marks = std::forward<storage_t>(other).is_runs_marks;
+        is_runs_marks_rs = std::forward<storage_t>(other).is_runs_marks_rs;
+        delta_parents = std::forward<storage_t>(other).delta_parents;
+        descriptors = std::forward<storage_t>(other).descriptors;
+        descriptor_length_bits = std::forward<storage_t>(other).descriptor_length_bits;
+        temp_bitmap_concat = std::forward<storage_t>(other).temp_bitmap_concat;
+        temp_arrays_concat = std::forward<storage_t>(other).temp_arrays_concat;
+        temp_elias_fano_concat = std::forward<storage_t>(other).temp_elias_fano_concat;
+        temp_complement_concat = std::forward<storage_t>(other).temp_complement_concat;
+        temp_runs_concat = std::forward<storage_t>(other).temp_runs_concat;
+        temp_bitmap_starts = std::forward<storage_t>(other).temp_bitmap_starts;
+        temp_arrays_starts = std::forward<storage_t>(other).temp_arrays_starts;
+        temp_elias_fano_starts = std::forward<storage_t>(other).temp_elias_fano_starts;
+        temp_complement_starts = std::forward<storage_t>(other).temp_complement_starts;
+        temp_runs_starts = std::forward<storage_t>(other).temp_runs_starts;
+        temp_is_bitmap_marks = std::forward<storage_t>(other).temp_is_bitmap_marks;
+        temp_is_elias_fano_marks = std::forward<storage_t>(other).temp_is_elias_fano_marks;
+        temp_is_complement_marks = std::forward<storage_t>(other).temp_is_complement_marks;
+        temp_is_runs_marks = std::forward<storage_t>(other).temp_is_runs_marks;
+
+        is_bitmap_marks_rs.set_vector(&is_bitmap_marks);
+        is_elias_fano_marks_rs.set_vector(&is_elias_fano_marks);
+        is_complement_marks_rs.set_vector(&is_complement_marks);
+        is_runs_marks_rs.set_vector(&is_runs_marks);
+    }
+
     public:
 
     Color_Set_Storage() {}
 
+    Color_Set_Storage(const Color_Set_Storage& other){
+        assign_members(other);
+    }
+
+    Color_Set_Storage(Color_Set_Storage&& other){
+        assign_members(std::move(other));
+    }
+
+    Color_Set_Storage& operator=(const Color_Set_Storage& other){
+        if(this != &other) assign_members(other);
+        return *this;
+    }
+
+    Color_Set_Storage& operator=(Color_Set_Storage&& other){
+        if(this != &other) assign_members(std::move(other));
+        return *this;
+    }
+
     // Build from list of sets directly. Instead of using this constructor, you should probably just
     // call add_set for each set you want to add separately and then call prepare_for_queries when done.
     // This constructor is just to have the same interface as the other color set storage class.
@@ -158,48 +285,153 @@ class Color_Set_Storage<SDSL_Variant_Color_Set>{
     }
 
     SDSL_Variant_Color_Set::view_t get_color_set_by_id(int64_t id) const{
+        if(descriptors.size() > 0){
+            uint64_t descriptor = descriptors[id];
+            int64_t start = descriptor >> (descriptor_length_bits + 3);
+            int64_t length = (descriptor >> 3) & ((1ULL << descriptor_length_bits) - 1);
+            SDSL_Variant_Color_Set_View::data_ptr_t data_ptr;
+            switch(descriptor & 7){
+                case 0: data_ptr = &bitmap_concat; break;
+                case 1: data_ptr = &arrays_concat; break;
+                case 2: data_ptr = &elias_fano_concat; break;
+                case 3: data_ptr = &complement_concat; break;
+                default: data_ptr = &runs_concat; break;
+            }
+            return SDSL_Variant_Color_Set::view_t(data_ptr, start, length);
+        }
+        return get_color_set_by_id_from_marks(id);
+    }
+
+    // Builds the descriptor table (see the member descriptors). This makes fetching a set faster,
+    // but it takes more space: a bit more than the bits of the largest start plus the bits of the
+    // longest set per set. The table is serialized with the sets, so an index needs to build it only
+    // once. Call after prepare_for_queries or load. If a descriptor would not fit in 64 bits, the
+    // table is not built and the sets are fetched through the marks as before.
+    void build_descriptor_table(){
+        descriptors = sdsl::int_vector<>();
+        int64_t n_sets = number_of_sets_stored();
+        uint64_t max_start = 0, max_length = 0;
+        for(int64_t id = 0; id < n_sets; id++){
+            SDSL_Variant_Color_Set::view_t view = get_color_set_by_id_from_marks(id);
+            max_start = max(max_start, (uint64_t)view.start);
+            max_length = max(max_length, (uint64_t)view.length);
+        }
+
+        int64_t length_bits = bits_needed(max_length);
+        int64_t width = 3 + length_bits + bits_needed(max_start);
+        if(width > 64){
+            sbwt::write_log("Warning: color sets are too large for the color set descriptor table. Fetching color sets without the table.", sbwt::LogLevel::MAJOR);
+            return;
+        }
+
+        sdsl::int_vector<> table(n_sets, 0, width);
+        for(int64_t id = 0; id < n_sets; id++){
+            SDSL_Variant_Color_Set::view_t view = get_color_set_by_id_from_marks(id);
+            table[id] = ((uint64_t)view.start << (length_bits + 3)) | ((uint64_t)view.length << 3) | view.data_ptr.index();
+        }
+        descriptors = table;
+        descriptor_length_bits = length_bits;
+    }
+
+    bool has_descriptor_table() const{
+        return descriptors.size() > 0;
+    }
+
+    private:
+
+    SDSL_Variant_Color_Set::view_t get_color_set_by_id_from_marks(int64_t id) const{
         if(is_bitmap_marks[id]){
             int64_t bitmap_idx = is_bitmap_marks_rs.rank(id); // This many bitmaps come before this bitmap
             int64_t start = bitmap_starts[bitmap_idx];
             int64_t end = bitmap_starts[bitmap_idx+1]; // One past the end
 
-            std::variant<const sdsl::bit_vector*, const sdsl::int_vector<>*> data_ptr = &bitmap_concat;
+            SDSL_Variant_Color_Set_View::data_ptr_t data_ptr = &bitmap_concat;
+            return SDSL_Variant_Color_Set::view_t(data_ptr, start, end-start);
+        } else if(is_elias_fano_marks[id]){
+            int64_t elias_fano_idx = is_elias_fano_marks_rs.rank(id); // This many Elias-Fano encodings come before this one
+            int64_t start = elias_fano_starts[elias_fano_idx];
+            int64_t end = elias_fano_starts[elias_fano_idx+1]; // One past the end
+
+            SDSL_Variant_Color_Set_View::data_ptr_t data_ptr = &elias_fano_concat;
+            return SDSL_Variant_Color_Set::view_t(data_ptr, start, end-start);
+        } else if(is_complement_marks[id]){
+            int64_t complement_idx = is_complement_marks_rs.rank(id); // This many complements come before this one
+            int64_t start = complement_starts[complement_idx];
+            int64_t end = complement_starts[complement_idx+1]; // One past the end
+
+            SDSL_Variant_Color_Set_View::data_ptr_t data_ptr = &complement_concat;
+            return SDSL_Variant_Color_Set::view_t(data_ptr, start, end-start);
+        } else if(is_runs_marks[id]){
+            int64_t runs_idx = is_runs_marks_rs.rank(id); // This many run-length encoded sets come before this one
+            int64_t start = runs_starts[runs_idx];
+            int64_t end = runs_starts[runs_idx+1]; // One past the end
+
+            SDSL_Variant_Color_Set_View::data_ptr_t data_ptr = &runs_concat;
             return SDSL_Variant_Color_Set::view_t(data_ptr, start, end-start);
         } else{
-            int64_t arrays_idx = id - is_bitmap_marks_rs.rank(id); // Rank-0. This many arrays come before this bitmap
+            int64_t arrays_idx = id - is_bitmap_marks_rs.rank(id) - is_elias_fano_marks_rs.rank(id)
+                                    - is_complement_marks_rs.rank(id) - is_runs_marks_rs.rank(id); // This many arrays come before this array
             int64_t start = arrays_starts[arrays_idx];
             int64_t end = arrays_starts[arrays_idx+1]; // One past the end
 
-            std::variant<const sdsl::bit_vector*, const sdsl::int_vector<>*> data_ptr = &arrays_concat;
+            SDSL_Variant_Color_Set_View::data_ptr_t data_ptr = &arrays_concat;
             return SDSL_Variant_Color_Set::view_t(data_ptr, start, end-start);
         }
     }
 
+    public:
+
     // Need to call prepare_for_queries() after all sets have been added
     // Set must be sorted
     void add_set(const vector<int64_t>& set){
 
-        int64_t max_element = *std::max_element(set.begin(), set.end());
-        if(log2(max_element) * set.size() > max_element){
-            // Dense -> bitmap
+        Color_Set_Encoding encoding = choose_color_set_encoding(set);
 
-            // Add is_bitmap_mark
-            temp_is_bitmap_marks.push_back(1);
+        // Add type marks
+        temp_is_bitmap_marks.push_back(encoding == Color_Set_Encoding::bitmap);
+        temp_is_elias_fano_marks.push_back(encoding == Color_Set_Encoding::elias_fano);
+        temp_is_complement_marks.push_back(encoding == Color_Set_Encoding::complement);
+        temp_is_runs_marks.push_back(encoding == Color_Set_Encoding::runs);
+
+        if(encoding == Color_Set_Encoding::bitmap){
+            // Dense -> bitmap
 
             // Store bitmap start
             temp_bitmap_starts.push_back(temp_bitmap_concat.size());
 
             // Create bitmap
-            vector<bool> bitmap(max_element+1, 0);
+            vector<bool> bitmap(set.back()+1, 0);
             for(int64_t x : set) bitmap[x] = 1;
             for(bool b : bitmap) temp_bitmap_concat.push_back(b);
 
+        } else if(encoding == Color_Set_Encoding::elias_fano){
+            // Medium density -> Elias-Fano
+
+            // Store Elias-Fano start
+            temp_elias_fano_starts.push_back(temp_elias_fano_concat.size());
+
+            sdsl::bit_vector encoded = elias_fano_encode(set);
+            for(int64_t i = 0; i < (int64_t)encoded.size(); i++) temp_elias_fano_concat.push_back(encoded[i]);
+
+        } else if(encoding == Color_Set_Encoding::complement){
+            // Almost all colors -> the missing colors
+
+            // Store complement start
+            temp_complement_starts.push_back(temp_complement_concat.size());
+
+            for(int64_t x : complement_encode(set)) temp_complement_concat.push_back(x);
+
+        } else if(encoding == Color_Set_Encoding::runs){
+            // Few runs of consecutive colors -> the runs
+
+            // Store runs start
+            temp_runs_starts.push_back(temp_runs_concat.size());
+
+            for(int64_t x : runs_encode(set)) temp_runs_concat.push_back(x);
+
         } else{
             // Sparse -> Array
 
-            // Add is_bitmap_mark
-            temp_is_bitmap_marks.push_back(0);
-
             // Store array start
             temp_arrays_starts.push_back(temp_arrays_concat.size());
 
@@ -213,33 +445,149 @@ class Color_Set_Storage<SDSL_Variant_Color_Set>{
     }
 
 
+    // Same as calling add_set for each set in order. Appending to the concatenations is sequential, and
+    // it is cheap compared to encoding a set in the other color set types, so this does not use threads.
+    void add_sets(const vector<vector<int64_t>>& new_sets, int64_t n_threads){
+        (void)n_threads;
+        for(const vector<int64_t>& set : new_sets) add_set(set);
+    }
+
     // Call this after done with add_set
     void prepare_for_queries(){
+        descriptors = sdsl::int_vector<>(); // The table would be out of date
 
         // Add extra starts points one past the end
         // These eliminate a special case when querying for the size of the last color set
         temp_bitmap_starts.push_back(temp_bitmap_concat.size());
         temp_arrays_starts.push_back(temp_arrays_concat.size());
+        temp_elias_fano_starts.push_back(temp_elias_fano_concat.size());
+        temp_complement_starts.push_back(temp_complement_concat.size());
+        temp_runs_starts.push_back(temp_runs_concat.size());
 
         arrays_concat = to_sdsl_int_vector(temp_arrays_concat);
         bitmap_starts = to_sdsl_int_vector(temp_bitmap_starts);
         arrays_starts = to_sdsl_int_vector(temp_arrays_starts);
+        elias_fano_starts = to_sdsl_int_vector(temp_elias_fano_starts);
+        complement_starts = to_sdsl_int_vector(temp_complement_starts);
+        runs_starts = to_sdsl_int_vector(temp_runs_starts);
         bitmap_concat = to_sdsl_bit_vector(temp_bitmap_concat);
+        elias_fano_concat.bits = to_sdsl_bit_vector(temp_elias_fano_concat);
+        complement_concat.values = to_sdsl_int_vector(temp_complement_concat);
+        runs_concat.values = to_sdsl_int_vector(temp_runs_concat);
         is_bitmap_marks = to_sdsl_bit_vector(temp_is_bitmap_marks);
+        is_elias_fano_marks = to_sdsl_bit_vector(temp_is_elias_fano_marks);
+        is_complement_marks = to_sdsl_bit_vector(temp_is_complement_marks);
+        is_runs_marks = to_sdsl_bit_vector(temp_is_runs_marks);
 
         sdsl::util::init_support(is_bitmap_marks_rs, &is_bitmap_marks);
+        sdsl::util::init_support(is_elias_fano_marks_rs, &is_elias_fano_marks);
+        sdsl::util::init_support(is_complement_marks_rs, &is_complement_marks);
+        sdsl::util::init_support(is_runs_marks_rs, &is_runs_marks);
 
         // Free memory
         temp_arrays_concat.clear(); temp_arrays_concat.shrink_to_fit();    
         temp_bitmap_concat.clear(); temp_bitmap_concat.shrink_to_fit();
+        temp_elias_fano_concat.clear(); temp_elias_fano_concat.shrink_to_fit();
+        temp_complement_concat.clear(); temp_complement_concat.shrink_to_fit();
+        temp_runs_concat.clear(); temp_runs_concat.shrink_to_fit();
         temp_is_bitmap_marks.clear(); temp_is_bitmap_marks.shrink_to_fit();
+        temp_is_elias_fano_marks.clear(); temp_is_elias_fano_marks.shrink_to_fit();
+        temp_is_complement_marks.clear(); temp_is_complement_marks.shrink_to_fit();
+        temp_is_runs_marks.clear(); temp_is_runs_marks.shrink_to_fit();
         temp_arrays_starts.clear(); temp_arrays_starts.shrink_to_fit();
         temp_bitmap_starts.clear(); temp_bitmap_starts.shrink_to_fit();
+        temp_elias_fano_starts.clear(); temp_elias_fano_starts.shrink_to_fit();
+        temp_complement_starts.clear(); temp_complement_starts.shrink_to_fit();
+        temp_runs_starts.clear(); temp_runs_starts.shrink_to_fit();
     }
 
+    static constexpr int64_t max_delta_depth = 64; // Longest chain of parents of a set. Bounds the decoding of corrupt files.
+
+    // Chooses the parents for delta encoding the sets on disk (see delta_parents.hh). Decoding a set
+    // at load time applies at most max_depth differences, which can be at most max_delta_depth.
+    // Call after prepare_for_queries.
+    void choose_delta_parents(int64_t largest_color, int64_t n_threads, int64_t max_depth = 16){
+        if(max_depth > max_delta_depth) throw std::runtime_error("Error: delta encoding depth " + to_string(max_depth) + " is larger than the maximum " + to_string(max_delta_depth));
+        int64_t n_sets = number_of_sets_stored();
+        auto get_set = [this](int64_t id, vector<int64_t>& out){
+            out.clear();
+            get_color_set_by_id(id).push_colors_to_vector(out);
+        };
+
+        // Cost of storing a set in full measured in colors
+        int64_t bits_per_color = bits_needed(largest_color);
+        vector<int64_t> full_cost(n_sets);
+        for(int64_t id = 0; id < n_sets; id++)
+            full_cost[id] = (get_color_set_by_id(id).size_in_bits() + bits_per_color - 1) / bits_per_color + 1;
+
+        vector<int64_t> parents = ::choose_delta_parents(n_sets, get_set, full_cost, max_depth, n_threads);
+        delta_parents = sdsl::int_vector<>(n_sets, 0, bits_needed(n_sets));
+        for(int64_t id = 0; id < n_sets; id++) delta_parents[id] = parents[id] + 1;
+    }
+
+    // Format version 5 starts with a byte of flags that tell whether the sets are delta encoded and
+    // whether the descriptor table is stored. Delta encoded sets are stored as the parents followed by
+    // blocks of delta_block_size consecutive set ids. A block has the sets without a parent in the
+    // earlier format, and the concatenation of the symmetric differences of the other sets with their
+    // parents. The blocks are encoded and written one at a time, so serializing takes memory for one
+    // block only. The descriptor table follows sets that are not delta encoded. The table of delta
+    // encoded sets is built again after decoding, because decoding already visits every set.
     int64_t serialize(ostream& os) const{
         int64_t bytes_written = 0;
 
+        char flags = (delta_parents.size() > 0 ? delta_encoded_flag : 0) | (descriptors.size() > 0 ? descriptor_table_flag : 0);
+        os.write(&flags, 1);
+        bytes_written += 1;
+        if(delta_parents.size() > 0) return bytes_written + serialize_delta_encoded(os);
+
+        bytes_written += serialize_sets(os);
+        if(descriptors.size() > 0){
+            bytes_written += descriptors.serialize(os);
+            os.write((char*)&descriptor_length_bits, sizeof(descriptor_length_bits));
+            bytes_written += sizeof(descriptor_length_bits);
+        }
+        return bytes_written;
+    }
+
+    private:
+
+    // See serialize
+    int64_t serialize_delta_encoded(ostream& os) const{
+        int64_t bytes_written = 0;
+        bytes_written += delta_parents.serialize(os);
+
+        int64_t n_sets = number_of_sets_stored();
+        vector<int64_t> set, parent_set;
+        for(int64_t block_start = 0; block_start < n_sets; block_start += delta_block_size){
+            int64_t block_end = min(n_sets, block_start + delta_block_size);
+            Color_Set_Storage<SDSL_Variant_Color_Set> full_sets;
+            vector<int64_t> deltas_concat;
+            vector<int64_t> delta_starts;
+            for(int64_t id = block_start; id < block_end; id++){
+                set.clear();
+                get_color_set_by_id(id).push_colors_to_vector(set);
+                if(delta_parents[id] == 0){
+                    full_sets.add_set(set);
+                } else{
+                    parent_set.clear();
+                    get_color_set_by_id(delta_parents[id] - 1).push_colors_to_vector(parent_set);
+                    delta_starts.push_back(deltas_concat.size());
+                    std::set_symmetric_difference(set.begin(), set.end(), parent_set.begin(), parent_set.end(), std::back_inserter(deltas_concat));
+                }
+            }
+            delta_starts.push_back(deltas_concat.size());
+            full_sets.prepare_for_queries();
+
+            bytes_written += full_sets.serialize_sets(os);
+            bytes_written += to_sdsl_int_vector(deltas_concat).serialize(os);
+            bytes_written += to_sdsl_int_vector(delta_starts).serialize(os);
+        }
+        return bytes_written;
+    }
+
+    int64_t serialize_sets(ostream& os) const{
+        int64_t bytes_written = 0;
+
         bytes_written += bitmap_concat.serialize(os);
         bytes_written += bitmap_starts.serialize(os);
 
@@ -249,12 +597,148 @@ class Color_Set_Storage<SDSL_Variant_Color_Set>{
         bytes_written += is_bitmap_marks.serialize(os);
         bytes_written += is_bitmap_marks_rs.serialize(os);
 
+        bytes_written += elias_fano_concat.bits.serialize(os);
+        bytes_written += elias_fano_starts.serialize(os);
+
+        bytes_written += is_elias_fano_marks.serialize(os);
+        bytes_written += is_elias_fano_marks_rs.serialize(os);
+
+        bytes_written += complement_concat.values.serialize(os);
+        bytes_written += complement_starts.serialize(os);
+        bytes_written += is_complement_marks.serialize(os);
+        bytes_written += is_complement_marks_rs.serialize(os);
+
+        bytes_written += runs_concat.values.serialize(os);
+        bytes_written += runs_starts.serialize(os);
+        bytes_written += is_runs_marks.serialize(os);
+        bytes_written += is_runs_marks_rs.serialize(os);
+
         return bytes_written;
 
         // Do not serialize temp structures
     }
 
-    void load(istream& is){
+    // Throws if a parent is not a set id, or if following the parents from a set does not reach
+    // a full set within max_delta_depth steps. This also rejects cycles.
+    void check_delta_parents() const{
+        int64_t n_sets = delta_parents.size();
+        for(int64_t id = 0; id < n_sets; id++)
+            if(delta_parents[id] > (uint64_t)n_sets || delta_parents[id] == (uint64_t)id + 1)
+                throw std::runtime_error("Error: corrupt delta encoded color sets: invalid parent of set " + to_string(id));
+
+        vector<int8_t> depth(n_sets, -1); // Number of differences to apply to decode the set. -1 if not known yet.
+        for(int64_t id = 0; id < n_sets; id++){
+            int64_t x = id, steps = 0;
+            while(depth[x] == -1 && delta_parents[x] != 0){
+                x = delta_parents[x] - 1;
+                if(++steps > max_delta_depth) throw std::runtime_error("Error: corrupt delta encoded color sets: the parents of set " + to_string(id) + " are too deep or have a cycle");
+            }
+            int64_t d = steps + (depth[x] == -1 ? 0 : depth[x]);
+            if(d > max_delta_depth) throw std::runtime_error("Error: corrupt delta encoded color sets: the parents of set " + to_string(id) + " are too deep or have a cycle");
+            for(x = id; depth[x] == -1; x = delta_parents[x] - 1){
+                depth[x] = d--;
+                if(delta_parents[x] == 0) break;
+            }
+        }
+    }
+
+    // Decodes delta encoded sets (see serialize) into this storage. Throws if the data is truncated
+    // or the parents or the blocks are not consistent.
+    void load_delta_encoded(istream& is, int64_t n_threads = 1){
+        delta_parents.load(is);
+        if(!is) throw std::runtime_error("Error: truncated delta encoded color sets");
+        check_delta_parents();
+        int64_t n_sets = delta_parents.size();
+        int64_t n_blocks = (n_sets + delta_block_size - 1) / delta_block_size;
+
+        // The parent of a set can be in any block, so all blocks are read before decoding
+        vector<Color_Set_Storage<SDSL_Variant_Color_Set>> full_sets(n_blocks);
+        vector<sdsl::int_vector<>> deltas_concat(n_blocks), delta_starts(n_blocks);
+        for(int64_t b = 0; b < n_blocks; b++){
+            if(is.peek() == EOF) throw std::runtime_error("Error: truncated delta encoded color sets"); // Before sdsl reads sizes from a failed stream
+            full_sets[b].load_sets(is, 5);
+            deltas_concat[b].load(is);
+            delta_starts[b].load(is);
+            if(!is) throw std::runtime_error("Error: truncated delta encoded color sets");
+        }
+
+        // Index of each set among the full sets or among the delta encoded sets of its block
+        vector<int64_t> rank(n_sets);
+        for(int64_t b = 0; b < n_blocks; b++){
+            int64_t n_full = 0, n_delta = 0;
+            for(int64_t id = b * delta_block_size; id < min(n_sets, (b+1) * delta_block_size); id++)
+                rank[id] = delta_parents[id] == 0 ? n_full++ : n_delta++;
+
+            // The block must have exactly these sets, and the differences must be within the block
+            const sdsl::int_vector<>& starts = delta_starts[b];
+            bool ok = full_sets[b].number_of_sets_stored() == n_full && (int64_t)starts.size() == n_delta + 1 && starts[0] == 0;
+            for(int64_t i = 0; ok && i < n_delta; i++) ok = starts[i] <= starts[i+1];
+            if(!ok || starts[n_delta] > deltas_concat[b].size())
+                throw std::runtime_error("Error: corrupt delta encoded color sets in block " + to_string(b));
+        }
+
+        // Decode in blocks. A set is decoded by applying the differences on the path from a full set down to it.
+        vector<vector<int64_t>> block(delta_block_size);
+        for(int64_t block_start = 0; block_start < n_sets; block_start += delta_block_size){
+            int64_t block_end = min(n_sets, block_start + delta_block_size);
+            block.resize(block_end - block_start);
+
+            #pragma omp parallel for num_threads(n_threads) schedule(dynamic, 64)
+            for(int64_t id = block_start; id < block_end; id++){
+                vector<int64_t> path; // From the set up to the full set, excluding the full set
+                int64_t x = id;
+                while(delta_parents[x] != 0){
+                    path.push_back(x);
+                    x = delta_parents[x] - 1;
+                }
+
+                vector<int64_t> set = full_sets[x / delta_block_size].get_color_set_by_id(rank[x]).get_colors_as_vector();
+                vector<int64_t> next;
+                for(int64_t i = (int64_t)path.size() - 1; i >= 0; i--){
+                    const sdsl::int_vector<>& deltas = deltas_concat[path[i] / delta_block_size];
+                    const sdsl::int_vector<>& starts = delta_starts[path[i] / delta_block_size];
+                    int64_t start = starts[rank[path[i]]];
+                    int64_t end = starts[rank[path[i]] + 1];
+                    next.clear();
+                    for(int64_t j = start, k = 0; j < end || k < (int64_t)set.size(); ){
+                        // Symmetric difference of the sorted delta and set
+                        if(k == (int64_t)set.size() || (j < end && (int64_t)deltas[j] < set[k])) next.push_back(deltas[j++]);
+                        else if(j == end || set[k] < (int64_t)deltas[j]) next.push_back(set[k++]);
+                        else{ j++; k++; }
+                    }
+                    set.swap(next);
+                }
+                block[id - block_start] = std::move(set);
+            }
+
+            add_sets(block, n_threads);
+        }
+        prepare_for_queries();
+    }
+
+    // Loads the descriptor table that follows the sets. Throws if a descriptor points outside of
+    // its concatenation, so that a corrupt table can not make queries read out of bounds.
+    void load_descriptor_table(istream& is){
+        descriptors.load(is);
+        is.read((char*)&descriptor_length_bits, sizeof(descriptor_length_bits));
+        if(!is) throw std::runtime_error("Error: truncated color set descriptor table");
+        if((int64_t)descriptors.size() != number_of_sets_stored() || descriptor_length_bits < 1 || descriptor_length_bits > 60)
+            throw std::runtime_error("Error: corrupt color set descriptor table");
+
+        const uint64_t concat_sizes[] = {bitmap_concat.size(), arrays_concat.size(), elias_fano_concat.bits.size(), complement_concat.values.size(), runs_concat.values.size()};
+        for(int64_t i = 0; i < (int64_t)descriptors.size(); i++){
+            uint64_t descriptor = descriptors[i];
+            uint64_t encoding = descriptor & 7;
+            uint64_t start = descriptor >> (descriptor_length_bits + 3);
+            uint64_t length = (descriptor >> 3) & ((1ULL << descriptor_length_bits) - 1);
+            if(encoding > 4 || start > concat_sizes[encoding] || length > concat_sizes[encoding] - start)
+                throw std::runtime_error("Error: corrupt color set descriptor table");
+        }
+    }
+
+    // See load
+    void load_sets(istream& is, int64_t format_version){
+        descriptors = sdsl::int_vector<>(); // The table would be out of date
         bitmap_concat.load(is);
         bitmap_starts.load(is);
         arrays_concat.load(is);
@@ -263,9 +747,52 @@ class Color_Set_Storage<SDSL_Variant_Color_Set>{
 
         is_bitmap_marks_rs.load(is, &is_bitmap_marks);
 
+        // Encodings that are not in the file have no sets
+        int64_t n_sets = is_bitmap_marks.size();
+        if(format_version >= 5){
+            elias_fano_concat.bits.load(is);
+            elias_fano_starts.load(is);
+            is_elias_fano_marks.load(is);
+            is_elias_fano_marks_rs.load(is, &is_elias_fano_marks);
+
+            complement_concat.values.load(is);
+            complement_starts.load(is);
+            is_complement_marks.load(is);
+            is_complement_marks_rs.load(is, &is_complement_marks);
+
+            runs_concat.values.load(is);
+            runs_starts.load(is);
+            is_runs_marks.load(is);
+            is_runs_marks_rs.load(is, &is_runs_marks);
+        } else{
+            is_elias_fano_marks = sdsl::bit_vector(n_sets, 0);
+            sdsl::util::init_support(is_elias_fano_marks_rs, &is_elias_fano_marks);
+            is_complement_marks = sdsl::bit_vector(n_sets, 0);
+            sdsl::util::init_support(is_complement_marks_rs, &is_complement_marks);
+            is_runs_marks = sdsl::bit_vector(n_sets, 0);
+            sdsl::util::init_support(is_runs_marks_rs, &is_runs_marks);
+        }
+
         // Do not load temp structures
     }
 
+    public:
+
+    // The format version is the version in the type id of the coloring (sdsl-hybrid-vN). Version 4,
+    // from the previous release, has only bitmaps and arrays and no delta encoding.
+    void load(istream& is, int64_t format_version = 5, int64_t n_threads = 1){
+        char flags = 0;
+        if(format_version >= 5) is.read(&flags, 1);
+        if(flags & delta_encoded_flag){
+            load_delta_encoded(is, n_threads);
+            if(flags & descriptor_table_flag) build_descriptor_table();
+        } else{
+            load_sets(is, format_version);
+            delta_parents = sdsl::int_vector<>();
+            if(flags & descriptor_table_flag) load_descriptor_table(is);
+        }
+    }
+
     int64_t number_of_sets_stored() const{
         return is_bitmap_marks.size();
     }
@@ -290,11 +817,177 @@ class Color_Set_Storage<SDSL_Variant_Color_Set>{
         breakdown["arrays-starts"] = arrays_starts.serialize(ns);
         breakdown["is-bitmap-marks"] = is_bitmap_marks.serialize(ns);
         breakdown["is-bitmap-marks-rank-suppport"] = is_bitmap_marks_rs.serialize(ns);
+        breakdown["elias-fano-concat"] = elias_fano_concat.bits.serialize(ns);
+        breakdown["elias-fano-starts"] = elias_fano_starts.serialize(ns);
+        breakdown["is-elias-fano-marks"] = is_elias_fano_marks.serialize(ns);
+        breakdown["is-elias-fano-marks-rank-suppport"] = is_elias_fano_marks_rs.serialize(ns);
+        breakdown["complement-concat"] = complement_concat.values.serialize(ns);
+        breakdown["complement-starts"] = complement_starts.serialize(ns);
+        breakdown["is-complement-marks"] = is_complement_marks.serialize(ns);
+        breakdown["is-complement-marks-rank-suppport"] = is_complement_marks_rs.serialize(ns);
+        breakdown["runs-concat"] = runs_concat.values.serialize(ns);
+        breakdown["runs-starts"] = runs_starts.serialize(ns);
+        breakdown["is-runs-marks"] = is_runs_marks.serialize(ns);
+        breakdown["is-runs-marks-rank-suppport"] = is_runs_marks_rs.serialize(ns);
+        if(descriptors.size() > 0) breakdown["descriptors"] = descriptors.serialize(ns);
 
         // In the future maybe the space breakdown struct should support float statistics but for now we just disgustingly print to cout.
         cout << "Fraction of bitmaps in coloring: " << (double) is_bitmap_marks_rs.rank(is_bitmap_marks.size()) / is_bitmap_marks.size() << endl;
+        cout << "Fraction of Elias-Fano sets in coloring: " << (double) is_elias_fano_marks_rs.rank(is_elias_fano_marks.size()) / is_elias_fano_marks.size() << endl;
+        cout << "Fraction of complement sets in coloring: " << (double) is_complement_marks_rs.rank(is_complement_marks.size()) / is_complement_marks.size() << endl;
+        cout << "Fraction of run-length encoded sets in coloring: " << (double) is_runs_marks_rs.rank(is_runs_marks.size()) / is_runs_marks.size() << endl;
 
         return breakdown;
     }
 
-};
\ No newline at end of file
+};
+
+
+/*
+
+Template specialization for Roaring_Color_Set.
+
+The sets are stored frozen (see Frozen_Roaring) and concatenated into one buffer, with pointers
+to the starts of the sets. Views point into the buffer, and intersecting a Roaring_Color_Set
+with a view runs on the frozen containers. Loading reads the buffer with a single read instead
+of allocating every set separately.
+
+*/
+
+template<>
+class Color_Set_Storage<Roaring_Color_Set>{
+
+private:
+
+    vector<uint64_t> data; // Concatenated frozen sets
+    vector<uint64_t> starts = {0}; // Set i is in data[starts[i]..starts[i+1])
+
+public:
+
+    Color_Set_Storage(){}
+    Color_Set_Storage(const vector<Roaring_Color_Set>& sets){
+        for(const Roaring_Color_Set& cs : sets){
+            Roaring_Color_Set::view_t view(cs); // The set is already frozen
+            data.insert(data.end(), view.frozen, view.frozen + view.frozen_words);
+            starts.push_back(data.size());
+        }
+        prepare_for_queries();
+    }
+
+    Roaring_Color_Set::view_t get_color_set_by_id(int64_t id) const{
+        return Roaring_Color_Set::view_t(data.data() + starts[id], starts[id+1] - starts[id]);
+    }
+
+    // The colors must be sorted. Need to call prepare_for_queries() after all sets have been added.
+    void add_set(const vector<int64_t>& set){
+        Frozen_Roaring::freeze(set, data);
+        starts.push_back(data.size());
+    }
+
+    // Same as calling add_set for each set in order. The sets are encoded in parallel.
+    void add_sets(const vector<vector<int64_t>>& new_sets, int64_t n_threads){
+        for(const vector<int64_t>& set : new_sets) Frozen_Roaring::check_color_range(set); // Not inside the parallel loop
+        vector<vector<uint64_t>> encoded(new_sets.size());
+        #pragma omp parallel for num_threads(n_threads) schedule(dynamic, 64)
+        for(int64_t i = 0; i < (int64_t)new_sets.size(); i++){
+            Frozen_Roaring::freeze(new_sets[i], encoded[i]);
+        }
+        for(const vector<uint64_t>& frozen : encoded){
+            data.insert(data.end(), frozen.begin(), frozen.end());
+            starts.push_back(data.size());
+        }
+    }
+
+    // Call this after done with add_set
+    void prepare_for_queries(){
+        data.shrink_to_fit();
+        starts.shrink_to_fit();
+    }
+
+    int64_t serialize(ostream& os) const{
+        int64_t bytes_written = 0;
+        std::size_t n_sets = number_of_sets_stored();
+        std::size_t n_words = data.size();
+        os.write(reinterpret_cast<const char*>(&n_sets), sizeof(std::size_t));
+        os.write(reinterpret_cast<const char*>(&n_words), sizeof(std::size_t));
+        os.write(reinterpret_cast<const char*>(starts.data()), starts.size() * sizeof(uint64_t));
+        os.write(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(uint64_t));
+        bytes_written += 2 * sizeof(std::size_t) + (starts.size() + data.size()) * sizeof(uint64_t);
+        return bytes_written;
+    }
+
+    // The format version is the version in the type id of the coloring (roaring-vN). Version 0,
+    // from the previous release, stores every set separately in the serialization format of
+    // CRoaring, and the sets are frozen in parallel when loaded. Throws if the data is truncated or
+    // a set is not well formed.
+    void load(istream& is, int64_t format_version = 1, int64_t n_threads = 1){
+        std::size_t n_sets = 0;
+        is.read(reinterpret_cast<char*>(&n_sets), sizeof(std::size_t));
+
+        if(format_version == 0){
+            data.clear();
+            starts = {0};
+            int64_t block_size = 1 << 16;
+            vector<vector<int64_t>> block;
+            for(int64_t block_start = 0; block_start < (int64_t)n_sets; block_start += block_size){
+                block.resize(min((int64_t)n_sets - block_start, block_size));
+                for(vector<int64_t>& colors : block){
+                    Roaring_Color_Set cs;
+                    cs.load(is);
+                    if(!is) throw std::runtime_error("Error: truncated Roaring color sets");
+                    colors = cs.get_colors_as_vector();
+                }
+                add_sets(block, n_threads);
+            }
+            prepare_for_queries();
+            return;
+        }
+
+        std::size_t n_words = 0;
+        is.read(reinterpret_cast<char*>(&n_words), sizeof(std::size_t));
+        if(!is) throw std::runtime_error("Error: truncated Roaring color sets");
+
+        // Do not allocate more than the rest of the stream, if its length is known
+        std::streampos pos = is.tellg();
+        if(pos != std::streampos(-1)){
+            is.seekg(0, std::ios::end);
+            uint64_t bytes_left = is.tellg() - pos;
+            is.seekg(pos);
+            if(n_sets >= bytes_left / sizeof(uint64_t) || n_words > bytes_left / sizeof(uint64_t) - n_sets - 1)
+                throw std::runtime_error("Error: truncated Roaring color sets");
+        }
+
+        starts.resize(n_sets + 1);
+        data.resize(n_words);
+        is.read(reinterpret_cast<char*>(starts.data()), starts.size() * sizeof(uint64_t));
+        is.read(reinterpret_cast<char*>(data.data()), data.size() * sizeof(uint64_t));
+        if(!is) throw std::runtime_error("Error: truncated Roaring color sets");
+
+        // Every set must be within the buffer and well formed, so that queries do not read out of bounds
+        if(starts[0] != 0 || starts[n_sets] != n_words) throw std::runtime_error("Error: corrupt Roaring color sets");
+        for(std::size_t i = 0; i < n_sets; i++){
+            if(starts[i+1] < starts[i] || starts[i+1] > n_words || !Frozen_Roaring::is_valid(data.data() + starts[i], starts[i+1] - starts[i]))
+                throw std::runtime_error("Error: corrupt Roaring color set " + to_string(i));
+        }
+    }
+
+    int64_t number_of_sets_stored() const{
+        return starts.size() - 1;
+    }
+
+    vector<Roaring_Color_Set::view_t> get_all_sets() const{
+        vector<Roaring_Color_Set::view_t> all;
+        for(int64_t i = 0; i < number_of_sets_stored(); i++){
+            all.push_back(get_color_set_by_id(i));
+        }
+        return all;
+    }
+
+    // Returns map: component -> number of bytes
+    map<string, int64_t> space_breakdown() const{
+        map<string, int64_t> breakdown;
+        breakdown["sets"] = data.size() * sizeof(uint64_t);
+        breakdown["starts"] = starts.size() * sizeof(uint64_t);
+        return breakdown;
+    }
+};
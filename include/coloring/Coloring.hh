@@ -32,6 +32,10 @@
 #include "Color_Set_Interface.hh"
 #include <variant>
 
+// Splits the type id of a serialized coloring, for example "sdsl-hybrid-v5", into the name of the
+// structure and the format version. The version is -1 if the type id does not end in one.
+pair<string, int64_t> parse_coloring_type_id(const string& type_id);
+
 // Takes as parameter a class that encodes a single color set
 template<typename colorset_t = SDSL_Variant_Color_Set> 
 requires Color_Set_Interface<colorset_t>
@@ -57,6 +61,26 @@ private:
     int64_t largest_color_id = 0;
     int64_t total_color_set_length = 0;
 
+    // Color ids are permuted if the colors have been reordered (see reorder_colors). The color
+    // sets store the permuted ids, and this maps them back to the original ids. Empty if the
+    // ids are not permuted.
+    sdsl::int_vector<> internal_to_original_color;
+    vector<int64_t> original_to_internal_color; // Inverse of the above. Not serialized.
+
+    void set_color_permutation(const sdsl::int_vector<>& permutation){
+        internal_to_original_color = permutation;
+        original_to_internal_color.assign(permutation.size(), 0);
+        for(int64_t i = 0; i < (int64_t)permutation.size(); i++)
+            original_to_internal_color[permutation[i]] = i;
+    }
+
+    static uint64_t mix(uint64_t x){ // Finalizer of splitmix64
+        x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
 public:
 
     Coloring() {}
@@ -69,14 +93,25 @@ public:
              : sets(sets), node_id_to_color_set_id(node_id_to_color_set_id), index_ptr(&index), largest_color_id(largest_id), total_color_set_length(total_color_set_length){
     }
 
+    // The color sets of `sets` are in permuted color ids. Internal color i is original color internal_to_original[i].
+    Coloring(const colorset_storage_type& sets,
+             const Sparse_Uint_Array& node_id_to_color_set_id,
+             const plain_matrix_sbwt_t& index,
+             const int64_t largest_id,
+             const int64_t total_color_set_length,
+             const sdsl::int_vector<>& internal_to_original)
+             : Coloring(sets, node_id_to_color_set_id, index, largest_id, total_color_set_length){
+        if(internal_to_original.size() > 0) set_color_permutation(internal_to_original);
+    }
+
     std::size_t serialize(std::ostream& os) const {
         std::size_t bytes_written = 0;
 
         if(std::is_same<colorset_t, SDSL_Variant_Color_Set>::value){
-            string type_id = "sdsl-hybrid-v4";
+            string type_id = "sdsl-hybrid-v5";
             bytes_written += sbwt::serialize_string(type_id, os);
         } else if(std::is_same<colorset_t, Roaring_Color_Set>::value){
-            string type_id = "roaring-v0";
+            string type_id = "roaring-v1";
             bytes_written += sbwt::serialize_string(type_id, os);
         } else{
             throw std::runtime_error("Unsupported color set template");
@@ -91,6 +126,8 @@ public:
         os.write((char*)&total_color_set_length, sizeof(total_color_set_length));
         bytes_written += sizeof(total_color_set_length);
 
+        bytes_written += internal_to_original_color.serialize(os);
+
         return bytes_written;
     }
 
@@ -100,34 +137,45 @@ public:
     }
 
 
-    void load(std::ifstream& is, const plain_matrix_sbwt_t& index) {
+    // The threads are used to decode delta encoded color sets (see delta_encode_color_sets)
+    void load(std::istream& is, const plain_matrix_sbwt_t& index, int64_t n_threads = 1) {
         index_ptr = &index;
 
         string type_id = sbwt::load_string(is);
 
-        // Check that the type id is correct for this class
-        if(type_id == "sdsl-hybrid-v4"){
+        // Check that the type id is correct for this class. The previous release wrote sdsl-hybrid-v4
+        // and roaring-v0, which have the color sets in their old layout (see Color_Set_Storage::load),
+        // the node pointers in a plain bit vector (see Sparse_Uint_Array::load) and no color permutation.
+        auto [structure, version] = parse_coloring_type_id(type_id);
+        if(structure == "sdsl-hybrid" && (version == 4 || version == 5)){
             if(!std::is_same<colorset_t, SDSL_Variant_Color_Set>::value){
                 throw WrongTemplateParameterException();
             }
-        } else if(type_id == "roaring-v0"){
+        } else if(structure == "roaring" && (version == 0 || version == 1)){
             if(!std::is_same<colorset_t, Roaring_Color_Set>::value){
                 throw WrongTemplateParameterException();
             }
         } else{
             throw std::runtime_error("Unknown color set type:" + type_id);
         }
+        bool old_format = version == (structure == "roaring" ? 0 : 4);
 
-        sets.load(is);
-        node_id_to_color_set_id.load(is);
+        sets.load(is, version, n_threads);
+        node_id_to_color_set_id.load(is, !old_format);
 
         is.read((char*)&largest_color_id, sizeof(largest_color_id));
         is.read((char*)&total_color_set_length, sizeof(total_color_set_length));
+
+        sdsl::int_vector<> permutation;
+        if(!old_format) permutation.load(is);
+        internal_to_original_color = sdsl::int_vector<>();
+        original_to_internal_color.clear();
+        if(permutation.size() > 0) set_color_permutation(permutation);
     }
 
-    void load(const std::string& filename, const plain_matrix_sbwt_t& index) {
+    void load(const std::string& filename, const plain_matrix_sbwt_t& index, int64_t n_threads = 1) {
         throwing_ifstream in(filename, ios::binary);
-        load(in.stream, index);
+        load(in.stream, index, n_threads);
     }
 
     std::int64_t get_color_set_id(std::int64_t node) const {
@@ -177,15 +225,205 @@ public:
     // Note! This function returns a new vector instead of a const-reference. Keep this
     // in mind if programming for performance. In that case, it's probably better to get the
     // color set using `get_color_set_of_node`, which returns a const-reference to a colorset_t object.
+    // Unlike the colors of the set objects, the colors in the vector are original color ids (see
+    // reorder_colors).
     std::vector<std::int64_t> get_color_set_of_node_as_vector(std::int64_t node) const {
         assert(node >= 0);
         assert(node < node_id_to_color_set_id.size());
-        return get_color_set_of_node(node).get_colors_as_vector();
+        std::vector<std::int64_t> colors = get_color_set_of_node(node).get_colors_as_vector();
+        to_original_colors(colors);
+        return colors;
     }
 
     // See the comment on `get_color_set_of_node_as_vector`.
     std::vector<std::int64_t> get_color_set_as_vector_by_color_set_id(std::int64_t color_set_id) const {
-        return get_color_set_by_color_set_id(color_set_id).get_colors_as_vector();
+        std::vector<std::int64_t> colors = get_color_set_by_color_set_id(color_set_id).get_colors_as_vector();
+        to_original_colors(colors);
+        return colors;
+    }
+
+    bool has_color_permutation() const{
+        return internal_to_original_color.size() > 0;
+    }
+
+    // Internal color i is original color get_color_permutation()[i]. Empty if the colors are not permuted.
+    const sdsl::int_vector<>& get_color_permutation() const{
+        return internal_to_original_color;
+    }
+
+    // Maps a color of the color set objects to the color id given at construction
+    int64_t get_original_color(int64_t internal_color) const{
+        return has_color_permutation() ? (int64_t)internal_to_original_color[internal_color] : internal_color;
+    }
+
+    // Inverse of get_original_color
+    int64_t get_internal_color(int64_t original_color) const{
+        return has_color_permutation() ? original_to_internal_color[original_color] : original_color;
+    }
+
+    // Maps the colors of a set object to original colors in place. The result is sorted.
+    void to_original_colors(std::vector<std::int64_t>& colors) const{
+        if(!has_color_permutation()) return;
+        for(std::int64_t& c : colors) c = internal_to_original_color[c];
+        std::sort(colors.begin(), colors.end());
+    }
+
+    // Makes fetching color sets faster at the cost of memory (see Color_Set_Storage::build_descriptor_table).
+    // Does nothing for Roaring_Color_Set, whose sets are fetched with a single lookup anyway.
+    void build_color_set_descriptor_table(){
+        if constexpr(std::is_same<colorset_t, SDSL_Variant_Color_Set>::value)
+            sets.build_descriptor_table();
+    }
+
+    // True if the color set descriptor table is built or was stored in the index
+    bool has_color_set_descriptor_table() const{
+        if constexpr(std::is_same<colorset_t, SDSL_Variant_Color_Set>::value)
+            return sets.has_descriptor_table();
+        else return false;
+    }
+
+    // Stores the color sets on disk as differences to similar sets (see delta_parents.hh). Only
+    // for SDSL_Variant_Color_Set. Call after reorder_colors, which drops the delta encoding.
+    void delta_encode_color_sets(int64_t n_threads, int64_t max_depth = 16){
+        if constexpr(std::is_same<colorset_t, SDSL_Variant_Color_Set>::value)
+            sets.choose_delta_parents(largest_color_id, n_threads, max_depth);
+        else throw std::runtime_error("Delta encoded color sets are only supported by the sdsl-hybrid coloring structure");
+    }
+
+    // Permutes the color ids so that colors that occur in many of the same color sets get nearby
+    // ids, and re-encodes the color sets. This makes bitmaps denser and runs longer, which makes
+    // the index smaller and set operations faster. Color set ids do not change. The permutation
+    // is stored, and the original ids are available through get_original_color.
+    //
+    // The colors are clustered by sorting them by MinHash sketches of the sets of color set ids
+    // that they occur in: two colors agree on the minimum of a hash function with probability
+    // equal to the Jaccard similarity of their color set id sets, so sorting by the sketches
+    // lexicographically puts similar colors next to each other.
+    //
+    // Every thread has its own copy of the sketches. If the copies do not fit in ram_bytes, fewer
+    // threads compute the sketches, and if even one copy besides the shared one does not fit, the
+    // sketches are made shorter.
+    void reorder_colors(int64_t n_threads, int64_t ram_bytes = (int64_t)1 << 30, int64_t sketch_size = 8){
+        int64_t n_colors = largest_color_id + 1;
+        int64_t n_sets = sets.number_of_sets_stored();
+
+        int64_t bytes_per_sketch_copy = max((int64_t)1, n_colors * sketch_size * (int64_t)sizeof(uint64_t));
+        int64_t n_sketch_threads = min(n_threads, ram_bytes / bytes_per_sketch_copy - 1);
+        if(n_sketch_threads < 1){
+            n_sketch_threads = 1;
+            sketch_size = max((int64_t)1, ram_bytes / (2 * max(n_colors, (int64_t)1) * (int64_t)sizeof(uint64_t)));
+            write_log("Using sketches of " + to_string(sketch_size) + " hashes to reorder the colors within the memory budget", LogLevel::MAJOR);
+        } else if(n_sketch_threads < n_threads){
+            write_log("Using " + to_string(n_sketch_threads) + " threads to reorder the colors within the memory budget", LogLevel::MAJOR);
+        }
+
+        // Colors are numbered in the current internal ids
+        vector<uint64_t> sketches(n_colors * sketch_size, UINT64_MAX);
+        #pragma omp parallel num_threads(n_sketch_threads)
+        {
+            vector<uint64_t> local_sketches(n_colors * sketch_size, UINT64_MAX);
+            vector<int64_t> colors;
+            vector<uint64_t> hashes(sketch_size);
+
+            #pragma omp for schedule(dynamic, 256)
+            for(int64_t id = 0; id < n_sets; id++){
+                colors.clear();
+                sets.get_color_set_by_id(id).push_colors_to_vector(colors);
+                for(int64_t j = 0; j < sketch_size; j++) hashes[j] = mix(id * sketch_size + j + 1);
+                for(int64_t c : colors){
+                    uint64_t* sketch = local_sketches.data() + c * sketch_size;
+                    for(int64_t j = 0; j < sketch_size; j++) sketch[j] = min(sketch[j], hashes[j]);
+                }
+            }
+
+            #pragma omp critical
+            {
+                for(int64_t i = 0; i < n_colors * sketch_size; i++)
+                    sketches[i] = min(sketches[i], local_sketches[i]);
+            }
+        }
+
+        // Colors that are in no set have the largest sketch and go last. Ties keep the current order.
+        vector<int64_t> order(n_colors); // New internal color -> current internal color
+        for(int64_t c = 0; c < n_colors; c++) order[c] = c;
+        std::stable_sort(order.begin(), order.end(), [&](int64_t a, int64_t b){
+            return std::lexicographical_compare(sketches.begin() + a * sketch_size, sketches.begin() + (a+1) * sketch_size,
+                                                sketches.begin() + b * sketch_size, sketches.begin() + (b+1) * sketch_size);
+        });
+        vector<uint64_t>().swap(sketches); // Free memory
+
+        vector<int64_t> new_color(n_colors); // Current internal color -> new internal color
+        sdsl::int_vector<> permutation(n_colors, 0, max((int64_t)std::bit_width((uint64_t)largest_color_id), (int64_t)1));
+        for(int64_t i = 0; i < n_colors; i++){
+            new_color[order[i]] = i;
+            permutation[i] = get_original_color(order[i]);
+        }
+
+        // Re-encode the sets in blocks so that only one block is decoded at a time
+        colorset_storage_type new_sets;
+        int64_t block_size = 1 << 16;
+        vector<vector<int64_t>> block(block_size);
+        for(int64_t block_start = 0; block_start < n_sets; block_start += block_size){
+            int64_t block_end = min(n_sets, block_start + block_size);
+            block.resize(block_end - block_start);
+
+            #pragma omp parallel for num_threads(n_threads) schedule(dynamic, 64)
+            for(int64_t id = block_start; id < block_end; id++){
+                vector<int64_t>& colors = block[id - block_start];
+                colors.clear();
+                sets.get_color_set_by_id(id).push_colors_to_vector(colors);
+                for(int64_t& c : colors) c = new_color[c];
+                std::sort(colors.begin(), colors.end());
+            }
+
+            new_sets.add_sets(block, n_threads);
+        }
+        new_sets.prepare_for_queries();
+
+        sets = std::move(new_sets);
+        set_color_permutation(permutation);
+    }
+
+    // Renumbers the color sets in descending order of the number of nodes that point to them, and
+    // stores the pointers in short codes (see Sparse_Uint_Array::encode_values_with_escapes). Usually
+    // a few color sets account for most of the nodes, so most pointers get a short code. This makes
+    // the node to color set map smaller, and the popular sets are stored next to each other. Call
+    // before delta_encode_color_sets, which this drops.
+    void order_color_sets_by_popularity(int64_t n_threads){
+        int64_t n_sets = sets.number_of_sets_stored();
+        vector<int64_t> counts = node_id_to_color_set_id.value_counts();
+        counts.resize(max((int64_t)counts.size(), n_sets), 0);
+
+        vector<int64_t> order(n_sets); // New color set id -> current color set id
+        for(int64_t id = 0; id < n_sets; id++) order[id] = id;
+        std::stable_sort(order.begin(), order.end(), [&](int64_t a, int64_t b){
+            return counts[a] > counts[b];
+        });
+        vector<int64_t> new_id(n_sets); // Current color set id -> new color set id
+        for(int64_t i = 0; i < n_sets; i++) new_id[order[i]] = i;
+
+        // Re-encode the sets in blocks so that only one block is decoded at a time
+        colorset_storage_type new_sets;
+        int64_t block_size = 1 << 16;
+        vector<vector<int64_t>> block(block_size);
+        for(int64_t block_start = 0; block_start < n_sets; block_start += block_size){
+            int64_t block_end = min(n_sets, block_start + block_size);
+            block.resize(block_end - block_start);
+
+            #pragma omp parallel for num_threads(n_threads) schedule(dynamic, 64)
+            for(int64_t id = block_start; id < block_end; id++){
+                vector<int64_t>& colors = block[id - block_start];
+                colors.clear();
+                sets.get_color_set_by_id(order[id]).push_colors_to_vector(colors);
+            }
+
+            new_sets.add_sets(block, n_threads);
+        }
+        new_sets.prepare_for_queries();
+        sets = std::move(new_sets);
+
+        node_id_to_color_set_id.renumber_values(new_id);
+        node_id_to_color_set_id.encode_values_with_escapes();
     }
 
     // If a node is a core k-mer, it has out-degree 1 and the color set of the out-neighbor is the
@@ -229,7 +467,9 @@ public:
         return breakdown;
     }
 
-    // Increases the index size, but makes queries faster
+    // Increases the index size, but makes queries faster. The pointers are stored in short codes
+    // like in order_color_sets_by_popularity, so that popular sets do not take the full width in
+    // every node.
     void add_all_node_id_to_color_set_id_pointers(const plain_matrix_sbwt_t& index, SBWT_backward_traversal_support& sbwt_bws, int64_t n_threads) {
 
         // Data structure for the new "sparse" array of values
@@ -281,7 +521,7 @@ public:
         }
         
         this->node_id_to_color_set_id = Sparse_Uint_Array(marks, values, max_value);
-
+        this->node_id_to_color_set_id.encode_values_with_escapes();
     }
 
     template<typename T1, typename T2> requires Color_Set_Interface<T1>
@@ -296,5 +536,11 @@ public:
 void load_coloring(string filename, const plain_matrix_sbwt_t& SBWT,
 std::variant<
 Coloring<SDSL_Variant_Color_Set>,
-Coloring<Roaring_Color_Set>>& coloring);
+Coloring<Roaring_Color_Set>>& coloring, int64_t n_threads = 1);
+
+// Same as above but from a seekable stream, for example one that reads from memory
+void load_coloring(std::istream& is, const plain_matrix_sbwt_t& SBWT,
+std::variant<
+Coloring<SDSL_Variant_Color_Set>,
+Coloring<Roaring_Color_Set>>& coloring, int64_t n_threads = 1);
 
@@ -8,6 +8,8 @@
 #include <cstring>
 #include <variant>
 #include <mutex>
+#include <filesystem>
+#include <omp.h>
 
 #include <sdsl/bit_vectors.hpp>
 
@@ -19,6 +21,9 @@
 #include "SeqIO/buffered_streams.hh"
 #include "sbwt/EM_sort/bit_level_stuff.hh"
 #include "sbwt/EM_sort/EM_sort.hh"
+#include "external_sort.hh"
+#include "record_file.hh"
+#include "build_checkpoint.hh"
 #include "sbwt/globals.hh"
 #include "SeqIO/SeqIO.hh"
 
@@ -90,14 +95,46 @@ class Coloring_Builder{
 
 private:
 
+    // Appends x to the record as a big-endian 64-bit integer
+    static void append_big_endian_LL(std::vector<char>& record, std::int64_t x) {
+        record.resize(record.size() + 8);
+        write_big_endian_LL(record.data() + record.size() - 8, x);
+    }
+
+    // Order of (node, color) pair records
+    static bool node_color_pair_less(const char* A, const char* B) {
+        std::int64_t x_1, y_1, x_2, y_2;
+        x_1 = parse_big_endian_LL(A + 0);
+        y_1 = parse_big_endian_LL(A + 8);
+        x_2 = parse_big_endian_LL(B + 0);
+        y_2 = parse_big_endian_LL(B + 8);
+
+        return std::make_pair(x_1, y_1) < std::make_pair(x_2, y_2);
+    }
+
     class ColorPairAlignerThread : public DispatcherConsumerCallback {
         ParallelBinaryOutputWriter& out;
         const std::size_t output_buffer_max_size;
         std::size_t output_buffer_size = 0;
         char* output_buffer;
+        std::string encoded_block; // Reusable space
         const plain_matrix_sbwt_t& index;
         const sdsl::bit_vector& cores;
         std::int64_t largest_color_id = 0;
+        std::int64_t n_pairs = 0;
+
+        // Writes the buffer as one block of the record file. The block is coded in this thread.
+        void flush_output_buffer() {
+            external_sort::Temp_Compression compression = external_sort::get_temp_compression();
+            if (compression == external_sort::Temp_Compression::none) {
+                out.write(output_buffer, output_buffer_size);
+            } else {
+                encoded_block.clear();
+                external_sort::encode_block(external_sort::Constant_Size_Records{16}, output_buffer, output_buffer_size, compression, encoded_block);
+                out.write(encoded_block.data(), encoded_block.size());
+            }
+            output_buffer_size = 0;
+        }
 
     public:
         ColorPairAlignerThread(ParallelBinaryOutputWriter& out,
@@ -117,14 +154,12 @@ private:
         void write(const std::int64_t node_id, const std::int64_t color_id) {
             const std::size_t space_left = output_buffer_max_size - output_buffer_size;
 
-            if (space_left < 8+8) {
-                out.write(output_buffer, output_buffer_size);
-                output_buffer_size = 0;
-            }
+            if (space_left < 8+8) flush_output_buffer();
 
             write_big_endian_LL(output_buffer + output_buffer_size, node_id);
             write_big_endian_LL(output_buffer + output_buffer_size + 8, color_id);
             output_buffer_size += 8+8;
+            n_pairs++;
         }
 
         // It is our responsibility to interpret the metadata
@@ -149,10 +184,7 @@ private:
         }
 
         virtual void finish() {
-            if (output_buffer_size > 0) {
-                out.write(output_buffer, output_buffer_size);
-                output_buffer_size = 0;
-            }
+            if (output_buffer_size > 0) flush_output_buffer();
 
             delete[] output_buffer;
         }
@@ -160,9 +192,13 @@ private:
         std::int64_t get_largest_color_id() const {
             return largest_color_id;
         }
+
+        std::int64_t get_number_of_pairs() const {
+            return n_pairs;
+        }
     };
 
-    // Return the filename of the generated node-color pairs, and the largest color id
+    // Return the filename of the generated node-color pairs, and the largest color id. Sets n_node_color_pairs.
     pair<std::string, int64_t> get_node_color_pairs(const plain_matrix_sbwt_t& index,
                                      sequence_reader_t& reader,
                                      Metadata_Stream* metadata_stream,
@@ -185,9 +221,11 @@ private:
         run_dispatcher(threads, reader, metadata_stream, 1024*1024);
 
         std::vector<std::int64_t> largest_color_ids;
+        n_node_color_pairs = 0;
         for (DispatcherConsumerCallback* t : threads) {
             ColorPairAlignerThread* cpat = static_cast<ColorPairAlignerThread*>(t);
             largest_color_ids.push_back(cpat->get_largest_color_id());
+            n_node_color_pairs += cpat->get_number_of_pairs();
             delete t;
         }
 
@@ -201,8 +239,8 @@ private:
     std::string delete_duplicate_pairs(const std::string& infile) {
         std::string outfile = get_temp_file_manager().create_filename();
 
-        seq_io::Buffered_ifstream<> in(infile, std::ios::binary);
-        seq_io::Buffered_ofstream<> out(outfile, std::ios::binary);
+        external_sort::Record_File_Reader<external_sort::Constant_Size_Records> in(infile, {16});
+        external_sort::Record_File_Writer<external_sort::Constant_Size_Records> out(outfile, {16});
 
         char prev[8+8]; // two long longs
         char cur[8+8]; // two long longs
@@ -218,7 +256,7 @@ private:
             std::memcpy(prev, cur, 8+8);
             ++record_count;
         }
-        out.flush();
+        out.finish();
 
         return outfile;
     }
@@ -226,17 +264,17 @@ private:
     std::string collect_colorsets(const std::string& infile){
         std::string outfile = get_temp_file_manager().create_filename();
 
-        seq_io::Buffered_ifstream<> in(infile, ios::binary);
-        seq_io::Buffered_ofstream<> out(outfile, ios::binary);
+        external_sort::Record_File_Reader<external_sort::Constant_Size_Records> in(infile, {16});
+        external_sort::Record_File_Writer<external_sort::Variable_Size_Records> out(outfile, {});
 
         std::int64_t active_key = -1;
         std::vector<std::int64_t> cur_value_list;
+        std::vector<char> record; // Reusable space
 
         char buffer[8+8];
 
         while (true) {
-            in.read(buffer,8+8);
-            if (in.eof()) break;
+            if (!in.read(buffer,8+8)) break;
 
             std::int64_t key = parse_big_endian_LL(buffer + 0);
             std::int64_t value = parse_big_endian_LL(buffer + 8);
@@ -247,12 +285,14 @@ private:
                 if (active_key != -1) {
                     std::sort(cur_value_list.begin(), cur_value_list.end());
                     std::int64_t record_size = 8 * (1 + 1 + cur_value_list.size());
-                    write_big_endian_LL(out, record_size);
-                    write_big_endian_LL(out, active_key);
+                    record.clear();
+                    append_big_endian_LL(record, record_size);
+                    append_big_endian_LL(record, active_key);
 
                     for (auto x : cur_value_list){
-                        write_big_endian_LL(out, x);
+                        append_big_endian_LL(record, x);
                     }
+                    out.write(record.data(), record.size());
                 }
 
                 active_key = key;
@@ -265,15 +305,17 @@ private:
         if(active_key != -1){
             sort(cur_value_list.begin(), cur_value_list.end());
             std::int64_t record_size = 8 * (1 + 1 + cur_value_list.size());
-            write_big_endian_LL(out, record_size);
-            write_big_endian_LL(out, active_key);
+            record.clear();
+            append_big_endian_LL(record, record_size);
+            append_big_endian_LL(record, active_key);
 
             for (auto x : cur_value_list){
-                write_big_endian_LL(out, x);
+                append_big_endian_LL(record, x);
             }
+            out.write(record.data(), record.size());
         }
 
-        out.flush();
+        out.finish();
 
         return outfile;
     }
@@ -296,26 +338,25 @@ private:
         };
 
         std::string outfile = get_temp_file_manager().create_filename();
-        EM_sort_variable_length_records(infile, outfile, cmp, ram_bytes, n_threads);
+        external_sort::sort_variable_length_records(infile, outfile, cmp, ram_bytes, n_threads);
         return outfile;
     }
 
     std::string collect_nodes_by_colorset(const std::string& infile){
         std::string outfile = get_temp_file_manager().create_filename();
 
-        seq_io::Buffered_ifstream<> in(infile, ios::binary);
-        seq_io::Buffered_ofstream<> out(outfile, ios::binary);
+        external_sort::Record_File_Reader<external_sort::Variable_Size_Records> in(infile, {});
+        external_sort::Record_File_Writer<external_sort::Variable_Size_Records> out(outfile, {});
 
         std::vector<std::int64_t> active_key;
         std::vector<std::int64_t> cur_value_list;
+        std::vector<char> record; // Reusable space
 
         std::vector<char> buffer(8);
         std::vector<std::int64_t> key; // Reusable space
         while (true) {
             key.clear();
-            in.read(buffer.data(),8);
-
-            if (in.eof())
+            if (!in.read(buffer.data(),8))
                 break;
 
             std::int64_t record_len = parse_big_endian_LL(buffer.data());
@@ -341,16 +382,18 @@ private:
                     assert(record_size > 0);
 
                     // record = (record length, number of nodes, node list, color list)
-                    write_big_endian_LL(out, record_size);
-                    write_big_endian_LL(out, cur_value_list.size());
+                    record.clear();
+                    append_big_endian_LL(record, record_size);
+                    append_big_endian_LL(record, cur_value_list.size());
 
                     for (auto x : cur_value_list) {
-                        write_big_endian_LL(out, x);
+                        append_big_endian_LL(record, x);
                     }
 
                     for (auto x : active_key) {
-                        write_big_endian_LL(out, x);
+                        append_big_endian_LL(record, x);
                     }
+                    out.write(record.data(), record.size());
                 }
 
                 active_key = key;
@@ -364,74 +407,97 @@ private:
             std::sort(cur_value_list.begin(), cur_value_list.end());
             std::int64_t record_size = 8 + 8 + 8*cur_value_list.size() + 8*active_key.size();
 
-            write_big_endian_LL(out, record_size);
-            write_big_endian_LL(out, cur_value_list.size());
+            record.clear();
+            append_big_endian_LL(record, record_size);
+            append_big_endian_LL(record, cur_value_list.size());
 
             for (auto x : cur_value_list) {
-                write_big_endian_LL(out, x);
+                append_big_endian_LL(record, x);
             }
 
             for (auto x : active_key) {
-                write_big_endian_LL(out, x);
+                append_big_endian_LL(record, x);
             }
+            out.write(record.data(), record.size());
         }
 
-        out.flush();
+        out.finish();
 
         return outfile;
     }
 
+    // Reads the records of the collected-nodes file into batches of about batch_bytes bytes. The color
+    // sets are encoded and the color set pointers are sampled in parallel over the records of a batch.
+    // Color set ids are assigned in file order, so the result does not depend on the number of threads.
     void build_representation(Coloring<colorset_t>& coloring, const std::string& infile, const sdsl::bit_vector& cores, int64_t colorset_sampling_distance, int64_t ram_bytes, int64_t n_threads) {
 
         SBWT_backward_traversal_support backward_support(coloring.index_ptr);
 
-        seq_io::Buffered_ifstream<> in(infile, ios::binary);
-        vector<char> buffer(16);
-
-        vector<std::int64_t> node_set; // Reusable space
-        vector<std::int64_t> colors_set; // Reusable space
-
-        std::size_t set_id = 0;
+        external_sort::Record_File_Reader<external_sort::Variable_Size_Records> in(infile, {});
         Sparse_Uint_Array_Builder builder(cores.size(), ram_bytes, n_threads);
 
-        auto callback = [&](int64_t node){
-            builder.add(node, set_id);;
-        };
+        const int64_t batch_bytes = 1 << 24;
+        vector<char> batch; // Concatenated records
+        vector<int64_t> record_starts; // Start of each record in batch
+        vector<vector<std::int64_t>> color_sets; // Color sets of the records of the batch
+        vector<vector<pair<int64_t,int64_t>>> thread_updates(n_threads); // Thread-local (node, color set id) updates
+        std::int64_t first_set_id = 0; // Id of the color set of the first record of the batch
 
         while (true) {
-            node_set.clear();
-            colors_set.clear();
-
-            in.read(buffer.data(), 16);
-            if (in.eof())
-                break;
-
-            const auto record_length = parse_big_endian_LL(buffer.data() + 0);
-            const auto number_of_nodes = parse_big_endian_LL(buffer.data() + 8);
-            while (buffer.size() < record_length)
-                buffer.resize(buffer.size() * 2);
-            in.read(buffer.data() + 16, record_length - 16); // Read the rest
-
-            for (std::int64_t i = 0; i < number_of_nodes; i++) {
-                std::int64_t node = parse_big_endian_LL(buffer.data() + 16 + i*8);
-                node_set.push_back(node);
+            // Read a batch of records
+            batch.clear();
+            record_starts.clear();
+            char header[16];
+            while ((int64_t)batch.size() < batch_bytes) {
+                if (!in.read(header, 16))
+                    break;
+
+                const auto record_length = parse_big_endian_LL(header + 0);
+                record_starts.push_back(batch.size());
+                batch.insert(batch.end(), header, header + 16);
+                batch.resize(batch.size() + record_length - 16);
+                in.read(batch.data() + batch.size() - (record_length - 16), record_length - 16); // Read the rest
             }
+            if (record_starts.size() == 0) break;
+
+            int64_t n_records = record_starts.size();
+            color_sets.assign(n_records, {});
+
+            #pragma omp parallel for num_threads(n_threads) schedule(dynamic, 16)
+            for (int64_t r = 0; r < n_records; r++) {
+                const char* record = batch.data() + record_starts[r];
+                const auto record_length = parse_big_endian_LL(record + 0);
+                const auto number_of_nodes = parse_big_endian_LL(record + 8);
+                const std::int64_t set_id = first_set_id + r;
+
+                std::int64_t number_of_colors = (record_length - 16 - number_of_nodes*8) / 8;
+                for (std::int64_t i = 0; i < number_of_colors; i++) {
+                    std::int64_t color = parse_big_endian_LL(record + 16 + number_of_nodes*8 + i*8);
+                    color_sets[r].push_back(color);
+                }
+
+                vector<pair<int64_t,int64_t>>& updates = thread_updates[omp_get_thread_num()];
+                auto callback = [&](int64_t node){
+                    updates.push_back({node, set_id});
+                };
 
-            std::int64_t number_of_colors = (record_length - 16 - number_of_nodes*8) / 8;
-            for (std::int64_t i = 0; i < number_of_colors; i++) {
-                std::int64_t color = parse_big_endian_LL(buffer.data() + 16 + number_of_nodes*8 + i*8);
-                colors_set.push_back(color);
+                for (std::int64_t i = 0; i < number_of_nodes; i++) {
+                    std::int64_t node = parse_big_endian_LL(record + 16 + i*8);
+                    updates.push_back({node, set_id});
+                    iterate_unitig_node_samples(cores, backward_support, node, colorset_sampling_distance, callback);
+                }
             }
 
-            coloring.sets.add_set(colors_set);
-            coloring.total_color_set_length += colors_set.size();
+            coloring.sets.add_sets(color_sets, n_threads);
+            for (const vector<std::int64_t>& colors : color_sets)
+                coloring.total_color_set_length += colors.size();
 
-            for (int64_t node : node_set) {
-                builder.add(node, set_id);
-                iterate_unitig_node_samples(cores, backward_support, node, colorset_sampling_distance, callback);
+            for (vector<pair<int64_t,int64_t>>& updates : thread_updates) {
+                for (auto [node, set_id] : updates) builder.add(node, set_id);
+                updates.clear();
             }
 
-            ++set_id;
+            first_set_id += n_records;
         }
 
         coloring.node_id_to_color_set_id = builder.finish();
@@ -441,6 +507,62 @@ private:
 
     public:
 
+    // Statistics of the last build, for resource planning (see resource_planner.hh)
+    int64_t n_core_kmers = 0;
+    int64_t n_node_color_pairs = 0;
+
+    // Must be set to false if k-mers of the sequences may be missing from the index because they
+    // were filtered out when the index was built
+    bool all_kmers_indexed = true;
+
+    // Marks the nodes whose k-mers occur in sequences of at least min_colors distinct colors. The
+    // colors are counted for the core k-mers only, on the same deduplicated pair stream as in
+    // build_coloring. A non-core node has the color set of the first core node after it in its
+    // unitig, so the mark of a core node is copied backward to the non-core nodes before it.
+    sdsl::bit_vector mark_nodes_with_enough_colors(
+                    const plain_matrix_sbwt_t& index,
+                    sequence_reader_t& sequence_reader,
+                    Metadata_Stream* metadata_stream,
+                    int64_t min_colors,
+                    const std::int64_t ram_bytes,
+                    const std::int64_t n_threads) {
+
+        write_log("Marking core kmers", LogLevel::MAJOR);
+        core_kmer_marker<sequence_reader_t> ckm;
+        ckm.mark_core_kmers(sequence_reader, index, all_kmers_indexed);
+        sequence_reader.rewind_to_start();
+
+        write_log("Counting the colors of the k-mers", LogLevel::MAJOR);
+        const std::string pairs = get_node_color_pairs(index, sequence_reader, metadata_stream, ckm.core_kmer_marks, n_threads).first;
+
+        const std::string sorted_pairs = get_temp_file_manager().create_filename();
+        external_sort::sort_constant_binary(pairs, sorted_pairs, [](const char* A, const char* B){ return node_color_pair_less(A, B); }, ram_bytes, 16, n_threads);
+        get_temp_file_manager().delete_file(pairs);
+        const std::string distinct_pairs = delete_duplicate_pairs(sorted_pairs);
+        get_temp_file_manager().delete_file(sorted_pairs);
+
+        SBWT_backward_traversal_support backward_support(&index);
+        sdsl::bit_vector marks(index.number_of_subsets(), 0);
+        auto mark = [&](int64_t node){ marks[node] = 1; };
+        {
+            external_sort::Record_File_Reader<external_sort::Constant_Size_Records> in(distinct_pairs, {16});
+            char buffer[8+8];
+            std::int64_t active_node = -1;
+            std::int64_t n_colors = 0;
+            while (in.read(buffer, 8+8)) {
+                std::int64_t node = parse_big_endian_LL(buffer);
+                if (node != active_node) n_colors = 0;
+                active_node = node;
+                if (++n_colors == min_colors) {
+                    marks[node] = 1;
+                    iterate_unitig_node_samples(ckm.core_kmer_marks, backward_support, node, 1, mark);
+                }
+            }
+        }
+        get_temp_file_manager().delete_file(distinct_pairs);
+
+        return marks;
+    }
 
     void build_coloring(
                     Coloring<colorset_t>& coloring,
@@ -454,6 +576,8 @@ private:
         build_coloring(coloring, index, sequence_reader, &imcs, ram_bytes, n_threads, colorset_sampling_distance);
     }
 
+    // If a checkpoint is given, the stages are recorded in it, and stages completed in an earlier run
+    // are skipped (see build_checkpoint.hh).
     void build_coloring(
                     Coloring<colorset_t>& coloring,
                     const plain_matrix_sbwt_t& index,
@@ -461,57 +585,85 @@ private:
                     Metadata_Stream* metadata_stream,
                     const std::int64_t ram_bytes,
                     const std::int64_t n_threads,
-                    int64_t colorset_sampling_distance) {
+                    int64_t colorset_sampling_distance,
+                    Build_Checkpoint* checkpoint = nullptr) {
 
         coloring.index_ptr = &index;
 
-        write_log("Marking core kmers", LogLevel::MAJOR);
-        core_kmer_marker<sequence_reader_t> ckm;
-        ckm.mark_core_kmers(sequence_reader, index);
-        sdsl::bit_vector cores = ckm.core_kmer_marks;
-
-        sequence_reader.rewind_to_start(); // Need this reader again for node-colors pairs
+        Build_Checkpoint disabled_checkpoint;
+        Build_Checkpoint& cp = checkpoint != nullptr ? *checkpoint : disabled_checkpoint;
+
+        sdsl::bit_vector cores;
+        if (cp.is_done("core_kmers")) {
+            sdsl::load_from_file(cores, cp.get_file("core_kmers", 0));
+        } else {
+            write_log("Marking core kmers", LogLevel::MAJOR);
+            core_kmer_marker<sequence_reader_t> ckm;
+            ckm.mark_core_kmers(sequence_reader, index, all_kmers_indexed);
+            cores = ckm.core_kmer_marks;
+            sequence_reader.rewind_to_start(); // Need this reader again for node-colors pairs
+
+            if (cp.enabled()) {
+                std::string cores_file = get_temp_file_manager().create_filename("", ".sdsl");
+                sdsl::store_to_file(cores, cores_file);
+                cp.mark_done("core_kmers", {cp.keep("core_kmers", cores_file)});
+            }
+        }
+        n_core_kmers = sdsl::util::cnt_one_bits(cores);
 
-        write_log("Getting node color pairs", LogLevel::MAJOR);
         std::string node_color_pairs; int64_t largest_color_id;
-        std::tie(node_color_pairs, largest_color_id) = get_node_color_pairs(index, sequence_reader, metadata_stream, cores, n_threads);
+        if (cp.is_done("node_color_pairs")) {
+            node_color_pairs = cp.get_file("node_color_pairs", 0);
+            largest_color_id = std::stoll(cp.get_value("node_color_pairs", "largest_color_id"));
+            n_node_color_pairs = std::stoll(cp.get_value("node_color_pairs", "n_node_color_pairs"));
+        } else {
+            write_log("Getting node color pairs", LogLevel::MAJOR);
+            std::tie(node_color_pairs, largest_color_id) = get_node_color_pairs(index, sequence_reader, metadata_stream, cores, n_threads);
+            node_color_pairs = cp.keep("node_color_pairs", node_color_pairs);
+            cp.mark_done("node_color_pairs", {node_color_pairs}, {{"largest_color_id", std::to_string(largest_color_id)}, {"n_node_color_pairs", std::to_string(n_node_color_pairs)}});
+        }
         coloring.largest_color_id = largest_color_id;
 
-        write_log("Sorting node color pairs", LogLevel::MAJOR);
-        const std::string sorted_pairs = get_temp_file_manager().create_filename();
-
-        auto cmp = [&](const char* A, const char* B) -> bool {
-            std::int64_t x_1, y_1, x_2, y_2;
-            x_1 = parse_big_endian_LL(A + 0);
-            y_1 = parse_big_endian_LL(A + 8);
-            x_2 = parse_big_endian_LL(B + 0);
-            y_2 = parse_big_endian_LL(B + 8);
-
-            return std::make_pair(x_1, y_1) < std::make_pair(x_2, y_2);
+        // Runs a stage that turns the output file of the previous stage into a new file, and deletes the input.
+        // Returns the output file. If the stage was done in an earlier run, returns its recorded output.
+        auto file_stage = [&](const std::string& stage, const std::string& input, auto produce) -> std::string {
+            if (cp.is_done(stage)) return cp.get_file(stage, 0);
+            std::string output = cp.keep(stage, produce(input));
+            if (cp.enabled()) cp.mark_done(stage, {output}, {}, {input}); // Releases the input
+            else get_temp_file_manager().delete_file(input);
+            return output;
         };
 
-        EM_sort_constant_binary(node_color_pairs, sorted_pairs, cmp, ram_bytes, 16, n_threads);
-        get_temp_file_manager().delete_file(node_color_pairs);
-
-        write_log("Removing duplicate node color pairs", LogLevel::MAJOR);
-        const std::string filtered_pairs = delete_duplicate_pairs(sorted_pairs);
-        get_temp_file_manager().delete_file(sorted_pairs);
-
-        write_log("Collecting colors", LogLevel::MAJOR);
-        const std::string collected_sets = collect_colorsets(filtered_pairs);
-        get_temp_file_manager().delete_file(filtered_pairs);
-
-        write_log("Sorting color sets", LogLevel::MAJOR);
-        const std::string sorted_sets = sort_by_colorsets(collected_sets, ram_bytes, n_threads);
-        get_temp_file_manager().delete_file(collected_sets);
-
-        write_log("Collecting nodes", LogLevel::MAJOR);
-        string collected_nodes = collect_nodes_by_colorset(sorted_sets);
-        get_temp_file_manager().delete_file(sorted_sets);
+        const std::string sorted_pairs = file_stage("sorted_node_color_pairs", node_color_pairs, [&](const std::string& infile){
+            write_log("Sorting node color pairs", LogLevel::MAJOR);
+            const std::string outfile = get_temp_file_manager().create_filename();
+            external_sort::sort_constant_binary(infile, outfile, [](const char* A, const char* B){ return node_color_pair_less(A, B); }, ram_bytes, 16, n_threads);
+            return outfile;
+        });
+
+        const std::string filtered_pairs = file_stage("deduplicated_node_color_pairs", sorted_pairs, [&](const std::string& infile){
+            write_log("Removing duplicate node color pairs", LogLevel::MAJOR);
+            return delete_duplicate_pairs(infile);
+        });
+
+        const std::string collected_sets = file_stage("collected_color_sets", filtered_pairs, [&](const std::string& infile){
+            write_log("Collecting colors", LogLevel::MAJOR);
+            return collect_colorsets(infile);
+        });
+
+        const std::string sorted_sets = file_stage("sorted_color_sets", collected_sets, [&](const std::string& infile){
+            write_log("Sorting color sets", LogLevel::MAJOR);
+            return sort_by_colorsets(infile, ram_bytes, n_threads);
+        });
+
+        const std::string collected_nodes = file_stage("collected_nodes", sorted_sets, [&](const std::string& infile){
+            write_log("Collecting nodes", LogLevel::MAJOR);
+            return collect_nodes_by_colorset(infile);
+        });
 
         write_log("Building representation", LogLevel::MAJOR);
         build_representation(coloring, collected_nodes, cores, colorset_sampling_distance, ram_bytes, n_threads);
-        get_temp_file_manager().delete_file(collected_nodes);
+        if (!cp.enabled()) get_temp_file_manager().delete_file(collected_nodes); // Otherwise kept until the index is written
 
         write_log("Representation built", LogLevel::MAJOR);
     }
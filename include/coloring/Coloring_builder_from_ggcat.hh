@@ -8,6 +8,8 @@
 #include <cstring>
 #include <variant>
 #include <mutex>
+#include <atomic>
+#include <memory>
 
 #include <sdsl/bit_vectors.hpp>
 
@@ -34,6 +36,28 @@
 
 using namespace ggcat;
 
+// A batch of colored unitigs produced by one GGCAT thread. Unitig i is unitigs[unitig_ends[i-1]..unitig_ends[i])
+// (with unitig_ends[-1] = 0), and the color sets are stored similarly in colors and color_set_ends. Only the
+// color sets that change between consecutive unitigs of the producing thread are stored: color_set_idx[i] is
+// the index of the color set of unitig i in this batch, or -1 if unitig i has the same colors as the last
+// unitig of the previous batch of the same producer.
+struct Colored_Unitig_Batch{
+    int64_t producer_id = 0; // Index of the GGCAT thread that produced the batch
+    string unitigs;
+    vector<int64_t> unitig_ends;
+    vector<int64_t> colors;
+    vector<int64_t> color_set_ends;
+    vector<int64_t> color_set_idx;
+
+    int64_t size_in_bytes() const{
+        return unitigs.size() + sizeof(int64_t) * (unitig_ends.size() + colors.size() + color_set_ends.size() + color_set_idx.size());
+    }
+
+    bool empty() const{
+        return unitig_ends.empty();
+    }
+};
+
 // An iterable GGCAT unitig database.
 class GGCAT_unitig_database{
 
@@ -42,14 +66,23 @@ private:
     GGCAT_unitig_database(GGCAT_unitig_database const& other) = delete;
     GGCAT_unitig_database& operator=(GGCAT_unitig_database const& other) = delete;
 
+    // The batch under construction in one GGCAT thread
+    struct Producer_State{
+        Colored_Unitig_Batch batch;
+    };
+
+    static inline std::atomic<int64_t> iteration_counter = 0; // Distinguishes iterations in the thread-local state
+
 public:
 
     GGCATInstance* instance;
     string graph_file;
     vector<string> color_names;
     int64_t k;
+    int64_t n_threads;
 
-    GGCAT_unitig_database(vector<string>& filenames, int64_t mem_gigas, int64_t k, int64_t n_threads, bool canonical) : k(k) {
+    // K-mers that occur fewer than min_abundance times in the input are left out of the unitigs
+    GGCAT_unitig_database(vector<string>& filenames, int64_t mem_gigas, int64_t k, int64_t n_threads, bool canonical, int64_t min_abundance = 1) : k(k), n_threads(n_threads) {
 
         GGCATConfig config;
 
@@ -81,7 +114,7 @@ public:
             k,
             n_threads,
             !canonical,
-            1,
+            min_abundance,
             ExtraElaborationStep_UnitigLinks,
             true,
             Slice<std::string>(color_names.data(), color_names.size()),
@@ -91,27 +124,46 @@ public:
 
     }
 
-    // The callback takes a unitig, the color set, and the is_same flag
-    void iterate(std::function<void(const std::string&, const vector<int64_t>&, bool)> callback){
+    // Dumps the unitigs with all GGCAT threads. Each thread collects its unitigs into its own batch
+    // without locking, and passes the batch to batch_callback when it reaches batch_bytes. The callback
+    // is called concurrently from different GGCAT threads, but the batches of one producer are passed in
+    // order from one thread at a time. The last batches of the producers are passed from the calling
+    // thread after GGCAT has finished.
+    void iterate_batches(std::function<void(Colored_Unitig_Batch&)> batch_callback, int64_t batch_bytes = 1 << 20){
 
-        vector<int64_t> prev_colors;
-        std::mutex callback_mutex;
+        int64_t iteration = iteration_counter++;
+        vector<unique_ptr<Producer_State>> producers;
+        std::mutex producers_mutex; // Protects the producers vector. Taken once per GGCAT thread.
+
+        thread_local Producer_State* local_state = nullptr;
+        thread_local int64_t local_iteration = -1;
 
         auto outer_callback = [&](Slice<char> read, Slice<uint32_t> colors, bool same_colors){
-            // Calls in callback provided by the caller of iterate.
             // WARNING: this function is called asynchronously from multiple threads, so it must be thread-safe.
             // Also the same_colors boolean is referred to the previous call of this function from the current thread.
-            std::lock_guard<std::mutex> _lock(callback_mutex);
             try{
-                string unitig = string(read.data, read.data + read.size);                
-                if(same_colors){
-                    callback(unitig, prev_colors, true);
-                } else{
-                    prev_colors.clear();
-                    for (size_t i = 0; i < colors.size; i++){
-                        prev_colors.push_back(colors.data[i]);
-                    }
-                    callback(unitig, prev_colors, false);
+                if(local_iteration != iteration){ // First call from this thread
+                    std::lock_guard<std::mutex> lock(producers_mutex);
+                    producers.push_back(make_unique<Producer_State>());
+                    local_state = producers.back().get();
+                    local_state->batch.producer_id = producers.size() - 1;
+                    local_iteration = iteration;
+                }
+                Colored_Unitig_Batch& batch = local_state->batch;
+
+                if(!same_colors){
+                    for(size_t i = 0; i < colors.size; i++) batch.colors.push_back(colors.data[i]);
+                    batch.color_set_ends.push_back(batch.colors.size());
+                }
+                batch.unitigs.append(read.data, read.size);
+                batch.unitig_ends.push_back(batch.unitigs.size());
+                batch.color_set_idx.push_back((int64_t)batch.color_set_ends.size() - 1); // -1 if no sets in this batch yet
+
+                if(batch.size_in_bytes() >= batch_bytes){
+                    batch_callback(batch);
+                    int64_t producer_id = batch.producer_id;
+                    batch = Colored_Unitig_Batch();
+                    batch.producer_id = producer_id;
                 }
             } catch(const std::exception& e){
                 std::cerr << "Caught Error: " << e.what() << '\n';
@@ -119,7 +171,41 @@ public:
             }
         };
 
-        this->instance->dump_unitigs(graph_file,k,1,true,outer_callback,true,-1);
+        // single_thread_output_function = false: GGCAT calls outer_callback from all of its threads
+        // without a lock of its own. The callback only touches the state of the calling thread.
+        this->instance->dump_unitigs(graph_file,k,n_threads,false,outer_callback,true,-1);
+
+        for(unique_ptr<Producer_State>& producer : producers){
+            if(!producer->batch.empty()) batch_callback(producer->batch);
+        }
+    }
+
+    // The callback takes a unitig, the color set, and the is_same flag, which tells whether the color set
+    // is the same as in the previous call. The callback is called from one thread at a time.
+    void iterate(std::function<void(const std::string&, const vector<int64_t>&, bool)> callback){
+
+        std::mutex callback_mutex;
+        vector<vector<int64_t>> last_colors_of_producer; // Color set that continues into the next batch of the producer
+
+        auto process_batch = [&](Colored_Unitig_Batch& batch){
+            std::lock_guard<std::mutex> _lock(callback_mutex);
+            if(last_colors_of_producer.size() <= batch.producer_id) last_colors_of_producer.resize(batch.producer_id + 1);
+            vector<int64_t>& colors = last_colors_of_producer[batch.producer_id];
+            int64_t prev_set_idx = -2; // Forces is_same = false for the first unitig of the batch
+            for(int64_t i = 0; i < (int64_t)batch.unitig_ends.size(); i++){
+                int64_t set_idx = batch.color_set_idx[i];
+                if(set_idx >= 0 && set_idx != prev_set_idx){
+                    int64_t set_start = set_idx == 0 ? 0 : batch.color_set_ends[set_idx-1];
+                    colors.assign(batch.colors.begin() + set_start, batch.colors.begin() + batch.color_set_ends[set_idx]);
+                }
+                int64_t unitig_start = i == 0 ? 0 : batch.unitig_ends[i-1];
+                string unitig = batch.unitigs.substr(unitig_start, batch.unitig_ends[i] - unitig_start);
+                callback(unitig, colors, set_idx == prev_set_idx);
+                prev_set_idx = set_idx;
+            }
+        };
+
+        iterate_batches(process_batch);
     }
 
     string get_unitig_filename(){
@@ -135,7 +221,8 @@ class Coloring_Builder_From_GGCAT{
     private:
 
     struct UnitigWorkBatch{
-        vector<string> unitigs;
+        string unitigs; // Concatenated
+        vector<int64_t> unitig_ends; // Unitig i ends at unitig_ends[i]
         vector<int64_t> color_set_ids;
     };
 
@@ -186,20 +273,22 @@ class Coloring_Builder_From_GGCAT{
         // This function should only modify local variables and the updates buffer in the context
         virtual void process_work_item(UnitigWorkBatch batch){
 
-            for(int64_t unitig_idx = 0; unitig_idx < batch.unitigs.size(); unitig_idx++){
+            for(int64_t unitig_idx = 0; unitig_idx < batch.unitig_ends.size(); unitig_idx++){
 
-                string& unitig = batch.unitigs[unitig_idx];
+                int64_t unitig_start = unitig_idx == 0 ? 0 : batch.unitig_ends[unitig_idx-1];
+                char* unitig = batch.unitigs.data() + unitig_start;
+                int64_t unitig_len = batch.unitig_ends[unitig_idx] - unitig_start;
                 int64_t color_set_id = batch.color_set_ids[unitig_idx];
 
                 // Forward strand
 
-                vector<int64_t> colex_ranks = context.SBWT->streaming_search(unitig);
+                vector<int64_t> colex_ranks = context.SBWT->streaming_search(unitig, unitig_len);
                 queue_updates(colex_ranks, color_set_id);
 
                 // Reverse complement strand
                 
-                reverse_complement_c_string(&(unitig[0]), unitig.size());
-                colex_ranks = context.SBWT->streaming_search(unitig);
+                reverse_complement_c_string(unitig, unitig_len);
+                colex_ranks = context.SBWT->streaming_search(unitig, unitig_len);
                 queue_updates(colex_ranks, color_set_id);
 
             }
@@ -216,56 +305,96 @@ class Coloring_Builder_From_GGCAT{
 
     };
 
-    void iterate_unitigs(GGCAT_unitig_database& unitig_database, Coloring<colorset_t>& coloring, ThreadPool<UnitigWorker, UnitigWorkBatch>& TP){
-        // Create work batches for the workers
-        UnitigWorkBatch work_batch;
-        int64_t work_batch_max_size = 1000;
-        int64_t color_set_id = -1;
+    static constexpr int64_t filtered_set_id = -2; // Color sets with fewer than min_colors colors
+
+    // Assigns global ids to the color sets of the batches from the GGCAT threads and passes the unitigs
+    // to the workers. The GGCAT threads only synchronize to append their new color sets to the coloring,
+    // once per batch. Unitigs with fewer than min_colors colors are dropped, and their color sets are
+    // not stored.
+    //
+    // The color set ids are not deterministic with more than one thread: GGCAT splits the unitigs
+    // between its threads differently on every run, and the ids are assigned in the order in which the
+    // batches arrive. Assigning the ids by producer and batch sequence would not help, because the
+    // producer of a unitig is not deterministic either. The color set of every k-mer is the same on
+    // every run, so query results do not change, but the bytes of the index file can. With one
+    // thread the ids are assigned in the order of the GGCAT output and the index is reproducible.
+    void iterate_unitigs(GGCAT_unitig_database& unitig_database, Coloring<colorset_t>& coloring, ThreadPool<UnitigWorker, UnitigWorkBatch>& TP, int64_t batch_bytes, int64_t min_colors){
+        std::mutex sets_mutex; // Protects the color sets of the coloring and last_set_id_of_producer
+        vector<int64_t> last_set_id_of_producer;
         coloring.largest_color_id = -1;
 
-        // This is the a callback given to the GGCAT unitig iterator.
-        auto process_unitig_and_colors = [&](const string& unitig, const vector<int64_t>& colors, bool same_colors){
-            // same_colors means that the color set of the current unitig is the same as the color set of
-            // the previous.
+        auto process_batch = [&](Colored_Unitig_Batch& batch){
+            vector<int64_t> set_ids(batch.color_set_ends.size()); // Global ids of the color sets of the batch
+            int64_t carried_set_id; // The color set that continues from the previous batch of the producer
+            vector<int64_t> colors; // Reused for every set of the batch
+            {
+                std::lock_guard<std::mutex> lock(sets_mutex);
+                for(int64_t i = 0; i < (int64_t)batch.color_set_ends.size(); i++){
+                    int64_t set_start = i == 0 ? 0 : batch.color_set_ends[i-1];
+                    if(batch.color_set_ends[i] - set_start < min_colors){
+                        set_ids[i] = filtered_set_id;
+                        continue;
+                    }
+                    colors.assign(batch.colors.begin() + set_start, batch.colors.begin() + batch.color_set_ends[i]);
 
-            if(!same_colors){
-                color_set_id++;
-                // Keep track of maximum color
-                for(int64_t x : colors) coloring.largest_color_id = max(x, coloring.largest_color_id);
+                    // Keep track of maximum color
+                    for(int64_t x : colors) coloring.largest_color_id = max(x, coloring.largest_color_id);
 
-                // Store color set
-                coloring.sets.add_set(colors);
-                coloring.total_color_set_length += colors.size();
+                    // Store color set
+                    set_ids[i] = coloring.sets.number_of_sets_stored();
+                    coloring.sets.add_set(colors);
+                    coloring.total_color_set_length += colors.size();
+                }
+                if(last_set_id_of_producer.size() <= batch.producer_id) last_set_id_of_producer.resize(batch.producer_id + 1, -1);
+                carried_set_id = last_set_id_of_producer[batch.producer_id];
+                if(!batch.color_set_ends.empty())
+                    last_set_id_of_producer[batch.producer_id] = set_ids.back();
             }
 
-            work_batch.unitigs.push_back(unitig);
-            work_batch.color_set_ids.push_back(color_set_id);
-
-            if(work_batch.unitigs.size() == work_batch_max_size){
-                TP.add_work(work_batch, 1);
-                work_batch.unitigs.clear();
-                work_batch.color_set_ids.clear();
+            UnitigWorkBatch work_batch;
+            bool any_filtered = false;
+            for(int64_t set_idx : batch.color_set_idx){
+                int64_t color_set_id = set_idx == -1 ? carried_set_id : set_ids[set_idx];
+                if(color_set_id == -1) throw std::runtime_error("BUG: unitig without a color set from GGCAT");
+                work_batch.color_set_ids.push_back(color_set_id);
+                any_filtered |= color_set_id == filtered_set_id;
             }
+            if(!any_filtered){
+                work_batch.unitigs = std::move(batch.unitigs);
+                work_batch.unitig_ends = std::move(batch.unitig_ends);
+            } else{
+                // Copy only the unitigs that have enough colors
+                vector<int64_t> kept_set_ids;
+                for(int64_t i = 0; i < (int64_t)batch.unitig_ends.size(); i++){
+                    if(work_batch.color_set_ids[i] == filtered_set_id) continue;
+                    int64_t unitig_start = i == 0 ? 0 : batch.unitig_ends[i-1];
+                    work_batch.unitigs.append(batch.unitigs, unitig_start, batch.unitig_ends[i] - unitig_start);
+                    work_batch.unitig_ends.push_back(work_batch.unitigs.size());
+                    kept_set_ids.push_back(work_batch.color_set_ids[i]);
+                }
+                work_batch.color_set_ids = std::move(kept_set_ids);
+            }
+            int64_t load = work_batch.unitigs.size() + sizeof(int64_t) * (work_batch.unitig_ends.size() + work_batch.color_set_ids.size());
+            TP.add_work(std::move(work_batch), load);
         };
 
-        unitig_database.iterate(process_unitig_and_colors);
-
-        if(work_batch.unitigs.size() > 0){ // Last batch
-            TP.add_work(work_batch, 1);
-        }
+        unitig_database.iterate_batches(process_batch, batch_bytes);
 
         TP.join_threads();
     }
 
     public:
 
+    int64_t batch_bytes = 1 << 20; // Size of the unitig batches of the GGCAT threads. Small values are for testing.
+
     // Colored unitig stream database produce canonical bidirected unitigs
     void build_from_colored_unitigs(Coloring<colorset_t>& coloring,
                         const plain_matrix_sbwt_t& SBWT,
                         const std::int64_t ram_bytes,
                         const std::int64_t n_threads,
                         int64_t colorset_sampling_distance,
-                        GGCAT_unitig_database& unitig_database){
+                        GGCAT_unitig_database& unitig_database,
+                        int64_t min_colors = 1){
 
         write_log("Building the color mapping", LogLevel::MAJOR);
 
@@ -279,9 +408,10 @@ class Coloring_Builder_From_GGCAT{
             worker_ptrs.push_back(workers.back().get());
         }
 
-        ThreadPool<UnitigWorker,UnitigWorkBatch> TP(worker_ptrs, n_threads * 2); 
+        // The work queue load is measured in bytes
+        ThreadPool<UnitigWorker,UnitigWorkBatch> TP(worker_ptrs, n_threads * 2 * batch_bytes);
 
-        iterate_unitigs(unitig_database, coloring, TP);
+        iterate_unitigs(unitig_database, coloring, TP, batch_bytes, min_colors);
 
         coloring.index_ptr = &SBWT;
         coloring.node_id_to_color_set_id = builder.finish();
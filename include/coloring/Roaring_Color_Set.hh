@@ -1,6 +1,8 @@
 #pragma once
 
 #include <algorithm>
+#include <functional>
+#include <stdexcept>
 #include <string>
 #include <utility>
 #include <vector>
@@ -17,107 +19,280 @@
 
 class Roaring_Color_Set_View;
 
+/*
+
+Frozen Roaring sets (see Color_Set_Storage<Roaring_Color_Set>). A frozen set is a sequence of 64-bit
+words that is read in place, so any number of them can be concatenated into one buffer and loaded
+with a single read. The colors are split into containers by the high bits (color >> 16) like in
+Roaring, and each container is stored in the smallest of the three Roaring container types:
+
+    word 0:               the number of colors
+    word 1:               the number of containers m
+    words 2..2+m-1:       descriptor of each container: (color >> 16) << 18 | type << 16 | (number of colors in the container - 1)
+    words 2+m..2+2m-1:    offset of the data of each container from the start of the set, in words
+    rest:                 the data of the containers:
+                              ARRAY:  the sorted low 16 bits of the colors
+                              BITMAP: 1024 words, where bit i is set if the low 16 bits i are in the set
+                              RUNS:   the number of runs r in one word, then (first, length - 1) of each run
+
+Lists of 16-bit values are packed four per word, starting from the lowest bits.
+
+*/
+struct Frozen_Roaring{
+
+    static constexpr uint64_t ARRAY = 0;
+    static constexpr uint64_t BITMAP = 1;
+    static constexpr uint64_t RUNS = 2;
+
+    // The key of a container has 46 bits in the descriptor, so the colors must be less than 2^62
+    static constexpr int64_t max_color = ((int64_t)1 << 62) - 1;
+
+    static uint64_t get16(const uint64_t* packed, int64_t i){
+        return (packed[i >> 2] >> ((i & 3) * 16)) & 0xFFFF;
+    }
+
+    static int64_t size(const uint64_t* set){
+        return set[0];
+    }
+
+    static int64_t number_of_containers(const uint64_t* set){
+        return set[1];
+    }
+
+    static uint64_t container_key(const uint64_t* set, int64_t j){
+        return set[2 + j] >> 18;
+    }
+
+    // Returns the index of the container with the given key, or -1 if there is none
+    static int64_t find_container(const uint64_t* set, uint64_t key){
+        int64_t m = number_of_containers(set);
+        const uint64_t* descriptors = set + 2;
+        int64_t j = std::lower_bound(descriptors, descriptors + m, key << 18) - descriptors;
+        if(j == m || (descriptors[j] >> 18) != key) return -1;
+        return j;
+    }
+
+    static bool container_contains(const uint64_t* set, int64_t j, uint64_t low){
+        uint64_t descriptor = set[2 + j];
+        int64_t card = (descriptor & 0xFFFF) + 1;
+        const uint64_t* data = set + set[2 + number_of_containers(set) + j];
+
+        uint64_t type = (descriptor >> 16) & 3;
+        if(type == BITMAP) return (data[low >> 6] >> (low & 63)) & 1;
+        if(type == ARRAY){
+            int64_t lo = 0, hi = card; // Binary search
+            while(lo < hi){
+                int64_t mid = (lo + hi) / 2;
+                if(get16(data, mid) < low) lo = mid + 1;
+                else hi = mid;
+            }
+            return lo < card && get16(data, lo) == low;
+        }
+
+        // Runs: find the last run that starts at or before low
+        int64_t r = data[0];
+        int64_t lo = 0, hi = r;
+        while(lo < hi){
+            int64_t mid = (lo + hi) / 2;
+            if(get16(data + 1, 2*mid) <= low) lo = mid + 1;
+            else hi = mid;
+        }
+        if(lo == 0) return false;
+        return low <= get16(data + 1, 2*(lo-1)) + get16(data + 1, 2*(lo-1) + 1);
+    }
+
+    static bool contains(const uint64_t* set, int64_t color){
+        int64_t j = find_container(set, (uint64_t)color >> 16);
+        return j != -1 && container_contains(set, j, color & 0xFFFF);
+    }
+
+    // Number of words of data of container j
+    static int64_t container_words(const uint64_t* set, int64_t j){
+        uint64_t descriptor = set[2 + j];
+        uint64_t type = (descriptor >> 16) & 3;
+        if(type == ARRAY) return ((descriptor & 0xFFFF) + 1 + 3) / 4;
+        if(type == BITMAP) return 1024;
+        const uint64_t* data = set + set[2 + number_of_containers(set) + j];
+        return 1 + (2 * data[0] + 3) / 4;
+    }
+
+    // Temporary space for the set operations below, so that it can be reused from one operation to the next
+    struct Buffers{
+        std::vector<uint16_t> lows;
+        std::vector<uint16_t> runs; // Pairs (first, length - 1)
+        std::vector<uint16_t> other_runs;
+        std::vector<uint64_t> bitmap;
+    };
+
+    // Throws if the sorted colors are not all in [0, max_color]
+    static void check_color_range(const std::vector<int64_t>& colors){
+        if(colors.size() > 0 && (colors[0] < 0 || colors.back() > max_color))
+            throw std::runtime_error("Color " + std::to_string(colors[0] < 0 ? colors[0] : colors.back()) + " is out of range for Roaring color sets");
+    }
+
+    // Appends the frozen encoding of the given sorted colors to out. Throws if a color is out of range.
+    static void freeze(const std::vector<int64_t>& colors, std::vector<uint64_t>& out);
+
+    // Returns true if the n_words words at set are exactly one frozen set with valid descriptors
+    // and offsets, so that reading the set stays within those words. For checking loaded data.
+    static bool is_valid(const uint64_t* set, int64_t n_words);
+
+    // Appends the colors of the frozen set to vec in sorted order
+    static void push_colors_to_vector(const uint64_t* set, std::vector<int64_t>& vec);
+
+    // Replaces the contents of out with the frozen intersection of the frozen sets A and B. The
+    // containers with the same key are intersected one pair at a time without decoding the sets:
+    // arrays are merged or filtered against the other container, bitmaps are combined with AND,
+    // and runs are intersected as intervals. out must not overlap A or B.
+    static void intersect(const uint64_t* A, const uint64_t* B, std::vector<uint64_t>& out, Buffers& buffers);
+
+    // Replaces the contents of out with the frozen union of the frozen sets A and B. Containers whose
+    // key is only in one of the sets are copied as they are. out must not overlap A or B.
+    static void unite(const uint64_t* A, const uint64_t* B, std::vector<uint64_t>& out, Buffers& buffers);
+};
+
+/*
+
+A color set that is stored frozen (see Frozen_Roaring). Making a set from a view copies the words
+of the frozen set, and intersections and unions work container by container into a second buffer
+that is then swapped with the first one. A set that is updated over and over, like the running
+intersection of a query, keeps its buffers, so it does not allocate after the first few updates.
+The serialization format is the one of CRoaring, for indexes of the previous release.
+
+*/
 class Roaring_Color_Set {
-    Roaring64Map roaring;
+    std::vector<uint64_t> words; // The frozen set
+    std::vector<uint64_t> result_words; // Output of the next set operation
+    Frozen_Roaring::Buffers buffers;
+
+    friend class Roaring_Color_Set_View;
+
+    void freeze_unsorted(std::vector<int64_t> colors){
+        std::sort(colors.begin(), colors.end());
+        colors.erase(std::unique(colors.begin(), colors.end()), colors.end());
+        words.clear();
+        Frozen_Roaring::freeze(colors, words);
+    }
+
+    template<typename int_t>
+    void add_colors(const std::size_t n, const int_t* colors){
+        std::vector<int64_t> new_colors(colors, colors + n);
+        Roaring_Color_Set added;
+        added.freeze_unsorted(std::move(new_colors));
+        do_union(added);
+    }
 
 public:
 
     typedef Roaring_Color_Set_View view_t;
 
-    Roaring_Color_Set() {}
+    Roaring_Color_Set() : words{0, 0} {} // No colors and no containers
 
     Roaring_Color_Set(const view_t& view); // This is defined at the .cpp file because the view is not yet defined here
 
-    Roaring_Color_Set(const Roaring_Color_Set& r){
-        *this = r;
+    Roaring_Color_Set(const Roaring_Color_Set& r) : words(r.words) {}
+
+    Roaring_Color_Set(Roaring_Color_Set&& r) : words(std::move(r.words)) {
+        r.words = {0, 0};
     }
 
-    Roaring_Color_Set(Roaring64Map r) : roaring(r) {}
+    Roaring_Color_Set& operator=(const Roaring_Color_Set& r){
+        if(this != &r) words.assign(r.words.begin(), r.words.end()); // Keeps the capacity of words
+        return *this;
+    }
 
-    Roaring_Color_Set(const std::vector<std::int64_t>& colors) {
-        for (const auto x : colors)
-            roaring.add(static_cast<std::uint64_t>(x));
+    Roaring_Color_Set& operator=(Roaring_Color_Set&& r){
+        if(this != &r){
+            words.swap(r.words);
+            r.words = {0, 0};
+        }
+        return *this;
+    }
 
-        roaring.runOptimize();
-        roaring.shrinkToFit();
+    // Copies the words of the frozen set. Defined in the .cpp file because the view is not yet defined here.
+    Roaring_Color_Set& operator=(const view_t& view);
+
+    Roaring_Color_Set(const Roaring64Map& r) {
+        std::vector<int64_t> colors(r.cardinality());
+        r.toUint64Array(reinterpret_cast<std::uint64_t*>(colors.data()));
+        Frozen_Roaring::freeze(colors, words);
     }
 
-    Roaring_Color_Set(const std::size_t n, const std::int32_t* colors) {
-        roaring.addMany(n, reinterpret_cast<const std::uint32_t*>(colors));
+    Roaring_Color_Set(const std::vector<std::int64_t>& colors) {
+        if(std::adjacent_find(colors.begin(), colors.end(), std::greater_equal<int64_t>()) == colors.end())
+            Frozen_Roaring::freeze(colors, words); // Sorted and distinct
+        else freeze_unsorted(colors);
+    }
 
-        roaring.runOptimize();
-        roaring.shrinkToFit();
+    Roaring_Color_Set(const std::size_t n, const std::int32_t* colors) {
+        freeze_unsorted(std::vector<int64_t>(colors, colors + n));
     }
 
     Roaring_Color_Set(const std::size_t n, const std::int64_t* colors) {
-        roaring.addMany(n, reinterpret_cast<const std::uint64_t*>(colors));
-
-        roaring.runOptimize();
-        roaring.shrinkToFit();
+        freeze_unsorted(std::vector<int64_t>(colors, colors + n));
     }
 
     void add(const std::vector<std::int64_t>& colors) {
-        for (const auto x : colors)
-            roaring.add(static_cast<std::uint64_t>(x));
-
-        roaring.runOptimize();
-        roaring.shrinkToFit();
+        add_colors(colors.size(), colors.data());
     }
 
     void add(const std::size_t n, const std::int32_t* colors) {
-        roaring.addMany(n, reinterpret_cast<const std::uint32_t*>(colors));
-
-        roaring.runOptimize();
-        roaring.shrinkToFit();
+        add_colors(n, colors);
     }
 
     void add(const std::size_t n, const std::int64_t* colors) {
-        roaring.addMany(n, reinterpret_cast<const std::uint64_t*>(colors));
-
-        roaring.runOptimize();
-        roaring.shrinkToFit();
+        add_colors(n, colors);
     }
 
     std::vector<std::int64_t> get_colors_as_vector() const {
-        std::vector<std::int64_t> v(roaring.cardinality());
-        roaring.toUint64Array(reinterpret_cast<std::uint64_t*>(v.data()));
-
+        std::vector<std::int64_t> v;
+        v.reserve(size());
+        Frozen_Roaring::push_colors_to_vector(words.data(), v);
         return v;
     }
 
     void push_colors_to_vector(std::vector<int64_t>& vec) const{
-        // Todo: implement without get_colors_as_vector
-        for(int64_t color : get_colors_as_vector())
-            vec.push_back(color);
+        Frozen_Roaring::push_colors_to_vector(words.data(), vec);
     }
 
     int64_t size() const {
-        return roaring.cardinality();
+        return Frozen_Roaring::size(words.data());
     }
 
     bool empty() const{
         return size() == 0;
     }
 
-
     int64_t size_in_bits() const {
-        return roaring.getSizeInBytes(false) * 8;
+        return words.size() * 64;
     }
 
     bool contains(const std::int64_t n) const {
-        return roaring.contains((uint64_t)n);
+        return Frozen_Roaring::contains(words.data(), n);
     }
 
     void intersection(const Roaring_Color_Set& c) {
-        *this = Roaring_Color_Set(roaring & c.roaring);
+        Frozen_Roaring::intersect(words.data(), c.words.data(), result_words, buffers);
+        words.swap(result_words);
     }
 
     // union is a reserved word in C++ so this function is called do_union
     void do_union(const Roaring_Color_Set& c) {
-        *this = Roaring_Color_Set(roaring | c.roaring);
+        Frozen_Roaring::unite(words.data(), c.words.data(), result_words, buffers);
+        words.swap(result_words);
     }
 
+    // Defined in the .cpp file because the view is not yet defined here
+    void intersection(const view_t& v);
+    void do_union(const view_t& v);
+
     int64_t serialize(std::ostream& os) const {
+        std::vector<int64_t> colors = get_colors_as_vector();
+        Roaring64Map roaring;
+        roaring.addMany(colors.size(), reinterpret_cast<const std::uint64_t*>(colors.data()));
+        roaring.runOptimize();
+        roaring.shrinkToFit();
+
         std::size_t expected_size = roaring.getSizeInBytes(false);
         char* serialized_bytes = new char[expected_size];
 
@@ -135,7 +310,7 @@ public:
 
         char* serialized_bytes = new char[n];
         is.read(serialized_bytes, n);
-        roaring = Roaring64Map::read(serialized_bytes, false);
+        *this = Roaring_Color_Set(Roaring64Map::read(serialized_bytes, false));
         delete[] serialized_bytes;
     }
 };
@@ -144,32 +319,38 @@ class Roaring_Color_Set_View {
 
     public:
 
-    const Roaring_Color_Set* ptr; // Non-owning pointer
+    // Points to a frozen set (see Frozen_Roaring) in a storage or in a Roaring_Color_Set
+    const uint64_t* frozen = nullptr; // Non-owning pointer
+    int64_t frozen_words = 0;
+
+    Roaring_Color_Set_View(const Roaring_Color_Set& c) : frozen(c.words.data()), frozen_words(c.words.size()) {}
 
-    Roaring_Color_Set_View(const Roaring_Color_Set& c) : ptr(&c) {}
+    Roaring_Color_Set_View(const uint64_t* frozen, int64_t frozen_words) : frozen(frozen), frozen_words(frozen_words) {}
 
     bool empty() const{
-        return ptr->empty();
+        return size() == 0;
     }
 
     int64_t size() const{
-        return ptr->size();
+        return Frozen_Roaring::size(frozen);
     }
 
     int64_t size_in_bits() const{
-        return ptr->size_in_bits();
+        return frozen_words * 64;
     }
 
     bool contains(int64_t color) const{
-        return ptr->contains(color);
+        return Frozen_Roaring::contains(frozen, color);
     }
 
     std::vector<int64_t> get_colors_as_vector() const{
-        return ptr->get_colors_as_vector();
+        std::vector<int64_t> colors;
+        push_colors_to_vector(colors);
+        return colors;
     }
 
     void push_colors_to_vector(std::vector<int64_t>& vec) const{
-        return ptr->push_colors_to_vector(vec);
+        Frozen_Roaring::push_colors_to_vector(frozen, vec);
     }
 
-};
\ No newline at end of file
+};
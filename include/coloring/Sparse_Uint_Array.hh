@@ -5,57 +5,160 @@
 #include "SeqIO/buffered_streams.hh"
 #include "sbwt/EM_sort/EM_sort.hh"
 #include "sbwt/EM_sort/bit_level_stuff.hh"
+#include "external_sort.hh"
+#include "record_file.hh"
 #include "sdsl/bit_vectors.hpp"
+#include <algorithm>
+#include <bit>
+#include <vector>
 
 
 // Should be constructed with Sparse_Uint_Array_Builder
+//
+// The marks are stored in blocks of one cache line each: 448 mark bits followed by the number of
+// marks before the block. This way has_index touches one cache line and get touches one cache line
+// for the marks and the rank, plus one for the value.
+//
+// The values can optionally be stored in short codes with an escape code for the values that do not
+// fit (see encode_values_with_escapes).
 class Sparse_Uint_Array{
     private:
 
-    sdsl::bit_vector marks; // Marks which cells have a value
-    sdsl::rank_support_v5<> marks_rs; // Rank support for marks
-    sdsl::int_vector<> values; // Values at those cells that are marked
-    uint64_t max_value;
+    static constexpr int64_t MARK_WORDS_PER_BLOCK = 7;
+    static constexpr int64_t BLOCK_SIZE = MARK_WORDS_PER_BLOCK * 64; // Number of cells per block
+
+    struct alignas(64) Block{
+        uint64_t marks[MARK_WORDS_PER_BLOCK]; // Bit i of word j marks cell 64*j + i of the block
+        uint64_t rank; // Number of marked cells before this block
+    };
+    static_assert(sizeof(Block) == 64);
+
+    vector<Block> blocks;
+    uint64_t length = 0; // Number of cells
+    sdsl::int_vector<> values; // Values at those cells that are marked, or their short codes
+    uint64_t max_value = 0;
+
+    // Values whose short code is escape_code are stored in escaped_values, in the order of the
+    // marked cells. escaped marks the escaped values. If there are no short codes, escape_code
+    // is UINT64_MAX and the rest are empty.
+    uint64_t escape_code = UINT64_MAX;
+    sdsl::bit_vector escaped;
+    sdsl::rank_support_v5<> escaped_rs;
+    sdsl::int_vector<> escaped_values;
+
+    uint64_t value_at(uint64_t pos) const{
+        uint64_t value = values[pos];
+        if(value == escape_code) return escaped_values[escaped_rs.rank(pos)];
+        return value;
+    }
 
-    public:
+    int64_t full_width() const{
+        return max((int64_t)std::bit_width(max_value), (int64_t)1);
+    }
 
-    Sparse_Uint_Array(const Sparse_Uint_Array& other){
-        *this = other;
+    // Back to the layout without short codes
+    void decode_values(){
+        if(escape_code == UINT64_MAX) return;
+        sdsl::int_vector<> plain(values.size(), 0, full_width());
+        for(uint64_t i = 0; i < values.size(); i++) plain[i] = value_at(i);
+        values = plain;
+        escape_code = UINT64_MAX;
+        escaped = sdsl::bit_vector();
+        escaped_rs = sdsl::rank_support_v5<>();
+        escaped_values = sdsl::int_vector<>();
     }
 
-    Sparse_Uint_Array& operator=(const Sparse_Uint_Array& other){
-        this->marks = other.marks;
-        this->marks_rs = other.marks_rs;
-        this->marks_rs.set_vector(&this->marks);
-        this->values = other.values;
-        this->max_value = other.max_value;
-        return *this;
+    void build_blocks(const sdsl::bit_vector& marks){
+        length = marks.size();
+        blocks.assign((length + BLOCK_SIZE - 1) / BLOCK_SIZE, Block{});
+        uint64_t rank = 0;
+        for(uint64_t b = 0; b < blocks.size(); b++){
+            blocks[b].rank = rank;
+            for(int64_t j = 0; j < MARK_WORDS_PER_BLOCK; j++){
+                uint64_t start = b * BLOCK_SIZE + j * 64;
+                if(start >= length) break;
+                uint64_t n_bits = min((uint64_t)64, length - start);
+                blocks[b].marks[j] = marks.get_int(start, n_bits);
+                rank += std::popcount(blocks[b].marks[j]);
+            }
+        }
     }
 
+    // Loads the layout of sdsl-hybrid-v4 and roaring-v0: a plain bit vector
+    // with an sdsl rank support, followed by the values
+    void load_bit_vector_layout(istream& is){
+        sdsl::bit_vector marks;
+        sdsl::rank_support_v5<> marks_rs;
+        marks.load(is);
+        marks_rs.load(is, &marks); // Not needed but has to be read past
+        values.load(is);
+        is.read((char*)&max_value, sizeof(max_value));
+        build_blocks(marks);
+    }
+
+    // Copies or moves the members of other to this array, depending on the reference type.
+    // The rank support is pointed to the escape marks of this array.
+    template<typename array_t>
+    void assign_members(array_t&& other){
+        blocks = std::forward<array_t>(other).blocks;
+        length = std::forward<array_t>(other).length;
+        values = std::forward<array_t>(other).values;
+        max_value = std::forward<array_t>(other).max_value;
+        escape_code = std::forward<array_t>(other).escape_code;
+        escaped = std::forward<array_t>(other).escaped;
+        escaped_rs = std::forward<array_t>(other).escaped_rs;
+        escaped_values = std::forward<array_t>(other).escaped_values;
+        escaped_rs.set_vector(&escaped);
+    }
+
+    public:
 
     Sparse_Uint_Array(){}
 
+    Sparse_Uint_Array(const Sparse_Uint_Array& other){
+        assign_members(other);
+    }
 
-    Sparse_Uint_Array(const sdsl::bit_vector& marks, sdsl::int_vector<>& values, uint64_t max_value) : marks(marks), values(values), max_value(max_value){
-        sdsl::util::init_support(marks_rs, &marks);
+    Sparse_Uint_Array(Sparse_Uint_Array&& other){
+        assign_members(std::move(other));
     }
 
+    Sparse_Uint_Array& operator=(const Sparse_Uint_Array& other){
+        if(this != &other) assign_members(other);
+        return *this;
+    }
+
+    Sparse_Uint_Array& operator=(Sparse_Uint_Array&& other){
+        if(this != &other) assign_members(std::move(other));
+        return *this;
+    }
+
+    Sparse_Uint_Array(const sdsl::bit_vector& marks, sdsl::int_vector<>& values, uint64_t max_value) : values(values), max_value(max_value){
+        build_blocks(marks);
+    }
 
     // Return -1 if not in the array
     int64_t get(uint64_t idx) const{
-        if(idx >= marks.size()) throw std::runtime_error("Access out of bounds at Sparse_Uint_Array");
-        if(marks[idx] == 0) return -1; // Not in array
-        int64_t pos = marks_rs.rank(idx);
-        return values[pos];
+        if(idx >= length) throw std::runtime_error("Access out of bounds at Sparse_Uint_Array");
+        const Block& block = blocks[idx / BLOCK_SIZE];
+        uint64_t offset = idx % BLOCK_SIZE;
+        uint64_t word = block.marks[offset / 64];
+        if(((word >> (offset % 64)) & 1) == 0) return -1; // Not in array
+
+        uint64_t pos = block.rank;
+        for(uint64_t j = 0; j < offset / 64; j++) pos += std::popcount(block.marks[j]);
+        pos += std::popcount(word & ((uint64_t(1) << (offset % 64)) - 1)); // Marks before idx in this word
+        return value_at(pos);
     }
 
     bool has_index(uint64_t idx) const{
-        return marks[idx];
+        uint64_t offset = idx % BLOCK_SIZE;
+        return (blocks[idx / BLOCK_SIZE].marks[offset / 64] >> (offset % 64)) & 1;
     }
 
     // Length of the array, including non-existent entries
     int64_t size() const{
-        return marks.size();
+        return length;
     }
 
     // Number of values stored in this array
@@ -67,43 +170,139 @@ class Sparse_Uint_Array{
         return max_value;
     }
 
+    // Returns the number of cells that have each value 0..max_value
+    vector<int64_t> value_counts() const{
+        vector<int64_t> counts(max_value + 1, 0);
+        for(uint64_t i = 0; i < values.size(); i++) counts[value_at(i)]++;
+        return counts;
+    }
+
+    // Replaces every value x with new_value[x]. Drops the short codes.
+    void renumber_values(const vector<int64_t>& new_value){
+        decode_values();
+        max_value = 0;
+        for(uint64_t i = 0; i < values.size(); i++) max_value = max(max_value, (uint64_t)new_value[values[i]]);
+        sdsl::int_vector<> renumbered(values.size(), 0, full_width());
+        for(uint64_t i = 0; i < values.size(); i++) renumbered[i] = new_value[values[i]];
+        values = std::move(renumbered);
+    }
+
+    // Stores the values in short codes of the width that minimizes the total size. The largest
+    // short code is an escape code for the values that do not fit, which are stored separately in
+    // full width. This makes the array much smaller when most cells have small values, and a
+    // lookup of a small value reads no more memory than before. Keeps the plain layout if that is
+    // the smallest.
+    void encode_values_with_escapes(){
+        decode_values();
+        int64_t n = values.size();
+        int64_t W = full_width();
+
+        // With short width w, value x is escaped iff x >= 2^w - 1, that is, iff w < bit_width(x+1)
+        vector<int64_t> n_escaped(66, 0); // n_escaped[w] = number of values escaped with short width w
+        for(int64_t i = 0; i < n; i++) n_escaped[std::bit_width((uint64_t)values[i] + 1) - 1]++;
+        for(int64_t w = 63; w >= 0; w--) n_escaped[w] += n_escaped[w+1];
+
+        // The escape marks take one bit per value, plus 1/16 for the rank support
+        double best_bits = (double)n * W;
+        int64_t best_width = W;
+        for(int64_t w = 1; w < W; w++){
+            double bits = (double)n * w + n * 1.0625 + (double)n_escaped[w] * W;
+            if(bits < best_bits){
+                best_bits = bits;
+                best_width = w;
+            }
+        }
+        if(best_width == W) return; // Plain is the smallest
+
+        escape_code = (uint64_t(1) << best_width) - 1;
+        sdsl::int_vector<> short_values(n, 0, best_width);
+        escaped = sdsl::bit_vector(n, 0);
+        escaped_values = sdsl::int_vector<>(n_escaped[best_width], 0, W);
+        int64_t n_escaped_so_far = 0;
+        for(int64_t i = 0; i < n; i++){
+            uint64_t x = values[i];
+            if(x >= escape_code){
+                short_values[i] = escape_code;
+                escaped[i] = 1;
+                escaped_values[n_escaped_so_far++] = x;
+            } else short_values[i] = x;
+        }
+        values = std::move(short_values);
+        sdsl::util::init_support(escaped_rs, &escaped);
+    }
+
     int64_t serialize(ostream& os) const{
         int64_t n_bytes_written = 0;
-        n_bytes_written += marks.serialize(os);
-        n_bytes_written += marks_rs.serialize(os);
+
+        os.write((char*)&length, sizeof(length));
+        n_bytes_written += sizeof(length);
+
+        // The number of blocks is determined by the length
+        os.write((char*)blocks.data(), blocks.size() * sizeof(Block));
+        n_bytes_written += blocks.size() * sizeof(Block);
+
         n_bytes_written += values.serialize(os);
 
         os.write((char*)&max_value, sizeof(max_value));
         n_bytes_written += sizeof(max_value);
 
+        os.write((char*)&escape_code, sizeof(escape_code));
+        n_bytes_written += sizeof(escape_code);
+        n_bytes_written += escaped.serialize(os);
+        n_bytes_written += escaped_rs.serialize(os);
+        n_bytes_written += escaped_values.serialize(os);
+
         return n_bytes_written;
     }
 
-    void load(istream& is){
-        marks.load(is);
-        marks_rs.load(is, &marks);
+    // The layout version is 0 for sdsl-hybrid-v4 and roaring-v0, from the previous release, and 1
+    // for the current layout.
+    void load(istream& is, int64_t layout_version = 1){
+        escape_code = UINT64_MAX;
+        escaped = sdsl::bit_vector();
+        escaped_rs = sdsl::rank_support_v5<>();
+        escaped_values = sdsl::int_vector<>();
+
+        if(layout_version == 0){
+            load_bit_vector_layout(is);
+            return;
+        }
+
+        is.read((char*)&length, sizeof(length));
+        blocks.resize((length + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        is.read((char*)blocks.data(), blocks.size() * sizeof(Block));
         values.load(is);
         is.read((char*)&max_value, sizeof(max_value));
-        
+        is.read((char*)&escape_code, sizeof(escape_code));
+        escaped.load(is);
+        escaped_rs.load(is, &escaped);
+        escaped_values.load(is);
     }
 
     // Returns map: component -> number of bytes
     map<string, int64_t> space_breakdown() const{
         map<string, int64_t> breakdown;
-        breakdown["marks"] = sdsl::size_in_bytes(marks);
-        breakdown["marks-rank-support"] = sdsl::size_in_bytes(marks_rs);
+        breakdown["marks-and-ranks"] = sizeof(length) + blocks.size() * sizeof(Block);
         breakdown["values"] = sdsl::size_in_bytes(values);
         breakdown["max-value"] = sizeof(max_value);
+        breakdown["escaped-values"] = sizeof(escape_code) + sdsl::size_in_bytes(escaped) + sdsl::size_in_bytes(escaped_rs) + sdsl::size_in_bytes(escaped_values);
         return breakdown;
     }
 };
 
+// Collects (index, value) updates. The updates are kept in memory as long as they fit in ram_bytes, and
+// are then sorted in parallel in finish(). If the updates do not fit, they are spilled to disk and sorted
+// in external memory.
 class Sparse_Uint_Array_Builder{
 
     private:
 
+    typedef pair<uint64_t, uint64_t> update_t; // (index, value)
+
     string temp_filename;
-    seq_io::Buffered_ofstream<> out_stream;
+    unique_ptr<external_sort::Record_File_Writer<external_sort::Constant_Size_Records>> out_stream;
+    vector<update_t> in_memory_updates;
+    bool spilled = false; // True if the updates are written to disk instead of in_memory_updates
     sdsl::bit_vector marks; // Marks which indices have been set
     uint64_t array_length;
     uint64_t max_value;
@@ -128,16 +327,81 @@ class Sparse_Uint_Array_Builder{
         };
 
         string outfile = sbwt::get_temp_file_manager().create_filename();
-        sbwt::EM_sort_constant_binary(infile, outfile, cmp, ram_bytes, 8+8, n_threads);
+        external_sort::sort_constant_binary(infile, outfile, cmp, ram_bytes, 8+8, n_threads);
         return outfile;
     }
 
+    void write_update(uint64_t index, uint64_t value){
+        char buffer[8+8];
+        write_big_endian_LL(buffer, index);
+        write_big_endian_LL(buffer + 8, value);
+        out_stream->write(buffer, 8+8);
+    }
+
+    // Moves the in-memory updates to disk. All later updates go to disk too.
+    void spill_to_disk(){
+        temp_filename = sbwt::get_temp_file_manager().create_filename("");
+        out_stream = make_unique<external_sort::Record_File_Writer<external_sort::Constant_Size_Records>>(temp_filename, external_sort::Constant_Size_Records{16});
+        for(auto [index, value] : in_memory_updates) write_update(index, value);
+        vector<update_t>().swap(in_memory_updates); // Free the memory
+        spilled = true;
+    }
+
+    // Sorts the in-memory updates by (index, value). The indices are distributed into buckets of
+    // consecutive index ranges, and the buckets are sorted in parallel.
+    void sort_in_memory_updates(){
+        int64_t n_buckets = n_threads * 4;
+        auto bucket_of = [&](uint64_t index){
+            return (int64_t)((__uint128_t)index * n_buckets / array_length);
+        };
+
+        vector<int64_t> bucket_starts(n_buckets + 1, 0);
+        for(auto [index, value] : in_memory_updates) bucket_starts[bucket_of(index) + 1]++;
+        for(int64_t b = 0; b < n_buckets; b++) bucket_starts[b+1] += bucket_starts[b];
+
+        vector<update_t> bucketed(in_memory_updates.size());
+        vector<int64_t> next_pos(bucket_starts.begin(), bucket_starts.end() - 1);
+        for(const update_t& update : in_memory_updates) bucketed[next_pos[bucket_of(update.first)]++] = update;
+        in_memory_updates.swap(bucketed);
+        vector<update_t>().swap(bucketed); // Free the memory
+
+        #pragma omp parallel for num_threads(n_threads) schedule(dynamic, 1)
+        for(int64_t b = 0; b < n_buckets; b++){
+            std::sort(in_memory_updates.begin() + bucket_starts[b], in_memory_updates.begin() + bucket_starts[b+1]);
+        }
+    }
+
+    // Calls f(index, value) for all updates in sorted order
+    template<typename callback_t>
+    void for_each_sorted_update(callback_t f){
+        if(!spilled){
+            sort_in_memory_updates();
+            for(auto [index, value] : in_memory_updates) f(index, value);
+            vector<update_t>().swap(in_memory_updates); // Free the memory
+            return;
+        }
+
+        out_stream->finish();
+        out_stream.reset();
+
+        string sorted_out = EM_sort_big_endian_LL_pairs(temp_filename, ram_bytes, 0, n_threads);
+        sbwt::get_temp_file_manager().delete_file(temp_filename);
+        {
+            external_sort::Record_File_Reader<external_sort::Constant_Size_Records> sorted_in(sorted_out, {16});
+            vector<char> buffer(8+8);
+            while(sorted_in.read(buffer.data(), 8+8)){
+                uint64_t index = sbwt::parse_big_endian_LL(buffer.data());
+                uint64_t value = sbwt::parse_big_endian_LL(buffer.data() + 8);
+                f(index, value);
+            }
+        }
+        sbwt::get_temp_file_manager().delete_file(sorted_out);
+    }
+
 
     public:
 
     Sparse_Uint_Array_Builder(uint64_t array_length, uint64_t ram_bytes, uint64_t n_threads) : array_length(array_length), max_value(0), n_values(0), ram_bytes(ram_bytes), n_threads(n_threads) {
-        temp_filename = sbwt::get_temp_file_manager().create_filename("");
-        out_stream.open(temp_filename, ios::binary);
         marks = sdsl::bit_vector(array_length, 0);
     }
 
@@ -145,19 +409,21 @@ class Sparse_Uint_Array_Builder{
     void add(uint64_t index, uint64_t value){
         if(marks[index] == 0) n_values++;
         marks[index] = 1;
-        write_big_endian_LL(out_stream, index);
-        write_big_endian_LL(out_stream, value);
         max_value = max(max_value, value);
+
+        if(!spilled){
+            // The vector can have up to twice the capacity of its size, and sorting needs one more copy
+            if((in_memory_updates.size() + 1) * sizeof(update_t) * 3 > ram_bytes) spill_to_disk();
+            else{
+                in_memory_updates.push_back({index, value});
+                return;
+            }
+        }
+        write_update(index, value);
     }    
 
     Sparse_Uint_Array finish(){
 
-        out_stream.close();
-
-        string sorted_out = EM_sort_big_endian_LL_pairs(temp_filename, ram_bytes, 0, n_threads);
-        sbwt::get_temp_file_manager().delete_file(temp_filename);
-        seq_io::Buffered_ifstream<> sorted_in(sorted_out);
-        vector<char> buffer(8+8);
         uint64_t rank = 0;
         int64_t prev_index = -1;
 
@@ -165,20 +431,14 @@ class Sparse_Uint_Array_Builder{
         if(bit_width == 0) bit_width = 1; // Need at least one bit to represent one value
 
         sdsl::int_vector<> values(n_values, 0, bit_width);
-        while(true){
-            sorted_in.read(buffer.data(), 8+8);
-            if(sorted_in.eof()) break;
-            uint64_t index = sbwt::parse_big_endian_LL(buffer.data());
-            uint64_t value = sbwt::parse_big_endian_LL(buffer.data() + 8);
-
+        for_each_sorted_update([&](uint64_t index, uint64_t value){
             if(index != prev_index) values[rank++] = value;
 
             // If there are multiple values with the same index, we ignore all but the first one
             // This is why the comment on add(...) says that the smallest value is kept
 
             prev_index = index;
-        }
-        sbwt::get_temp_file_manager().delete_file(sorted_out);
+        });
 
         return Sparse_Uint_Array(marks, values, max_value);
     }
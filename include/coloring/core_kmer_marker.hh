@@ -24,6 +24,9 @@ using namespace sbwt;
     marked node v that can be reached by walking forward from u in the de Bruijn graph.
     In other words, the color set of a non-marked node u is the same as the color set of
     its successor in the graph (the successor exists due to case 2 and is unique due to case 4).
+
+    If k-mers of the sequences were filtered out of the graph (by abundance or by the number
+    of colors), the sequences are split at the missing k-mers for cases (1) and (2).
 */
 
 template<typename sequence_reader_t = seq_io::Reader<>>
@@ -36,12 +39,13 @@ public:
 
     core_kmer_marker(const std::size_t sz) : core_kmer_marks(sz, 0) {}
 
-    std::size_t mark_core_kmers(sequence_reader_t& reader, const plain_matrix_sbwt_t& index) {
+    // all_kmers_indexed tells whether every k-mer of the sequences is in the index
+    std::size_t mark_core_kmers(sequence_reader_t& reader, const plain_matrix_sbwt_t& index, bool all_kmers_indexed = true) {
         std::size_t total_core_count = 0;
         sdsl::util::assign(core_kmer_marks, sdsl::bit_vector(index.number_of_subsets(), 0));
 
         write_log("Handling cases one and two", LogLevel::MAJOR);
-        total_core_count += handle_case_one_and_two(reader, index);
+        total_core_count += handle_case_one_and_two(reader, index, all_kmers_indexed);
         write_log("Handling case three", LogLevel::MAJOR);
         total_core_count += handle_case_three(index);
         write_log("Handling case four", LogLevel::MAJOR);
@@ -50,7 +54,7 @@ public:
         return total_core_count;
     }
 
-    inline std::size_t handle_case_one_and_two(sequence_reader_t& reader, const plain_matrix_sbwt_t& index) {
+    inline std::size_t handle_case_one_and_two(sequence_reader_t& reader, const plain_matrix_sbwt_t& index, bool all_kmers_indexed) {
         const std::size_t n = index.number_of_subsets();
         const auto k = index.get_k();
         const auto& rank_structure = index.get_subset_rank_structure();
@@ -62,7 +66,18 @@ public:
         std::size_t read_len = 0;
         while ((read_len = reader.get_next_read_to_buffer()) > 0) {
             for(const string& part : split_at_non_ACGT(reader.read_buf, read_len)){
-                if (part.size() >= k) {
+                if (part.size() >= k && !all_kmers_indexed) {
+                    // Every maximal run of indexed k-mers is a sequence of its own
+                    const vector<int64_t> nodes = index.streaming_search(part.c_str(), part.size());
+                    for (std::size_t i = 0; i < nodes.size(); ++i) {
+                        if (nodes[i] < 0) continue;
+                        if (i + 1 == nodes.size() || nodes[i+1] < 0) {
+                            cores += core_kmer_marks[nodes[i]] == 1 ? 0 : 1;
+                            core_kmer_marks[nodes[i]] = 1;
+                        }
+                        if (i == 0 || nodes[i-1] < 0) first_kmer_marks[nodes[i]] = 1;
+                    }
+                } else if (part.size() >= k) {
                     // End of a sequence
                     int64_t last_kmer_idx = index.search(part.substr(part.size() - k));
                     core_kmer_marks[last_kmer_idx] = 1;
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+
+/*
+
+Parent selection for delta encoded color sets (see Color_Set_Storage::choose_delta_parents).
+
+A set that has a parent is stored as the symmetric difference with its parent, so that it can be
+decoded by starting from a set that is stored in full and applying the differences on the path
+down to the set. The parents are chosen like in Mantis: the sets are the nodes of a graph that has
+an edge between two sets that are likely to be similar, weighted by the size of their symmetric
+difference, and an edge from every set to a virtual root node, weighted by the cost of storing the
+set in full. The parents are given by the minimum spanning tree of this graph, rooted at the
+virtual root. Children of the virtual root are stored in full.
+
+Comparing all pairs of sets is too slow, so the candidate edges come from MinHash: the sets are
+sorted by the minimum of a hash function over their colors, which puts sets with a large Jaccard
+similarity next to each other, and each set is compared to its next few sets in the order.
+
+*/
+
+// get_set(id, out) replaces the contents of out with the sorted colors of the set with the given id.
+// full_cost[id] is the cost of storing set id in full, in the same unit as the size of a symmetric
+// difference: number of colors. Returns the parent of each set, or -1 if the set is stored in full.
+// Decoding a set applies at most max_depth differences. Thread-safe get_set is required.
+vector<int64_t> choose_delta_parents(int64_t n_sets, const std::function<void(int64_t, vector<int64_t>&)>& get_set, const vector<int64_t>& full_cost, int64_t max_depth, int64_t n_threads);
+
+// Minimum spanning forest of the sets and the virtual root (see above) with the given candidate
+// edges (a, b, weight) with the depths of the trees cut to max_depth. Sets that would be deeper
+// are stored in full. Returns the parent of each set, or -1 if the set is stored in full.
+vector<int64_t> delta_parents_from_candidates(vector<std::tuple<int64_t, int64_t, int64_t>>& candidates, const vector<int64_t>& full_cost, int64_t max_depth);
+
+// Size of the symmetric difference of two sorted sets
+int64_t symmetric_difference_size(const vector<int64_t>& A, const vector<int64_t>& B);
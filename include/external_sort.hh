@@ -0,0 +1,619 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <future>
+#include <algorithm>
+#include <filesystem>
+#include <cstring>
+#include <omp.h>
+
+#include "sbwt/globals.hh"
+#include "sbwt/EM_sort/bit_level_stuff.hh"
+#include "record_file.hh"
+
+using namespace std;
+
+// External memory sorting of files of binary records.
+//
+// The input is read in chunks that fit in memory. Each chunk is sorted in parallel and written to
+// disk as a sorted run. If the whole input fits in one chunk, the sorted chunk is written directly to
+// the output in parallel parts, without runs. A run is a sequence of blocks of whole records, and the first record of every
+// block is kept in memory. If there are too many runs to merge at once, groups of runs are merged in
+// parallel into longer runs. The final merge is split into one part per thread by splitter records
+// chosen from the first records of the blocks, and each thread writes its part directly to its
+// position in the output file.
+//
+// Merging is done with a loser tree, and the comparator is a template parameter so that it can be
+// inlined. Blocks are read and written in background threads, so that disk I/O overlaps the merging.
+//
+// The input and output files and the runs are compressed as set with set_temp_compression (see
+// record_file.hh). Run blocks and the output are coded in the background threads.
+namespace external_sort{
+
+// Records of a fixed number of bytes
+struct Constant_Size_Records{
+    int64_t record_size;
+    int64_t size_of(const char* record) const{ (void)record; return record_size; }
+    int64_t min_record_size() const{ return record_size; }
+};
+
+// Records that start with their total length in bytes, including the length itself, as a big-endian 64-bit integer
+struct Variable_Size_Records{
+    int64_t size_of(const char* record) const{ return sbwt::parse_big_endian_LL(record); }
+    int64_t min_record_size() const{ return 8; }
+};
+
+// Tournament tree over k sources that stores the loser of the match at each internal node. The winner
+// is kept separately. Replacing the winner with the next record of its source takes log2(k) comparisons
+// against the losers on the path from the leaf to the root. Exhausted sources are represented with nullptr.
+// Ties are broken by the source index.
+template<typename cmp_t>
+class Loser_Tree{
+
+    int64_t k; // Number of leaves, rounded up to a power of two
+    vector<int64_t> losers; // Internal nodes 1..k-1 in heap order
+    vector<const char*> keys; // Current record of each source
+    int64_t winner;
+    cmp_t& cmp;
+
+    bool beats(int64_t a, int64_t b) const{
+        if(keys[a] == nullptr) return false;
+        if(keys[b] == nullptr) return true;
+        if(cmp(keys[a], keys[b])) return true;
+        if(cmp(keys[b], keys[a])) return false;
+        return a < b;
+    }
+
+    // Returns the winner of the subtree and stores the losers
+    int64_t build(int64_t node){
+        if(node >= k) return node - k;
+        int64_t a = build(2*node);
+        int64_t b = build(2*node+1);
+        if(beats(a,b)){
+            losers[node] = b;
+            return a;
+        } else{
+            losers[node] = a;
+            return b;
+        }
+    }
+
+public:
+
+    Loser_Tree(const vector<const char*>& first_records, cmp_t& cmp) : cmp(cmp){
+        k = 1;
+        while(k < (int64_t)first_records.size()) k *= 2;
+        keys = first_records;
+        keys.resize(k, nullptr);
+        losers.resize(k, -1);
+        winner = build(1);
+    }
+
+    bool empty() const{ return keys[winner] == nullptr; }
+    int64_t top_source() const{ return winner; }
+    const char* top() const{ return keys[winner]; }
+
+    // Sets the current record of the source of the top record. nullptr if the source is exhausted.
+    void replace_top(const char* next){
+        keys[winner] = next;
+        int64_t w = winner;
+        for(int64_t node = (winner + k) / 2; node >= 1; node /= 2){
+            if(beats(losers[node], w)) std::swap(losers[node], w);
+        }
+        winner = w;
+    }
+};
+
+// Merges the sources into the writer. A source has the methods current(), which returns the current
+// record or nullptr if the source is exhausted, and advance().
+template<typename source_t, typename cmp_t, typename writer_t>
+void merge(vector<source_t*>& sources, cmp_t& cmp, writer_t& writer){
+    vector<const char*> first_records;
+    for(source_t* S : sources) first_records.push_back(S->current());
+    Loser_Tree<cmp_t> tree(first_records, cmp);
+    while(!tree.empty()){
+        int64_t source = tree.top_source();
+        writer.write(tree.top());
+        sources[source]->advance();
+        tree.replace_top(sources[source]->current());
+    }
+}
+
+struct Run_Block{
+    int64_t file_offset; // Start of the block in the run file
+    int64_t raw_start; // Number of record bytes in the run before this block
+    int64_t raw_size; // Number of record bytes in this block
+    string first_record; // Copy of the first record of the block, for choosing splitters
+};
+
+// On disk, each block is coded like a block of a compressed record file (see record_file.hh)
+struct Run{
+    string filename;
+    vector<Run_Block> blocks;
+
+    int64_t raw_size() const{
+        return blocks.empty() ? 0 : blocks.back().raw_start + blocks.back().raw_size;
+    }
+};
+
+// A position between records in a run. The offset is in bytes within the records of the block,
+// and is always smaller than the size of the block. The end of the run is (number of blocks, 0).
+struct Run_Position{
+    int64_t block;
+    int64_t offset;
+
+    bool operator==(const Run_Position& other) const{
+        return block == other.block && offset == other.offset;
+    }
+};
+
+// Number of record bytes in the run before the position
+static inline int64_t raw_offset(const Run& run, Run_Position pos){
+    if(pos.block == (int64_t)run.blocks.size()) return run.raw_size();
+    return run.blocks[pos.block].raw_start + pos.offset;
+}
+
+template<typename format_t>
+void read_run_block(std::ifstream& in, const Run& run, format_t format, int64_t block_idx, vector<char>& dest){
+    const Run_Block& info = run.blocks[block_idx];
+    in.seekg(info.file_offset);
+    int64_t sizes[2]; // Stored size, raw size
+    in.read((char*)sizes, 16);
+    vector<char> stored(sizes[0]);
+    in.read(stored.data(), sizes[0]);
+    if(!in.good()) throw std::runtime_error("Error reading " + run.filename);
+    decode_block(format, stored.data(), sizes[0], sizes[1], dest);
+}
+
+// Writes records into a new run. The previous block is coded and written in a background thread
+// while the next block is filled.
+template<typename format_t>
+class Run_Writer{
+
+    Run run;
+    std::ofstream out;
+    format_t format;
+    Temp_Compression compression;
+    int64_t block_bytes;
+    vector<char> block; // Block being filled
+    vector<char> in_flight; // Block being written
+    std::future<int64_t> pending_write; // Returns the number of bytes written
+    int64_t file_size = 0;
+    int64_t raw_size = 0;
+
+    void wait_for_write(){
+        if(pending_write.valid()) file_size += pending_write.get(); // Rethrows errors
+    }
+
+    void flush_block(){
+        if(block.empty()) return;
+        wait_for_write();
+
+        Run_Block info;
+        info.file_offset = file_size;
+        info.raw_start = raw_size;
+        info.raw_size = block.size();
+        info.first_record.assign(block.data(), format.size_of(block.data()));
+        run.blocks.push_back(std::move(info));
+        raw_size += block.size();
+
+        std::swap(block, in_flight);
+        block.clear();
+        pending_write = std::async(std::launch::async, [this]() -> int64_t{
+            string coded;
+            encode_block(format, in_flight.data(), in_flight.size(), compression, coded);
+            out.write(coded.data(), coded.size());
+            if(!out.good()) throw std::runtime_error("Error writing to " + run.filename);
+            return coded.size();
+        });
+    }
+
+public:
+
+    Run_Writer(const string& filename, format_t format, int64_t block_bytes) : format(format), compression(get_temp_compression()), block_bytes(block_bytes){
+        run.filename = filename;
+        out.open(filename, ios::binary);
+        if(!out.good()) throw std::runtime_error("Could not open " + filename);
+        block.reserve(block_bytes);
+    }
+
+    void write(const char* record){
+        int64_t size = format.size_of(record);
+        if(!block.empty() && (int64_t)block.size() + size > block_bytes) flush_block();
+        block.insert(block.end(), record, record + size);
+    }
+
+    Run finish(){
+        flush_block();
+        wait_for_write();
+        out.close();
+        return std::move(run);
+    }
+};
+
+// Reads the records of a run between two positions. The next block is read in a background thread
+// while the current block is merged.
+template<typename format_t>
+class Run_Reader{
+
+    const Run& run;
+    format_t format;
+    std::ifstream in;
+    Run_Position end;
+    int64_t last_block; // Last block with records in the range
+    int64_t current_block;
+    vector<char> block;
+    vector<char> prefetched;
+    std::future<void> pending_read;
+    int64_t pos = 0; // Current record in block
+    int64_t limit = 0; // End of the records of the range in block
+
+    void start_prefetch(int64_t block_idx){
+        if(block_idx > last_block) return;
+        pending_read = std::async(std::launch::async, [this, block_idx](){
+            read_run_block(in, run, format, block_idx, prefetched);
+        });
+    }
+
+    void set_limit(){
+        limit = current_block == end.block ? end.offset : (int64_t)block.size();
+    }
+
+public:
+
+    Run_Reader(const Run& run, format_t format, Run_Position begin, Run_Position end) : run(run), format(format), end(end){
+        last_block = end.offset > 0 ? end.block : end.block - 1;
+        if(begin == end) return; // Empty range
+        in.open(run.filename, ios::binary);
+        if(!in.good()) throw std::runtime_error("Could not open " + run.filename);
+        current_block = begin.block;
+        read_run_block(in, run, format, current_block, block);
+        pos = begin.offset;
+        set_limit();
+        start_prefetch(current_block + 1);
+    }
+
+    // No copying or moving because the background read refers to this object
+    Run_Reader(const Run_Reader&) = delete;
+    Run_Reader& operator=(const Run_Reader&) = delete;
+
+    const char* current() const{
+        return pos < limit ? block.data() + pos : nullptr;
+    }
+
+    void advance(){
+        pos += format.size_of(block.data() + pos);
+        if(pos >= limit && current_block < last_block){
+            pending_read.get();
+            std::swap(block, prefetched);
+            current_block++;
+            pos = 0;
+            set_limit();
+            start_prefetch(current_block + 1);
+        }
+    }
+
+    ~Run_Reader(){
+        if(pending_read.valid()) pending_read.wait();
+    }
+};
+
+// Reads a file in chunks of whole records
+template<typename format_t>
+class Chunk_Reader{
+
+    string filename;
+    Record_File_Reader<format_t> in;
+    format_t format;
+    int64_t chunk_bytes;
+    vector<char> leftover; // Bytes of an incomplete record at the end of the previous chunk
+    bool eof_reached = false;
+
+public:
+
+    Chunk_Reader(const string& filename, format_t format, int64_t chunk_bytes) : filename(filename), in(filename, format), format(format), chunk_bytes(chunk_bytes){}
+
+    // Reads the next chunk and stores pointers to its records to records. Returns false if there are no more records.
+    bool next(vector<char>& chunk, vector<const char*>& records){
+        chunk.swap(leftover);
+        leftover.clear();
+        int64_t target = chunk_bytes;
+        while(true){
+            // Grow the chunk as data arrives, so that a small input does not allocate the whole chunk
+            while(!eof_reached && (int64_t)chunk.size() < target){
+                int64_t old_size = chunk.size();
+                int64_t piece = min(target - old_size, (int64_t)1 << 24);
+                chunk.resize(old_size + piece);
+                int64_t n_read = in.read_some(chunk.data() + old_size, piece);
+                chunk.resize(old_size + n_read);
+                if(n_read == 0) eof_reached = true;
+            }
+
+            records.clear();
+            int64_t pos = 0;
+            while((int64_t)chunk.size() - pos >= format.min_record_size()){
+                int64_t size = format.size_of(chunk.data() + pos);
+                if(size < format.min_record_size()) throw std::runtime_error("Invalid record length in " + filename);
+                if(pos + size > (int64_t)chunk.size()) break; // Incomplete
+                records.push_back(chunk.data() + pos);
+                pos += size;
+            }
+
+            if(records.empty() && !eof_reached){ // A record larger than the chunk
+                target *= 2;
+                continue;
+            }
+            if(eof_reached && records.empty() && pos < (int64_t)chunk.size())
+                throw std::runtime_error("Truncated record at the end of " + filename);
+
+            leftover.assign(chunk.begin() + pos, chunk.end());
+            chunk.resize(pos); // Does not reallocate, so the record pointers stay valid
+            return !records.empty();
+        }
+    }
+
+    // True if next has returned all records of the file
+    bool at_end(){
+        if(!eof_reached && leftover.empty()){
+            // The last chunk may have ended exactly at the end of the file
+            leftover.resize(1 << 16);
+            leftover.resize(in.read_some(leftover.data(), leftover.size()));
+            if(leftover.empty()) eof_reached = true;
+        }
+        return eof_reached && leftover.empty();
+    }
+};
+
+// A sorted range of record pointers as a merge source
+struct Pointer_Range_Source{
+    const char* const* it;
+    const char* const* end;
+    const char* current() const{ return it < end ? *it : nullptr; }
+    void advance(){ it++; }
+};
+
+// Returns the first position in the run whose record is not smaller than key
+template<typename format_t, typename cmp_t>
+Run_Position lower_bound_in_run(const Run& run, format_t format, const char* key, cmp_t& cmp){
+    // Last block whose first record is smaller than the key
+    int64_t lo = 0, hi = run.blocks.size(); // Answer block is in [lo-1, hi)
+    while(lo < hi){
+        int64_t mid = (lo + hi) / 2;
+        if(cmp(run.blocks[mid].first_record.data(), key)) lo = mid + 1;
+        else hi = mid;
+    }
+    if(lo == 0) return {0,0};
+    int64_t b = lo - 1;
+
+    std::ifstream in(run.filename, ios::binary);
+    vector<char> block;
+    read_run_block(in, run, format, b, block);
+    int64_t pos = 0;
+    while(pos < (int64_t)block.size() && cmp(block.data() + pos, key))
+        pos += format.size_of(block.data() + pos);
+    if(pos == (int64_t)block.size()) return {b+1, 0};
+    return {b, pos};
+}
+
+// Adapts a record file writer to the writer interface of merge
+template<typename format_t>
+struct Output_Writer{
+    Record_File_Writer<format_t>& out;
+    format_t format;
+    void write(const char* record){ out.write(record, format.size_of(record)); }
+};
+
+// Writes the parts of a sorted output to outfile in parallel. Part p has raw_part_sizes[p] bytes of records,
+// and write_part(p, writer) passes them to writer.write in order. Each part is written at an offset reserved
+// for it. With compression, the unused end of the reservation is marked as a gap, and the file is truncated
+// after the last part.
+template<typename format_t, typename write_part_t>
+void write_parts(const string& outfile, format_t format, const vector<int64_t>& raw_part_sizes, int64_t buffer_bytes, int64_t n_threads, write_part_t write_part){
+    int64_t n_parts = raw_part_sizes.size();
+    Temp_Compression compression = get_temp_compression();
+    vector<int64_t> reserved(n_parts, 0); // Reserved bytes for each part in the output
+    for(int64_t p = 0; p < n_parts; p++) reserved[p] = max_file_bytes(raw_part_sizes[p], buffer_bytes, compression);
+    vector<int64_t> part_offsets(n_parts + 1, 0); // Byte offset of each part in the output
+    for(int64_t p = 0; p < n_parts; p++) part_offsets[p+1] = part_offsets[p] + reserved[p];
+
+    { std::ofstream create(outfile, ios::binary); }
+    std::filesystem::resize_file(outfile, part_offsets[n_parts]); // Without compression, this is the final size
+    int64_t last_part_bytes = 0;
+
+    #pragma omp parallel for num_threads(n_threads) schedule(dynamic, 1)
+    for(int64_t p = 0; p < n_parts; p++){
+        Record_File_Writer<format_t> out(outfile, format, part_offsets[p], buffer_bytes);
+        Output_Writer<format_t> writer{out, format};
+        write_part(p, writer);
+        if(p == n_parts - 1) last_part_bytes = out.finish();
+        else out.finish(reserved[p]);
+    }
+
+    std::filesystem::resize_file(outfile, part_offsets[n_parts - 1] + last_part_bytes);
+}
+
+// Merges the runs and writes the result to outfile, using n_threads threads
+template<typename format_t, typename cmp_t>
+void final_merge(const vector<Run>& runs, const string& outfile, format_t format, cmp_t& cmp, int64_t buffer_bytes, int64_t n_threads){
+
+    // Choose splitters from the first records of the blocks
+    vector<const char*> samples;
+    for(const Run& run : runs)
+        for(const Run_Block& block : run.blocks) samples.push_back(block.first_record.data());
+    std::sort(samples.begin(), samples.end(), [&](const char* a, const char* b){ return cmp(a,b); });
+    int64_t n_parts = max((int64_t)1, min(n_threads, (int64_t)samples.size()));
+    vector<const char*> splitters; // Part p has records in [splitters[p-1], splitters[p])
+    for(int64_t p = 1; p < n_parts; p++) splitters.push_back(samples[p * samples.size() / n_parts]);
+
+    // positions[r][p] = start of part p in run r
+    vector<vector<Run_Position>> positions(runs.size(), vector<Run_Position>(n_parts + 1));
+    #pragma omp parallel for num_threads(n_threads) schedule(dynamic, 1) collapse(2)
+    for(int64_t r = 0; r < (int64_t)runs.size(); r++){
+        for(int64_t p = 0; p <= n_parts; p++){
+            if(p == 0) positions[r][p] = {0,0};
+            else if(p == n_parts) positions[r][p] = {(int64_t)runs[r].blocks.size(), 0};
+            else positions[r][p] = lower_bound_in_run(runs[r], format, splitters[p-1], cmp);
+        }
+    }
+
+    vector<int64_t> raw_part_sizes(n_parts, 0);
+    for(int64_t p = 0; p < n_parts; p++)
+        for(int64_t r = 0; r < (int64_t)runs.size(); r++)
+            raw_part_sizes[p] += raw_offset(runs[r], positions[r][p+1]) - raw_offset(runs[r], positions[r][p]);
+
+    write_parts(outfile, format, raw_part_sizes, buffer_bytes, n_threads, [&](int64_t p, Output_Writer<format_t>& writer){
+        vector<unique_ptr<Run_Reader<format_t>>> readers;
+        vector<Run_Reader<format_t>*> sources;
+        for(int64_t r = 0; r < (int64_t)runs.size(); r++){
+            readers.push_back(make_unique<Run_Reader<format_t>>(runs[r], format, positions[r][p], positions[r][p+1]));
+            sources.push_back(readers.back().get());
+        }
+        merge(sources, cmp, writer);
+    });
+}
+
+// Merges sorted ranges of records in memory and writes the result to outfile, using n_threads threads.
+// The output is split into parts by splitters sampled from the records.
+template<typename format_t, typename cmp_t>
+void in_memory_merge(const vector<Pointer_Range_Source>& ranges, const string& outfile, format_t format, cmp_t& cmp, int64_t buffer_bytes, int64_t n_threads){
+    auto ptr_cmp = [&](const char* a, const char* b){ return cmp(a,b); };
+
+    vector<const char*> samples;
+    for(const Pointer_Range_Source& range : ranges){
+        int64_t n = range.end - range.it;
+        for(int64_t i = 0; i < 64; i++) if(i * n / 64 < n) samples.push_back(range.it[i * n / 64]);
+    }
+    std::sort(samples.begin(), samples.end(), ptr_cmp);
+    int64_t n_parts = max((int64_t)1, min(n_threads, (int64_t)samples.size()));
+    vector<const char*> splitters; // Part p has records in [splitters[p-1], splitters[p])
+    for(int64_t p = 1; p < n_parts; p++) splitters.push_back(samples[p * samples.size() / n_parts]);
+
+    // bounds[r][p] = start of part p in range r
+    vector<vector<const char* const*>> bounds(ranges.size(), vector<const char* const*>(n_parts + 1));
+    vector<int64_t> raw_part_sizes(n_parts, 0);
+    #pragma omp parallel for num_threads(n_threads)
+    for(int64_t r = 0; r < (int64_t)ranges.size(); r++){
+        bounds[r][0] = ranges[r].it;
+        bounds[r][n_parts] = ranges[r].end;
+        for(int64_t p = 1; p < n_parts; p++)
+            bounds[r][p] = std::lower_bound(bounds[r][p-1], ranges[r].end, splitters[p-1], ptr_cmp);
+    }
+    #pragma omp parallel for num_threads(n_threads)
+    for(int64_t p = 0; p < n_parts; p++)
+        for(int64_t r = 0; r < (int64_t)ranges.size(); r++)
+            for(const char* const* it = bounds[r][p]; it != bounds[r][p+1]; it++) raw_part_sizes[p] += format.size_of(*it);
+
+    write_parts(outfile, format, raw_part_sizes, buffer_bytes, n_threads, [&](int64_t p, Output_Writer<format_t>& writer){
+        vector<Pointer_Range_Source> parts;
+        for(int64_t r = 0; r < (int64_t)ranges.size(); r++) parts.push_back({bounds[r][p], bounds[r][p+1]});
+        vector<Pointer_Range_Source*> sources;
+        for(Pointer_Range_Source& part : parts) sources.push_back(&part);
+        merge(sources, cmp, writer);
+    });
+}
+
+template<typename format_t, typename cmp_t>
+void sort_records(const string& infile, const string& outfile, format_t format, cmp_t cmp, int64_t ram_bytes, int64_t n_threads){
+    n_threads = max(n_threads, (int64_t)1);
+    int64_t input_size = std::filesystem::file_size(infile);
+    if(get_temp_compression() != Temp_Compression::none) input_size *= 4; // Rough guess of the uncompressed size
+
+    // The chunk and a pointer to each of its records must fit in memory, with some space left for the run writer
+    int64_t r = format.min_record_size();
+    int64_t chunk_bytes = max((int64_t)(ram_bytes * 0.8 * r / (r + 8)), (int64_t)(1 << 16));
+
+    // Every merge thread has two blocks in memory for each run it merges
+    const int64_t min_block_bytes = 1 << 16;
+    const int64_t max_block_bytes = 1 << 22;
+    int64_t estimated_runs = max((int64_t)1, (input_size + chunk_bytes - 1) / chunk_bytes);
+    int64_t block_bytes = ram_bytes / (4 * n_threads * min(estimated_runs, (int64_t)512));
+    block_bytes = max(min_block_bytes, min(max_block_bytes, block_bytes));
+    int64_t max_fan_in = max((int64_t)2, min((int64_t)512, ram_bytes / (4 * n_threads * block_bytes)));
+
+    // Every part of the final merge opens every run, so limit the number of open files
+    const int64_t max_open_files = 768;
+    max_fan_in = max((int64_t)2, min(max_fan_in, max_open_files / n_threads));
+
+    // Form sorted runs. If the whole input fits in the first chunk, it is sorted in memory and written
+    // directly to the output.
+    vector<Run> runs;
+    {
+        Chunk_Reader<format_t> reader(infile, format, chunk_bytes);
+        vector<char> chunk;
+        vector<const char*> records;
+        auto ptr_cmp = [&](const char* a, const char* b){ return cmp(a,b); };
+        while(reader.next(chunk, records)){
+            // Sort parts of the chunk in parallel and merge the parts into a run
+            int64_t n_parts = min(n_threads, (int64_t)records.size());
+            vector<Pointer_Range_Source> parts(n_parts);
+            #pragma omp parallel for num_threads(n_threads)
+            for(int64_t p = 0; p < n_parts; p++){
+                int64_t begin = records.size() * p / n_parts;
+                int64_t end = records.size() * (p+1) / n_parts;
+                std::sort(records.begin() + begin, records.begin() + end, ptr_cmp);
+                parts[p] = {records.data() + begin, records.data() + end};
+            }
+            if(runs.empty() && reader.at_end()){
+                sbwt::write_log("External sort: input fits in memory", sbwt::LogLevel::MINOR);
+                in_memory_merge(parts, outfile, format, cmp, 1 << 20, n_threads);
+                return;
+            }
+
+            vector<Pointer_Range_Source*> sources;
+            for(Pointer_Range_Source& part : parts) sources.push_back(&part);
+
+            Run_Writer<format_t> writer(sbwt::get_temp_file_manager().create_filename("run-"), format, block_bytes);
+            merge(sources, cmp, writer);
+            runs.push_back(writer.finish());
+        }
+    }
+    sbwt::write_log("External sort: " + to_string(runs.size()) + " sorted runs", sbwt::LogLevel::MINOR);
+
+    // Merge groups of runs in parallel until the remaining runs can be merged at once
+    while((int64_t)runs.size() > max_fan_in){
+        int64_t n_groups = (runs.size() + max_fan_in - 1) / max_fan_in;
+        vector<Run> next_round(n_groups);
+        vector<string> filenames;
+        for(int64_t g = 0; g < n_groups; g++) filenames.push_back(sbwt::get_temp_file_manager().create_filename("run-"));
+
+        #pragma omp parallel for num_threads(min(n_threads, n_groups)) schedule(dynamic, 1)
+        for(int64_t g = 0; g < n_groups; g++){
+            int64_t begin = g * max_fan_in;
+            int64_t end = min((int64_t)runs.size(), begin + max_fan_in);
+            vector<unique_ptr<Run_Reader<format_t>>> readers;
+            vector<Run_Reader<format_t>*> sources;
+            for(int64_t i = begin; i < end; i++){
+                readers.push_back(make_unique<Run_Reader<format_t>>(runs[i], format, Run_Position{0,0}, Run_Position{(int64_t)runs[i].blocks.size(), 0}));
+                sources.push_back(readers.back().get());
+            }
+            Run_Writer<format_t> writer(filenames[g], format, block_bytes);
+            merge(sources, cmp, writer);
+            next_round[g] = writer.finish();
+        }
+
+        for(const Run& run : runs) sbwt::get_temp_file_manager().delete_file(run.filename);
+        runs = std::move(next_round);
+        sbwt::write_log("External sort: merged into " + to_string(runs.size()) + " runs", sbwt::LogLevel::MINOR);
+    }
+
+    final_merge(runs, outfile, format, cmp, max(block_bytes, (int64_t)1 << 20), n_threads);
+    for(const Run& run : runs) sbwt::get_temp_file_manager().delete_file(run.filename);
+}
+
+// Sorts a file of records of record_size bytes. cmp(x,y) returns true iff record x is smaller than record y.
+template<typename cmp_t>
+void sort_constant_binary(const string& infile, const string& outfile, cmp_t cmp, int64_t ram_bytes, int64_t record_size, int64_t n_threads){
+    sort_records(infile, outfile, Constant_Size_Records{record_size}, cmp, ram_bytes, n_threads);
+}
+
+// Sorts a file of records that start with their length in bytes as a big-endian 64-bit integer.
+// cmp(x,y) returns true iff record x is smaller than record y.
+template<typename cmp_t>
+void sort_variable_length_records(const string& infile, const string& outfile, cmp_t cmp, int64_t ram_bytes, int64_t n_threads){
+    sort_records(infile, outfile, Variable_Size_Records(), cmp, ram_bytes, n_threads);
+}
+
+} // namespace external_sort
@@ -24,54 +24,55 @@ class UnitigExtractor {
         vector<int64_t>
             links;  // Outgoing edges from this unitig, as a list of unitig ids
         int64_t id;
+        int64_t offset;  // Index of the first node in the unitig that this was split from
     };
 
-    // Assumes that dummy nodes are always visited
-    Unitig get_unitig_containing_node(DBG::Node v, const DBG& dbg, vector<bool>& visited) {
-        // TODO: visited hash map is slow.
-        vector<DBG::Node> backward, forward;
-
-        visited[dbg.kmer_rank(v)] = true;
-
-        // Walk backward until (indegree >= 2), or (predecessor is visited or
-        // has outdegree >= 2)
-        DBG::Node u = v;
-        while (true) {
-            int64_t indeg = dbg.indegree(u);
-            if (indeg >= 2 || indeg == 0) break;
-            DBG::Node pred = dbg.pred(u);
-            if (pred.id == -1) break;
-            if (visited[dbg.kmer_rank(pred)]) break;
-            if (dbg.outdegree(pred) >= 2) break;
-            u = pred;
-            visited[dbg.kmer_rank(u)] = true;
-            backward.push_back(u);
-        }
+    // Output of one block of unitig heads. Blocks are formatted in parallel and written in order.
+    struct Block_Output {
+        string fasta;
+        string gfa;
+        string colors;
+        int64_t n_nodes = 0;
+    };
+
+    // Bit vector with one bit per node id, marking the nodes that are already in some unitig.
+    // Different threads set bits in the same words, so the bits are set atomically.
+    vector<uint64_t> visited;
+
+    void mark_visited(int64_t node) {
+        __atomic_fetch_or(visited.data() + node / 64, 1ULL << (node % 64), __ATOMIC_RELAXED);
+    }
+
+    bool is_visited(int64_t node) const {
+        return (visited[node / 64] >> (node % 64)) & 1;
+    }
+
+    // A node starts a unitig unless it has exactly one predecessor and the predecessor has
+    // exactly one successor. The only unitigs without such a start node are cycles where
+    // every node has in- and outdegree 1.
+    bool is_unitig_head(DBG::Node v, const DBG& dbg) const {
+        if (dbg.indegree(v) != 1) return true;
+        return dbg.outdegree(dbg.pred(v)) >= 2;
+    }
 
-        // Walk forward until (outdegree >= 2) or (successor is visited or has
-        // indegree >= 2)
-        u = v;
-        while (true) {
-            int64_t outdeg = dbg.outdegree(u);
-            if (outdeg >= 2 || outdeg == 0) break;
+    // Walks forward from the first node of a unitig until (outdegree != 1) or (successor has
+    // indegree >= 2) or the walk returns to the first node, which happens only on cycles.
+    Unitig get_unitig_starting_from(DBG::Node head, const DBG& dbg) {
+        Unitig U;
+        U.nodes.push_back(head);
+        mark_visited(head.id);
+
+        DBG::Node u = head;
+        while (dbg.outdegree(u) == 1) {
             DBG::Node succ = dbg.succ(u);
-            if (succ.id == -1) break;
-            if (visited[dbg.kmer_rank(succ)]) break;
+            if (succ == head) break;
             if (dbg.indegree(succ) >= 2) break;
             u = succ;
-            visited[dbg.kmer_rank(u)] = true;
-            forward.push_back(u);
+            mark_visited(u.id);
+            U.nodes.push_back(u);
         }
 
-        // Collect the unitig path
-        Unitig U;
-        for (int64_t i = (int64_t)backward.size() - 1; i >= 0; i--)
-            U.nodes.push_back(backward[i]);
-        U.nodes.push_back(v);
-        for (DBG::Node w : forward) U.nodes.push_back(w);
-
         // Compute links
-
         for(DBG::Edge edge : dbg.outedges(U.nodes.back())){
             DBG::Node destination = edge.dest;
             U.links.push_back(destination.id);
@@ -98,6 +99,7 @@ class UnitigExtractor {
                 colored.nodes.push_back(U.nodes[i]);
             colored.colorset = coloring.get_color_set_of_node_as_vector(U.nodes[run_start].id);
             colored.id = U.nodes[run_start].id;
+            colored.offset = run_start;
 
             colored_unitigs.push_back(colored);  // Links are added later
 
@@ -142,6 +144,7 @@ class UnitigExtractor {
                     colored.nodes.push_back(U.nodes[i]);
 
                 colored.id = U.nodes[run_start].id;
+                colored.offset = run_start;
 
                 colored_unitigs.push_back(colored);  // Links are added later
 
@@ -163,39 +166,124 @@ class UnitigExtractor {
         return colored_unitigs;
     }
 
-    string get_unitig_string(vector<DBG::Node>& nodes, const DBG& dbg) {
-        if (nodes.size() == 0) return "";
-        string first_kmer = dbg.get_node_label(nodes[0]);
-        string rest;
-        for (int64_t i = 1; i < nodes.size(); i++)
-            rest += dbg.incoming_character(nodes[i]);
-        return first_kmer + rest;
+    static void append_int(string& out, int64_t x) {
+        char buffer[32];
+        int64_t len = fast_int_to_string(x, buffer);
+        out.append(buffer, len);
+    }
+
+    // Concatenates the spellings of the unitigs into unitig_strings and records the start of
+    // each spelling in starts. The first k-mers of all the unitigs are reconstructed in one
+    // batch, and the rest of each unitig is spelled from the incoming characters of its nodes.
+    void spell_unitigs(const vector<Unitig>& unitigs, const DBG& dbg, string& unitig_strings,
+                       vector<int64_t>& starts) {
+        int64_t k = dbg.get_k();
+        vector<DBG::Node> first_nodes;
+        int64_t total_length = 0;
+        for (const Unitig& U : unitigs) {
+            first_nodes.push_back(U.nodes[0]);
+            total_length += (int64_t)U.nodes.size() + k - 1;
+        }
+
+        string labels;
+        dbg.get_node_labels(first_nodes, labels);
+
+        unitig_strings.clear();
+        unitig_strings.reserve(total_length);
+        starts.clear();
+        for (int64_t i = 0; i < (int64_t)unitigs.size(); i++) {
+            starts.push_back(unitig_strings.size());
+            unitig_strings.append(labels, i * k, k);
+            for (int64_t j = 1; j < (int64_t)unitigs[i].nodes.size(); j++)
+                unitig_strings += dbg.incoming_character(unitigs[i].nodes[j]);
+        }
     }
 
     void write_colorset(int64_t unitig_id, vector<int64_t>& colorset,
-                        ostream& colorsets_out) {
-        colorsets_out << unitig_id;
-        for (int64_t color : colorset) colorsets_out << " " << color;
-        colorsets_out << "\n";
+                        string& colorsets_out) {
+        append_int(colorsets_out, unitig_id);
+        for (int64_t color : colorset) {
+            colorsets_out += ' ';
+            append_int(colorsets_out, color);
+        }
+        colorsets_out += '\n';
     }
 
-    void write_unitig(vector<DBG::Node>& nodes, int64_t unitig_id, const DBG& dbg,
-                      ostream& fasta_out, ostream& gfa_out) {
-        string unitig_string = get_unitig_string(nodes, dbg);
-        fasta_out << ">" << unitig_id << "\n" << unitig_string << "\n";
-        gfa_out << "S\t" << unitig_id << "\t" << unitig_string << "\n";
+    void write_unitig(const char* unitig_string, int64_t length, int64_t unitig_id,
+                      string& fasta_out, string& gfa_out, bool write_gfa) {
+        fasta_out += '>';
+        append_int(fasta_out, unitig_id);
+        fasta_out += '\n';
+        fasta_out.append(unitig_string, length);
+        fasta_out += '\n';
+        if (write_gfa) {
+            gfa_out += "S\t";
+            append_int(gfa_out, unitig_id);
+            gfa_out += '\t';
+            gfa_out.append(unitig_string, length);
+            gfa_out += '\n';
+        }
     }
 
-    void write_linkage(int64_t from_unitig, vector<int64_t> to_unitigs, ostream& gfa_out,
+    void write_linkage(int64_t from_unitig, vector<int64_t>& to_unitigs, string& gfa_out,
                        int64_t k) {
         for (int64_t to_unitig : to_unitigs) {
             // Print overlap with k-1 characters
-            gfa_out << "L\t" << from_unitig << "\t+\t" << to_unitig << "\t+\t"
-                    << (k - 1) << "M\n";
+            gfa_out += "L\t";
+            append_int(gfa_out, from_unitig);
+            gfa_out += "\t+\t";
+            append_int(gfa_out, to_unitig);
+            gfa_out += "\t+\t";
+            append_int(gfa_out, k - 1);
+            gfa_out += "M\n";
         }
     }
 
+    // Splits the unitigs as requested and formats them into the block output. The pieces
+    // of a split unitig are substrings of the spelling of the whole unitig.
+    void process_unitigs(vector<Unitig>& unitigs, const DBG& dbg, const coloring_t& coloring,
+                         bool split_by_colorset_runs, int64_t min_colors, bool write_gfa,
+                         Block_Output& out) {
+        int64_t k = dbg.get_k();
+        string unitig_strings;
+        vector<int64_t> starts;
+        spell_unitigs(unitigs, dbg, unitig_strings, starts);
+
+        for (int64_t i = 0; i < (int64_t)unitigs.size(); i++) {
+            Unitig& U = unitigs[i];
+            const char* S = unitig_strings.data() + starts[i];
+            out.n_nodes += U.nodes.size();
+            if (min_colors > 0) {
+                for (Colored_Unitig& CU : split_by_colorset_size(min_colors, U, coloring)) {
+                    write_unitig(S + CU.offset, CU.nodes.size() + k - 1, CU.id, out.fasta, out.gfa, write_gfa);
+                    if (write_gfa) write_linkage(CU.id, CU.links, out.gfa, k);
+                }
+            } else if (split_by_colorset_runs) {
+                for (Colored_Unitig& CU : split_to_colorset_runs(U, coloring)) {
+                    write_unitig(S + CU.offset, CU.nodes.size() + k - 1, CU.id, out.fasta, out.gfa, write_gfa);
+                    if (write_gfa) write_linkage(CU.id, CU.links, out.gfa, k);
+                    write_colorset(CU.id, CU.colorset, out.colors);
+                }
+            } else {
+                write_unitig(S, U.nodes.size() + k - 1, U.id, out.fasta, out.gfa, write_gfa);
+                if (write_gfa) write_linkage(U.id, U.links, out.gfa, k);
+            }
+        }
+    }
+
+    void flush_block(Block_Output& out, ostream& unitigs_out, ostream& colorsets_out,
+                     ostream& gfa_out, Progress_printer& pp) {
+        unitigs_out.write(out.fasta.data(), out.fasta.size());
+        gfa_out.write(out.gfa.data(), out.gfa.size());
+        colorsets_out.write(out.colors.data(), out.colors.size());
+        for (int64_t i = 0; i < out.n_nodes; i++) pp.job_done();  // Record progress
+        out = Block_Output(); // Releases the memory
+    }
+
    public:
+    // Number of node ids in one block of the parallel extraction
+    int64_t block_size = 1 << 14;
+
     // Writes the unitigs to the outputstream, one unitig per line
     // If split_by_colorset_runs == true, also splits the unitigs to maximal
     // runs of nodes that have the same colorset, and writes the color sets to
@@ -205,45 +293,65 @@ class UnitigExtractor {
     // The colorsets are written one per line, in the same order as unitigs, in
     // a space-separated format "id c1 c2 ..", where id is the fasta header of
     // the colorset, and c1 c2... are the colors.
+    //
+    // The unitigs are extracted in parallel. The node ids are split into blocks, and the
+    // unitigs starting in each block are formatted into a buffer of the block. The buffers
+    // are written in block order, so the output is the same for any number of threads: the
+    // unitigs appear in the order of the node ids of their first nodes, followed by the
+    // unitigs that are cycles. If write_gfa == false, gfa_out is unused and the GFA
+    // formatting is skipped.
     void extract_unitigs(const DBG& dbg, const coloring_t& coloring, ostream& unitigs_out,
                          bool split_by_colorset_runs, ostream& colorsets_out,
-                         ostream& gfa_out, int64_t min_colors = 0) {
+                         ostream& gfa_out, bool write_gfa, int64_t min_colors = 0, int64_t n_threads = 1) {
 
-        gfa_out << "H"
-                << "\t"
-                << "VN:Z:1.0"
-                << "\n";  // Header
+        if (write_gfa) {
+            gfa_out << "H"
+                    << "\t"
+                    << "VN:Z:1.0"
+                    << "\n";  // Header
+        }
 
-        vector<bool> visited(dbg.number_of_kmers());
+        int64_t n_nodes = dbg.number_of_subsets();
+        visited.assign((n_nodes + 63) / 64, 0);
 
         int64_t total_kmers = dbg.number_of_kmers();
         Progress_printer pp(total_kmers, 100);
 
-        for(DBG::Node v : dbg.all_nodes()){
-            if (!visited[dbg.kmer_rank(v.id)]) {
-                Unitig U = get_unitig_containing_node(v, dbg, visited);
-                for (int64_t i = 0; i < U.nodes.size(); i++)
-                    pp.job_done();  // Record progress
-                if (min_colors > 0) {
-                    for (Colored_Unitig& CU :
-                         split_by_colorset_size(min_colors, U, coloring)) {
-                        write_unitig(CU.nodes, CU.id, dbg, unitigs_out,
-                                     gfa_out);
-                        write_linkage(CU.id, CU.links, gfa_out, dbg.get_k());
-                    }
-                } else if (split_by_colorset_runs) {
-                    for (Colored_Unitig& CU :
-                         split_to_colorset_runs(U, coloring)) {
-                        write_unitig(CU.nodes, CU.id, dbg, unitigs_out,
-                                     gfa_out);
-                        write_linkage(CU.id, CU.links, gfa_out, dbg.get_k());
-                        write_colorset(CU.id, CU.colorset, colorsets_out);
-                    }
-                } else {
-                    write_unitig(U.nodes, U.id, dbg, unitigs_out, gfa_out);
-                    write_linkage(U.id, U.links, gfa_out, dbg.get_k());
+        // Blocks are processed in rounds of a few blocks per thread to bound the buffer memory
+        const int64_t blocks_per_round = 4 * n_threads;
+        int64_t n_blocks = (n_nodes + block_size - 1) / block_size;
+        vector<Block_Output> round_outputs(blocks_per_round);
+
+        for (int64_t round_start = 0; round_start < n_blocks; round_start += blocks_per_round) {
+            int64_t round_end = min(n_blocks, round_start + blocks_per_round);
+
+            #pragma omp parallel for num_threads(n_threads) schedule(dynamic, 1)
+            for (int64_t block = round_start; block < round_end; block++) {
+                vector<Unitig> unitigs;
+                int64_t node_end = min(n_nodes, (block + 1) * block_size);
+                for (int64_t id = block * block_size; id < node_end; id++) {
+                    DBG::Node v(id);
+                    if (dbg.is_dummy(v) || !is_unitig_head(v, dbg)) continue;
+                    unitigs.push_back(get_unitig_starting_from(v, dbg));
                 }
+                process_unitigs(unitigs, dbg, coloring, split_by_colorset_runs, min_colors, write_gfa,
+                                round_outputs[block - round_start]);
             }
+
+            for (int64_t block = round_start; block < round_end; block++)
+                flush_block(round_outputs[block - round_start], unitigs_out, colorsets_out, gfa_out, pp);
+        }
+
+        // The remaining nodes are on cycles where every node has in- and outdegree 1.
+        // These are rare, so they are handled sequentially.
+        vector<Unitig> cycles;
+        for (int64_t id = 0; id < n_nodes; id++) {
+            DBG::Node v(id);
+            if (dbg.is_dummy(v) || is_visited(id)) continue;
+            cycles.push_back(get_unitig_starting_from(v, dbg));
         }
+        Block_Output cycle_output;
+        process_unitigs(cycles, dbg, coloring, split_by_colorset_runs, min_colors, write_gfa, cycle_output);
+        flush_block(cycle_output, unitigs_out, colorsets_out, gfa_out, pp);
     }
 };
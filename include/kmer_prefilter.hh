@@ -0,0 +1,90 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <iostream>
+
+using namespace std;
+
+// A blocked Bloom filter over the canonical k-mers of the index. Each k-mer sets a few bits
+// inside a single 512-bit block, so a lookup touches just one cache line. The filter has no
+// false negatives: if it says that a k-mer is not present, the k-mer is not in the index in
+// either orientation. It is used to reject reads that can not have enough hits in the index
+// before running the SBWT search on them. Supports k <= 32.
+class Kmer_Prefilter{
+
+private:
+
+    static constexpr int64_t words_per_block = 8; // 512 bits
+    static constexpr int64_t n_probes = 6; // Bits set per k-mer. Each probe takes 9 bits of the hash.
+
+    int64_t k = 0;
+    int64_t n_blocks = 0;
+    vector<uint64_t> bits;
+
+    static uint64_t mix(uint64_t x){ // Finalizer of splitmix64
+        x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+    // Calls f(canonical_kmer) for every k-mer of S that has only ACGT characters (in either case).
+    // The canonical k-mer is the smaller of the 2-bit encodings of the k-mer and its reverse complement.
+    template<typename callback_t>
+    void for_each_kmer(const char* S, int64_t S_size, callback_t f) const{
+        uint64_t mask = (k == 32) ? ~0ULL : ((1ULL << (2*k)) - 1);
+        uint64_t fw = 0, rc = 0;
+        int64_t valid_length = 0; // Length of the current run of ACGT characters
+        for(int64_t i = 0; i < S_size; i++){
+            int64_t c = char_to_code(S[i]);
+            if(c < 0) valid_length = 0;
+            else{
+                fw = ((fw << 2) | c) & mask;
+                rc = (rc >> 2) | ((uint64_t)(3 - c) << (2*(k-1)));
+                valid_length++;
+            }
+            if(valid_length >= k) f(fw < rc ? fw : rc);
+        }
+    }
+
+    static int64_t char_to_code(char c){
+        switch(c){
+            case 'A': case 'a': return 0;
+            case 'C': case 'c': return 1;
+            case 'G': case 'g': return 2;
+            case 'T': case 't': return 3;
+            default: return -1;
+        }
+    }
+
+public:
+
+    Kmer_Prefilter(){}
+
+    // Allocates bits_per_kmer * expected_n_kmers bits, rounded up to full blocks.
+    Kmer_Prefilter(int64_t k, int64_t expected_n_kmers, double bits_per_kmer);
+
+    // Adds all k-mers of S. Safe to call from multiple threads at the same time.
+    void insert(const char* S, int64_t S_size);
+
+    // Returns true if the k-mer with the given canonical encoding may be in the filter
+    bool may_contain(uint64_t canonical_kmer) const;
+
+    // Returns the number of k-mers of S that may be in the index. This is an upper bound
+    // for the number of k-mers of S that are found in the index.
+    int64_t count_possible_hits(const char* S, int64_t S_size) const;
+
+    int64_t get_k() const {return k;}
+    int64_t size_in_bytes() const {return bits.size() * sizeof(uint64_t);}
+
+    int64_t serialize(ostream& os) const;
+    void serialize(const string& filename) const;
+    void load(istream& is);
+    void load(const string& filename);
+
+};
+
+// Builds a prefilter from all k-mers of the given sequence files
+Kmer_Prefilter build_kmer_prefilter(const vector<string>& seqfiles, int64_t k, int64_t expected_n_kmers, double bits_per_kmer);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+using namespace std;
+
+// Building an index from precomputed k-mer sets instead of sequences (`themisto build --kmer-sets`).
+// A k-mer set is either a KMC database, given as its path without the .kmc_pre and .kmc_suf
+// extensions, or a text file with one k-mer per line. Anything after the k-mer on a line, such as
+// the count written by kmc_dump, is ignored.
+//
+// The k-mers of each set are joined into sequences that contain every k-mer of the set once in one
+// of its two orientations, and no other k-mers. The sequence files are then indexed with KMC and the
+// usual color construction, with one color per set and reverse complements included, so that the
+// index has the same k-mers and color sets as an index of the sequences the k-mer sets were counted
+// from. GGCAT is not used even though every set has its own color, because the sets are already
+// counted. The joined sequences are much shorter than the original input, so the passes over the
+// sequences are cheap.
+//
+// Joining keeps one whole set in memory, packed two bits per nucleotide. The peak is about
+// 24 * ceil(2k / 64) + 8 bytes per k-mer of the set, so 32 bytes per k-mer for k <= 32.
+
+// True if path.kmc_pre and path.kmc_suf exist
+bool is_kmc_database(const string& path);
+
+// The file that holds the k-mers of the set: the .kmc_suf file of a KMC database, or the text file
+string kmer_set_data_file(const string& path);
+
+// Calls callback for every k-mer of the set, in upper case. If k is 0, it is taken from the set.
+// Throws if a k-mer does not have length k or has characters other than ACGT.
+void for_each_kmer_in_set(const string& path, int64_t k, const std::function<void(const string&)>& callback);
+
+// Joins the k-mers of the set greedily into sequences through overlaps of k-1 characters in either
+// orientation, and writes the sequences to a new FASTA file in the temporary directory. Returns the
+// name of the file. If k is 0, it is taken from the set. Throws if the set does not fit in ram_bytes.
+string kmer_set_to_fasta(const string& path, int64_t k, int64_t ram_bytes);
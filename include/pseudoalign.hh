@@ -1,11 +1,15 @@
 #pragma once
 
 #include <string>
+#include <functional>
 #include "sbwt/SBWT.hh"
 #include "coloring/Coloring.hh"
+#include "coloring/Color_Mask.hh"
 #include "SeqIO/SeqIO.hh"
 #include "ThreadPool.hh"
 #include "variants.hh"
+#include "read_binning.hh"
+#include "kmer_prefilter.hh"
 
 using namespace std;
 using namespace sbwt;
@@ -20,8 +24,64 @@ std::unique_ptr<ParallelBaseWriter> create_writer(const string& outfile, bool gz
 
 void call_sort_parallel_output_file(const string& outfile, bool gzipped);
 
+// Receives pseudoalignment results instead of the text output. Called from all worker
+// threads concurrently, so implementations must be thread-safe. The colors are sorted if
+// sort_hits is enabled. The call is skipped for reads that the intersection method rejects
+// because of the relevant k-mers fraction, just like the text output skips them.
+class Pseudoalignment_Result_Sink{
+public:
+    virtual void add_result(int64_t seq_id, const vector<int64_t>& colors, int64_t n_relevant_kmers) = 0;
+    virtual ~Pseudoalignment_Result_Sink() = default;
+};
+
 namespace pseudoalignment{ // Helper classes for pseudoalignment.
 
+class WorkBatch{
+    public:
+        unique_ptr<vector<char>> seqs_concat;
+        unique_ptr<vector<int64_t>> starts; // Has an end sentinel one past the last one
+        unique_ptr<vector<int64_t>> seq_ids;
+
+        // Headers of the reads. Only filled if they are needed for read binning.
+        unique_ptr<vector<char>> headers_concat;
+        unique_ptr<vector<int64_t>> header_starts; // Has an end sentinel one past the last one. Empty if no headers.
+
+        // Quality strings of FASTQ reads for read binning. The quality string of a read has the
+        // same start and length as the read in seqs_concat. Empty if no quality strings.
+        unique_ptr<vector<char>> quals_concat;
+
+    // Default constructor
+    WorkBatch(){
+        seqs_concat = make_unique<vector<char>>();
+        starts = make_unique<vector<int64_t>>();
+        seq_ids = make_unique<vector<int64_t>>();
+        headers_concat = make_unique<vector<char>>();
+        header_starts = make_unique<vector<int64_t>>();
+        quals_concat = make_unique<vector<char>>();
+    }
+
+    // Move constructor
+    WorkBatch(WorkBatch&& other){
+
+        // Move the stuff in
+        this->seqs_concat = move(other.seqs_concat);
+        this->starts = move(other.starts);
+        this->seq_ids = move(other.seq_ids);
+        this->headers_concat = move(other.headers_concat);
+        this->header_starts = move(other.header_starts);
+        this->quals_concat = move(other.quals_concat);
+
+        // Clear the other
+        other.seqs_concat = make_unique<vector<char>>();
+        other.starts = make_unique<vector<int64_t>>();
+        other.seq_ids = make_unique<vector<int64_t>>();
+        other.headers_concat = make_unique<vector<char>>();
+        other.header_starts = make_unique<vector<int64_t>>();
+        other.quals_concat = make_unique<vector<char>>();
+    }
+};
+
+
 template<class coloring_t>
 class Pseudoaligner_Base{
 
@@ -31,7 +91,8 @@ public:
 
     const plain_matrix_sbwt_t* SBWT; // Not owned by this class
     const coloring_t* coloring; // Not owned by this class
-    ParallelBaseWriter* out;
+    ParallelBaseWriter* out; // Null if results go to the sink
+    Pseudoalignment_Result_Sink* sink; // Null if results go to the writer
     bool reverse_complements;
     int64_t k;
     bool report_relevant;
@@ -55,13 +116,32 @@ public:
     atomic<int64_t>* total_length_of_sequence_processed;
     atomic<int64_t>* total_bytes_written;
 
+    // If the mask is not null, color set ids in the id buffers are masked set ids
+    // and the colors of the sets are masked colors. See Color_Mask.
+    const Color_Mask<coloring_t>* mask; // Not owned by this class
+
+    // Filter for rejecting reads that have too few k-mers in the index. Null if not in use.
+    const Kmer_Prefilter* prefilter; // Not owned by this class
+
+    // Read binning. The binner is null if binning is not enabled.
+    Read_Binner* binner; // Not owned by this class
+    Read_Binner::Thread_Buffer bin_buffer;
+
+    // The read that is currently being processed. Set by the worker before processing
+    // each read so that the record can be passed on to the binner.
+    const char* current_header = nullptr;
+    int64_t current_header_length = 0;
+    const char* current_seq = nullptr;
+    int64_t current_seq_length = 0;
+    const char* current_quality = nullptr; // Null if the reads have no quality strings
+
     // For output writing
     char int_to_string_buffer[32]; // Enough space for a 64-bit integer in ascii
     char newline = '\n';
     char space = ' ';
     char semicolon = ';';
 
-    Pseudoaligner_Base(const plain_matrix_sbwt_t* SBWT, const coloring_t* coloring, ParallelBaseWriter* out, bool reverse_complements, int64_t output_buffer_capacity, atomic<int64_t>* total_length_of_sequence_processed, atomic<int64_t>* total_bytes_written, bool report_relevant, double relevant_kmers_fraction, bool sort_hits){
+    Pseudoaligner_Base(const plain_matrix_sbwt_t* SBWT, const coloring_t* coloring, ParallelBaseWriter* out, bool reverse_complements, int64_t output_buffer_capacity, atomic<int64_t>* total_length_of_sequence_processed, atomic<int64_t>* total_bytes_written, bool report_relevant, double relevant_kmers_fraction, bool sort_hits, Read_Binner* binner, const Color_Mask<coloring_t>* mask, const Kmer_Prefilter* prefilter, Pseudoalignment_Result_Sink* sink){
         this->SBWT = SBWT;
         this->coloring = coloring;
         this->out = out;
@@ -73,6 +153,10 @@ public:
         this->report_relevant = report_relevant;
         this->relevant_kmers_fraction = relevant_kmers_fraction;
         this->sort_hits = sort_hits;
+        this->binner = binner;
+        this->mask = mask;
+        this->prefilter = prefilter;
+        this->sink = sink;
         rc_buffer.resize(1 << 10); // 1 kb. Will be resized if needed
         output_buffer.reserve(output_buffer_capacity);
     }
@@ -91,7 +175,18 @@ public:
 
     // If n_kmers_found_in_index is given, then also reports that
     void report_results_for_seq(int64_t seq_id, vector<int64_t>& hits, int64_t n_kmers_found_in_index){
+        if(mask != nullptr) for(int64_t& x : hits) x = mask->get_original_color(x);
+        else if(coloring->has_color_permutation()) for(int64_t& x : hits) x = coloring->get_original_color(x);
         if(sort_hits) std::sort(hits.begin(), hits.end());
+
+        if(binner != nullptr)
+            binner->add_read(bin_buffer, current_header, current_header_length, seq_id, current_seq, current_seq_length, current_quality, hits);
+
+        if(sink != nullptr){
+            sink->add_result(seq_id, hits, n_kmers_found_in_index);
+            return;
+        }
+
         int64_t len = fast_int_to_string(seq_id, int_to_string_buffer);
         add_to_output(int_to_string_buffer, len);
         for(color_t x : hits){
@@ -108,7 +203,33 @@ public:
         add_to_output(&newline, 1);
     }
 
-    // -1 if node is not found at all.
+    // Processes all reads in the batch with the given function
+    template<typename process_sequence_t>
+    void process_batch(const WorkBatch& item, process_sequence_t process_sequence){
+        for(int64_t i = 0; i < (int64_t)item.starts->size() - 1; i++){
+            int64_t start = (*item.starts)[i];
+            int64_t end = (*item.starts)[i+1];
+            int64_t seq_id = (*item.seq_ids)[i];
+            current_seq = item.seqs_concat->data() + start;
+            current_seq_length = end - start;
+            if(item.header_starts->size() > 0){
+                current_header = item.headers_concat->data() + (*item.header_starts)[i];
+                current_header_length = (*item.header_starts)[i+1] - (*item.header_starts)[i];
+            }
+            if(item.quals_concat->size() > 0) current_quality = item.quals_concat->data() + start;
+            process_sequence(item.seqs_concat->data() + start, end-start, seq_id);
+            *total_length_of_sequence_processed += end - start;
+        }
+    }
+
+    // Takes a color set id from the id buffers
+    typename coloring_t::colorset_type::view_t get_color_set(int64_t id) const{
+        if(mask != nullptr) return mask->get_masked_set(id);
+        return coloring->get_color_set_by_color_set_id(id);
+    }
+
+    // -1 if node is not found at all. If there is a color mask, the ids are masked
+    // set ids, and sets that are disjoint from the mask are Color_Mask::DISJOINT.
     void push_color_set_ids_to_buffer(const vector<int64_t>& colex_ranks, vector<int64_t>& buffer){
 
         // First pass: get all k-mer kmers and the last k-mer
@@ -137,6 +258,10 @@ public:
                 }
             }
         }
+
+        if(mask != nullptr){
+            for(int64_t& id : buffer) if(id >= 0) id = mask->get_masked_set_id(id);
+        }
     }
 
     vector<int64_t> get_rc_colex_ranks(const char* S, int64_t S_size){
@@ -148,10 +273,19 @@ public:
         return SBWT->streaming_search(rc_buffer.data(), S_size);
     }
 
+    // Writes the reads that are still in the bin buffer. This is not done in the destructor
+    // because writing the bins can fail, so the pseudoaligner calls this after the worker
+    // threads have finished.
+    void flush_bins(){
+        if(binner != nullptr) binner->flush(bin_buffer);
+    }
+
     ~Pseudoaligner_Base(){
         // Flush remaining output
-        out->write(output_buffer.data(), output_buffer.size());
-        *total_bytes_written += output_buffer.size();
+        if(out != nullptr){
+            out->write(output_buffer.data(), output_buffer.size());
+            *total_bytes_written += output_buffer.size();
+        }
     }
 
 };
@@ -176,35 +310,6 @@ void sort_parallel_output_file(instream_t& instream, outstream_t& outstream){
     assert(Q.empty());
 }
 
-class WorkBatch{
-    public:
-        unique_ptr<vector<char>> seqs_concat;
-        unique_ptr<vector<int64_t>> starts; // Has an end sentinel one past the last one
-        unique_ptr<vector<int64_t>> seq_ids;
-
-    // Default constructor
-    WorkBatch(){
-        seqs_concat = make_unique<vector<char>>();
-        starts = make_unique<vector<int64_t>>();
-        seq_ids = make_unique<vector<int64_t>>();
-    }
-
-    // Move constructor
-    WorkBatch(WorkBatch&& other){
-
-        // Move the stuff in
-        this->seqs_concat = move(other.seqs_concat);
-        this->starts = move(other.starts);
-        this->seq_ids = move(other.seq_ids);
-
-        // Clear the other
-        other.seqs_concat = make_unique<vector<char>>();
-        other.starts = make_unique<vector<int64_t>>();
-        other.seq_ids = make_unique<vector<int64_t>>();
-    }
-};
-
-
 // Context for the worker threads
 template<typename coloring_t>
 struct WorkerContext{
@@ -227,6 +332,11 @@ struct WorkerContext{
     bool report_relevant; 
     double relevant_kmers_fraction;
 
+    Read_Binner* binner = nullptr; // Null if read binning is not enabled
+    const Color_Mask<coloring_t>* mask = nullptr; // Null if all colors are used
+    const Kmer_Prefilter* prefilter = nullptr; // Null if not in use
+    Pseudoalignment_Result_Sink* sink = nullptr; // If not null, results go here instead of the writer
+
 };
 
 template <typename coloring_t>
@@ -236,6 +346,7 @@ class ThresholdWorker : public BaseWorkerThread<WorkBatch>, Pseudoaligner_Base<c
     typedef WorkBatch work_item_t;
     typedef WorkerContext<coloring_t> Context;
     typedef Pseudoaligner_Base<coloring_t> Base;
+    using Base::flush_bins;
 
     double count_threshold; // Fraction of k-mers that need to be found to report pseudoalignment to a color
     bool ignore_unknown_kmers = false; // Ignore k-mers that do not exist in the de Bruijn graph or have no colors
@@ -248,8 +359,9 @@ class ThresholdWorker : public BaseWorkerThread<WorkBatch>, Pseudoaligner_Base<c
     vector<int64_t> hits; // Pseudoalignment hits to report
 
     ThresholdWorker(WorkerContext<coloring_t> context) :
-        Pseudoaligner_Base<coloring_t>(context.SBWT, context.coloring, context.writer, context.reverse_complements, context.output_buffer_size, context.total_length_of_sequence_processed, context.total_bytes_written, context.report_relevant, context.relevant_kmers_fraction, context.sort_hits), count_threshold(context.threshold), ignore_unknown_kmers(context.ignore_unknown){
-        counts.resize(context.coloring->largest_color() + 1); // Initializes counts to zeroes
+        Pseudoaligner_Base<coloring_t>(context.SBWT, context.coloring, context.writer, context.reverse_complements, context.output_buffer_size, context.total_length_of_sequence_processed, context.total_bytes_written, context.report_relevant, context.relevant_kmers_fraction, context.sort_hits, context.binner, context.mask, context.prefilter, context.sink), count_threshold(context.threshold), ignore_unknown_kmers(context.ignore_unknown){
+        // Initializes counts to zeroes. With a mask, only the masked colors are counted.
+        counts.resize(context.mask != nullptr ? context.mask->size() : context.coloring->largest_color() + 1);
     }
 
 
@@ -262,6 +374,9 @@ class ThresholdWorker : public BaseWorkerThread<WorkBatch>, Pseudoaligner_Base<c
             write_log("Warning: query is shorter than k", LogLevel::MINOR);
             hits.clear();
             Base::report_results_for_seq(string_id, hits, 0);
+        } else if(rejected_by_prefilter(S, S_size)){
+            hits.clear();
+            Base::report_results_for_seq(string_id, hits, 0);
         } else{
             vector<int64_t> colex_ranks = Base::SBWT->streaming_search(S, S_size); // TODO: version that pushes to existing buffer?
             Base::push_color_set_ids_to_buffer(colex_ranks, Base::color_set_id_buffer);
@@ -283,17 +398,21 @@ class ThresholdWorker : public BaseWorkerThread<WorkBatch>, Pseudoaligner_Base<c
 
                 if(end_of_run){
 
+                    int64_t fw_id = Base::color_set_id_buffer[kmer_idx];
+                    int64_t rc_id = Base::reverse_complements ? Base::rc_color_set_id_buffer[n_kmers - 1 - kmer_idx] : -1;
+
                     // Retrieve forward color set
-                    if(Base::color_set_id_buffer[kmer_idx] == -1) fw_set = (typename coloring_t::colorset_type){}; // Empty
-                    else fw_set = Base::coloring->get_color_set_by_color_set_id(Base::color_set_id_buffer[kmer_idx]);
+                    if(fw_id < 0) fw_set = (typename coloring_t::colorset_type){}; // Empty
+                    else fw_set = Base::get_color_set(fw_id);
                     
                     // Retrieve reverse complement color set
-                    if(Base::reverse_complements && Base::rc_color_set_id_buffer[n_kmers - 1  - kmer_idx] != -1){
-                        typename coloring_t::colorset_type::view_t rc_set_view = Base::coloring->get_color_set_by_color_set_id(Base::rc_color_set_id_buffer[n_kmers - 1 - kmer_idx]);
+                    if(rc_id >= 0){
+                        typename coloring_t::colorset_type::view_t rc_set_view = Base::get_color_set(rc_id);
                         fw_set.do_union(rc_set_view);
                     }
 
-                    bool has_at_least_one_color =false;
+                    // Sets that are disjoint from the color mask have colors, but none to count
+                    bool has_at_least_one_color = (fw_id == Color_Mask<coloring_t>::DISJOINT || rc_id == Color_Mask<coloring_t>::DISJOINT);
 
                     // Add the run length to the counts
                     color_buffer.clear();
@@ -330,15 +449,23 @@ class ThresholdWorker : public BaseWorkerThread<WorkBatch>, Pseudoaligner_Base<c
         }
     }
 
+    // Returns true if the prefilter shows that the read gets no hits. Then the output line of the read
+    // has no colors, and the relevant k-mer count is 0 because we only reject on that if it is reported.
+    bool rejected_by_prefilter(const char* S, int64_t S_size){
+        if(Base::prefilter == nullptr) return false;
+        int64_t n_kmers = S_size - Base::k + 1;
+        int64_t possible_hits = Base::prefilter->count_possible_hits(S, S_size); // Upper bound for k-mers with colors
+        if(possible_hits == 0) return true;
+        if(Base::report_relevant) return false; // Need the exact number of k-mers with colors
+        if(ignore_unknown_kmers) return (double)possible_hits / n_kmers < Base::relevant_kmers_fraction;
+        else return possible_hits < n_kmers * count_threshold || 1.0 < Base::relevant_kmers_fraction;
+    }
+
     // This function should only use local variables and protected shared variables
     virtual void process_work_item(WorkBatch item){
-        for(int64_t i = 0; i < (int64_t)item.starts->size() - 1; i++){
-            int64_t start = (*item.starts)[i];
-            int64_t end = (*item.starts)[i+1];
-            int64_t seq_id = (*item.seq_ids)[i];
-            process_sequence(item.seqs_concat->data() + start, end-start, seq_id);
-            *Base::total_length_of_sequence_processed += end - start;
-        }
+        Base::process_batch(item, [this](const char* S, int64_t S_size, int64_t seq_id){
+            process_sequence(S, S_size, seq_id);
+        });
     }
 
     // This function is called after every work item. It is called so
@@ -355,9 +482,10 @@ class IntersectionWorker : public BaseWorkerThread<WorkBatch>, Pseudoaligner_Bas
     typedef WorkBatch work_item_t;
     typedef WorkerContext<coloring_t> Context;
     typedef Pseudoaligner_Base<coloring_t> Base;
+    using Base::flush_bins;
 
     IntersectionWorker(WorkerContext<coloring_t> context) :
-        Pseudoaligner_Base<coloring_t>(context.SBWT, context.coloring, context.writer, context.reverse_complements, context.output_buffer_size, context.total_length_of_sequence_processed, context.total_bytes_written, context.report_relevant, context.relevant_kmers_fraction, context.sort_hits){}
+        Pseudoaligner_Base<coloring_t>(context.SBWT, context.coloring, context.writer, context.reverse_complements, context.output_buffer_size, context.total_length_of_sequence_processed, context.total_bytes_written, context.report_relevant, context.relevant_kmers_fraction, context.sort_hits, context.binner, context.mask, context.prefilter, context.sink){}
 
     void process_sequence(const char* S, int64_t S_size, int64_t string_id){
 
@@ -376,6 +504,9 @@ class IntersectionWorker : public BaseWorkerThread<WorkBatch>, Pseudoaligner_Bas
             vector<color_t> empty;
             Base::report_results_for_seq(string_id, empty, 0);
         }
+        else if(Base::prefilter != nullptr && prefilter_rejects(S, S_size, string_id)){
+            // Handled by prefilter_rejects
+        }
         else{
             vector<int64_t> colex_ranks = Base::SBWT->streaming_search(S, S_size); // TODO: version that pushes to existing buffer?
             Base::push_color_set_ids_to_buffer(colex_ranks, Base::color_set_id_buffer);
@@ -392,14 +523,42 @@ class IntersectionWorker : public BaseWorkerThread<WorkBatch>, Pseudoaligner_Bas
         }
     }
 
+    // Returns true if the prefilter shows that the read has too few k-mers in the index for the relevant
+    // k-mer fraction. If no k-mer can be in the index, also reports the result like process_sequence would.
+    bool prefilter_rejects(const char* S, int64_t S_size, int64_t string_id){
+        int64_t n_kmers = S_size - Base::k + 1;
+        int64_t possible_hits = Base::prefilter->count_possible_hits(S, S_size); // Upper bound for k-mers with colors
+        if(possible_hits == 0){
+            if(0 >= Base::relevant_kmers_fraction){
+                vector<color_t> empty;
+                Base::report_results_for_seq(string_id, empty, 0);
+            }
+            return true;
+        }
+        return (double)possible_hits / n_kmers < Base::relevant_kmers_fraction;
+    }
+
     // Returns the color set and the number of non-empty colorsets in the query
     pair<vector<int64_t>, int64_t> do_intersections_on_color_id_buffers_with_reverse_complements(){
         int64_t n_kmers = Base::color_set_id_buffer.size();
 
         int64_t prev_colorset_size = 0;
         int64_t n_nonempty = 0;
+        bool disjoint_from_mask = false; // If true, the result is empty and we only need to count
         
         typename coloring_t::colorset_type result;
+        typename coloring_t::colorset_type fw_rc_union; // Reused for every k-mer that has colors in both directions
+
+        // The first nonempty set is copied to the result, and the rest are intersected into it
+        auto intersect_with = [&](const auto& cs){
+            if(cs.size() > 0){
+                if(n_nonempty == 0) result = cs; // This is the first nonempty color set
+                else result.intersection(cs); // Intersection
+                n_nonempty++;
+            }
+            prev_colorset_size = cs.size();
+        };
+
         for(int64_t i = 0; i < n_kmers; i++){
             if(i > 0
             && (Base::color_set_id_buffer[i] == Base::color_set_id_buffer[i-1])
@@ -412,26 +571,29 @@ class IntersectionWorker : public BaseWorkerThread<WorkBatch>, Pseudoaligner_Bas
             int64_t rc_id = Base::rc_color_set_id_buffer[n_kmers-1-i];
 
             // Figure out the color set
-            typename coloring_t::colorset_type cs; // For union. TODO: Reuse a union buffer
             if(fw_id == -1 && rc_id == -1){
                 prev_colorset_size = 0;
                 continue; // Neither direction is found
             }
-            else if(fw_id == -1 && rc_id >= 0) cs = Base::coloring->get_color_set_by_color_set_id(rc_id);
-            else if(fw_id >= 0 && rc_id == -1) cs = Base::coloring->get_color_set_by_color_set_id(fw_id);
-            else if(fw_id >= 0 && rc_id >= 0){
-                // Take union of forward and reverse complement
-                cs = Base::coloring->get_color_set_by_color_set_id(fw_id);
-                cs.do_union(Base::coloring->get_color_set_by_color_set_id(rc_id));
-            }
-
-            if(cs.size() > 0){
-                if(n_nonempty == 0) result = cs; // This is the first nonempty color set
-                else result.intersection(cs); // Intersection
+            else if(disjoint_from_mask || (fw_id < 0 && rc_id < 0)){
+                // The k-mer has colors, but none in the color mask. Masked sets are never
+                // empty, so after this the k-mers only need to be counted.
+                disjoint_from_mask = true;
                 n_nonempty++;
+                prev_colorset_size = 1;
+                continue;
+            }
+            else if(fw_id < 0 || rc_id < 0){
+                // Only one direction is found. Its set is intersected without a copy.
+                intersect_with(Base::get_color_set(fw_id >= 0 ? fw_id : rc_id));
+            } else{
+                // Take union of forward and reverse complement
+                fw_rc_union = Base::get_color_set(fw_id);
+                fw_rc_union.do_union(Base::get_color_set(rc_id));
+                intersect_with(fw_rc_union);
             }
-            prev_colorset_size = cs.size();
         }
+        if(disjoint_from_mask) return {{}, n_nonempty};
         return {result.get_colors_as_vector(), n_nonempty};
     }
 
@@ -441,6 +603,7 @@ class IntersectionWorker : public BaseWorkerThread<WorkBatch>, Pseudoaligner_Bas
 
         int64_t prev_colorset_size = 0;
         int64_t n_nonempty = 0;
+        bool disjoint_from_mask = false; // If true, the result is empty and we only need to count
         typename coloring_t::colorset_type result;
         for(int64_t i = 0; i < n_kmers; i++){
             if(i > 0  && (Base::color_set_id_buffer[i] == Base::color_set_id_buffer[i-1])){
@@ -450,9 +613,15 @@ class IntersectionWorker : public BaseWorkerThread<WorkBatch>, Pseudoaligner_Bas
             } else if(Base::color_set_id_buffer[i] == -1){
                 // k-mer not found
                 prev_colorset_size = 0;
+            } else if(disjoint_from_mask || Base::color_set_id_buffer[i] == Color_Mask<coloring_t>::DISJOINT){
+                // The k-mer has colors, but none in the color mask. Masked sets are never
+                // empty, so after this the k-mers only need to be counted.
+                disjoint_from_mask = true;
+                n_nonempty++;
+                prev_colorset_size = 1;
             } else{
                 // k-mer is found and it has a different color set from the previous one
-                const typename coloring_t::colorset_type::view_t cs = Base::coloring->get_color_set_by_color_set_id(Base::color_set_id_buffer[i]);
+                const typename coloring_t::colorset_type::view_t cs = Base::get_color_set(Base::color_set_id_buffer[i]);
                 if(cs.size() > 0){
                     if(n_nonempty == 0) result = cs; // This is the first nonempty color set
                     else result.intersection(cs); // Intersection
@@ -461,18 +630,15 @@ class IntersectionWorker : public BaseWorkerThread<WorkBatch>, Pseudoaligner_Bas
                 prev_colorset_size = cs.size();
             }
         }
+        if(disjoint_from_mask) return {{}, n_nonempty};
         return {result.get_colors_as_vector(), n_nonempty};
     }
 
     // This function should only use local variables and protected shared variables
     virtual void process_work_item(WorkBatch item){
-        for(int64_t i = 0; i < (int64_t)item.starts->size() - 1; i++){
-            int64_t start = (*item.starts)[i];
-            int64_t end = (*item.starts)[i+1];
-            int64_t seq_id = (*item.seq_ids)[i];
-            process_sequence(item.seqs_concat->data() + start, end-start, seq_id);
-            *Base::total_length_of_sequence_processed += end - start;
-        }
+        Base::process_batch(item, [this](const char* S, int64_t S_size, int64_t seq_id){
+            process_sequence(S, S_size, seq_id);
+        });
     }
 
     // This function is called after every work item. It is called so
@@ -488,13 +654,25 @@ class Worker : public BaseWorkerThread<WorkBatch>{
     public:
 
         unique_ptr<BaseWorkerThread<WorkBatch>> inner_worker;
+        std::function<void()> flush_inner_worker_bins;
 
         Worker(WorkerContext<coloring_t> context){
             // Initialize the correct inner worker
-            if(context.threshold == 1)
-                inner_worker = make_unique<IntersectionWorker<coloring_t>>(context);
-            else
-                inner_worker = make_unique<ThresholdWorker<coloring_t>>(context);
+            if(context.threshold == 1){
+                auto worker = make_unique<IntersectionWorker<coloring_t>>(context);
+                flush_inner_worker_bins = [w = worker.get()](){w->flush_bins();};
+                inner_worker = move(worker);
+            } else{
+                auto worker = make_unique<ThresholdWorker<coloring_t>>(context);
+                flush_inner_worker_bins = [w = worker.get()](){w->flush_bins();};
+                inner_worker = move(worker);
+            }
+        }
+
+        // Writes the reads that the worker still has buffered for read binning. Called
+        // after the thread pool has finished. Throws if writing a bin fails.
+        void flush_bins(){
+            flush_inner_worker_bins();
         }
 
         // This function should only use local variables and protected shared variables
@@ -514,7 +692,7 @@ class Worker : public BaseWorkerThread<WorkBatch>{
 void print_thread(atomic<int64_t>* total_length_of_sequence_processed, atomic<int64_t>* total_bytes_written, atomic<bool>* stop_printing);
 
 template<typename sequence_reader_t, typename coloring_t>
-void push_work_batches(int64_t buffer_size, sequence_reader_t& reader, ThreadPool<Worker<coloring_t>, pseudoalignment::WorkBatch>& TP){
+void push_work_batches(int64_t buffer_size, sequence_reader_t& reader, ThreadPool<Worker<coloring_t>, pseudoalignment::WorkBatch>& TP, bool include_headers, Fastq_Quality_Reader* qualities){
     // Start creating work batches
     int64_t batch_push_threshold = buffer_size; // A batch is pushed to the thread pool when it reaches this size
     WorkBatch wb;
@@ -530,10 +708,22 @@ void push_work_batches(int64_t buffer_size, sequence_reader_t& reader, ThreadPoo
         for(int64_t i = 0 ; i < len; i++){
             wb.seqs_concat->push_back(reader.read_buf[i]);
         }
+        if(include_headers){
+            wb.header_starts->push_back(wb.headers_concat->size());
+            for(const char* c = reader.header_buf; *c != '\0'; c++)
+                wb.headers_concat->push_back(*c);
+        }
+        if(qualities != nullptr){
+            const string& quality = qualities->next();
+            if((int64_t)quality.size() != len)
+                throw std::runtime_error("The quality string of read " + to_string(seq_id) + " does not have the same length as the read");
+            wb.quals_concat->insert(wb.quals_concat->end(), quality.begin(), quality.end());
+        }
 
         if(wb.seqs_concat->size() >= batch_push_threshold){
             // Push the batch
             wb.starts->push_back(wb.seqs_concat->size()); // End sentinel
+            if(include_headers) wb.header_starts->push_back(wb.headers_concat->size()); // End sentinel
             TP.add_work(std::move(wb), wb.seqs_concat->size());
             // Moving the batch also clears it
         }
@@ -544,15 +734,57 @@ void push_work_batches(int64_t buffer_size, sequence_reader_t& reader, ThreadPoo
     // Push the last batch
     if(wb.seqs_concat->size() > 0){
         wb.starts->push_back(wb.seqs_concat->size()); // End sentinel
+        if(include_headers) wb.header_starts->push_back(wb.headers_concat->size()); // End sentinel
         TP.add_work(std::move(wb), wb.seqs_concat->size());
     }
 
 }
 
+// Pushes in-memory sequences to the thread pool. The id of a sequence is its index in the arrays.
+template<typename coloring_t>
+void push_in_memory_work_batches(int64_t buffer_size, const char* const* seqs, const int64_t* lengths, int64_t n_seqs, ThreadPool<Worker<coloring_t>, pseudoalignment::WorkBatch>& TP){
+    WorkBatch wb;
+    for(int64_t seq_id = 0; seq_id < n_seqs; seq_id++){
+        wb.starts->push_back(wb.seqs_concat->size());
+        wb.seq_ids->push_back(seq_id);
+        wb.seqs_concat->insert(wb.seqs_concat->end(), seqs[seq_id], seqs[seq_id] + lengths[seq_id]);
+
+        if(wb.seqs_concat->size() >= buffer_size || seq_id == n_seqs - 1){
+            wb.starts->push_back(wb.seqs_concat->size()); // End sentinel
+            int64_t batch_size = wb.seqs_concat->size();
+            TP.add_work(std::move(wb), batch_size);
+            // Moving the batch also clears it
+        }
+    }
+}
+
 } // End namespace pseudoalignment
 
+// Pseudoaligns sequences that are already in memory and passes the results to the sink instead of
+// writing text output. Sequence i gets id i. This is the entry point for embedding Themisto.
+template<typename coloring_t>
+void pseudoalign_to_sink(const plain_matrix_sbwt_t& SBWT, const coloring_t& coloring, int64_t n_threads, const char* const* seqs, const int64_t* lengths, int64_t n_seqs, Pseudoalignment_Result_Sink* sink, bool reverse_complements, int64_t buffer_size, double threshold, bool ignore_unknown, double relevant_kmers_fraction, bool sort_hits, const Color_Mask<coloring_t>* mask = nullptr, const Kmer_Prefilter* prefilter = nullptr){
+
+    using namespace pseudoalignment;
+
+    atomic<int64_t> total_length_of_sequence_processed = 0;
+    atomic<int64_t> total_bytes_written = 0;
+    WorkerContext<coloring_t> context = {&SBWT, &coloring, reverse_complements, threshold, ignore_unknown, sort_hits, buffer_size, &total_length_of_sequence_processed, &total_bytes_written, nullptr, true, relevant_kmers_fraction, nullptr, mask, prefilter, sink};
+
+    vector<unique_ptr<Worker<coloring_t>>> workers;
+    vector<Worker<coloring_t>*> worker_ptrs;
+    for(int64_t i = 0; i < n_threads; i++){
+        workers.push_back(make_unique<Worker<coloring_t>>(context));
+        worker_ptrs.push_back(workers.back().get());
+    }
+
+    ThreadPool<Worker<coloring_t>, WorkBatch> TP(worker_ptrs, buffer_size);
+    push_in_memory_work_batches(buffer_size, seqs, lengths, n_seqs, TP);
+    TP.join_threads();
+}
+
 template<typename coloring_t, typename sequence_reader_t>
-void pseudoalign(const plain_matrix_sbwt_t& SBWT, const coloring_t& coloring, int64_t n_threads, sequence_reader_t& reader, std::string outfile, bool reverse_complements, int64_t buffer_size, bool gzipped, bool sorted_output, double threshold, bool ignore_unknown, bool report_relevant, double relevant_kmers_fraction, bool sort_hits){
+void pseudoalign(const plain_matrix_sbwt_t& SBWT, const coloring_t& coloring, int64_t n_threads, sequence_reader_t& reader, std::string outfile, bool reverse_complements, int64_t buffer_size, bool gzipped, bool sorted_output, double threshold, bool ignore_unknown, bool report_relevant, double relevant_kmers_fraction, bool sort_hits, Read_Binner* binner = nullptr, const Color_Mask<coloring_t>* mask = nullptr, const Kmer_Prefilter* prefilter = nullptr, Fastq_Quality_Reader* qualities = nullptr){
 
     using namespace pseudoalignment;
 
@@ -564,7 +796,7 @@ void pseudoalign(const plain_matrix_sbwt_t& SBWT, const coloring_t& coloring, in
         std::unique_ptr<ParallelBaseWriter> out = create_writer(outfile, gzipped);
         atomic<int64_t> total_length_of_sequence_processed = 0; // For printing progress
         atomic<int64_t> total_bytes_written = 0; // For printing progress
-        WorkerContext<coloring_t> context = {&SBWT, &coloring, reverse_complements, threshold, ignore_unknown, sort_hits, buffer_size, &total_length_of_sequence_processed, &total_bytes_written, out.get(), report_relevant, relevant_kmers_fraction};
+        WorkerContext<coloring_t> context = {&SBWT, &coloring, reverse_complements, threshold, ignore_unknown, sort_hits, buffer_size, &total_length_of_sequence_processed, &total_bytes_written, out.get(), report_relevant, relevant_kmers_fraction, binner, mask, prefilter};
 
         // Create workers
         vector<unique_ptr<Worker<coloring_t>>> workers;
@@ -582,18 +814,20 @@ void pseudoalign(const plain_matrix_sbwt_t& SBWT, const coloring_t& coloring, in
         ThreadPool<Worker<coloring_t>, WorkBatch> TP(worker_ptrs, buffer_size);
 
         try{ // For some reason exceptions are not propagates up to main from here, so we catch them and terminate the program here
-            push_work_batches(buffer_size, reader, TP);
+            push_work_batches(buffer_size, reader, TP, binner != nullptr, qualities);
         } catch (const std::runtime_error &e){
             std::cerr << "Runtime error: " << e.what() << '\n';
             std::terminate();
         }
 
         TP.join_threads();
-        workers.clear(); // This will delete the workers, which will flush their internal buffers to the common output buffer
 
         // Terminate the print thread
         stop_printing = true;
         print_thread.join();
+
+        if(binner != nullptr) for(auto& worker : workers) worker->flush_bins();
+        workers.clear(); // This will delete the workers, which will flush their internal buffers to the common output buffer
     } // Flushes output
 
     if (sorted_output) call_sort_parallel_output_file(outfile, gzipped);
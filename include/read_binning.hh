@@ -0,0 +1,97 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "SeqIO/SeqIO.hh"
+#include "SeqIO/buffered_streams.hh"
+
+using namespace std;
+
+// Writes pseudoaligned reads into one output file per color, or per group of colors.
+// The bins are FASTQ if the queries are FASTQ, and FASTA otherwise.
+// The worker threads collect records into their own Thread_Buffer and hand them over
+// to the binner in large chunks. The binner does not keep files open between chunks:
+// a chunk is appended to the file of the bin and the file is closed again, so the
+// number of bins is not limited by the number of available file descriptors. Gzipped
+// bins are written as a concatenation of gzip members, which is a valid gzip file.
+class Read_Binner{
+
+public:
+
+    // Thread-local staging area for records. Not thread-safe.
+    class Thread_Buffer{
+        public:
+        unordered_map<int64_t, vector<char>> buffers; // Bin id -> concatenated records
+        int64_t total_bytes = 0;
+        vector<int64_t> bins_of_read; // Reused space
+        vector<char> compressed; // Reused space
+    };
+
+private:
+
+    struct Bin{
+        std::mutex mutex;
+        bool created = false; // Whether the file has been truncated already
+    };
+
+    string out_prefix;
+    bool gzipped;
+    bool fastq; // Whether the records have quality strings
+    int64_t flush_threshold; // Bytes per thread
+    vector<int64_t> color_to_bin;
+    vector<string> bin_names;
+    vector<unique_ptr<Bin>> bins;
+
+    void append_to_bin(int64_t bin, const char* data, int64_t data_length);
+
+public:
+
+    // If color_groups is empty, every color gets its own bin. Otherwise color_groups[c]
+    // is the name of the bin of color c. Group names can not contain '/' or "..", so that
+    // the bins stay next to out_prefix. The output file of a bin is out_prefix + bin name
+    // + ".fastq" if fastq is true and ".fna" otherwise, with ".gz" appended if gzipped is true.
+    // Existing files with the names of the bins are removed, and bins that receive no reads
+    // do not get a file.
+    Read_Binner(const string& out_prefix, int64_t n_colors, const vector<string>& color_groups, bool gzipped, bool fastq, int64_t flush_threshold);
+
+    // Adds the read to the bins of the given colors. If the header is empty, the rank of
+    // the read is used as the header. The quality string has seq_length characters, and it
+    // must be given if and only if the bins are FASTQ. Flushes the thread buffer if it grows
+    // past the threshold.
+    void add_read(Thread_Buffer& buf, const char* header, int64_t header_length, int64_t read_rank, const char* seq, int64_t seq_length, const char* quality, const vector<int64_t>& colors);
+
+    // Writes everything in the thread buffer to the bin files. Must be called by the owner of
+    // the buffer when it is done adding reads.
+    void flush(Thread_Buffer& buf);
+
+    int64_t number_of_bins() const {return bins.size();}
+    string get_bin_filename(int64_t bin) const;
+
+};
+
+// Reads the quality strings of a FASTQ file in the same order as seq_io::Reader reads the
+// sequences. The reader does not keep the quality strings, so read binning reads them from
+// a second stream over the same file. Like seq_io::Reader, supports only single-line FASTQ.
+class Fastq_Quality_Reader{
+
+    string filename;
+    unique_ptr<seq_io::Buffered_ifstream<std::ifstream>> plain_in; // Null if the file is gzipped
+    unique_ptr<seq_io::Buffered_ifstream<seq_io::zstr::ifstream>> gzipped_in; // Null if the file is not gzipped
+    string line;
+
+    bool getline(string& line);
+
+public:
+
+    Fastq_Quality_Reader(const string& filename);
+
+    // Returns the quality string of the next record. Throws if the file ends.
+    const string& next();
+
+};
+
+// Reads a file with one line per color, where line i is the name of the group of color i
+vector<string> read_color_groups(const string& filename);
@@ -0,0 +1,395 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <future>
+#include <cstring>
+#include <stdexcept>
+#include <zlib.h>
+
+#include "sbwt/EM_sort/bit_level_stuff.hh"
+
+using namespace std;
+
+// Temporary files of binary records, optionally compressed.
+//
+// Without compression, a file is the concatenation of the records. With compression, a file is a sequence
+// of blocks of whole records. A block starts with a 16-byte header (stored size, raw size) followed by the
+// stored bytes. The first stored byte tells how the records are coded:
+//
+//   0: as is
+//   1: delta coded
+//   2: delta coded and then compressed with zlib. The size of the delta coded bytes is given as a varint
+//      before the zlib stream.
+//
+// Delta coding splits each record into 64-bit big-endian words, and writes the difference of each word
+// to the word at the same position in the previous record of the block as a zigzag varint. Sorted keys,
+// shared prefixes and small values all code into few bytes. Bytes after the last whole word of a record
+// are copied as is.
+//
+// A header with raw size 0 marks a gap: the reader skips the number of bytes given as the stored size.
+// Gaps let the parts of a file be written in parallel at offsets reserved in advance.
+namespace external_sort{
+
+enum class Temp_Compression{none, delta, delta_zlib};
+
+static inline Temp_Compression& temp_compression_setting(){
+    static Temp_Compression setting = Temp_Compression::delta;
+    return setting;
+}
+
+// Applies to all temporary record files written and read after the call
+static inline void set_temp_compression(Temp_Compression compression){
+    temp_compression_setting() = compression;
+}
+
+static inline Temp_Compression get_temp_compression(){
+    return temp_compression_setting();
+}
+
+static inline Temp_Compression parse_temp_compression(const string& name){
+    if(name == "none") return Temp_Compression::none;
+    if(name == "delta") return Temp_Compression::delta;
+    if(name == "delta-zlib") return Temp_Compression::delta_zlib;
+    throw std::runtime_error("Unknown temporary file compression: " + name + " (options: none, delta, delta-zlib)");
+}
+
+static inline void append_varint(string& dest, uint64_t x){
+    while(x >= 0x80){
+        dest.push_back((char)(x | 0x80));
+        x >>= 7;
+    }
+    dest.push_back((char)x);
+}
+
+static inline uint64_t read_varint(const char*& p, const char* end){
+    uint64_t x = 0;
+    for(int64_t shift = 0; shift < 64; shift += 7){
+        if(p == end) throw std::runtime_error("Corrupt block in a temporary file");
+        uint8_t byte = *(p++);
+        x |= (uint64_t)(byte & 0x7f) << shift;
+        if(byte < 0x80) return x;
+    }
+    throw std::runtime_error("Corrupt block in a temporary file");
+}
+
+static inline uint64_t zigzag(int64_t x){ return ((uint64_t)x << 1) ^ (uint64_t)(x >> 63); }
+static inline int64_t unzigzag(uint64_t x){ return (int64_t)(x >> 1) ^ -(int64_t)(x & 1); }
+
+static inline void store_big_endian_LL(char* dest, uint64_t x){
+    for(int64_t i = 7; i >= 0; i--){
+        dest[i] = (char)(x & 0xff);
+        x >>= 8;
+    }
+}
+
+// Delta codes the whole records data[0..n) and appends the result to dest
+template<typename format_t>
+void delta_encode(format_t format, const char* data, int64_t n, string& dest){
+    vector<uint64_t> prev; // Words of the previous record
+    int64_t pos = 0;
+    while(pos < n){
+        int64_t size = format.size_of(data + pos);
+        int64_t n_words = size / 8;
+        if((int64_t)prev.size() < n_words) prev.resize(n_words, 0);
+        for(int64_t i = 0; i < n_words; i++){
+            uint64_t word = sbwt::parse_big_endian_LL(data + pos + i*8);
+            append_varint(dest, zigzag(word - prev[i]));
+            prev[i] = word;
+        }
+        dest.append(data + pos + n_words*8, size - n_words*8);
+        pos += size;
+    }
+}
+
+// Decodes delta coded records into dest[0..raw_size)
+template<typename format_t>
+void delta_decode(format_t format, const char* p, const char* end, char* dest, int64_t raw_size){
+    vector<uint64_t> prev;
+    int64_t pos = 0;
+    while(pos < raw_size){
+        if(prev.empty()) prev.resize(1, 0);
+        // The first word is enough to find the length of the record
+        uint64_t first = prev[0] + unzigzag(read_varint(p, end));
+        store_big_endian_LL(dest + pos, first);
+        prev[0] = first;
+
+        int64_t size = format.size_of(dest + pos);
+        if(size < 8 || pos + size > raw_size) throw std::runtime_error("Corrupt block in a temporary file");
+        int64_t n_words = size / 8;
+        if((int64_t)prev.size() < n_words) prev.resize(n_words, 0);
+        for(int64_t i = 1; i < n_words; i++){
+            uint64_t word = prev[i] + unzigzag(read_varint(p, end));
+            store_big_endian_LL(dest + pos + i*8, word);
+            prev[i] = word;
+        }
+        int64_t tail = size - n_words*8;
+        if(end - p < tail) throw std::runtime_error("Corrupt block in a temporary file");
+        memcpy(dest + pos + n_words*8, p, tail);
+        p += tail;
+        pos += size;
+    }
+}
+
+// Appends a block with the whole records data[0..n) to dest, including the header
+template<typename format_t>
+void encode_block(format_t format, const char* data, int64_t n, Temp_Compression compression, string& dest){
+    string stored;
+    stored.reserve(n/4 + 16);
+    bool codable = format.min_record_size() >= 8; // Decoding needs the first word to find the record length
+
+    if(compression != Temp_Compression::none && codable){
+        stored.push_back(1);
+        delta_encode(format, data, n, stored);
+        if(compression == Temp_Compression::delta_zlib){
+            uLongf zlib_size = compressBound(stored.size() - 1);
+            string compressed;
+            compressed.push_back(2);
+            append_varint(compressed, stored.size() - 1);
+            int64_t prefix = compressed.size();
+            compressed.resize(prefix + zlib_size);
+            if(compress2((Bytef*)compressed.data() + prefix, &zlib_size, (const Bytef*)stored.data() + 1, stored.size() - 1, Z_BEST_SPEED) != Z_OK)
+                throw std::runtime_error("zlib compression failed");
+            compressed.resize(prefix + zlib_size);
+            stored.swap(compressed);
+        }
+    }
+
+    if(stored.empty() || (int64_t)stored.size() >= n + 1){ // Coding does not help
+        stored.clear();
+        stored.push_back(0);
+        stored.append(data, n);
+    }
+
+    int64_t header[2] = {(int64_t)stored.size(), n};
+    dest.append((const char*)header, 16);
+    dest.append(stored);
+}
+
+// Decodes the stored bytes of a block into dest, which is resized to raw_size
+template<typename format_t>
+void decode_block(format_t format, const char* stored, int64_t stored_size, int64_t raw_size, vector<char>& dest){
+    dest.resize(raw_size);
+    if(stored_size < 1) throw std::runtime_error("Corrupt block in a temporary file");
+    const char* p = stored + 1;
+    const char* end = stored + stored_size;
+    if(stored[0] == 0){
+        if(end - p != raw_size) throw std::runtime_error("Corrupt block in a temporary file");
+        memcpy(dest.data(), p, raw_size);
+    } else if(stored[0] == 1){
+        delta_decode(format, p, end, dest.data(), raw_size);
+    } else if(stored[0] == 2){
+        uLongf delta_size = read_varint(p, end);
+        string delta(delta_size, '\0');
+        if(uncompress((Bytef*)delta.data(), &delta_size, (const Bytef*)p, end - p) != Z_OK || delta_size != delta.size())
+            throw std::runtime_error("Corrupt block in a temporary file");
+        delta_decode(format, delta.data(), delta.data() + delta.size(), dest.data(), raw_size);
+    } else throw std::runtime_error("Corrupt block in a temporary file");
+}
+
+// Upper bound for the number of file bytes of raw_size bytes of records written by a Record_File_Writer
+// with the given block size, including a final gap marker
+static inline int64_t max_file_bytes(int64_t raw_size, int64_t block_bytes, Temp_Compression compression){
+    if(compression == Temp_Compression::none) return raw_size;
+    int64_t max_blocks = raw_size / (block_bytes / 2) + 1; // All blocks except the last have at least block_bytes/2 bytes
+    return raw_size + max_blocks * (16 + 1) + 16;
+}
+
+// Writes a temporary record file. The data may be given in pieces that do not end at record boundaries.
+// Blocks are coded and written in a background thread while the next block is filled.
+template<typename format_t>
+class Record_File_Writer{
+
+    string filename;
+    std::ofstream out;
+    format_t format;
+    Temp_Compression compression;
+    int64_t block_bytes;
+    vector<char> buffer;
+    int64_t complete_end = 0; // End of the whole records at the start of buffer
+    vector<char> in_flight; // Records being coded and written
+    std::future<int64_t> pending_write; // Returns the number of bytes written
+    int64_t bytes_written = 0;
+
+    void wait_for_write(){
+        if(pending_write.valid()) bytes_written += pending_write.get(); // Rethrows errors
+    }
+
+    void flush(int64_t n){
+        wait_for_write();
+        in_flight.assign(buffer.begin(), buffer.begin() + n);
+        buffer.erase(buffer.begin(), buffer.begin() + n);
+        complete_end = max((int64_t)0, complete_end - n);
+        pending_write = std::async(std::launch::async, [this]() -> int64_t{
+            int64_t n_bytes;
+            if(compression == Temp_Compression::none){
+                out.write(in_flight.data(), in_flight.size());
+                n_bytes = in_flight.size();
+            } else{
+                string block;
+                encode_block(format, in_flight.data(), in_flight.size(), compression, block);
+                out.write(block.data(), block.size());
+                n_bytes = block.size();
+            }
+            if(!out.good()) throw std::runtime_error("Error writing to " + filename);
+            return n_bytes;
+        });
+    }
+
+    void find_complete_records(){
+        while((int64_t)buffer.size() - complete_end >= format.min_record_size()){
+            int64_t size = format.size_of(buffer.data() + complete_end);
+            if(size < format.min_record_size()) throw std::runtime_error("Invalid record length written to " + filename);
+            if(complete_end + size > (int64_t)buffer.size()) break;
+            complete_end += size;
+        }
+    }
+
+public:
+
+    // If offset is -1, the file is created. Otherwise writing starts at the offset of an existing file.
+    Record_File_Writer(const string& filename, format_t format, int64_t offset = -1, int64_t block_bytes = 1 << 20)
+        : filename(filename), format(format), compression(get_temp_compression()), block_bytes(block_bytes){
+        if(offset == -1) out.open(filename, ios::binary);
+        else{
+            out.open(filename, ios::binary | ios::in | ios::out);
+            out.seekp(offset);
+        }
+        if(!out.good()) throw std::runtime_error("Could not open " + filename);
+        buffer.reserve(block_bytes);
+    }
+
+    // No copying or moving because the background write refers to this object
+    Record_File_Writer(const Record_File_Writer&) = delete;
+    Record_File_Writer& operator=(const Record_File_Writer&) = delete;
+
+    void write(const char* data, int64_t n){
+        buffer.insert(buffer.end(), data, data + n);
+        if((int64_t)buffer.size() < block_bytes) return;
+        if(compression == Temp_Compression::none){
+            flush(buffer.size());
+            return;
+        }
+        find_complete_records();
+        if(complete_end >= block_bytes / 2) flush(complete_end);
+    }
+
+    // Flushes everything and returns the number of bytes written to the file. If reserved_bytes is given,
+    // the rest of the reserved space is marked as a gap.
+    int64_t finish(int64_t reserved_bytes = -1){
+        if(compression != Temp_Compression::none){ // Without compression, records are not tracked
+            find_complete_records();
+            if(complete_end != (int64_t)buffer.size()) throw std::runtime_error("Incomplete record written to " + filename);
+        }
+        if(buffer.size() > 0) flush(buffer.size());
+        wait_for_write();
+        if(reserved_bytes != -1 && compression != Temp_Compression::none){
+            int64_t gap[2] = {reserved_bytes - bytes_written - 16, 0};
+            if(gap[0] < 0) throw std::runtime_error("Reserved space exceeded in " + filename);
+            out.write((char*)gap, 16);
+            bytes_written += 16;
+        }
+        out.close();
+        if(out.fail()) throw std::runtime_error("Error writing to " + filename);
+        return bytes_written;
+    }
+
+    ~Record_File_Writer(){
+        if(pending_write.valid()) pending_write.wait();
+    }
+};
+
+// Reads a temporary record file. The next block is read and decoded in a background thread.
+template<typename format_t>
+class Record_File_Reader{
+
+    string filename;
+    std::ifstream in;
+    format_t format;
+    Temp_Compression compression;
+    vector<char> block;
+    int64_t pos = 0; // Position in block
+    vector<char> prefetched;
+    std::future<bool> pending_read; // Returns false at the end of the file
+
+    // Reads the next block into prefetched. Returns false if there are no more blocks.
+    bool read_block(){
+        vector<char> stored;
+        while(true){
+            int64_t header[2];
+            in.read((char*)header, 16);
+            if(in.gcount() == 0) return false;
+            if(in.gcount() != 16) throw std::runtime_error("Truncated block in " + filename);
+            if(header[1] == 0){ // Gap
+                in.seekg(header[0], ios::cur);
+                continue;
+            }
+            stored.resize(header[0]);
+            in.read(stored.data(), header[0]);
+            if(in.gcount() != header[0]) throw std::runtime_error("Truncated block in " + filename);
+            decode_block(format, stored.data(), header[0], header[1], prefetched);
+            return true;
+        }
+    }
+
+    void start_prefetch(){
+        pending_read = std::async(std::launch::async, [this](){ return read_block(); });
+    }
+
+    // Moves to the next block. Returns false if there are no more blocks.
+    bool next_block(){
+        if(!pending_read.valid()) return false; // Already at the end
+        bool got_block = pending_read.get();
+        if(!got_block) return false;
+        std::swap(block, prefetched);
+        pos = 0;
+        start_prefetch();
+        return true;
+    }
+
+public:
+
+    Record_File_Reader(const string& filename, format_t format) : filename(filename), format(format), compression(get_temp_compression()){
+        in.open(filename, ios::binary);
+        if(!in.good()) throw std::runtime_error("Could not open " + filename);
+        if(compression != Temp_Compression::none) start_prefetch();
+    }
+
+    // No copying or moving because the background read refers to this object
+    Record_File_Reader(const Record_File_Reader&) = delete;
+    Record_File_Reader& operator=(const Record_File_Reader&) = delete;
+
+    // Copies up to n bytes to dest. Returns the number of bytes copied, which is 0 only at the end of the file.
+    int64_t read_some(char* dest, int64_t n){
+        if(compression == Temp_Compression::none){
+            in.read(dest, n);
+            return in.gcount();
+        }
+        if(pos == (int64_t)block.size() && !next_block()) return 0;
+        int64_t n_copied = min(n, (int64_t)block.size() - pos);
+        memcpy(dest, block.data() + pos, n_copied);
+        pos += n_copied;
+        return n_copied;
+    }
+
+    // Reads exactly n bytes to dest. Returns false if the file ended before the first byte.
+    bool read(char* dest, int64_t n){
+        int64_t done = 0;
+        while(done < n){
+            int64_t got = read_some(dest + done, n - done);
+            if(got == 0){
+                if(done == 0) return false;
+                throw std::runtime_error("Truncated record in " + filename);
+            }
+            done += got;
+        }
+        return true;
+    }
+
+    ~Record_File_Reader(){
+        if(pending_read.valid()) pending_read.wait();
+    }
+};
+
+} // namespace external_sort
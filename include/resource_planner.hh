@@ -0,0 +1,139 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+
+using namespace std;
+
+// Resource planning for index construction and queries. The planner estimates the properties of
+// the index from a hash sample of the k-mers of the input (see estimate_plan_inputs), and feeds
+// them into a model of the memory, temporary disk and time taken by each stage of the build
+// (see predict_resources). The model can be calibrated with statistics files written by real
+// builds with `themisto build --stats-out`.
+
+// Properties of the input and of the index that the resource model depends on. The build writes
+// the measured values of these into its statistics file under the same names.
+struct Plan_Inputs{
+    int64_t k = 0;
+    int64_t input_bytes = 0; // Total size of the input files on disk
+    int64_t input_bases = 0; // Total number of nucleotides in the input, without reverse complements
+    int64_t n_sequences = 0;
+    int64_t n_colors = 0;
+    int64_t n_kmers = 0; // Number of k-mers in the de Bruijn graph, including reverse complements if indexed
+    int64_t n_core_kmers = 0; // Number of k-mers that get their color set stored explicitly during construction
+    int64_t n_node_color_pairs = 0; // Number of (core k-mer occurrence, color) pairs generated during construction
+    int64_t n_distinct_color_sets = 0;
+    int64_t sum_of_distinct_color_set_lengths = 0;
+    int64_t color_set_storage_bytes = 0; // Size of the distinct color sets in the chosen coloring structure
+
+    void add_to(map<string, string>& kv) const;
+    static Plan_Inputs from_key_values(const map<string, string>& kv);
+};
+
+// The build and query parameters that the plan is made for
+struct Plan_Settings{
+    int64_t colorset_sampling_distance = 20; // The -d parameter
+    string coloring_structure_type = "sdsl-hybrid";
+    int64_t mem_megas = 2048;
+    int64_t n_threads = 1;
+    bool reverse_complements = true;
+    bool ggcat = false; // File colors are built with GGCAT
+    bool prefilter = false;
+    double prefilter_bits_per_kmer = 10;
+    int64_t query_buffer_megas = 8;
+
+    void add_to(map<string, string>& kv) const;
+    static Plan_Settings from_key_values(const map<string, string>& kv);
+};
+
+struct Stage_Prediction{
+    string name;
+    double peak_ram_bytes = 0;
+    double peak_temp_bytes = 0;
+    double seconds = 0;
+};
+
+struct Resource_Plan{
+    vector<Stage_Prediction> build_stages; // In execution order
+    double index_dbg_bytes = 0;
+    double index_colors_bytes = 0;
+    double query_ram_bytes = 0; // Intersection method
+    double query_ram_bytes_threshold = 0; // With --threshold, which keeps a counter for every color in every thread
+
+    double peak_build_ram_bytes() const;
+    double peak_build_temp_bytes() const;
+    double total_build_seconds() const;
+};
+
+// Multiplicative corrections to the model, keyed as "[stage].ram", "[stage].temp", "[stage].seconds",
+// "index.dbg" and "index.colors". Missing keys mean a factor of 1.
+struct Calibration{
+    map<string, double> factors;
+    int64_t n_runs = 0;
+
+    double get(const string& key) const;
+};
+
+// Samples a fraction of the distinct k-mers of the input by their hash values and extrapolates the
+// number of k-mers, core k-mers, node-color pairs and distinct color sets from the sample. Colors are
+// assigned like in the build command: one color per file, one color per sequence, or from the given
+// color files (one per sequence file). The number of distinct color sets is estimated with a
+// Chao1-type estimator corrected for sampling without replacement.
+Plan_Inputs estimate_plan_inputs(const vector<string>& seqfiles, const vector<string>& colorfiles, bool file_colors, int64_t k, bool reverse_complements, const string& coloring_structure_type, double sample_fraction, int64_t n_threads);
+
+Resource_Plan predict_resources(const Plan_Inputs& inputs, const Plan_Settings& settings, const Calibration& calibration);
+
+// Derives calibration factors from statistics files written by `themisto build --stats-out`.
+// For each run, the model is evaluated with the measured inputs of the run and the factor is the
+// ratio of the measured value to the predicted value. Memory and disk factors take the largest ratio
+// over the runs so that the plan errs on the safe side. Time factors take the average.
+Calibration load_calibration(const vector<string>& stats_files);
+
+// Files with one "key value" pair per line
+map<string, string> read_key_value_file(const string& filename);
+void write_key_value_file(const map<string, string>& kv, const string& filename);
+
+// Records the wall-clock time, peak resident memory and peak size of the temporary directory of each
+// stage of a build. A background thread samples the memory and disk usage a few times per second.
+class Build_Resource_Monitor{
+
+private:
+
+    struct Stage_Record{
+        string name;
+        double seconds = 0;
+        int64_t peak_rss_bytes = 0;
+        int64_t peak_temp_bytes = 0;
+    };
+
+    string temp_dir;
+    vector<Stage_Record> stages;
+    bool in_stage = false; // Whether stages.back() is still running
+    std::chrono::steady_clock::time_point stage_start;
+    std::mutex mutex; // Protects stages
+    std::atomic<bool> stop_flag = false;
+    std::thread sampler;
+
+    void sample();
+
+public:
+
+    Build_Resource_Monitor(const string& temp_dir);
+    ~Build_Resource_Monitor();
+
+    // Ends the current stage, if any, and starts a new one
+    void start_stage(const string& name);
+    void end_stage();
+
+    // Adds the per-stage measurements to kv as "[stage].seconds", "[stage].peak_rss_bytes" and "[stage].peak_temp_bytes"
+    void add_to(map<string, string>& kv);
+};
+
+int64_t current_rss_bytes();
+int64_t directory_size_in_bytes(const string& dir);
@@ -0,0 +1,83 @@
+/*
+ * C interface of libthemisto.
+ *
+ * Loads a Themisto index once and pseudoaligns batches of in-memory sequences against it,
+ * without temporary files or text parsing. All functions are safe to call concurrently on
+ * the same index. Functions that can fail return NULL or a nonzero value, and the reason is
+ * available from themisto_last_error() in the same thread.
+ *
+ * The ABI is versioned with THEMISTO_ABI_VERSION. Structs are only ever extended at the end.
+ */
+
+#ifndef THEMISTO_H
+#define THEMISTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define THEMISTO_ABI_VERSION 1
+
+typedef struct themisto_index themisto_index;
+
+typedef struct themisto_query_options{
+    double threshold;                 /* Fraction of k-mers required to report a color. 1 = intersection method. */
+    double relevant_kmers_fraction;   /* Report only reads with at least this fraction of k-mers with colors. */
+    int32_t ignore_unknown_kmers;     /* Ignore k-mers that are not in the index (threshold method only). */
+    int32_t reverse_complements;      /* Also search reverse complements (for indexes built with --forward-strand-only). */
+    int32_t sort_hits;                /* Sort the colors of each read. */
+    int32_t use_prefilter;            /* Use the k-mer prefilter if the index has one. */
+    int64_t n_threads;
+    int64_t batch_size_bytes;         /* Amount of sequence given to a thread at a time. */
+} themisto_query_options;
+
+/* Results of a batch in CSR layout: the colors of read i are colors[offsets[i]..offsets[i+1]).
+ * n_relevant_kmers[i] is the number of k-mers of read i with at least one color, or -1 if the
+ * read was not reported because it did not reach the relevant k-mers fraction. */
+typedef struct themisto_results{
+    int64_t n_reads;
+    int64_t* offsets;          /* n_reads + 1 elements */
+    int64_t* colors;           /* offsets[n_reads] elements */
+    int64_t* n_relevant_kmers; /* n_reads elements */
+} themisto_results;
+
+/* Called once for each reported read. Calls are serialized, but come from worker threads
+ * and not in input order. The colors array is only valid during the call. */
+typedef void (*themisto_result_callback)(void* user_data, int64_t read_id, const int64_t* colors, int64_t n_colors, int64_t n_relevant_kmers);
+
+int themisto_abi_version(void);
+
+/* Error message of the last failed call in this thread. */
+const char* themisto_last_error(void);
+
+void themisto_default_query_options(themisto_query_options* options);
+
+/* Loads [prefix].tdbg, [prefix].tcolors and [prefix].tprefilter if present. */
+themisto_index* themisto_load_index(const char* index_prefix);
+
+/* Loads an index from serialized buffers, for example from memory-mapped files. The buffers
+ * are only read during the call. The prefilter buffer may be NULL. */
+themisto_index* themisto_load_index_from_memory(const void* dbg_data, size_t dbg_size, const void* colors_data, size_t colors_size, const void* prefilter_data, size_t prefilter_size);
+
+void themisto_free_index(themisto_index* index);
+
+int64_t themisto_get_k(const themisto_index* index);
+int64_t themisto_number_of_colors(const themisto_index* index);
+
+/* Pseudoaligns n_reads sequences and stores the results into out, which must be freed with
+ * themisto_free_results. Returns 0 on success. */
+int themisto_pseudoalign(const themisto_index* index, const char* const* seqs, const int64_t* lengths, int64_t n_reads, const themisto_query_options* options, themisto_results* out);
+
+/* Like themisto_pseudoalign, but streams the results to the callback instead of storing them. */
+int themisto_pseudoalign_stream(const themisto_index* index, const char* const* seqs, const int64_t* lengths, int64_t n_reads, const themisto_query_options* options, themisto_result_callback callback, void* user_data);
+
+void themisto_free_results(themisto_results* results);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -8,9 +8,10 @@
 
 using namespace std;
 
-// Builds from existing index and serializes to disk
+// Builds from existing index and serializes to disk. The sets are copied in the permuted color ids
+// of the old coloring, and the permutation is carried over (see Coloring::reorder_colors).
 template<typename old_coloring_t, typename new_coloring_t> 
-void build_from_index(plain_matrix_sbwt_t& dbg, const old_coloring_t& old_coloring, const string& to_index_dbg, const string& to_index_colors){
+void build_from_index(plain_matrix_sbwt_t& dbg, const old_coloring_t& old_coloring, const string& to_index_dbg, const string& to_index_colors, bool reorder_colors, bool delta_color_sets, bool sort_color_sets, bool fast_color_set_lookup, int64_t n_threads){
 
     // TODO: This makes a ton of unnecessary copies of things and has high peak RAM
 
@@ -20,7 +21,7 @@ void build_from_index(plain_matrix_sbwt_t& dbg, const old_coloring_t& old_colori
     int64_t total_length = 0;
 
     for(int64_t i = 0; i < old_coloring.number_of_distinct_color_sets(); i++){
-        vector<int64_t> set = old_coloring.get_color_set_as_vector_by_color_set_id(i);
+        vector<int64_t> set = old_coloring.get_color_set_by_color_set_id(i).get_colors_as_vector();
 
         for(int64_t x : set) largest_color = max(largest_color, x);
         total_length += set.size();
@@ -31,7 +32,24 @@ void build_from_index(plain_matrix_sbwt_t& dbg, const old_coloring_t& old_colori
     typename new_coloring_t::colorset_storage_type new_storage(new_colorsets);
     new_coloring_t new_coloring(new_storage, 
                                 old_coloring.get_node_id_to_colorset_id_structure(),
-                                dbg, largest_color, total_length);
+                                dbg, largest_color, total_length, old_coloring.get_color_permutation());
+
+    if(reorder_colors){
+        write_log("Reordering colors", LogLevel::MAJOR);
+        new_coloring.reorder_colors(n_threads);
+    }
+    if(sort_color_sets){
+        write_log("Sorting color sets by popularity", LogLevel::MAJOR);
+        new_coloring.order_color_sets_by_popularity(n_threads);
+    }
+    if(delta_color_sets){
+        write_log("Choosing parents for delta encoded color sets", LogLevel::MAJOR);
+        new_coloring.delta_encode_color_sets(n_threads);
+    }
+    if(fast_color_set_lookup){
+        write_log("Building the color set descriptor table", LogLevel::MAJOR);
+        new_coloring.build_color_set_descriptor_table();
+    }
 
     write_log("Serializing to " + to_index_dbg + " and " + to_index_colors, LogLevel::MAJOR);
 
@@ -42,7 +60,7 @@ void build_from_index(plain_matrix_sbwt_t& dbg, const old_coloring_t& old_colori
     dbg.serialize(dbg_out.stream);
 }
 
-void transform_existing_index(const string& from_index_dbg, const string& from_index_coloring, const string& to_index_dbg, const string& to_index_coloring, const string& new_index_color_set_type){
+void transform_existing_index(const string& from_index_dbg, const string& from_index_coloring, const string& to_index_dbg, const string& to_index_coloring, const string& new_index_color_set_type, bool reorder_colors = false, bool delta_color_sets = false, bool sort_color_sets = false, bool fast_color_set_lookup = false, int64_t n_threads = 1){
 
     write_log("Building new structure of type " + new_index_color_set_type, LogLevel::MAJOR);
 
@@ -54,7 +72,7 @@ void transform_existing_index(const string& from_index_dbg, const string& from_i
 
     sbwt::write_log("Loading coloring", sbwt::LogLevel::MAJOR);
     std::variant<Coloring<SDSL_Variant_Color_Set>, Coloring<Roaring_Color_Set>> old_coloring;
-    load_coloring(from_index_coloring, *dbg_ptr, old_coloring);
+    load_coloring(from_index_coloring, *dbg_ptr, old_coloring, n_threads);
 
     if(std::holds_alternative<Coloring<SDSL_Variant_Color_Set>>(old_coloring))
         write_log("sdsl coloring structure loaded", LogLevel::MAJOR);
@@ -63,9 +81,9 @@ void transform_existing_index(const string& from_index_dbg, const string& from_i
 
     auto visitor = [&](auto& old){
         if(new_index_color_set_type == "sdsl-hybrid"){
-            build_from_index<decltype(old), Coloring<SDSL_Variant_Color_Set>>(*dbg_ptr, old, to_index_dbg, to_index_coloring);
+            build_from_index<decltype(old), Coloring<SDSL_Variant_Color_Set>>(*dbg_ptr, old, to_index_dbg, to_index_coloring, reorder_colors, delta_color_sets, sort_color_sets, fast_color_set_lookup, n_threads);
         } else if(new_index_color_set_type == "roaring"){
-            build_from_index<decltype(old), Coloring<Roaring_Color_Set>>(*dbg_ptr, old,  to_index_dbg, to_index_coloring);
+            build_from_index<decltype(old), Coloring<Roaring_Color_Set>>(*dbg_ptr, old, to_index_dbg, to_index_coloring, reorder_colors, delta_color_sets, sort_color_sets, fast_color_set_lookup, n_threads);
         } else{
             throw std::runtime_error("Unkown coloring structure type: " + new_index_color_set_type);
         }
@@ -0,0 +1,228 @@
+#include "build_checkpoint.hh"
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <set>
+#include <zlib.h>
+#include "sbwt/globals.hh"
+
+static const string checkpoint_dir_prefix = "themisto-checkpoint-";
+
+uint32_t file_crc32(const string& filename){
+    std::ifstream in(filename, ios::binary);
+    if(!in.good()) throw std::runtime_error("Could not open " + filename);
+    vector<char> buffer(1 << 20);
+    uLong crc = crc32(0L, Z_NULL, 0);
+    while(in){
+        in.read(buffer.data(), buffer.size());
+        crc = crc32_z(crc, (const Bytef*)buffer.data(), in.gcount());
+    }
+    return crc;
+}
+
+static string fingerprint_hash(const string& fingerprint){
+    uLong crc = crc32_z(crc32(0L, Z_NULL, 0), (const Bytef*)fingerprint.data(), fingerprint.size());
+    stringstream ss;
+    ss << std::hex << crc << "-" << std::dec << fingerprint.size();
+    return ss.str();
+}
+
+Build_Checkpoint::Build_Checkpoint(const string& temp_dir, const string& fingerprint, bool resume, bool checksums) : is_enabled(true), checksums(checksums), fingerprint(fingerprint_hash(fingerprint)){
+    dir = temp_dir + "/" + checkpoint_dir_prefix + this->fingerprint;
+    manifest_file = dir + "/manifest.txt";
+
+    if(!resume && std::filesystem::exists(manifest_file)){
+        throw std::runtime_error("There is a checkpoint of an interrupted build with the same configuration in " + dir
+                                 + ". Give --resume to continue it, or delete the directory to start from the beginning.");
+    }
+    std::filesystem::create_directories(dir);
+
+    bool have_manifest = resume && load_manifest();
+    if(resume && !have_manifest){
+        sbwt::write_log("No resumable build with the same configuration in " + temp_dir + ". Starting from the beginning.", sbwt::LogLevel::MAJOR);
+    }
+
+    // The last stage after which all live files are intact
+    int64_t resume_after = -1;
+    if(have_manifest){
+        for(resume_after = (int64_t)stages.size() - 1; resume_after >= 0; resume_after--){
+            if(live_files_intact(resume_after)) break;
+        }
+    }
+
+    // Forget the stages after the resume point. Their outputs can not be used.
+    set<string> kept_files;
+    for(int64_t i = 0; i <= resume_after; i++)
+        for(const File_Record& f : stages[i].files) kept_files.insert(f.path);
+    for(int64_t i = resume_after + 1; i < (int64_t)stages.size(); i++){
+        for(const File_Record& f : stages[i].files)
+            if(!kept_files.count(f.path)) remove_owned(f.path);
+    }
+    stages.resize(resume_after + 1);
+
+    for(const Stage_Record& S : stages)
+        sbwt::write_log("Resuming: stage " + S.name + " already done", sbwt::LogLevel::MAJOR);
+
+    write_manifest();
+}
+
+bool Build_Checkpoint::owns(const string& path) const{
+    return std::filesystem::path(path).parent_path() == std::filesystem::path(dir);
+}
+
+void Build_Checkpoint::remove_owned(const string& path) const{
+    if(owns(path)) std::filesystem::remove(path);
+}
+
+bool Build_Checkpoint::load_manifest(){
+    stages.clear();
+    std::ifstream in(manifest_file);
+    if(!in.good()) return false;
+
+    string line;
+    bool fingerprint_matches = false;
+    try{
+        while(getline(in, line)){
+            vector<string> fields;
+            stringstream ss(line);
+            string field;
+            while(getline(ss, field, '\t')) fields.push_back(field);
+            if(fields.size() == 0) continue;
+
+            if(fields[0] == "fingerprint" && fields.size() == 2){
+                fingerprint_matches = fields[1] == fingerprint;
+            } else if(fields[0] == "stage" && fields.size() == 2){
+                stages.push_back({fields[1], {}, {}, {}});
+            } else if(fields[0] == "file" && fields.size() == 4 && stages.size() > 0){
+                stages.back().files.push_back({fields[1], stoll(fields[2]), fields[3] == "-" ? -1 : stoll(fields[3])});
+            } else if(fields[0] == "value" && fields.size() == 3 && stages.size() > 0){
+                stages.back().values[fields[1]] = fields[2];
+            } else if(fields[0] == "released" && fields.size() == 2 && stages.size() > 0){
+                stages.back().released.push_back(fields[1]);
+            } else if(fields[0] != "themisto-build-manifest"){
+                throw std::runtime_error("Invalid line: " + line);
+            }
+        }
+    } catch(const std::exception& e){
+        sbwt::write_log("Ignoring a corrupt build manifest " + manifest_file + ": " + e.what(), sbwt::LogLevel::MAJOR);
+        fingerprint_matches = false;
+    }
+
+    if(!fingerprint_matches){
+        // The manifest is not usable. The files are left alone and overwritten when the stages are rerun.
+        stages.clear();
+        return false;
+    }
+    return true;
+}
+
+void Build_Checkpoint::write_manifest() const{
+    string temp_file = manifest_file + ".tmp";
+    {
+        std::ofstream out(temp_file);
+        out << "themisto-build-manifest\t2\n";
+        out << "fingerprint\t" << fingerprint << "\n";
+        for(const Stage_Record& S : stages){
+            out << "stage\t" << S.name << "\n";
+            for(const File_Record& f : S.files){
+                out << "file\t" << f.path << "\t" << f.size << "\t";
+                if(f.crc == -1) out << "-\n";
+                else out << f.crc << "\n";
+            }
+            for(const auto& [key, value] : S.values) out << "value\t" << key << "\t" << value << "\n";
+            for(const string& path : S.released) out << "released\t" << path << "\n";
+        }
+        out.flush();
+        if(!out.good()) throw std::runtime_error("Error writing " + temp_file);
+    }
+    std::filesystem::rename(temp_file, manifest_file); // Atomic
+}
+
+bool Build_Checkpoint::live_files_intact(int64_t last_stage) const{
+    set<string> released;
+    for(int64_t i = 0; i <= last_stage; i++)
+        for(const string& path : stages[i].released) released.insert(path);
+
+    for(int64_t i = 0; i <= last_stage; i++){
+        for(const File_Record& f : stages[i].files){
+            if(released.count(f.path)) continue;
+            std::error_code ec;
+            if(!std::filesystem::exists(f.path, ec)) return false;
+            if((int64_t)std::filesystem::file_size(f.path, ec) != f.size || ec) return false;
+            if(checksums && f.crc != -1 && file_crc32(f.path) != f.crc){
+                sbwt::write_log("Checksum mismatch in " + f.path, sbwt::LogLevel::MAJOR);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+const Build_Checkpoint::Stage_Record* Build_Checkpoint::find(const string& stage) const{
+    for(const Stage_Record& S : stages) if(S.name == stage) return &S;
+    return nullptr;
+}
+
+bool Build_Checkpoint::is_done(const string& stage) const{
+    return is_enabled && find(stage) != nullptr;
+}
+
+string Build_Checkpoint::get_value(const string& stage, const string& key) const{
+    const Stage_Record* S = find(stage);
+    if(S == nullptr || S->values.count(key) == 0)
+        throw std::runtime_error("Build manifest has no value " + key + " for stage " + stage);
+    return S->values.at(key);
+}
+
+string Build_Checkpoint::get_file(const string& stage, int64_t i) const{
+    const Stage_Record* S = find(stage);
+    if(S == nullptr || i >= (int64_t)S->files.size())
+        throw std::runtime_error("Build manifest has no file " + to_string(i) + " for stage " + stage);
+    return S->files[i].path;
+}
+
+string Build_Checkpoint::keep(const string& stage, const string& file, int64_t index){
+    if(!is_enabled) return file;
+
+    // Keep the extensions, because some readers detect the file format from them
+    string basename = std::filesystem::path(file).filename().string();
+    string extensions = basename.find('.') == string::npos ? "" : basename.substr(basename.find('.'));
+    string stable_name = dir + "/" + stage + "-" + to_string(index) + extensions;
+    std::filesystem::rename(file, stable_name);
+    return stable_name;
+}
+
+void Build_Checkpoint::mark_done(const string& stage, const vector<string>& files, const map<string, string>& values, const vector<string>& released){
+    if(!is_enabled) return;
+
+    Stage_Record S;
+    S.name = stage;
+    for(const string& path : files) S.files.push_back({path, (int64_t)std::filesystem::file_size(path), checksums ? (int64_t)file_crc32(path) : -1});
+    S.values = values;
+    S.released = released;
+    stages.push_back(S);
+    write_manifest();
+
+    // Only outputs recorded for earlier stages are released
+    set<string> recorded;
+    for(int64_t i = 0; i + 1 < (int64_t)stages.size(); i++)
+        for(const File_Record& f : stages[i].files) recorded.insert(f.path);
+    for(const string& path : released)
+        if(recorded.count(path)) remove_owned(path);
+}
+
+void Build_Checkpoint::finish(){
+    if(!is_enabled) return;
+
+    set<string> released;
+    for(const Stage_Record& S : stages)
+        for(const string& path : S.released) released.insert(path);
+    for(const Stage_Record& S : stages)
+        for(const File_Record& f : S.files)
+            if(!released.count(f.path)) remove_owned(f.path);
+
+    stages.clear();
+    std::filesystem::remove(manifest_file);
+    std::error_code ec;
+    std::filesystem::remove(dir, ec); // Fails if the directory is not empty, which is fine
+}
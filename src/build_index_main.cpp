@@ -2,6 +2,7 @@
 #include "zpipe.hh"
 #include <string>
 #include <cstring>
+#include <filesystem>
 #include "version.h"
 #include "sbwt/globals.hh"
 #include "sbwt/variants.hh"
@@ -12,6 +13,10 @@
 #include "coloring/Coloring_Builder.hh"
 #include "coloring/Coloring_builder_from_ggcat.hh"
 #include "transform_index.hh"
+#include "kmer_prefilter.hh"
+#include "resource_planner.hh"
+#include "build_checkpoint.hh"
+#include "kmer_set_input.hh"
 
 using namespace std;
 
@@ -135,7 +140,9 @@ struct Build_Config{
     vector<string> colorfiles;
     string index_dbg_file;
     string index_color_file;
+    string index_prefilter_file;
     string temp_dir;
+    string temp_compression = "delta";
     string coloring_structure_type;
     string from_index;
     seq_io::FileFormat input_format;
@@ -147,6 +154,19 @@ struct Build_Config{
     bool verbose = false;
     bool silent = false;
     bool reverse_complements = false;
+    bool build_prefilter = false;
+    double prefilter_bits_per_kmer = 10;
+    string stats_file; // Empty if statistics are not recorded
+    bool checkpoint = false; // Record the completed stages so that the build can be resumed (see build_checkpoint.hh)
+    bool checkpoint_checksums = false; // Also record and check checksums of the outputs of the stages
+    bool resume = false;
+    bool kmer_sets = false; // The input files are k-mer sets (see kmer_set_input.hh)
+    int64_t min_abundance = 1; // K-mers that occur fewer times in the input are left out
+    int64_t min_colors = 1; // K-mers with fewer colors are left out
+    bool reorder_colors = false; // Permute the color ids to cluster co-occurring colors (see Coloring::reorder_colors)
+    bool delta_color_sets = false; // Store the color sets on disk as differences to similar sets (see delta_parents.hh)
+    bool sort_color_sets = false; // Number the color sets by popularity (see Coloring::order_color_sets_by_popularity)
+    bool fast_color_set_lookup = false; // Store the color set descriptor table in the index (see Color_Set_Storage::build_descriptor_table)
 
     bool manual_colors = false;
     bool file_colors = false;
@@ -164,7 +184,7 @@ struct Build_Config{
             // From fasta
             sbwt::check_true(seqfiles.size() > 0, "Input file not set");
             for(const string& S : seqfiles)
-                sbwt::check_readable(S);
+                sbwt::check_readable(kmer_sets ? kmer_set_data_file(S) : S);
             if(!load_dbg){
                 sbwt::check_true(k != 0, "Parameter k not set");
                 sbwt::check_true(k <= MAX_KMER_LENGTH, "Maximum allowed k is " + std::to_string(MAX_KMER_LENGTH) + ". To increase the limit, recompile by first running cmake with the option `-DMAX_KMER_LENGTH=n`, where n is a number up to 255, and then running `make` again."); // 255 is max because of KMC
@@ -177,6 +197,8 @@ struct Build_Config{
 
         sbwt::check_writable(index_dbg_file);
         sbwt::check_writable(index_color_file);
+        sbwt::check_true(!delta_color_sets || coloring_structure_type == "sdsl-hybrid", "--delta-color-sets requires --coloring-structure-type sdsl-hybrid");
+        sbwt::check_true(!fast_color_set_lookup || coloring_structure_type == "sdsl-hybrid", "--fast-color-set-lookup requires --coloring-structure-type sdsl-hybrid");
 
         if(colorfiles.size() > 0){
             sbwt::check_true(!no_colors, "Must not give both --no-colors and --manual-colors");
@@ -192,10 +214,65 @@ struct Build_Config{
 
         sbwt::check_true(temp_dir != "", "Temp directory not set");
         check_dir_exists(temp_dir);
+        external_sort::parse_temp_compression(temp_compression); // Throws if unknown
 
         sbwt::check_true(memory_megas > 0, "Memory budget must be positive");
         sbwt::check_true(colorset_sampling_distance >= 1, "Colorset sampling distance must be positive");
 
+        if(build_prefilter){
+            sbwt::check_true(from_index == "", "Must not give both --from-index and --prefilter");
+            sbwt::check_true(load_dbg || k <= 32, "The k-mer prefilter supports only k <= 32");
+            sbwt::check_true(prefilter_bits_per_kmer > 0, "Prefilter bits per k-mer must be positive");
+        }
+
+        if(resume) sbwt::check_true(from_index == "", "Must not give both --from-index and --resume");
+        if(checkpoint) sbwt::check_true(from_index == "", "Must not give both --from-index and --checkpoint");
+
+        sbwt::check_true(min_abundance >= 1, "Minimum abundance must be positive");
+        sbwt::check_true(min_colors >= 1, "Minimum number of colors must be positive");
+        if(min_colors > 1){
+            sbwt::check_true(!no_colors, "Must not give both --no-colors and --min-colors");
+            sbwt::check_true(!load_dbg, "Must not give both --load-dbg and --min-colors");
+        }
+        if(load_dbg && min_abundance > 1){
+            sbwt::write_log("Warning: value of parameter --min-abundance is ignored because the DBG is not built, but loaded from disk instead", sbwt::LogLevel::MAJOR);
+        }
+
+        if(kmer_sets){
+            sbwt::check_true(!manual_colors && !sequence_colors, "K-mer sets are colored with --file-colors");
+            sbwt::check_true(reverse_complements, "Must not give both --kmer-sets and --forward-strand-only");
+            sbwt::check_true(min_abundance == 1, "Must not give both --kmer-sets and --min-abundance, because the joined k-mer sets have every k-mer once");
+        }
+
+        if(stats_file != ""){
+            sbwt::check_true(from_index == "", "Must not give both --from-index and --stats-out");
+            sbwt::check_writable(stats_file);
+        }
+
+    }
+
+    // False if k-mers of the input may be missing from the DBG. A loaded DBG may have been built with filters.
+    bool all_kmers_indexed() const{
+        return !load_dbg && min_abundance == 1 && min_colors == 1;
+    }
+
+    // Describes everything that affects the results of the build stages, for resuming (see build_checkpoint.hh).
+    // The number of threads and the memory budget may change between runs.
+    string checkpoint_fingerprint() const{
+        stringstream ss;
+        ss << "k=" << k << " rc=" << reverse_complements << " del_non_ACGT=" << del_non_ACGT << " load_dbg=" << load_dbg
+           << " colors=" << no_colors << manual_colors << file_colors << sequence_colors
+           << " d=" << colorset_sampling_distance << " structure=" << coloring_structure_type
+           << " prefilter=" << build_prefilter << "," << prefilter_bits_per_kmer << " temp_compression=" << temp_compression
+           << " dbg=" << index_dbg_file << " colors=" << index_color_file;
+        ss << " kmer_sets=" << kmer_sets << " min_abundance=" << min_abundance << " min_colors=" << min_colors << " reorder_colors=" << reorder_colors << " delta_color_sets=" << delta_color_sets << " sort_color_sets=" << sort_color_sets << " fast_color_set_lookup=" << fast_color_set_lookup;
+        for(const vector<string>* files : {&seqfiles, &colorfiles}){
+            for(const string& f : *files){
+                string data = kmer_sets ? kmer_set_data_file(f) : f;
+                ss << " " << f << "," << std::filesystem::file_size(data) << "," << std::filesystem::last_write_time(data).time_since_epoch().count();
+            }
+        }
+        return ss.str();
     }
 
     string to_string(){
@@ -210,6 +287,16 @@ struct Build_Config{
         ss << "Index de Bruijn graph output file = " << index_dbg_file << "\n";
         ss << "Index coloring output file = " << index_color_file << "\n";
         ss << "Temporary directory = " << temp_dir << "\n";
+        ss << "Temporary file compression = " << temp_compression << "\n";
+        ss << "Checkpoint = " << (checkpoint ? "true" : "false") << (checkpoint_checksums ? " (with checksums)" : "") << "\n";
+        ss << "Resume = " << (resume ? "true" : "false") << "\n";
+        ss << "K-mer sets = " << (kmer_sets ? "true" : "false") << "\n";
+        ss << "Minimum abundance = " << min_abundance << "\n";
+        ss << "Minimum number of colors = " << min_colors << "\n";
+        ss << "Reorder colors = " << (reorder_colors ? "true" : "false") << "\n";
+        ss << "Delta encoded color sets = " << (delta_color_sets ? "true" : "false") << "\n";
+        ss << "Sort color sets by popularity = " << (sort_color_sets ? "true" : "false") << "\n";
+        ss << "Fast color set lookup = " << (fast_color_set_lookup ? "true" : "false") << "\n";
         ss << "k = " << k << "\n";
         ss << "Reverse complements = " << (reverse_complements ? "true" : "false") << "\n";
         ss << "Number of threads = " << n_threads << "\n";
@@ -220,6 +307,7 @@ struct Build_Config{
         ss << "Load DBG = " << (load_dbg ? "true" : "false") << "\n";
         ss << "Handling of non-ACGT characters = " << (del_non_ACGT ? "delete" : "randomize") << "\n";
         ss << "Coloring structure type: " << coloring_structure_type << "\n"; 
+        ss << "K-mer prefilter = " << (build_prefilter ? std::to_string(prefilter_bits_per_kmer) + " bits per k-mer" : "none") << "\n";
 
         string verbose_level = "normal";
         if(verbose) verbose_level = "verbose";
@@ -250,26 +338,165 @@ string generate_default_colorfile(sequence_reader_t& reader, bool reverse_comple
 }
 
 
+// Adds the properties of the coloring that the resource planner uses to the build statistics
+template<typename colorset_t>
+void add_coloring_stats(const Coloring<colorset_t>& coloring, map<string, string>& stats){
+    int64_t storage_bytes = 0;
+    for(auto [component, bytes] : coloring.space_breakdown())
+        if(component.starts_with("color-set-storage-")) storage_bytes += bytes;
+    stats["n_colors"] = to_string(coloring.largest_color() + 1);
+    stats["n_distinct_color_sets"] = to_string(coloring.number_of_distinct_color_sets());
+    stats["sum_of_distinct_color_set_lengths"] = to_string(coloring.sum_of_all_distinct_color_set_lengths());
+    stats["color_set_storage_bytes"] = to_string(storage_bytes);
+}
+
+template<typename reader_t>
+void count_sequences_and_bases(const vector<string>& seqfiles, int64_t& n_sequences, int64_t& n_bases){
+    for(const string& filename : seqfiles){
+        reader_t reader(filename);
+        while(true){
+            int64_t len = reader.get_next_read_to_buffer();
+            if(len == 0) break;
+            n_sequences++;
+            n_bases += len;
+        }
+    }
+}
+
+// Writes the statistics file for resource planning (see resource_planner.hh)
+// The builders add the k and the number of k-mers, and the properties of the coloring.
+void write_build_stats(const Build_Config& C, const vector<string>& original_seqfiles, Build_Resource_Monitor& monitor, map<string, string>& stats){
+    monitor.add_to(stats);
+
+    Plan_Settings settings;
+    settings.colorset_sampling_distance = C.colorset_sampling_distance;
+    settings.coloring_structure_type = C.coloring_structure_type;
+    settings.mem_megas = C.memory_megas;
+    settings.n_threads = C.n_threads;
+    settings.reverse_complements = C.reverse_complements;
+    settings.ggcat = C.file_colors;
+    settings.prefilter = C.build_prefilter;
+    settings.prefilter_bits_per_kmer = C.prefilter_bits_per_kmer;
+    settings.add_to(stats);
+
+    // Counted after the build so that this does not show up in the measurements
+    int64_t n_sequences = 0, n_bases = 0, n_bytes = 0;
+    if(seq_io::figure_out_file_format(original_seqfiles[0]).gzipped)
+        count_sequences_and_bases<seq_io::Reader<seq_io::Buffered_ifstream<seq_io::zstr::ifstream>>>(original_seqfiles, n_sequences, n_bases);
+    else
+        count_sequences_and_bases<seq_io::Reader<seq_io::Buffered_ifstream<std::ifstream>>>(original_seqfiles, n_sequences, n_bases);
+    for(const string& filename : original_seqfiles) n_bytes += std::filesystem::file_size(filename);
+
+    stats["input_bytes"] = to_string(n_bytes);
+    stats["input_bases"] = to_string(n_bases);
+    stats["n_sequences"] = to_string(n_sequences);
+    stats["index_dbg_bytes"] = to_string(std::filesystem::file_size(C.index_dbg_file));
+    if(std::filesystem::exists(C.index_color_file))
+        stats["index_colors_bytes"] = to_string(std::filesystem::file_size(C.index_color_file));
+
+    write_key_value_file(stats, C.stats_file);
+    write_log("Wrote build statistics to " + C.stats_file, LogLevel::MAJOR);
+}
+
+std::unique_ptr<plain_matrix_sbwt_t> build_sbwt(const vector<string>& input_files, int64_t k, int64_t min_abundance, int64_t n_threads, int64_t memory_megas, const string& temp_dir){
+    sbwt::plain_matrix_sbwt_t::BuildConfig sbwt_config;
+    sbwt_config.build_streaming_support = true;
+    sbwt_config.input_files = input_files;
+    sbwt_config.k = k;
+    sbwt_config.max_abundance = 1e9;
+    sbwt_config.min_abundance = min_abundance;
+    sbwt_config.n_threads = n_threads;
+    sbwt_config.ram_gigas = max((int64_t)2, memory_megas / (1 << 10)); // KMC requires at least 2 GB
+    sbwt_config.temp_dir = temp_dir;
+    return std::make_unique<sbwt::plain_matrix_sbwt_t>(sbwt_config);
+}
+
+// Finds the k-mers of the DBG that have at least C.min_colors colors, and writes them to a new FASTA file.
+// Each maximal run of kept k-mers of an input sequence is written as one sequence, and each k-mer is
+// written only once. With reverse complements, both orientations are written.
+template<typename reader_t>
+string write_kmers_with_enough_colors(const plain_matrix_sbwt_t& dbg, Metadata_Stream* cfs, const Build_Config& C){
+    reader_t reader(C.seqfiles);
+    if(C.reverse_complements) reader.enable_reverse_complements();
+    Coloring_Builder<SDSL_Variant_Color_Set, reader_t> cb;
+    cb.all_kmers_indexed = C.all_kmers_indexed();
+    sdsl::bit_vector keep = cb.mark_nodes_with_enough_colors(dbg, reader, cfs, C.min_colors, C.memory_megas * (1 << 20), C.n_threads);
+
+    write_log("Writing the k-mers with at least " + to_string(C.min_colors) + " colors", LogLevel::MAJOR);
+    reader.rewind_to_start();
+    sdsl::bit_vector written(dbg.number_of_subsets(), 0);
+    string outfile = get_temp_file_manager().create_filename("", ".fna");
+    sbwt::throwing_ofstream out(outfile);
+    int64_t k = dbg.get_k();
+    int64_t len;
+    while((len = reader.get_next_read_to_buffer()) > 0){
+        if(len < k) continue;
+        vector<int64_t> nodes = dbg.streaming_search(reader.read_buf, len);
+        int64_t run_start = 0; // Start of the current run of k-mers to write
+        for(int64_t i = 0; i <= (int64_t)nodes.size(); i++){
+            bool write = i < (int64_t)nodes.size() && nodes[i] >= 0 && keep[nodes[i]] && !written[nodes[i]];
+            if(write){
+                written[nodes[i]] = 1;
+                continue;
+            }
+            if(i > run_start){ // Write the k-mers run_start..i-1 as one sequence
+                out.stream << ">\n";
+                out.stream.write(reader.read_buf + run_start, i - 1 + k - run_start);
+                out.stream << "\n";
+            }
+            run_start = i + 1;
+        }
+    }
+    return outfile;
+}
+
 // Builds and serializes to disk
 template<typename colorset_t>
-void build_coloring(plain_matrix_sbwt_t& dbg, Metadata_Stream* cfs, const Build_Config& C){
+void build_coloring(plain_matrix_sbwt_t& dbg, Metadata_Stream* cfs, const Build_Config& C, map<string, string>* stats, Build_Checkpoint* checkpoint){
 
     Coloring<colorset_t> coloring;
     if(C.input_format.gzipped){
         typedef seq_io::Multi_File_Reader<seq_io::Reader<seq_io::Buffered_ifstream<seq_io::zstr::ifstream>>> reader_t; // gzipped
         Coloring_Builder<colorset_t, reader_t> cb;
+        cb.all_kmers_indexed = C.all_kmers_indexed();
         reader_t reader(C.seqfiles);
         if(C.reverse_complements) reader.enable_reverse_complements();
-        cb.build_coloring(coloring, dbg, reader, cfs, C.memory_megas * (1 << 20), C.n_threads, C.colorset_sampling_distance);
+        cb.build_coloring(coloring, dbg, reader, cfs, C.memory_megas * (1 << 20), C.n_threads, C.colorset_sampling_distance, checkpoint);
+        if(stats != nullptr){
+            (*stats)["n_core_kmers"] = to_string(cb.n_core_kmers);
+            (*stats)["n_node_color_pairs"] = to_string(cb.n_node_color_pairs);
+        }
     } else{
         typedef seq_io::Multi_File_Reader<seq_io::Reader<seq_io::Buffered_ifstream<std::ifstream>>> reader_t; // not gzipped
         Coloring_Builder<colorset_t, reader_t> cb; // Builder without gzipped input
+        cb.all_kmers_indexed = C.all_kmers_indexed();
         reader_t reader(C.seqfiles);
         if(C.reverse_complements) reader.enable_reverse_complements();
-        cb.build_coloring(coloring, dbg, reader, cfs, C.memory_megas * (1 << 20), C.n_threads, C.colorset_sampling_distance);        
+        cb.build_coloring(coloring, dbg, reader, cfs, C.memory_megas * (1 << 20), C.n_threads, C.colorset_sampling_distance, checkpoint);
+        if(stats != nullptr){
+            (*stats)["n_core_kmers"] = to_string(cb.n_core_kmers);
+            (*stats)["n_node_color_pairs"] = to_string(cb.n_node_color_pairs);
+        }
+    }
+    if(C.reorder_colors){
+        sbwt::write_log("Reordering colors", sbwt::LogLevel::MAJOR);
+        coloring.reorder_colors(C.n_threads, C.memory_megas * (1 << 20));
+    }
+    if(C.sort_color_sets){
+        sbwt::write_log("Sorting color sets by popularity", sbwt::LogLevel::MAJOR);
+        coloring.order_color_sets_by_popularity(C.n_threads);
+    }
+    if(C.delta_color_sets){
+        sbwt::write_log("Choosing parents for delta encoded color sets", sbwt::LogLevel::MAJOR);
+        coloring.delta_encode_color_sets(C.n_threads);
+    }
+    if(C.fast_color_set_lookup){
+        sbwt::write_log("Building the color set descriptor table", sbwt::LogLevel::MAJOR);
+        coloring.build_color_set_descriptor_table();
     }
     sbwt::throwing_ofstream out(C.index_color_file, ios::binary);
     coloring.serialize(out.stream);
+    if(stats != nullptr) add_coloring_stats(coloring, *stats);
 }
 
 
@@ -278,7 +505,7 @@ bool has_suffix_dot_txt(const string& S){
 }
 
 template<typename color_set_t>
-int build_index_with_ggcat(int64_t k, int64_t n_threads, string index_dbg_file, string index_color_file, string temp_dir, int64_t mem_megas, int64_t colorset_sampling_distance, vector<string>& seqfiles, bool load_dbg);
+int build_index_with_ggcat(int64_t k, int64_t n_threads, string index_dbg_file, string index_color_file, string temp_dir, int64_t mem_megas, int64_t colorset_sampling_distance, vector<string>& seqfiles, bool load_dbg, string index_prefilter_file, double prefilter_bits_per_kmer, int64_t min_abundance, int64_t min_colors, bool reorder_colors, bool delta_color_sets, bool sort_color_sets, bool fast_color_set_lookup, Build_Resource_Monitor* monitor = nullptr, map<string, string>* stats = nullptr, Build_Checkpoint* checkpoint = nullptr);
 
 Build_Config parse_build_options(int argc_given, char** argv_given){
 
@@ -347,6 +574,20 @@ Build_Config parse_build_options(int argc_given, char** argv_given){
         ("s,coloring-structure-type", "Type of coloring structure to build (\"sdsl-hybrid\", \"roaring\").", cxxopts::value<string>()->default_value("sdsl-hybrid"))
         ("from-index", "Take as input a pre-built Themisto index. Builds a new index in the format specified by --coloring-structure-type. This is currently implemented by decompressing the distinct color sets in memory before re-encoding them, so this might take a lot of RAM.",  cxxopts::value<string>())
         ("silent", "Print as little as possible to stderr (only errors).", cxxopts::value<bool>()->default_value("false"))
+        ("prefilter", "Also build a k-mer prefilter into [prefix].tprefilter. Pseudoalign uses it to skip reads that can not have enough k-mers in the index, which is much faster if most reads do not hit the index. Supports k up to 32.", cxxopts::value<bool>()->default_value("false"))
+        ("prefilter-bits-per-kmer", "Size of the k-mer prefilter in bits per k-mer. More bits give fewer false positives.", cxxopts::value<double>()->default_value("10"))
+        ("temp-compression", "Compression of the temporary files of the color construction: \"none\", \"delta\" (delta coding, fast) or \"delta-zlib\" (delta coding followed by zlib, smaller but slower). Compression helps when the temporary directory is on a slow or shared disk.", cxxopts::value<string>()->default_value("delta"))
+        ("min-abundance", "Leave out k-mers that occur fewer than this many times in the input, counting both orientations. Removes sequencing errors from read-based references.", cxxopts::value<int64_t>()->default_value("1"))
+        ("min-colors", "Leave out k-mers that have fewer than this many distinct colors. This removes k-mers that are unique to a single color, for example. Not available with --load-dbg.", cxxopts::value<int64_t>()->default_value("1"))
+        ("kmer-sets", "The input files are precomputed k-mer sets instead of sequences: KMC databases, given as paths without the .kmc_pre and .kmc_suf extensions, or text files with one k-mer per line (anything after the k-mer on a line is ignored). A single text file must not have the extension .txt, which is for lists of files. Each set gets its own color, and reverse complements are indexed. Each set is held in memory while it is read, which takes about 32 bytes per k-mer for k <= 32 and must fit in --mem-gigas.", cxxopts::value<bool>()->default_value("false"))
+        ("reorder-colors", "Renumber the colors internally so that colors that share many k-mers get nearby ids. This makes the color sets compress better and speeds up queries on indexes with many similar references. Colors are still reported in the original numbering. Can also be used with --from-index.", cxxopts::value<bool>()->default_value("false"))
+        ("delta-color-sets", "Store each color set in the index file as the difference to a similar color set when that is smaller. This can make the index file much smaller on large pangenomes. The sets are decoded when the index is loaded, so queries are not slower, but loading is. Only with --coloring-structure-type sdsl-hybrid. Can also be used with --from-index.", cxxopts::value<bool>()->default_value("false"))
+        ("fast-color-set-lookup", "Store a table with the location of every distinct color set in the index, so that fetching a color set is faster in queries. Takes up to 8 bytes per distinct color set on disk and in memory. Only with --coloring-structure-type sdsl-hybrid. Can also be used with --from-index.", cxxopts::value<bool>()->default_value("false"))
+        ("sort-color-sets-by-popularity", "Number the distinct color sets in descending order of the number of k-mers that have them, and store the small numbers of the common sets in fewer bits. This makes the index smaller when a few color sets cover most of the k-mers. Can also be used with --from-index.", cxxopts::value<bool>()->default_value("false"))
+        ("checkpoint", "Record the completed stages of the build in a subdirectory of the temporary directory, so that an interrupted build can be continued with --resume. The outputs of the completed stages are kept until the build finishes, so this needs more temporary disk space.", cxxopts::value<bool>()->default_value("false"))
+        ("checkpoint-checksums", "With --checkpoint, also record checksums of the outputs of the stages, and check them when resuming. Otherwise only the sizes of the files are checked.", cxxopts::value<bool>()->default_value("false"))
+        ("resume", "Continue an interrupted build from the last completed stage recorded with --checkpoint. The same --temp-dir and the same options must be given. The number of threads and the memory budget may differ. Implies --checkpoint.", cxxopts::value<bool>()->default_value("false"))
+        ("stats-out", "Record the time, peak memory and peak temporary disk usage of each stage of the build together with the properties of the index into this file. These files can be given to `themisto plan --calibration`.", cxxopts::value<string>()->default_value(""))
     ;
 
     int64_t old_argc = argc; // Must store this because the parser modifies it
@@ -367,7 +608,9 @@ Build_Config parse_build_options(int argc_given, char** argv_given){
     C.n_threads = opts["n-threads"].as<int64_t>();
     C.index_dbg_file = opts["index-prefix"].as<string>() + ".tdbg";
     C.index_color_file = opts["index-prefix"].as<string>() + ".tcolors";
+    C.index_prefilter_file = opts["index-prefix"].as<string>() + ".tprefilter";
     C.temp_dir = opts["temp-dir"].as<string>();
+    C.temp_compression = opts["temp-compression"].as<string>();
     C.load_dbg = opts["load-dbg"].as<bool>();
     C.memory_megas = opts["mem-gigas"].as<int64_t>() * 1024;
     C.no_colors = opts["no-colors"].as<bool>();
@@ -379,6 +622,19 @@ Build_Config parse_build_options(int argc_given, char** argv_given){
     C.reverse_complements = !opts["forward-strand-only"].as<bool>();
     C.file_colors = opts["file-colors"].as<bool>();
     C.sequence_colors = opts["sequence-colors"].as<bool>();
+    C.build_prefilter = opts["prefilter"].as<bool>();
+    C.prefilter_bits_per_kmer = opts["prefilter-bits-per-kmer"].as<double>();
+    C.stats_file = opts["stats-out"].as<string>();
+    C.resume = opts["resume"].as<bool>();
+    C.checkpoint = opts["checkpoint"].as<bool>() || C.resume;
+    C.checkpoint_checksums = opts["checkpoint-checksums"].as<bool>();
+    C.kmer_sets = opts["kmer-sets"].as<bool>();
+    C.min_abundance = opts["min-abundance"].as<int64_t>();
+    C.min_colors = opts["min-colors"].as<int64_t>();
+    C.reorder_colors = opts["reorder-colors"].as<bool>();
+    C.delta_color_sets = opts["delta-color-sets"].as<bool>();
+    C.sort_color_sets = opts["sort-color-sets-by-popularity"].as<bool>();
+    C.fast_color_set_lookup = opts["fast-color-set-lookup"].as<bool>();
 
     try{
         C.colorfile_CLI_variable = opts["manual-colors"].as<string>();
@@ -416,11 +672,11 @@ Build_Config parse_build_options(int argc_given, char** argv_given){
     if(!C.manual_colors && !C.sequence_colors && !C.file_colors){
         // No coloring mode specified.
         // Set the default coloring mode depending on the number of input files
-        if(C.seqfiles.size() == 1) C.sequence_colors = true;
+        if(C.seqfiles.size() == 1 && !C.kmer_sets) C.sequence_colors = true;
         else C.file_colors = true;
     }
 
-    if(C.seqfiles.size() > 0) // If not --from-index
+    if(C.seqfiles.size() > 0 && !C.kmer_sets) // If not --from-index
         C.input_format = seq_io::figure_out_file_format(C.seqfiles[0]);
 
     if(C.verbose && C.silent) throw runtime_error("Can not give both --verbose and --silent");
@@ -441,15 +697,42 @@ int build_index_main(int argc, char** argv){
     
     create_directory_if_does_not_exist(C.temp_dir);
     sbwt::get_temp_file_manager().set_dir(C.temp_dir);
+    external_sort::set_temp_compression(external_sort::parse_temp_compression(C.temp_compression));
 
     write_log("Starting", sbwt::LogLevel::MAJOR);
 
     if(C.from_index != ""){
-        transform_existing_index(C.from_index + ".tdbg", C.from_index + ".tcolors", C.index_dbg_file, C.index_color_file, C.coloring_structure_type);
+        std::filesystem::remove(C.index_prefilter_file); // Would be wrong for the new index
+        transform_existing_index(C.from_index + ".tdbg", C.from_index + ".tcolors", C.index_dbg_file, C.index_color_file, C.coloring_structure_type, C.reorder_colors, C.delta_color_sets, C.sort_color_sets, C.fast_color_set_lookup, C.n_threads);
         return 0;
     }
 
-    if(C.file_colors){
+    // Completed stages are recorded only if asked, because their outputs are kept until the end
+    Build_Checkpoint checkpoint; // Disabled
+    if(C.checkpoint) checkpoint = Build_Checkpoint(C.temp_dir, C.checkpoint_fingerprint(), C.resume, C.checkpoint_checksums);
+
+    // A prefilter left over from an earlier index with the same prefix would be wrong for this index
+    if(!checkpoint.is_done("prefilter")) std::filesystem::remove(C.index_prefilter_file);
+
+    unique_ptr<Build_Resource_Monitor> monitor;
+    map<string, string> stats;
+    if(C.stats_file != "") monitor = make_unique<Build_Resource_Monitor>(C.temp_dir);
+
+    if(C.kmer_sets){
+        // From here on, the joined sequences are indexed like any sequence files
+        if(checkpoint.is_done("kmer_sets")){
+            for(int64_t i = 0; i < (int64_t)C.seqfiles.size(); i++) C.seqfiles[i] = checkpoint.get_file("kmer_sets", i);
+        } else{
+            write_log("Joining the k-mers of the k-mer sets into sequences", LogLevel::MAJOR);
+            for(int64_t i = 0; i < (int64_t)C.seqfiles.size(); i++)
+                C.seqfiles[i] = checkpoint.keep("kmer_sets", kmer_set_to_fasta(C.seqfiles[i], C.k, C.memory_megas * (1 << 20)), i);
+            checkpoint.mark_done("kmer_sets", C.seqfiles);
+        }
+        C.input_format = seq_io::figure_out_file_format(C.seqfiles[0]);
+    }
+    const vector<string> original_seqfiles = C.seqfiles; // Non-ACGT handling may replace these
+
+    if(C.file_colors && !C.kmer_sets){ // K-mer sets are already counted, so they skip GGCAT (see kmer_set_input.hh)
         // Delegate to GGCAT.
         if(!C.del_non_ACGT){
             cerr << "Error: file colors only works with the option to delete of unknown base pairs" << endl;
@@ -461,44 +744,59 @@ int build_index_main(int argc, char** argv){
         }
 
         if(C.coloring_structure_type == "sdsl-hybrid"){
-            build_index_with_ggcat<SDSL_Variant_Color_Set>(C.k, C.n_threads, C.index_dbg_file, C.index_color_file, C.temp_dir, C.memory_megas, C.colorset_sampling_distance, C.seqfiles, C.load_dbg);
+            build_index_with_ggcat<SDSL_Variant_Color_Set>(C.k, C.n_threads, C.index_dbg_file, C.index_color_file, C.temp_dir, C.memory_megas, C.colorset_sampling_distance, C.seqfiles, C.load_dbg, (C.build_prefilter ? C.index_prefilter_file : ""), C.prefilter_bits_per_kmer, C.min_abundance, C.min_colors, C.reorder_colors, C.delta_color_sets, C.sort_color_sets, C.fast_color_set_lookup, monitor.get(), &stats, &checkpoint);
         } else if(C.coloring_structure_type == "roaring"){
-            build_index_with_ggcat<Roaring_Color_Set>(C.k, C.n_threads, C.index_dbg_file, C.index_color_file, C.temp_dir, C.memory_megas, C.colorset_sampling_distance, C.seqfiles, C.load_dbg); 
+            build_index_with_ggcat<Roaring_Color_Set>(C.k, C.n_threads, C.index_dbg_file, C.index_color_file, C.temp_dir, C.memory_megas, C.colorset_sampling_distance, C.seqfiles, C.load_dbg, (C.build_prefilter ? C.index_prefilter_file : ""), C.prefilter_bits_per_kmer, C.min_abundance, C.min_colors, C.reorder_colors, C.delta_color_sets, C.sort_color_sets, C.fast_color_set_lookup, monitor.get(), &stats, &checkpoint); 
         }
+        if(monitor) write_build_stats(C, original_seqfiles, *monitor, stats);
+        checkpoint.finish();
         return 0;
     }
 
+    if(monitor) monitor->start_stage("dbg");
+
     // Deal with non-ACGT characters
     if(C.del_non_ACGT){
         // KMC takes care of this
+    } else if(checkpoint.is_done("fix_alphabet")){
+        for(int64_t i = 0; i < (int64_t)C.seqfiles.size(); i++){
+            C.seqfiles[i] = checkpoint.get_file("fix_alphabet", i);
+            C.input_format = seq_io::figure_out_file_format(C.seqfiles[i]);
+        }
     } else {
         write_log("Replacing non-ACGT characters with random nucleotides", LogLevel::MAJOR);
-        for(string& S : C.seqfiles){
-            S = fix_alphabet(S); // Turns the file into fasta format also
-            C.input_format = seq_io::figure_out_file_format(S);
+        for(int64_t i = 0; i < (int64_t)C.seqfiles.size(); i++){
+            C.seqfiles[i] = checkpoint.keep("fix_alphabet", fix_alphabet(C.seqfiles[i]), i); // Turns the file into fasta format also
+            C.input_format = seq_io::figure_out_file_format(C.seqfiles[i]);
         }
+        checkpoint.mark_done("fix_alphabet", C.seqfiles);
     }
 
-    // Set up color stream
-    std::unique_ptr<Metadata_Stream> color_stream;
-    if(!C.no_colors){
+    // Set up color stream. Each pass over the sequences needs a new one.
+    auto make_color_stream = [&]() -> std::unique_ptr<Metadata_Stream> {
         if(C.file_colors){
-            color_stream = make_unique<Unique_For_Each_File_Color_Stream>(C.seqfiles, C.reverse_complements);
+            return make_unique<Unique_For_Each_File_Color_Stream>(C.seqfiles, C.reverse_complements);
         } else if(C.colorfiles.size() == 0){
             // Color each sequence separately
-            color_stream = make_unique<Unique_For_Each_Sequence_Color_Stream>(C.reverse_complements);
+            return make_unique<Unique_For_Each_Sequence_Color_Stream>(C.reverse_complements);
         } else{
             // User-defined colors
-            color_stream = make_unique<Colorfile_Stream>(C.colorfiles, C.reverse_complements);
+            return make_unique<Colorfile_Stream>(C.colorfiles, C.reverse_complements);
         }
-    }
+    };
 
-    // Build the DBG
+    // Build the DBG. With --min-colors, this graph has all k-mers and is kept in the temporary directory
+    // until the filtered graph is built from it.
+    const bool color_filter = C.min_colors > 1;
+    string unfiltered_dbg_file; // With --min-colors
     std::unique_ptr<sbwt::plain_matrix_sbwt_t> dbg_ptr;
-    if(C.load_dbg){
+    if(color_filter && checkpoint.is_done("color_filter")){
+        // The filtered graph is loaded below
+    } else if(C.load_dbg || checkpoint.is_done("dbg")){
         sbwt::write_log("Loading de Bruijn Graph", sbwt::LogLevel::MAJOR);
         dbg_ptr = std::make_unique<sbwt::plain_matrix_sbwt_t>();
-        dbg_ptr->load(C.index_dbg_file);
+        if(color_filter) unfiltered_dbg_file = checkpoint.get_file("dbg", 0); // --load-dbg is not allowed with --min-colors
+        dbg_ptr->load(color_filter ? unfiltered_dbg_file : C.index_dbg_file);
     } else{
         sbwt::write_log("Building de Bruijn Graph", sbwt::LogLevel::MAJOR);
 
@@ -520,86 +818,165 @@ int build_index_main(int argc, char** argv){
             }
             for(string S : rc_files) KMC_input_files.push_back(S);
         }
-        
-        sbwt::plain_matrix_sbwt_t::BuildConfig sbwt_config;
-        sbwt_config.build_streaming_support = true;
-        sbwt_config.input_files = KMC_input_files;
-        sbwt_config.k = C.k;
-        sbwt_config.max_abundance = 1e9;
-        sbwt_config.min_abundance = 1;
-        sbwt_config.n_threads = C.n_threads;
-        sbwt_config.ram_gigas = max((int64_t)2, C.memory_megas / (1 << 10)); // KMC requires at least 2 GB
-        sbwt_config.temp_dir = C.temp_dir;
-        dbg_ptr = std::make_unique<sbwt::plain_matrix_sbwt_t>(sbwt_config);
-        dbg_ptr->serialize(C.index_dbg_file);
+
+        dbg_ptr = build_sbwt(KMC_input_files, C.k, C.min_abundance, C.n_threads, C.memory_megas, C.temp_dir);
+        if(color_filter){
+            unfiltered_dbg_file = get_temp_file_manager().create_filename("", ".tdbg");
+            dbg_ptr->serialize(unfiltered_dbg_file);
+            unfiltered_dbg_file = checkpoint.keep("dbg", unfiltered_dbg_file);
+            checkpoint.mark_done("dbg", {unfiltered_dbg_file});
+        } else{
+            dbg_ptr->serialize(C.index_dbg_file);
+            checkpoint.mark_done("dbg", {C.index_dbg_file});
+        }
         sbwt::write_log("Building de Bruijn Graph finished (" + std::to_string(dbg_ptr->number_of_kmers()) + " k-mers)", sbwt::LogLevel::MAJOR);
     }
 
+    if(color_filter){
+        if(checkpoint.is_done("color_filter")){
+            sbwt::write_log("Loading de Bruijn Graph", sbwt::LogLevel::MAJOR);
+            dbg_ptr = std::make_unique<sbwt::plain_matrix_sbwt_t>();
+            dbg_ptr->load(C.index_dbg_file);
+        } else{
+            sbwt::write_log("Removing k-mers with fewer than " + to_string(C.min_colors) + " colors", sbwt::LogLevel::MAJOR);
+            string kmers_file;
+            if(C.input_format.gzipped){
+                typedef seq_io::Multi_File_Reader<seq_io::Reader<seq_io::Buffered_ifstream<seq_io::zstr::ifstream>>> reader_t;
+                kmers_file = write_kmers_with_enough_colors<reader_t>(*dbg_ptr, make_color_stream().get(), C);
+            } else{
+                typedef seq_io::Multi_File_Reader<seq_io::Reader<seq_io::Buffered_ifstream<std::ifstream>>> reader_t;
+                kmers_file = write_kmers_with_enough_colors<reader_t>(*dbg_ptr, make_color_stream().get(), C);
+            }
+            int64_t k = dbg_ptr->get_k();
+            dbg_ptr.reset(); // Free the memory before the next build
+            dbg_ptr = build_sbwt({kmers_file}, k, 1, C.n_threads, C.memory_megas, C.temp_dir);
+            get_temp_file_manager().delete_file(kmers_file);
+            dbg_ptr->serialize(C.index_dbg_file);
+            if(checkpoint.enabled()) checkpoint.mark_done("color_filter", {C.index_dbg_file}, {}, {unfiltered_dbg_file}); // Releases the unfiltered graph
+            else get_temp_file_manager().delete_file(unfiltered_dbg_file);
+            sbwt::write_log("Filtered de Bruijn Graph has " + std::to_string(dbg_ptr->number_of_kmers()) + " k-mers", sbwt::LogLevel::MAJOR);
+        }
+    }
+    stats["k"] = to_string(dbg_ptr->get_k());
+    stats["n_kmers"] = to_string(dbg_ptr->number_of_kmers());
+
+    if(C.build_prefilter && !checkpoint.is_done("prefilter")){
+        if(monitor) monitor->start_stage("prefilter");
+        sbwt::write_log("Building k-mer prefilter", sbwt::LogLevel::MAJOR);
+        sbwt::check_true(dbg_ptr->get_k() <= 32, "The k-mer prefilter supports only k <= 32");
+        build_kmer_prefilter(C.seqfiles, dbg_ptr->get_k(), dbg_ptr->number_of_kmers(), C.prefilter_bits_per_kmer).serialize(C.index_prefilter_file);
+        checkpoint.mark_done("prefilter", {C.index_prefilter_file});
+    }
+
     // Build the colors
     if(!C.no_colors){
+        if(monitor) monitor->start_stage("coloring");
         sbwt::write_log("Building colors", sbwt::LogLevel::MAJOR);
 
         if(C.coloring_structure_type == "sdsl-hybrid"){
-            build_coloring<SDSL_Variant_Color_Set>(*dbg_ptr, color_stream.get(), C);
+            build_coloring<SDSL_Variant_Color_Set>(*dbg_ptr, make_color_stream().get(), C, monitor ? &stats : nullptr, &checkpoint);
         } else if(C.coloring_structure_type == "roaring"){
-            build_coloring<Roaring_Color_Set>(*dbg_ptr, color_stream.get(), C);
+            build_coloring<Roaring_Color_Set>(*dbg_ptr, make_color_stream().get(), C, monitor ? &stats : nullptr, &checkpoint);
         }
     } else{
         std::filesystem::remove(C.index_color_file); // There is an empty file so let's remove it
     }
 
+    if(monitor) write_build_stats(C, original_seqfiles, *monitor, stats);
+    checkpoint.finish();
+
     sbwt::write_log("Finished", sbwt::LogLevel::MAJOR);
 
     return 0;
 }
 
 template<typename color_set_t>
-int build_index_with_ggcat(int64_t k, int64_t n_threads, string index_dbg_file, string index_color_file, string temp_dir, int64_t mem_megas, int64_t colorset_sampling_distance, vector<string>& seqfiles, bool load_dbg){
+int build_index_with_ggcat(int64_t k, int64_t n_threads, string index_dbg_file, string index_color_file, string temp_dir, int64_t mem_megas, int64_t colorset_sampling_distance, vector<string>& seqfiles, bool load_dbg, string index_prefilter_file, double prefilter_bits_per_kmer, int64_t min_abundance, int64_t min_colors, bool reorder_colors, bool delta_color_sets, bool sort_color_sets, bool fast_color_set_lookup, Build_Resource_Monitor* monitor, map<string, string>* stats, Build_Checkpoint* checkpoint){
 
     create_directory_if_does_not_exist(temp_dir);
     sbwt::get_temp_file_manager().set_dir(temp_dir);
 
     // Run GGCAT
+    if(monitor) monitor->start_stage("ggcat");
     sbwt::write_log("Running GGCAT", sbwt::LogLevel::MAJOR);
-    GGCAT_unitig_database db(seqfiles, max(1LL, mem_megas / (1LL << 10)), k, n_threads, true); // Canonical unitigs
+    GGCAT_unitig_database db(seqfiles, max(1LL, mem_megas / (1LL << 10)), k, n_threads, true, min_abundance); // Canonical unitigs
 
     string unitigfile = db.get_unitig_filename();
+    if(min_colors > 1){
+        // Index only the unitigs with enough colors. The coloring drops the other unitigs too.
+        sbwt::write_log("Removing unitigs with fewer than " + to_string(min_colors) + " colors", sbwt::LogLevel::MAJOR);
+        unitigfile = get_temp_file_manager().create_filename("", ".fa");
+        sbwt::throwing_ofstream out(unitigfile);
+        db.iterate([&](const string& unitig, const vector<int64_t>& colors, bool is_same){
+            if((int64_t)colors.size() >= min_colors) out.stream << ">\n" << unitig << "\n";
+        });
+    }
     string rev_unitigfile = get_temp_file_manager().create_filename("", seq_io::figure_out_file_format(unitigfile).extension);
     seq_io::create_reverse_complement_file<
             seq_io::Reader<seq_io::Buffered_ifstream<std::ifstream>>,
             seq_io::Writer<seq_io::Buffered_ofstream<std::ofstream>>>(unitigfile, rev_unitigfile);
 
+    if(monitor) monitor->start_stage("dbg");
+    // GGCAT is always rerun when resuming, because the coloring reads its output, but the DBG and the
+    // prefilter are recorded in the checkpoint
+    Build_Checkpoint disabled_checkpoint;
+    Build_Checkpoint& cp = checkpoint != nullptr ? *checkpoint : disabled_checkpoint;
+
     std::unique_ptr<sbwt::plain_matrix_sbwt_t> dbg_ptr;
-    if(load_dbg){
+    if(load_dbg || cp.is_done("dbg")){
         sbwt::write_log("Loading de Bruijn Graph", sbwt::LogLevel::MAJOR);
         dbg_ptr = std::make_unique<sbwt::plain_matrix_sbwt_t>();
         dbg_ptr->load(index_dbg_file);
     } else{
         // Build SBWT
         sbwt::write_log("Building SBWT", sbwt::LogLevel::MAJOR);
-        sbwt::plain_matrix_sbwt_t::BuildConfig sbwt_config;
-        sbwt_config.build_streaming_support = true;
-        sbwt_config.input_files = {unitigfile, rev_unitigfile};
-        sbwt_config.k = k;
-        sbwt_config.max_abundance = 1e9;
-        sbwt_config.min_abundance = 1;
-        sbwt_config.n_threads = n_threads;
-        sbwt_config.ram_gigas = max((int64_t)2, mem_megas / (1 << 10)); // KMC requires at least 2 GB
-        sbwt_config.temp_dir = temp_dir;
-
-        dbg_ptr = std::make_unique<sbwt::plain_matrix_sbwt_t>(sbwt_config);
+        dbg_ptr = build_sbwt({unitigfile, rev_unitigfile}, k, 1, n_threads, mem_megas, temp_dir); // GGCAT applied the abundance filter
         dbg_ptr->serialize(index_dbg_file);
+        cp.mark_done("dbg", {index_dbg_file});
         sbwt::write_log("Building de Bruijn Graph finished (" + std::to_string(dbg_ptr->number_of_kmers()) + " k-mers)", sbwt::LogLevel::MAJOR);
     }
 
+    if(stats != nullptr){
+        (*stats)["k"] = to_string(dbg_ptr->get_k());
+        (*stats)["n_kmers"] = to_string(dbg_ptr->number_of_kmers());
+    }
+
+    if(index_prefilter_file != "" && !cp.is_done("prefilter")){
+        // The unitigs contain all k-mers of the input
+        if(monitor) monitor->start_stage("prefilter");
+        sbwt::write_log("Building k-mer prefilter", sbwt::LogLevel::MAJOR);
+        sbwt::check_true(dbg_ptr->get_k() <= 32, "The k-mer prefilter supports only k <= 32");
+        build_kmer_prefilter({unitigfile}, dbg_ptr->get_k(), dbg_ptr->number_of_kmers(), prefilter_bits_per_kmer).serialize(index_prefilter_file);
+        cp.mark_done("prefilter", {index_prefilter_file});
+    }
+
+    if(monitor) monitor->start_stage("coloring");
     sbwt::write_log("Building color structure", sbwt::LogLevel::MAJOR);
     Coloring<color_set_t> coloring;
     Coloring_Builder_From_GGCAT<color_set_t> cb;
-    cb.build_from_colored_unitigs(coloring, *dbg_ptr, max((int64_t)1, mem_megas * (1 << 20)), n_threads, colorset_sampling_distance, db);
+    cb.build_from_colored_unitigs(coloring, *dbg_ptr, max((int64_t)1, mem_megas * (1 << 20)), n_threads, colorset_sampling_distance, db, min_colors);
+    if(reorder_colors){
+        sbwt::write_log("Reordering colors", sbwt::LogLevel::MAJOR);
+        coloring.reorder_colors(n_threads, max((int64_t)1, mem_megas * (1 << 20)));
+    }
+    if(sort_color_sets){
+        sbwt::write_log("Sorting color sets by popularity", sbwt::LogLevel::MAJOR);
+        coloring.order_color_sets_by_popularity(n_threads);
+    }
+    if(delta_color_sets){
+        sbwt::write_log("Choosing parents for delta encoded color sets", sbwt::LogLevel::MAJOR);
+        coloring.delta_encode_color_sets(n_threads);
+    }
+    if(fast_color_set_lookup){
+        sbwt::write_log("Building the color set descriptor table", sbwt::LogLevel::MAJOR);
+        coloring.build_color_set_descriptor_table();
+    }
 
     sbwt::write_log("Serializing color structure", sbwt::LogLevel::MAJOR);
     sbwt::throwing_ofstream out(index_color_file, ios::binary);
     coloring.serialize(out.stream);
+    out.close();
+    if(stats != nullptr) add_coloring_stats(coloring, *stats);
 
     sbwt::write_log("Done", sbwt::LogLevel::MAJOR);
     return 0;
@@ -1,5 +1,478 @@
 #include "coloring/Roaring_Color_Set.hh"
 
-Roaring_Color_Set::Roaring_Color_Set(const Roaring_Color_Set::view_t& view){
-    *this = *(view.ptr); // Make a copy
-}
\ No newline at end of file
+Roaring_Color_Set::Roaring_Color_Set(const Roaring_Color_Set::view_t& view) : words(view.frozen, view.frozen + view.frozen_words) {}
+
+Roaring_Color_Set& Roaring_Color_Set::operator=(const view_t& view){
+    if(view.frozen != words.data()) words.assign(view.frozen, view.frozen + view.frozen_words); // Keeps the capacity of words
+    return *this;
+}
+
+void Roaring_Color_Set::intersection(const view_t& v){
+    Frozen_Roaring::intersect(words.data(), v.frozen, result_words, buffers);
+    words.swap(result_words);
+}
+
+void Roaring_Color_Set::do_union(const view_t& v){
+    Frozen_Roaring::unite(words.data(), v.frozen, result_words, buffers);
+    words.swap(result_words);
+}
+
+static void append_packed16(const std::vector<uint16_t>& values, std::vector<uint64_t>& out){
+    for(int64_t i = 0; i < (int64_t)values.size(); i += 4){
+        uint64_t word = 0;
+        for(int64_t k = 0; k < 4 && i + k < (int64_t)values.size(); k++)
+            word |= (uint64_t)values[i + k] << (16 * k);
+        out.push_back(word);
+    }
+}
+
+// Sets the bits first..last of a container bitmap
+static void set_bit_range(uint64_t* bitmap, int64_t first, int64_t last){
+    int64_t first_word = first >> 6, last_word = last >> 6;
+    uint64_t first_mask = UINT64_MAX << (first & 63);
+    uint64_t last_mask = UINT64_MAX >> (63 - (last & 63));
+    if(first_word == last_word){
+        bitmap[first_word] |= first_mask & last_mask;
+        return;
+    }
+    bitmap[first_word] |= first_mask;
+    for(int64_t w = first_word + 1; w < last_word; w++) bitmap[w] = UINT64_MAX;
+    bitmap[last_word] |= last_mask;
+}
+
+// The smallest container type for a container with the given numbers of colors and runs. Ties go to the array.
+static uint64_t smallest_container_type(int64_t n_colors, int64_t n_runs){
+    int64_t array_words = (n_colors + 3) / 4;
+    int64_t bitmap_words = 1024;
+    int64_t runs_words = 1 + (2 * n_runs + 3) / 4;
+    if(runs_words < std::min(array_words, bitmap_words)) return Frozen_Roaring::RUNS;
+    if(bitmap_words < array_words) return Frozen_Roaring::BITMAP;
+    return Frozen_Roaring::ARRAY;
+}
+
+// The functions below write container j of the set that starts at out[set_start] and has room for
+// m containers. The data of the container is appended to out, so the containers are written in order.
+
+static void write_container_header(std::vector<uint64_t>& out, int64_t set_start, int64_t m, int64_t j, uint64_t key, uint64_t type, int64_t n_colors){
+    out[set_start + 2 + j] = key << 18 | type << 16 | (n_colors - 1);
+    out[set_start + 2 + m + j] = out.size() - set_start;
+}
+
+// The lows are sorted and not empty. runs is for temporary space.
+static void write_container_from_lows(std::vector<uint64_t>& out, int64_t set_start, int64_t m, int64_t j, uint64_t key, const std::vector<uint16_t>& lows, std::vector<uint16_t>& runs){
+    runs.clear();
+    for(int64_t i = 0; i < (int64_t)lows.size(); i++){
+        if(i > 0 && lows[i] == lows[i-1] + 1) runs.back()++; // Extend the run
+        else{
+            runs.push_back(lows[i]);
+            runs.push_back(0);
+        }
+    }
+
+    uint64_t type = smallest_container_type(lows.size(), runs.size() / 2);
+    write_container_header(out, set_start, m, j, key, type, lows.size());
+    if(type == Frozen_Roaring::ARRAY) append_packed16(lows, out);
+    else if(type == Frozen_Roaring::BITMAP){
+        int64_t bitmap_start = out.size();
+        out.resize(out.size() + 1024, 0);
+        for(uint16_t low : lows) out[bitmap_start + (low >> 6)] |= uint64_t(1) << (low & 63);
+    } else{
+        out.push_back(runs.size() / 2);
+        append_packed16(runs, out);
+    }
+}
+
+// The runs are pairs (first, length - 1), sorted and not empty. lows and runs_temp are for temporary space.
+static void write_container_from_runs(std::vector<uint64_t>& out, int64_t set_start, int64_t m, int64_t j, uint64_t key, const std::vector<uint16_t>& runs, std::vector<uint16_t>& lows, std::vector<uint16_t>& runs_temp){
+    int64_t n_colors = 0;
+    for(int64_t i = 1; i < (int64_t)runs.size(); i += 2) n_colors += runs[i] + 1;
+    if(smallest_container_type(n_colors, runs.size() / 2) == Frozen_Roaring::RUNS){
+        write_container_header(out, set_start, m, j, key, Frozen_Roaring::RUNS, n_colors);
+        out.push_back(runs.size() / 2);
+        append_packed16(runs, out);
+        return;
+    }
+
+    lows.clear();
+    for(int64_t i = 0; i < (int64_t)runs.size(); i += 2)
+        for(int64_t x = runs[i]; x <= runs[i] + runs[i+1]; x++) lows.push_back(x);
+    write_container_from_lows(out, set_start, m, j, key, lows, runs_temp);
+}
+
+// The bitmap has 1024 words and is not empty. lows and runs are for temporary space.
+static void write_container_from_bitmap(std::vector<uint64_t>& out, int64_t set_start, int64_t m, int64_t j, uint64_t key, const uint64_t* bitmap, std::vector<uint16_t>& lows, std::vector<uint16_t>& runs){
+    int64_t n_colors = 0, n_runs = 0;
+    uint64_t carry = 0; // The highest bit of the previous word
+    for(int64_t w = 0; w < 1024; w++){
+        n_colors += __builtin_popcountll(bitmap[w]);
+        n_runs += __builtin_popcountll(bitmap[w] & ~((bitmap[w] << 1) | carry)); // Bits that start a run
+        carry = bitmap[w] >> 63;
+    }
+    if(smallest_container_type(n_colors, n_runs) == Frozen_Roaring::BITMAP){
+        write_container_header(out, set_start, m, j, key, Frozen_Roaring::BITMAP, n_colors);
+        out.insert(out.end(), bitmap, bitmap + 1024);
+        return;
+    }
+
+    lows.clear();
+    for(int64_t w = 0; w < 1024; w++){
+        uint64_t word = bitmap[w];
+        while(word != 0){
+            lows.push_back(w * 64 + __builtin_ctzll(word));
+            word &= word - 1; // Clear the lowest set bit
+        }
+    }
+    write_container_from_lows(out, set_start, m, j, key, lows, runs);
+}
+
+// Drops the unused room for containers after the first m of the set that starts at out[set_start]
+static void finish_set(std::vector<uint64_t>& out, int64_t set_start, int64_t room, int64_t m){
+    int64_t n_colors = 0;
+    for(int64_t j = 0; j < m; j++) n_colors += (out[set_start + 2 + j] & 0xFFFF) + 1;
+    out[set_start] = n_colors;
+    out[set_start + 1] = m;
+    if(m == room) return;
+
+    int64_t shift = 2 * (room - m);
+    for(int64_t j = 0; j < m; j++) out[set_start + 2 + m + j] = out[set_start + 2 + room + j] - shift;
+    std::copy(out.begin() + set_start + 2 + 2*room, out.end(), out.begin() + set_start + 2 + 2*m);
+    out.resize(out.size() - shift);
+}
+
+void Frozen_Roaring::freeze(const std::vector<int64_t>& colors, std::vector<uint64_t>& out){
+    check_color_range(colors);
+
+    // Container boundaries
+    std::vector<int64_t> container_starts;
+    for(int64_t i = 0; i < (int64_t)colors.size(); i++)
+        if(i == 0 || (colors[i] >> 16) != (colors[i-1] >> 16)) container_starts.push_back(i);
+    int64_t m = container_starts.size();
+    container_starts.push_back(colors.size());
+
+    int64_t set_start = out.size();
+    out.push_back(colors.size());
+    out.push_back(m);
+    out.resize(out.size() + 2*m); // Descriptors and offsets are filled below
+
+    std::vector<uint16_t> lows, runs;
+    for(int64_t j = 0; j < m; j++){
+        lows.clear();
+        for(int64_t i = container_starts[j]; i < container_starts[j+1]; i++) lows.push_back(colors[i] & 0xFFFF);
+        write_container_from_lows(out, set_start, m, j, colors[container_starts[j]] >> 16, lows, runs);
+    }
+}
+
+bool Frozen_Roaring::is_valid(const uint64_t* set, int64_t n_words){
+    if(n_words < 2) return false;
+    uint64_t m = set[1];
+    if(m > (uint64_t)(n_words - 2) / 2) return false;
+
+    // The containers must be in order of their keys, with their data one after the other right after the offsets
+    uint64_t n_colors = 0;
+    uint64_t end = 2 + 2*m; // End of the previous container
+    for(uint64_t j = 0; j < m; j++){
+        uint64_t descriptor = set[2 + j];
+        uint64_t type = (descriptor >> 16) & 3;
+        if(type != ARRAY && type != BITMAP && type != RUNS) return false;
+        if(j > 0 && (descriptor >> 18) <= (set[2 + j - 1] >> 18)) return false;
+        if(set[2 + m + j] != end || end >= (uint64_t)n_words) return false;
+        if(type == RUNS && set[end] > 32768) return false; // There are at most 2^15 separate runs in 2^16 values
+        uint64_t card = (descriptor & 0xFFFF) + 1;
+        uint64_t words = container_words(set, j);
+        if(words > (uint64_t)n_words - end) return false;
+        if(type == RUNS){
+            // The runs must be in order, must not overlap and must end within the 2^16 values of
+            // the container, and their lengths must add up to the cardinality
+            const uint64_t* data = set + end;
+            uint64_t run_colors = 0;
+            int64_t previous_last = -1;
+            for(uint64_t i = 0; i < data[0]; i++){
+                int64_t first = get16(data + 1, 2*i);
+                int64_t last = first + get16(data + 1, 2*i + 1);
+                if(first <= previous_last || last > 0xFFFF) return false;
+                run_colors += last - first + 1;
+                previous_last = last;
+            }
+            if(run_colors != card) return false;
+        }
+        end += words;
+        n_colors += card;
+    }
+    return end == (uint64_t)n_words && set[0] == n_colors;
+}
+
+void Frozen_Roaring::push_colors_to_vector(const uint64_t* set, std::vector<int64_t>& vec){
+    int64_t m = number_of_containers(set);
+    for(int64_t j = 0; j < m; j++){
+        uint64_t descriptor = set[2 + j];
+        int64_t high = (int64_t)(descriptor >> 18) << 16;
+        int64_t card = (descriptor & 0xFFFF) + 1;
+        uint64_t type = (descriptor >> 16) & 3;
+        const uint64_t* data = set + set[2 + m + j];
+
+        if(type == ARRAY){
+            for(int64_t i = 0; i < card; i++) vec.push_back(high | get16(data, i));
+        } else if(type == BITMAP){
+            for(int64_t w = 0; w < 1024; w++){
+                uint64_t word = data[w];
+                while(word != 0){
+                    vec.push_back(high | (w * 64 + __builtin_ctzll(word)));
+                    word &= word - 1; // Clear the lowest set bit
+                }
+            }
+        } else{
+            int64_t r = data[0];
+            for(int64_t i = 0; i < r; i++){
+                int64_t first = get16(data + 1, 2*i);
+                int64_t last = first + get16(data + 1, 2*i + 1);
+                for(int64_t x = first; x <= last; x++) vec.push_back(high | x);
+            }
+        }
+    }
+}
+
+// ORs container j of the set into a bitmap of 1024 words
+static void add_container_to_bitmap(const uint64_t* set, int64_t j, uint64_t* bitmap){
+    uint64_t descriptor = set[2 + j];
+    int64_t card = (descriptor & 0xFFFF) + 1;
+    uint64_t type = (descriptor >> 16) & 3;
+    const uint64_t* data = set + set[2 + Frozen_Roaring::number_of_containers(set) + j];
+
+    if(type == Frozen_Roaring::ARRAY){
+        for(int64_t i = 0; i < card; i++){
+            uint64_t low = Frozen_Roaring::get16(data, i);
+            bitmap[low >> 6] |= uint64_t(1) << (low & 63);
+        }
+    } else if(type == Frozen_Roaring::BITMAP){
+        for(int64_t w = 0; w < 1024; w++) bitmap[w] |= data[w];
+    } else{
+        for(int64_t i = 0; i < (int64_t)data[0]; i++){
+            int64_t first = Frozen_Roaring::get16(data + 1, 2*i);
+            set_bit_range(bitmap, first, first + Frozen_Roaring::get16(data + 1, 2*i + 1));
+        }
+    }
+}
+
+static void get_container_runs(const uint64_t* set, int64_t j, std::vector<uint16_t>& runs){
+    const uint64_t* data = set + set[2 + Frozen_Roaring::number_of_containers(set) + j];
+    runs.clear();
+    for(int64_t i = 0; i < 2 * (int64_t)data[0]; i++) runs.push_back(Frozen_Roaring::get16(data + 1, i));
+}
+
+static uint64_t container_type(const uint64_t* set, int64_t j){
+    return (set[2 + j] >> 16) & 3;
+}
+
+// Writes the intersection of container a of A and container b of B, which have the same key, as
+// container j of out. Returns false and writes nothing if the intersection is empty.
+static bool intersect_containers(const uint64_t* A, int64_t a, const uint64_t* B, int64_t b, std::vector<uint64_t>& out, int64_t m, int64_t j, Frozen_Roaring::Buffers& buffers){
+    uint64_t key = Frozen_Roaring::container_key(A, a);
+    uint64_t type_A = container_type(A, a), type_B = container_type(B, b);
+
+    if(type_A == Frozen_Roaring::BITMAP && type_B == Frozen_Roaring::BITMAP){
+        const uint64_t* data_A = A + A[2 + Frozen_Roaring::number_of_containers(A) + a];
+        const uint64_t* data_B = B + B[2 + Frozen_Roaring::number_of_containers(B) + b];
+        buffers.bitmap.resize(1024);
+        uint64_t any = 0;
+        for(int64_t w = 0; w < 1024; w++) any |= (buffers.bitmap[w] = data_A[w] & data_B[w]);
+        if(any == 0) return false;
+        write_container_from_bitmap(out, 0, m, j, key, buffers.bitmap.data(), buffers.lows, buffers.runs);
+        return true;
+    }
+
+    if(type_A == Frozen_Roaring::ARRAY || type_B == Frozen_Roaring::ARRAY){
+        // Keep the colors of the array that are in the other container
+        if(type_A != Frozen_Roaring::ARRAY){
+            std::swap(A, B); std::swap(a, b); std::swap(type_A, type_B);
+        }
+        const uint64_t* array = A + A[2 + Frozen_Roaring::number_of_containers(A) + a];
+        int64_t card = (A[2 + a] & 0xFFFF) + 1;
+        const uint64_t* data_B = B + B[2 + Frozen_Roaring::number_of_containers(B) + b];
+        buffers.lows.clear();
+
+        if(type_B == Frozen_Roaring::ARRAY){
+            int64_t card_B = (B[2 + b] & 0xFFFF) + 1;
+            for(int64_t i = 0, k = 0; i < card && k < card_B; ){
+                uint64_t x = Frozen_Roaring::get16(array, i), y = Frozen_Roaring::get16(data_B, k);
+                if(x < y) i++;
+                else if(x > y) k++;
+                else{
+                    buffers.lows.push_back(x);
+                    i++; k++;
+                }
+            }
+        } else if(type_B == Frozen_Roaring::BITMAP){
+            for(int64_t i = 0; i < card; i++){
+                uint64_t x = Frozen_Roaring::get16(array, i);
+                if((data_B[x >> 6] >> (x & 63)) & 1) buffers.lows.push_back(x);
+            }
+        } else{
+            int64_t n_runs = data_B[0];
+            for(int64_t i = 0, r = 0; i < card && r < n_runs; ){
+                uint64_t x = Frozen_Roaring::get16(array, i);
+                uint64_t first = Frozen_Roaring::get16(data_B + 1, 2*r);
+                uint64_t last = first + Frozen_Roaring::get16(data_B + 1, 2*r + 1);
+                if(x < first) i++;
+                else if(x > last) r++;
+                else{
+                    buffers.lows.push_back(x);
+                    i++;
+                }
+            }
+        }
+
+        if(buffers.lows.empty()) return false;
+        write_container_from_lows(out, 0, m, j, key, buffers.lows, buffers.runs);
+        return true;
+    }
+
+    if(type_A == Frozen_Roaring::RUNS && type_B == Frozen_Roaring::RUNS){
+        get_container_runs(A, a, buffers.runs);
+        get_container_runs(B, b, buffers.other_runs);
+        std::vector<uint16_t>& result = buffers.lows; // Used for runs here
+        result.clear();
+        for(int64_t i = 0, k = 0; i < (int64_t)buffers.runs.size() && k < (int64_t)buffers.other_runs.size(); ){
+            int64_t last_A = buffers.runs[i] + buffers.runs[i+1];
+            int64_t last_B = buffers.other_runs[k] + buffers.other_runs[k+1];
+            int64_t first = std::max(buffers.runs[i], buffers.other_runs[k]);
+            int64_t last = std::min(last_A, last_B);
+            if(first <= last){
+                result.push_back(first);
+                result.push_back(last - first);
+            }
+            if(last_A < last_B) i += 2;
+            else k += 2;
+        }
+        if(result.empty()) return false;
+        buffers.other_runs.swap(result); // So that the lows buffer is free for writing the container
+        write_container_from_runs(out, 0, m, j, key, buffers.other_runs, buffers.lows, buffers.runs);
+        return true;
+    }
+
+    // Runs and a bitmap
+    if(type_A != Frozen_Roaring::RUNS){
+        std::swap(A, B); std::swap(a, b);
+    }
+    const uint64_t* data_B = B + B[2 + Frozen_Roaring::number_of_containers(B) + b];
+    buffers.bitmap.assign(1024, 0);
+    add_container_to_bitmap(A, a, buffers.bitmap.data());
+    uint64_t any = 0;
+    for(int64_t w = 0; w < 1024; w++) any |= (buffers.bitmap[w] &= data_B[w]);
+    if(any == 0) return false;
+    write_container_from_bitmap(out, 0, m, j, key, buffers.bitmap.data(), buffers.lows, buffers.runs);
+    return true;
+}
+
+void Frozen_Roaring::intersect(const uint64_t* A, const uint64_t* B, std::vector<uint64_t>& out, Buffers& buffers){
+    int64_t m_A = number_of_containers(A), m_B = number_of_containers(B);
+
+    // Room for a container for every key in both sets. The empty intersections are dropped at the end.
+    int64_t room = 0;
+    for(int64_t a = 0, b = 0; a < m_A && b < m_B; ){
+        if(container_key(A, a) < container_key(B, b)) a++;
+        else if(container_key(A, a) > container_key(B, b)) b++;
+        else{
+            room++; a++; b++;
+        }
+    }
+
+    out.assign(2 + 2*room, 0);
+    int64_t m = 0;
+    for(int64_t a = 0, b = 0; a < m_A && b < m_B; ){
+        if(container_key(A, a) < container_key(B, b)) a++;
+        else if(container_key(A, a) > container_key(B, b)) b++;
+        else{
+            if(intersect_containers(A, a, B, b, out, room, m, buffers)) m++;
+            a++; b++;
+        }
+    }
+    finish_set(out, 0, room, m);
+}
+
+// Copies container a of A as container j of out
+static void copy_container(const uint64_t* A, int64_t a, std::vector<uint64_t>& out, int64_t m, int64_t j){
+    const uint64_t* data = A + A[2 + Frozen_Roaring::number_of_containers(A) + a];
+    out[2 + j] = A[2 + a];
+    out[2 + m + j] = out.size();
+    out.insert(out.end(), data, data + Frozen_Roaring::container_words(A, a));
+}
+
+// Writes the union of container a of A and container b of B, which have the same key, as container j of out
+static void unite_containers(const uint64_t* A, int64_t a, const uint64_t* B, int64_t b, std::vector<uint64_t>& out, int64_t m, int64_t j, Frozen_Roaring::Buffers& buffers){
+    uint64_t key = Frozen_Roaring::container_key(A, a);
+    uint64_t type_A = container_type(A, a), type_B = container_type(B, b);
+
+    if(type_A == Frozen_Roaring::ARRAY && type_B == Frozen_Roaring::ARRAY){
+        const uint64_t* data_A = A + A[2 + Frozen_Roaring::number_of_containers(A) + a];
+        const uint64_t* data_B = B + B[2 + Frozen_Roaring::number_of_containers(B) + b];
+        int64_t card_A = (A[2 + a] & 0xFFFF) + 1, card_B = (B[2 + b] & 0xFFFF) + 1;
+        buffers.lows.clear();
+        int64_t i = 0, k = 0;
+        while(i < card_A || k < card_B){
+            if(k == card_B) buffers.lows.push_back(Frozen_Roaring::get16(data_A, i++));
+            else if(i == card_A) buffers.lows.push_back(Frozen_Roaring::get16(data_B, k++));
+            else{
+                uint64_t x = Frozen_Roaring::get16(data_A, i), y = Frozen_Roaring::get16(data_B, k);
+                buffers.lows.push_back(std::min(x, y));
+                i += (x <= y);
+                k += (y <= x);
+            }
+        }
+        write_container_from_lows(out, 0, m, j, key, buffers.lows, buffers.runs);
+        return;
+    }
+
+    if(type_A == Frozen_Roaring::RUNS && type_B == Frozen_Roaring::RUNS){
+        get_container_runs(A, a, buffers.runs);
+        get_container_runs(B, b, buffers.other_runs);
+        std::vector<uint16_t>& result = buffers.lows; // Used for runs here
+        result.clear();
+        int64_t i = 0, k = 0;
+        while(i < (int64_t)buffers.runs.size() || k < (int64_t)buffers.other_runs.size()){
+            // Take the run that starts first
+            int64_t first, last;
+            if(k == (int64_t)buffers.other_runs.size() || (i < (int64_t)buffers.runs.size() && buffers.runs[i] <= buffers.other_runs[k])){
+                first = buffers.runs[i]; last = first + buffers.runs[i+1]; i += 2;
+            } else{
+                first = buffers.other_runs[k]; last = first + buffers.other_runs[k+1]; k += 2;
+            }
+            int64_t result_last = result.empty() ? -2 : result[result.size() - 2] + result.back();
+            if(first <= result_last + 1) // Overlaps or touches the previous run
+                result.back() = std::max(result_last, last) - result[result.size() - 2];
+            else{
+                result.push_back(first);
+                result.push_back(last - first);
+            }
+        }
+        buffers.other_runs.swap(result); // So that the lows buffer is free for writing the container
+        write_container_from_runs(out, 0, m, j, key, buffers.other_runs, buffers.lows, buffers.runs);
+        return;
+    }
+
+    buffers.bitmap.assign(1024, 0);
+    add_container_to_bitmap(A, a, buffers.bitmap.data());
+    add_container_to_bitmap(B, b, buffers.bitmap.data());
+    write_container_from_bitmap(out, 0, m, j, key, buffers.bitmap.data(), buffers.lows, buffers.runs);
+}
+
+void Frozen_Roaring::unite(const uint64_t* A, const uint64_t* B, std::vector<uint64_t>& out, Buffers& buffers){
+    int64_t m_A = number_of_containers(A), m_B = number_of_containers(B);
+
+    // One container for every key in either set
+    int64_t m = 0;
+    for(int64_t a = 0, b = 0; a < m_A || b < m_B; m++){
+        if(b == m_B || (a < m_A && container_key(A, a) < container_key(B, b))) a++;
+        else if(a == m_A || container_key(A, a) > container_key(B, b)) b++;
+        else{
+            a++; b++;
+        }
+    }
+
+    out.assign(2 + 2*m, 0);
+    for(int64_t a = 0, b = 0, j = 0; a < m_A || b < m_B; j++){
+        if(b == m_B || (a < m_A && container_key(A, a) < container_key(B, b))) copy_container(A, a++, out, m, j);
+        else if(a == m_A || container_key(A, a) > container_key(B, b)) copy_container(B, b++, out, m, j);
+        else unite_containers(A, a++, B, b++, out, m, j, buffers);
+    }
+    finish_set(out, 0, m, m);
+}
@@ -77,6 +77,241 @@ int64_t array_vs_array_intersection(sdsl::int_vector<>& A, int64_t A_len, const
     return intersect_buffers(A, A_len, B, B_start, B_len);
 }
 
+// See header for description
+int64_t array_vs_elias_fano_intersection(sdsl::int_vector<>& iv, int64_t iv_size, const sdsl::bit_vector& ef, int64_t ef_start){
+    Elias_Fano_Iterator it(ef, ef_start);
+    int64_t j = 0;
+    for(int64_t i = 0; i < iv_size; i++){
+        int64_t x = iv[i];
+        it.skip_to(x);
+        if(it.done()) break;
+        if(it.get() == x) iv[j++] = x; // Add to intersection modifying iv in-place
+    }
+    return j;
+}
+
+// See header for description
+int64_t elias_fano_vs_bitmap_intersection(sdsl::int_vector<>& result, const sdsl::bit_vector& ef, int64_t ef_start, const sdsl::bit_vector& bv, int64_t bv_start, int64_t bv_size){
+    int64_t j = 0;
+    for(Elias_Fano_Iterator it(ef, ef_start); !it.done() && it.get() < bv_size; it.next()){
+        if(bv[bv_start + it.get()]) result[j++] = it.get();
+    }
+    return j;
+}
+
+// See header for description
+sdsl::bit_vector elias_fano_encode(const vector<int64_t>& set){
+    int64_t n = set.size();
+    int64_t l = elias_fano_low_bits(n, set.back());
+    int64_t w = std::bit_width((uint64_t)n);
+
+    sdsl::bit_vector bits(elias_fano_size_in_bits(n, set.back()), 0);
+    bits.set_int(0, l, 6);
+    bits.set_int(6, w, 6);
+    bits.set_int(12, n, w);
+
+    int64_t low_start = 12 + w;
+    int64_t high_start = low_start + n * l;
+    for(int64_t i = 0; i < n; i++){
+        if(l > 0) bits.set_int(low_start + i * l, set[i] & ((1ULL << l) - 1), l);
+        bits[high_start + (set[i] >> l) + i] = 1;
+    }
+    return bits;
+}
+
+// See header for description
+vector<int64_t> complement_encode(const vector<int64_t>& set){
+    vector<int64_t> values = {set.back() + 1}; // Universe size
+    int64_t i = 0;
+    for(int64_t x = 0; x <= set.back(); x++){
+        if(set[i] == x) i++;
+        else values.push_back(x);
+    }
+    return values;
+}
+
+// See header for description
+vector<int64_t> runs_encode(const vector<int64_t>& set){
+    vector<int64_t> values;
+    for(int64_t i = 0; i < (int64_t)set.size(); i++){
+        if(i == 0 || set[i] != set[i-1] + 1){
+            values.push_back(set[i]); // First
+            values.push_back(set[i]); // Last
+        } else values.back() = set[i];
+    }
+    return values;
+}
+
+// See header for description
+int64_t bitmap_vs_complement_intersection(sdsl::bit_vector& bv, int64_t bv_size, const sdsl::int_vector<>& comp, int64_t comp_start, int64_t comp_len){
+    int64_t universe = comp[comp_start];
+    for(int64_t i = 1; i < comp_len; i++){
+        int64_t x = comp[comp_start + i];
+        if(x >= bv_size) break;
+        bv[x] = 0;
+    }
+    return min(bv_size, universe); // Everything after the universe is ignored
+}
+
+// See header for description
+int64_t array_vs_complement_intersection(sdsl::int_vector<>& iv, int64_t iv_size, const sdsl::int_vector<>& comp, int64_t comp_start, int64_t comp_len){
+    int64_t universe = comp[comp_start];
+    int64_t j = 0;
+    int64_t m = 1; // Index of the next missing element
+    for(int64_t i = 0; i < iv_size; i++){
+        int64_t x = iv[i];
+        if(x >= universe) break;
+        while(m < comp_len && comp[comp_start + m] < x) m++;
+        if(m < comp_len && comp[comp_start + m] == x) continue; // Missing from the complement
+        iv[j++] = x; // Add to intersection modifying iv in-place
+    }
+    return j;
+}
+
+// See header for description
+int64_t complement_vs_complement_intersection(sdsl::int_vector<>& A, int64_t A_len, const sdsl::int_vector<>& B, int64_t B_start, int64_t B_len){
+    // The missing elements of the intersection are missing from either set, so the output can run
+    // ahead of the input in A. Copy the missing elements of A first.
+    vector<int64_t> A_missing;
+    for(int64_t i = 1; i < A_len; i++) A_missing.push_back(A[i]);
+
+    int64_t universe = min<int64_t>(A[0], B[B_start]);
+    A[0] = universe;
+    int64_t i = 0, j = 1, k = 1;
+    while(true){
+        int64_t x = i < (int64_t)A_missing.size() ? A_missing[i] : INT64_MAX;
+        int64_t y = j < B_len ? B[B_start + j] : INT64_MAX;
+        int64_t z = min(x, y);
+        if(z >= universe) break;
+        A[k++] = z;
+        if(x == z) i++;
+        if(y == z) j++;
+    }
+    return k;
+}
+
+// Clears bits [from, to) of bv
+static void clear_bit_range(sdsl::bit_vector& bv, int64_t from, int64_t to){
+    while(from < to && from % 64 != 0) bv[from++] = 0;
+    for(; from + 64 <= to; from += 64) bv.set_int(from, 0, 64);
+    while(from < to) bv[from++] = 0;
+}
+
+// See header for description
+int64_t bitmap_vs_runs_intersection(sdsl::bit_vector& bv, int64_t bv_size, const sdsl::int_vector<>& runs, int64_t runs_start, int64_t runs_len){
+    if(runs_len == 0) return 0;
+    int64_t new_size = min<int64_t>(bv_size, runs[runs_start + runs_len - 1] + 1); // Everything after the last run is ignored
+    int64_t gap_start = 0;
+    for(int64_t i = 0; i < runs_len && gap_start < new_size; i += 2){
+        clear_bit_range(bv, gap_start, min<int64_t>(runs[runs_start + i], new_size));
+        gap_start = runs[runs_start + i + 1] + 1;
+    }
+    return new_size;
+}
+
+// See header for description
+int64_t array_vs_runs_intersection(sdsl::int_vector<>& iv, int64_t iv_size, const sdsl::int_vector<>& runs, int64_t runs_start, int64_t runs_len){
+    int64_t j = 0;
+    int64_t r = 0; // Index of the first value of the current run
+    for(int64_t i = 0; i < iv_size; i++){
+        int64_t x = iv[i];
+        while(r < runs_len && runs[runs_start + r + 1] < x) r += 2; // Skip runs that end before x
+        if(r >= runs_len) break;
+        if(runs[runs_start + r] <= x) iv[j++] = x; // Add to intersection modifying iv in-place
+    }
+    return j;
+}
+
+// See header for description
+int64_t runs_vs_runs_intersection(sdsl::int_vector<>& result, const sdsl::int_vector<>& A, int64_t A_len, const sdsl::int_vector<>& B, int64_t B_start, int64_t B_len){
+    int64_t i = 0, j = 0, k = 0;
+    while(i < A_len && j < B_len){
+        int64_t first = max<int64_t>(A[i], B[B_start + j]);
+        int64_t last = min<int64_t>(A[i+1], B[B_start + j + 1]);
+        if(first <= last){
+            result[k++] = first;
+            result[k++] = last;
+        }
+        if(A[i+1] < B[B_start + j + 1]) i += 2; // The run that ends first can not overlap later runs
+        else j += 2;
+    }
+    return k;
+}
+
+// See header for description
+int64_t runs_vs_complement_intersection(sdsl::int_vector<>& result, const sdsl::int_vector<>& runs, int64_t runs_len, const sdsl::int_vector<>& comp, int64_t comp_start, int64_t comp_len){
+    int64_t universe = comp[comp_start];
+    int64_t m = 1; // Index of the next missing element
+    int64_t k = 0;
+    for(int64_t i = 0; i < runs_len; i += 2){
+        int64_t first = runs[i];
+        int64_t last = min<int64_t>(runs[i+1], universe - 1);
+        if(first > last) break; // The rest of the runs are outside of the universe
+        while(m < comp_len && comp[comp_start + m] < first) m++;
+
+        // Split the run at the missing elements
+        while(first <= last){
+            if(m < comp_len && comp[comp_start + m] <= last){
+                int64_t x = comp[comp_start + m++];
+                if(x > first){
+                    result[k++] = first;
+                    result[k++] = x - 1;
+                }
+                first = x + 1;
+            } else{
+                result[k++] = first;
+                result[k++] = last;
+                break;
+            }
+        }
+    }
+    return k;
+}
+
+// See header for description
+int64_t complement_vs_complement_union(sdsl::int_vector<>& result, const sdsl::int_vector<>& A, int64_t A_len, const sdsl::int_vector<>& B, int64_t B_start, int64_t B_len){
+    // An element is missing from the union if it is missing from or outside of the universe of both sets
+    int64_t A_universe = A[0];
+    int64_t B_universe = B[B_start];
+    result[0] = max(A_universe, B_universe);
+    int64_t i = 1, j = 1, k = 1;
+    while(i < A_len || j < B_len){
+        int64_t x = i < A_len ? A[i] : INT64_MAX;
+        int64_t y = j < B_len ? B[B_start + j] : INT64_MAX;
+        if(x == y){
+            result[k++] = x;
+            i++; j++;
+        } else if(x < y){
+            if(x >= B_universe) result[k++] = x;
+            i++;
+        } else{
+            if(y >= A_universe) result[k++] = y;
+            j++;
+        }
+    }
+    return k;
+}
+
+// See header for description
+int64_t runs_vs_runs_union(sdsl::int_vector<>& result, const sdsl::int_vector<>& A, int64_t A_len, const sdsl::int_vector<>& B, int64_t B_start, int64_t B_len){
+    int64_t i = 0, j = 0, k = 0;
+    while(i < A_len || j < B_len){
+        int64_t first, last;
+        if(j >= B_len || (i < A_len && A[i] < B[B_start + j])){
+            first = A[i]; last = A[i+1]; i += 2;
+        } else{
+            first = B[B_start + j]; last = B[B_start + j + 1]; j += 2;
+        }
+        if(k > 0 && first <= (int64_t)result[k-1] + 1){
+            result[k-1] = max<int64_t>(result[k-1], last); // Merge with the previous run
+        } else{
+            result[k++] = first;
+            result[k++] = last;
+        }
+    }
+    return k;
+}
+
 // See header for description
 int64_t bitmap_vs_bitmap_union(sdsl::bit_vector& A, int64_t A_size, const sdsl::bit_vector& B, int64_t B_start, int64_t B_size){
     return 0; // TODO
@@ -1,9 +1,18 @@
 #include "coloring/Coloring.hh"
+#include <cctype>
+
+pair<string, int64_t> parse_coloring_type_id(const string& type_id){
+    int64_t dash = (int64_t)type_id.rfind("-v");
+    if(dash == (int64_t)string::npos || dash + 2 == (int64_t)type_id.size()) return {type_id, -1};
+    for(int64_t i = dash + 2; i < (int64_t)type_id.size(); i++)
+        if(!std::isdigit((unsigned char)type_id[i])) return {type_id, -1};
+    return {type_id.substr(0, dash), std::stoll(type_id.substr(dash + 2))};
+}
 
 void load_coloring(string filename, const plain_matrix_sbwt_t& SBWT,
 std::variant<
 Coloring<SDSL_Variant_Color_Set>,
-Coloring<Roaring_Color_Set>>& coloring){
+Coloring<Roaring_Color_Set>>& coloring, int64_t n_threads){
 
     Coloring<SDSL_Variant_Color_Set> coloring1;
     Coloring<Roaring_Color_Set> coloring2;
@@ -11,7 +20,7 @@ Coloring<Roaring_Color_Set>>& coloring){
     try{
         throwing_ifstream colors_in(filename, ios::binary);
         coloring = coloring1;
-        std::get<Coloring<SDSL_Variant_Color_Set>>(coloring).load(colors_in.stream, SBWT);
+        std::get<Coloring<SDSL_Variant_Color_Set>>(coloring).load(colors_in.stream, SBWT, n_threads);
         return; // No exception thrown
     } catch(Coloring<SDSL_Variant_Color_Set>::WrongTemplateParameterException& e){
         // Was not this one
@@ -20,7 +29,7 @@ Coloring<Roaring_Color_Set>>& coloring){
     try{
         throwing_ifstream colors_in(filename, ios::binary);
         coloring = coloring2;
-        std::get<Coloring<Roaring_Color_Set>>(coloring).load(colors_in.stream, SBWT);
+        std::get<Coloring<Roaring_Color_Set>>(coloring).load(colors_in.stream, SBWT, n_threads);
         return; // No exception thrown
     } catch(Coloring<Roaring_Color_Set>::WrongTemplateParameterException& e){
         // Was not this one
@@ -28,3 +37,25 @@ Coloring<Roaring_Color_Set>>& coloring){
 
     throw std::runtime_error("Error: could not load color structure.");
 }
+
+void load_coloring(std::istream& is, const plain_matrix_sbwt_t& SBWT,
+std::variant<
+Coloring<SDSL_Variant_Color_Set>,
+Coloring<Roaring_Color_Set>>& coloring, int64_t n_threads){
+
+    // Peek at the type id and rewind
+    std::streampos start = is.tellg();
+    string type_id = sbwt::load_string(is);
+    is.seekg(start);
+
+    string structure = parse_coloring_type_id(type_id).first;
+    if(structure == "sdsl-hybrid"){
+        coloring = Coloring<SDSL_Variant_Color_Set>();
+        std::get<Coloring<SDSL_Variant_Color_Set>>(coloring).load(is, SBWT, n_threads);
+    } else if(structure == "roaring"){
+        coloring = Coloring<Roaring_Color_Set>();
+        std::get<Coloring<Roaring_Color_Set>>(coloring).load(is, SBWT, n_threads);
+    } else{
+        throw std::runtime_error("Error: could not load color structure.");
+    }
+}
@@ -0,0 +1,140 @@
+#include "coloring/delta_parents.hh"
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+
+static uint64_t mix(uint64_t x){ // Finalizer of splitmix64
+    x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// See header for description
+int64_t symmetric_difference_size(const vector<int64_t>& A, const vector<int64_t>& B){
+    int64_t i = 0, j = 0, common = 0;
+    while(i < (int64_t)A.size() && j < (int64_t)B.size()){
+        if(A[i] < B[j]) i++;
+        else if(A[i] > B[j]) j++;
+        else{
+            common++; i++; j++;
+        }
+    }
+    return A.size() + B.size() - 2*common;
+}
+
+static int64_t find_root(vector<int64_t>& union_find_parent, int64_t x){
+    while(union_find_parent[x] != x){
+        union_find_parent[x] = union_find_parent[union_find_parent[x]]; // Path halving
+        x = union_find_parent[x];
+    }
+    return x;
+}
+
+// See header for description
+vector<int64_t> delta_parents_from_candidates(vector<std::tuple<int64_t, int64_t, int64_t>>& candidates, const vector<int64_t>& full_cost, int64_t max_depth){
+    int64_t n_sets = full_cost.size();
+    int64_t root = n_sets; // The virtual root
+
+    for(int64_t i = 0; i < n_sets; i++) candidates.push_back({i, root, full_cost[i]});
+    std::stable_sort(candidates.begin(), candidates.end(), [](const auto& x, const auto& y){
+        return std::get<2>(x) < std::get<2>(y);
+    });
+
+    // Kruskal
+    vector<int64_t> union_find_parent(n_sets + 1);
+    std::iota(union_find_parent.begin(), union_find_parent.end(), 0);
+    vector<vector<int64_t>> tree(n_sets + 1); // Adjacency lists
+    for(auto [a, b, weight] : candidates){
+        int64_t ra = find_root(union_find_parent, a);
+        int64_t rb = find_root(union_find_parent, b);
+        if(ra == rb) continue;
+        union_find_parent[ra] = rb;
+        tree[a].push_back(b);
+        tree[b].push_back(a);
+    }
+    candidates.clear(); candidates.shrink_to_fit();
+
+    // Root the tree at the virtual root with a BFS. Every set has an edge to the root, so the tree is connected.
+    vector<int64_t> parent(n_sets, -1);
+    vector<int64_t> depth(n_sets + 1, 0); // Number of differences to apply to decode the set
+    vector<bool> visited(n_sets + 1, false);
+    vector<int64_t> queue = {root};
+    visited[root] = true;
+    for(int64_t q = 0; q < (int64_t)queue.size(); q++){
+        int64_t u = queue[q];
+        for(int64_t v : tree[u]){
+            if(visited[v]) continue;
+            visited[v] = true;
+            if(u != root && depth[u] + 1 <= max_depth){
+                parent[v] = u;
+                depth[v] = depth[u] + 1;
+            } // Else v is stored in full and has depth 0
+            queue.push_back(v);
+        }
+    }
+
+    return parent;
+}
+
+// See header for description
+vector<int64_t> choose_delta_parents(int64_t n_sets, const std::function<void(int64_t, vector<int64_t>&)>& get_set, const vector<int64_t>& full_cost, int64_t max_depth, int64_t n_threads){
+    const int64_t n_hashes = 4; // Number of orders
+    const int64_t window = 2; // Each set is compared to this many next sets in each order
+
+    // MinHash values of the sets
+    vector<uint64_t> min_hashes(n_sets * n_hashes, UINT64_MAX);
+    #pragma omp parallel num_threads(n_threads)
+    {
+        vector<int64_t> set;
+        #pragma omp for schedule(dynamic, 256)
+        for(int64_t id = 0; id < n_sets; id++){
+            get_set(id, set);
+            for(int64_t x : set)
+                for(int64_t h = 0; h < n_hashes; h++)
+                    min_hashes[id * n_hashes + h] = std::min(min_hashes[id * n_hashes + h], mix(x * n_hashes + h + 1));
+        }
+    }
+
+    // Pairs (kind, a, b) of sets to compare. Each set is compared to the first set of the run of sets
+    // with the same MinHash value (kind 0) and to the next sets in the run (kind 1). The edges to the
+    // first sets make shallow trees if there are many equally good parents, so they are preferred on ties.
+    vector<std::tuple<int64_t, int64_t, int64_t>> pairs;
+    vector<int64_t> order(n_sets);
+    for(int64_t h = 0; h < n_hashes; h++){
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](int64_t a, int64_t b){
+            return std::make_pair(min_hashes[a * n_hashes + h], a) < std::make_pair(min_hashes[b * n_hashes + h], b);
+        });
+        int64_t run_start = 0;
+        for(int64_t i = 0; i < n_sets; i++){
+            uint64_t value = min_hashes[order[i] * n_hashes + h];
+            if(value != min_hashes[order[run_start] * n_hashes + h]) run_start = i;
+            if(run_start != i) pairs.push_back({0, min(order[run_start], order[i]), max(order[run_start], order[i])});
+            for(int64_t j = i+1; j < min(n_sets, i + 1 + window); j++)
+                if(min_hashes[order[j] * n_hashes + h] == value)
+                    pairs.push_back({1, min(order[i], order[j]), max(order[i], order[j])});
+        }
+    }
+    vector<uint64_t>().swap(min_hashes); // Free memory
+    vector<int64_t>().swap(order);
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+    // Weigh the candidate edges. The parent pointer costs about as much as one color.
+    vector<std::tuple<int64_t, int64_t, int64_t>> candidates(pairs.size());
+    #pragma omp parallel num_threads(n_threads)
+    {
+        vector<int64_t> A, B;
+        #pragma omp for schedule(dynamic, 256)
+        for(int64_t i = 0; i < (int64_t)pairs.size(); i++){
+            auto [kind, a, b] = pairs[i];
+            get_set(a, A);
+            get_set(b, B);
+            candidates[i] = {a, b, symmetric_difference_size(A, B) + 1};
+        }
+    }
+    vector<std::tuple<int64_t, int64_t, int64_t>>().swap(pairs);
+
+    return delta_parents_from_candidates(candidates, full_cost, max_depth);
+}
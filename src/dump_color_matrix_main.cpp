@@ -6,6 +6,9 @@
 #include <cstring>
 #include <sstream>
 #include <iomanip>
+#include <atomic>
+#include <fstream>
+#include <algorithm>
 #include "version.h"
 #include "cxxopts.hpp"
 #include "extract_unitigs.hh"
@@ -15,71 +18,214 @@
 using namespace sbwt;
 using namespace std;
 
-// Assumes the row has been initialized with enough space for all colors
-template<typename coloring_t> 
-void print_color_set_as_bitmap(int64_t node_id, const coloring_t& coloring, seq_io::Buffered_ofstream<>& out){
+enum class Dump_Format{
+    dense, // k-mer followed by a string of zeroes and ones
+    sparse, // k-mer followed by the colors
+    set_ids, // k-mer followed by the color set id, and a separate table of the distinct color sets
+    mtx // MatrixMarket coordinate format. Rows are k-mers in the order of the other formats, columns are colors.
+};
+
+static Dump_Format parse_dump_format(const string& format){
+    if(format == "dense") return Dump_Format::dense;
+    if(format == "sparse") return Dump_Format::sparse;
+    if(format == "set-ids") return Dump_Format::set_ids;
+    if(format == "mtx") return Dump_Format::mtx;
+    throw std::runtime_error("Unknown dump format: " + format);
+}
 
-    char space = ' '; out.write(&space, 1); // Write a space
+static void append_int(string& out, int64_t x){
+    char string_buf[32]; // Enough space to represent a 64-bit integer in ascii
+    int64_t len = fast_int_to_string(x, string_buf);
+    out.append(string_buf, len);
+}
 
-    vector<char> row(coloring.largest_color() + 1, '0'); // ASCII characters '0' and '1'
+// Formats chunks 0..n_chunks-1 in parallel with format_chunk(chunk, buffer) and writes the buffers
+// to out in chunk order, so the output does not depend on the number of threads. The chunks are
+// processed in rounds of a few chunks per thread to bound the memory for the buffers.
+template<typename format_chunk_t>
+void write_chunks_in_parallel(ostream& out, int64_t n_chunks, int64_t n_threads, format_chunk_t format_chunk){
+    int64_t chunks_per_round = 4 * n_threads;
+    vector<string> buffers(chunks_per_round);
+    for(int64_t round_start = 0; round_start < n_chunks; round_start += chunks_per_round){
+        int64_t round_end = min(n_chunks, round_start + chunks_per_round);
+
+        #pragma omp parallel for num_threads(n_threads) schedule(dynamic, 1)
+        for(int64_t chunk = round_start; chunk < round_end; chunk++){
+            format_chunk(chunk, buffers[chunk - round_start]);
+        }
+
+        for(int64_t chunk = round_start; chunk < round_end; chunk++){
+            string& buf = buffers[chunk - round_start];
+            out.write(buf.data(), buf.size());
+            buf.clear();
+        }
+    }
+}
 
-    // Set the colors
-    for(int64_t color : coloring.get_color_set_of_node(node_id).get_colors_as_vector()) 
-        row[color] = '1';
+// Formats the lines of the k-mers with node ids in [begin, end) into out.
+// Returns the number of k-mers in the range.
+template<typename coloring_t>
+int64_t format_rows(const DBG& dbg, const coloring_t& coloring, int64_t begin, int64_t end, Dump_Format format, string& out){
+    int64_t k = dbg.get_k();
+    int64_t n_colors = coloring.largest_color() + 1;
 
-    // Write out
-    out.write(row.data(), row.size());
+    vector<DBG::Node> nodes;
+    for(int64_t id = begin; id < end; id++)
+        if(!dbg.is_dummy(DBG::Node(id))) nodes.push_back(DBG::Node(id));
+
+    string labels; // The MatrixMarket format has no k-mers
+    if(format != Dump_Format::mtx) dbg.get_node_labels(nodes, labels);
+
+    vector<int64_t> colors;
+    string dense_row(n_colors, '0'); // ASCII characters '0' and '1'
+    for(int64_t i = 0; i < (int64_t)nodes.size(); i++){
+        int64_t color_set_id = coloring.get_color_set_id(nodes[i].id);
+
+        if(format == Dump_Format::mtx){
+            colors.clear();
+            coloring.get_color_set_by_color_set_id(color_set_id).push_colors_to_vector(colors);
+            coloring.to_original_colors(colors);
+            int64_t row = dbg.kmer_rank(nodes[i]) + 1; // 1-based
+            for(int64_t color : colors){
+                append_int(out, row); out += ' ';
+                append_int(out, color + 1); out += '\n'; // 1-based
+            }
+            continue;
+        }
+
+        out.append(labels, i * k, k);
+        if(format == Dump_Format::set_ids){
+            out += ' ';
+            append_int(out, color_set_id);
+        } else{
+            colors.clear();
+            coloring.get_color_set_by_color_set_id(color_set_id).push_colors_to_vector(colors);
+            coloring.to_original_colors(colors);
+            if(format == Dump_Format::sparse){
+                for(int64_t color : colors){
+                    out += ' ';
+                    append_int(out, color);
+                }
+            } else{ // Dense
+                for(int64_t color : colors) dense_row[color] = '1';
+                out += ' ';
+                out += dense_row;
+                for(int64_t color : colors) dense_row[color] = '0';
+            }
+        }
+        out += '\n';
+    }
+    return nodes.size();
 }
 
-// Assumes the row has been initialized with enough space for all colors
-template<typename coloring_t> 
-void print_color_set_as_integers(int64_t node_id, const coloring_t& coloring, seq_io::Buffered_ofstream<>& out){
-    char string_buf[32]; // Enough space to represent a 64-bit integer in ascii
-    for(int64_t color : coloring.get_color_set_of_node(node_id).get_colors_as_vector()){
-        int64_t len = fast_int_to_string(color, string_buf);
+static const string mtx_banner = "%%MatrixMarket matrix coordinate pattern general\n";
 
-        char space = ' '; out.write(&space, 1); 
-        out.write(string_buf, len);
-    }
+// The MatrixMarket size line is written with a fixed width so that it can be rewritten in place
+// after the number of entries is known.
+static void write_mtx_size_line(ostream& out, int64_t n_rows, int64_t n_cols, int64_t n_entries){
+    out << std::setw(20) << n_rows << " " << std::setw(20) << n_cols << " " << std::setw(20) << n_entries << "\n";
 }
 
-template<typename coloring_t> 
-void dump_colors(const DBG& dbg, const coloring_t& coloring, string outfile, bool sparse){
+// Dumps the k-mers with node ids in [begin, end) to outfile. If write_mtx_header is true,
+// the MatrixMarket banner and a size line with zero entries are written first. Returns the
+// number of MatrixMarket entries written.
+template<typename coloring_t>
+int64_t dump_shard(const DBG& dbg, const coloring_t& coloring, int64_t begin, int64_t end, Dump_Format format, const string& outfile, bool write_mtx_header, int64_t n_threads, sbwt::Progress_printer& pp){
+    const int64_t chunk_size = 1 << 14; // Node ids
+    int64_t n_chunks = (end - begin + chunk_size - 1) / chunk_size;
+
+    throwing_ofstream out(outfile, ios::binary);
+    if(format == Dump_Format::mtx && write_mtx_header){
+        out.stream << mtx_banner;
+        write_mtx_size_line(out.stream, dbg.number_of_kmers(), coloring.largest_color() + 1, 0);
+    }
 
-    int64_t n_colors = coloring.largest_color() + 1;
+    std::atomic<int64_t> n_entries = 0; // For MatrixMarket
+    write_chunks_in_parallel(out.stream, n_chunks, n_threads, [&](int64_t chunk, string& buf){
+        int64_t chunk_begin = begin + chunk * chunk_size;
+        int64_t chunk_end = min(end, chunk_begin + chunk_size);
+        int64_t n_kmers = format_rows(dbg, coloring, chunk_begin, chunk_end, format, buf);
+        if(format == Dump_Format::mtx) n_entries += std::count(buf.begin(), buf.end(), '\n');
 
-    seq_io::Buffered_ofstream<> out(outfile);
-    vector<bool> matrix_row(n_colors, 0);
-    vector<char> matrix_row_as_ASCII(n_colors, '0');
+        #pragma omp critical
+        {
+            for(int64_t i = 0; i < n_kmers; i++) pp.job_done();
+        }
+    });
 
-    sbwt::Progress_printer pp(dbg.number_of_kmers(), 100);
-    for(DBG::Node v : dbg.all_nodes()){
-        // Extract the k-mer
-        string kmer = dbg.get_node_label(v);
+    return n_entries;
+}
 
-        // Write the k-mer and a space
-        out.write(kmer.c_str(), kmer.size());
+// Writes the distinct color sets, one per line in the format "[color set id] [color 1] [color 2] ...".
+template<typename coloring_t>
+void dump_color_set_table(const coloring_t& coloring, const string& outfile, int64_t n_threads){
+    const int64_t chunk_size = 1 << 12; // Color sets
+    int64_t n_sets = coloring.number_of_distinct_color_sets();
+    int64_t n_chunks = (n_sets + chunk_size - 1) / chunk_size;
+
+    throwing_ofstream out(outfile, ios::binary);
+    write_chunks_in_parallel(out.stream, n_chunks, n_threads, [&](int64_t chunk, string& buf){
+        vector<int64_t> colors;
+        for(int64_t id = chunk * chunk_size; id < min(n_sets, (chunk + 1) * chunk_size); id++){
+            colors.clear();
+            coloring.get_color_set_by_color_set_id(id).push_colors_to_vector(colors);
+            coloring.to_original_colors(colors);
+            append_int(buf, id);
+            for(int64_t color : colors){
+                buf += ' ';
+                append_int(buf, color);
+            }
+            buf += '\n';
+        }
+    });
+}
 
-        if(sparse) print_color_set_as_integers(v.id, coloring, out);
-        else print_color_set_as_bitmap(v.id, coloring, out);
+// If n_shards > 1, the node ids are split into n_shards contiguous ranges written to files
+// outfile.0, outfile.1, ..., so that concatenating the shards gives the output of a single
+// shard in every format. For MatrixMarket, only the first shard has the banner and the size
+// line, and the size line has the number of entries in all shards.
+template<typename coloring_t>
+void dump_colors(const DBG& dbg, const coloring_t& coloring, string outfile, Dump_Format format, int64_t n_shards, int64_t n_threads){
 
-        char newline = '\n'; out.write(&newline, 1); // Write a line break
+    if(format == Dump_Format::set_ids){
+        write_log("Writing the distinct color sets to " + outfile + ".sets", LogLevel::MAJOR);
+        dump_color_set_table(coloring, outfile + ".sets", n_threads);
+    }
 
-        pp.job_done();
+    int64_t n_nodes = dbg.number_of_subsets();
+    int64_t n_entries = 0;
+    sbwt::Progress_printer pp(dbg.number_of_kmers(), 100);
+    auto shard_file = [&](int64_t shard){ return n_shards == 1 ? outfile : outfile + "." + to_string(shard); };
+    for(int64_t shard = 0; shard < n_shards; shard++){
+        int64_t begin = n_nodes * shard / n_shards;
+        int64_t end = n_nodes * (shard + 1) / n_shards;
+        n_entries += dump_shard(dbg, coloring, begin, end, format, shard_file(shard), shard == 0, n_threads, pp);
+    }
+
+    if(format == Dump_Format::mtx){
+        // Fill in the number of entries in the first shard
+        std::fstream first(shard_file(0), ios::in | ios::out | ios::binary);
+        check_true(first.good(), "Could not reopen " + shard_file(0));
+        first.seekp(mtx_banner.size());
+        write_mtx_size_line(first, dbg.number_of_kmers(), coloring.largest_color() + 1, n_entries);
+        check_true(first.good(), "Error writing to " + shard_file(0));
     }
 
 }
 
 int dump_color_matrix_main(int argc, char** argv){
 
-    cxxopts::Options options(argv[0], "This command prints a file where each line corresponds to a k-mer in the index. The line starts with the k-mer, followed by space, followed by the color set of that k-mer. If `--sparse` is given, the color set is printed as a space-separated list of integers. Otherwise, the color set is printed as a string of zeroes and ones such that the i-th character is '1' iff color i is present in the color set.");
+    cxxopts::Options options(argv[0], "This command prints a file where each line corresponds to a k-mer in the index. The line starts with the k-mer, followed by space, followed by the color set of that k-mer. If `--sparse` is given, the color set is printed as a space-separated list of integers. Otherwise, the color set is printed as a string of zeroes and ones such that the i-th character is '1' iff color i is present in the color set. Other output formats can be selected with --format.");
 
     options.add_options()
         ("i,index-prefix", "The index prefix that was given to the build command.", cxxopts::value<string>())
         ("o,output-file", "The output file for the dump.", cxxopts::value<string>())
         ("v,verbose", "More verbose progress reporting into stderr.", cxxopts::value<bool>()->default_value("false"))
         ("silent", "Print as little as possible to stderr (only errors).", cxxopts::value<bool>()->default_value("false"))
-        ("sparse", "Print only the indices of non-zero entries.", cxxopts::value<bool>()->default_value("false"))
+        ("sparse", "Print only the indices of non-zero entries. Same as --format sparse.", cxxopts::value<bool>()->default_value("false"))
+        ("format", "Output format. \"dense\": the k-mer and a string of zeroes and ones. \"sparse\": the k-mer and the list of colors. \"set-ids\": the k-mer and the id of its color set. The distinct color sets are written to [output-file].sets, one per line, starting with the color set id followed by the colors. \"mtx\": MatrixMarket coordinate format without k-mers, where row i (1-based) is the i-th k-mer in the order of the other formats and column j is color j-1.", cxxopts::value<string>()->default_value("dense"))
+        ("shards", "Split the output into this many files [output-file].0, [output-file].1, ... The k-mers are in the same order as in a single file, and concatenating the files gives the output of a single file. In the mtx format only the first file has the header.", cxxopts::value<int64_t>()->default_value("1"))
+        ("t,n-threads", "Number of parallel threads.", cxxopts::value<int64_t>()->default_value("1"))
         ("h,help", "Print usage")
     ;
 
@@ -94,7 +240,16 @@ int dump_color_matrix_main(int argc, char** argv){
     string index_dbg_file = opts["index-prefix"].as<string>() + ".tdbg";
     string index_color_file = opts["index-prefix"].as<string>() + ".tcolors";
     string outfile = opts["output-file"].as<string>();
-    bool sparse = opts["sparse"].as<bool>();
+    Dump_Format format = parse_dump_format(opts["format"].as<string>());
+    if(opts["sparse"].as<bool>()){
+        if(opts.count("format") && format != Dump_Format::sparse)
+            throw std::runtime_error("Can not give both --sparse and --format " + opts["format"].as<string>());
+        format = Dump_Format::sparse;
+    }
+    int64_t n_shards = opts["shards"].as<int64_t>();
+    int64_t n_threads = opts["n-threads"].as<int64_t>();
+    check_true(n_shards >= 1, "Number of shards must be positive");
+    check_true(n_threads >= 1, "Number of threads must be positive");
 
     if(opts["verbose"].as<bool>()) set_log_level(LogLevel::MINOR);
     if(opts["silent"].as<bool>()) set_log_level(LogLevel::OFF);
@@ -109,10 +264,10 @@ int dump_color_matrix_main(int argc, char** argv){
     DBG dbg(&SBWT);
 
     std::variant<Coloring<SDSL_Variant_Color_Set>, Coloring<Roaring_Color_Set>> coloring;
-    load_coloring(index_color_file, SBWT, coloring);
+    load_coloring(index_color_file, SBWT, coloring, n_threads);
 
     auto call_dump_colors = [&](const auto& obj){
-        dump_colors(dbg, obj, outfile, sparse);
+        dump_colors(dbg, obj, outfile, format, n_shards, n_threads);
     };
 
     write_log("Dumping color matrix to " + outfile, LogLevel::MAJOR);
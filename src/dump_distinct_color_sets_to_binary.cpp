@@ -28,6 +28,7 @@ void dump_distinct_color_sets_to_binary(const coloring_t& coloring, const string
         color_buf.clear();
         typename coloring_t::colorset_view_type cs = coloring.get_color_set_by_color_set_id(color_set_id);
         cs.push_colors_to_vector(color_buf);
+        coloring.to_original_colors(color_buf);
         if(cs.size() > UINT32_MAX){
             throw std::runtime_error("Error: color set has more than 2^32 elements");
         }
@@ -21,6 +21,7 @@ int extract_unitigs_main(int argc, char** argv){
         ("gfa-out", "Output the unitig graph in GFA1 format (optional).", cxxopts::value<string>()->default_value(""))
         ("colors-out", "Output filename for the unitig colors (optional). If this option is not given, the colors are not computed. Note that giving this option affects the unitigs written to unitigs-out: if a unitig has nodes with different color sets, the unitig is split into maximal segments of nodes that have equal color sets. The file format of the color file is as follows: there is one line for each unitig. The lines contain space-separated strings. The first string on a line is the FASTA header of a unitig (without the '>'), and the following strings on the line are the integer color labels of the colors of that unitig. The unitigs appear in the same order as in the FASTA file.", cxxopts::value<string>()->default_value(""))
         ("min-colors", "Extract maximal unitigs with at least (>=) min-colors in each node. Can't be used with --colors-out. (optional)", cxxopts::value<int64_t>()->default_value("0"))
+        ("t,n-threads", "Number of parallel threads.", cxxopts::value<int64_t>()->default_value("1"))
         ("v,verbose", "More verbose progress reporting into stderr.", cxxopts::value<bool>()->default_value("false"))
         ("silent", "Print as little as possible to stderr (only errors).", cxxopts::value<bool>()->default_value("false"))
         ("h,help", "Print usage")
@@ -43,6 +44,7 @@ int extract_unitigs_main(int argc, char** argv){
     string gfa_outfile = opts["gfa-out"].as<string>();
     string colors_outfile = opts["colors-out"].as<string>();
     int64_t min_colors = opts["min-colors"].as<int64_t>();
+    int64_t n_threads = opts["n-threads"].as<int64_t>();
     bool do_colors = (colors_outfile != "") || min_colors > 0;
     string index_dbg_file = opts["index-prefix"].as<string>() + ".tdbg";
     string index_color_file = opts["index-prefix"].as<string>() + ".tcolors";
@@ -56,6 +58,7 @@ int extract_unitigs_main(int argc, char** argv){
     if (colors_outfile != "" && min_colors != 0) { // Colors may not make sense for --min-colors
     throw std::runtime_error("Error: Colorset extraction not allowed when --min-colors is given");
     }
+    check_true(n_threads >= 1, "Number of threads must be positive");
 
     // Prepare output streams
 
@@ -94,7 +97,7 @@ int extract_unitigs_main(int argc, char** argv){
     std::variant<Coloring<SDSL_Variant_Color_Set>, Coloring<Roaring_Color_Set>> coloring;
     if(do_colors){
         // Load whichever coloring data structure type is stored on disk
-        load_coloring(index_color_file, SBWT, coloring);
+        load_coloring(index_color_file, SBWT, coloring, n_threads);
     }
 
     DBG dbg(&SBWT);
@@ -103,11 +106,11 @@ int extract_unitigs_main(int argc, char** argv){
 
     if(std::holds_alternative<Coloring<SDSL_Variant_Color_Set>>(coloring)){
         UnitigExtractor<Coloring<SDSL_Variant_Color_Set>> UE;
-        UE.extract_unitigs(dbg, std::get<Coloring<SDSL_Variant_Color_Set>>(coloring), *unitigs_out, do_colors, *colors_out, *gfa_out, min_colors);
+        UE.extract_unitigs(dbg, std::get<Coloring<SDSL_Variant_Color_Set>>(coloring), *unitigs_out, do_colors, *colors_out, *gfa_out, gfa_outfile != "", min_colors, n_threads);
     }
     if(std::holds_alternative<Coloring<Roaring_Color_Set>>(coloring)){
         UnitigExtractor<Coloring<Roaring_Color_Set>> UE;
-        UE.extract_unitigs(dbg, std::get<Coloring<Roaring_Color_Set>>(coloring), *unitigs_out, do_colors, *colors_out, *gfa_out, min_colors);
+        UE.extract_unitigs(dbg, std::get<Coloring<Roaring_Color_Set>>(coloring), *unitigs_out, do_colors, *colors_out, *gfa_out, gfa_outfile != "", min_colors, n_threads);
     }
 
     return 0;
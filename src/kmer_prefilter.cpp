@@ -0,0 +1,112 @@
+#include "kmer_prefilter.hh"
+#include "SeqIO/SeqIO.hh"
+#include "sbwt/globals.hh"
+#include "sbwt/throwing_streams.hh"
+#include <cmath>
+#include <stdexcept>
+
+using namespace sbwt;
+
+Kmer_Prefilter::Kmer_Prefilter(int64_t k, int64_t expected_n_kmers, double bits_per_kmer) : k(k){
+    if(k < 1 || k > 32) throw std::runtime_error("The k-mer prefilter supports only k <= 32");
+    int64_t n_bits = max((int64_t)1, (int64_t)std::ceil(bits_per_kmer * expected_n_kmers));
+    n_blocks = (n_bits + words_per_block * 64 - 1) / (words_per_block * 64);
+    bits.resize(n_blocks * words_per_block, 0);
+}
+
+void Kmer_Prefilter::insert(const char* S, int64_t S_size){
+    for_each_kmer(S, S_size, [this](uint64_t kmer){
+        uint64_t h = mix(kmer);
+        uint64_t* block = bits.data() + ((unsigned __int128)h * n_blocks >> 64) * words_per_block;
+        uint64_t g = mix(h ^ 0x9e3779b97f4a7c15ULL);
+        for(int64_t p = 0; p < n_probes; p++){
+            int64_t bit = (g >> (9*p)) & 511;
+            __atomic_fetch_or(block + bit / 64, 1ULL << (bit % 64), __ATOMIC_RELAXED);
+        }
+    });
+}
+
+bool Kmer_Prefilter::may_contain(uint64_t canonical_kmer) const{
+    uint64_t h = mix(canonical_kmer);
+    const uint64_t* block = bits.data() + ((unsigned __int128)h * n_blocks >> 64) * words_per_block;
+    uint64_t g = mix(h ^ 0x9e3779b97f4a7c15ULL);
+    for(int64_t p = 0; p < n_probes; p++){
+        int64_t bit = (g >> (9*p)) & 511;
+        if(((block[bit / 64] >> (bit % 64)) & 1) == 0) return false;
+    }
+    return true;
+}
+
+int64_t Kmer_Prefilter::count_possible_hits(const char* S, int64_t S_size) const{
+    int64_t count = 0;
+    for_each_kmer(S, S_size, [this, &count](uint64_t kmer){
+        count += may_contain(kmer);
+    });
+    return count;
+}
+
+int64_t Kmer_Prefilter::serialize(ostream& os) const{
+    int64_t bytes_written = 0;
+    bytes_written += serialize_string("themisto-prefilter-v0", os);
+    os.write((char*)&k, sizeof(k));
+    os.write((char*)&n_blocks, sizeof(n_blocks));
+    os.write((char*)bits.data(), bits.size() * sizeof(uint64_t));
+    bytes_written += sizeof(k) + sizeof(n_blocks) + bits.size() * sizeof(uint64_t);
+    return bytes_written;
+}
+
+void Kmer_Prefilter::serialize(const string& filename) const{
+    throwing_ofstream out(filename, ios::binary);
+    serialize(out.stream);
+}
+
+void Kmer_Prefilter::load(istream& is){
+    string type_id = load_string(is);
+    if(!is) throw std::runtime_error("Error: truncated k-mer prefilter");
+    if(type_id != "themisto-prefilter-v0") throw std::runtime_error("Unknown prefilter type: " + type_id);
+    is.read((char*)&k, sizeof(k));
+    is.read((char*)&n_blocks, sizeof(n_blocks));
+    if(!is) throw std::runtime_error("Error: truncated k-mer prefilter");
+    if(k < 1 || k > 32 || n_blocks < 1) throw std::runtime_error("Error: corrupt k-mer prefilter header");
+
+    // The bit array must be as long as the header says. Do not allocate more than the rest
+    // of the stream, if its length is known.
+    const int64_t block_bytes = words_per_block * sizeof(uint64_t);
+    std::streampos pos = is.tellg();
+    if(pos != std::streampos(-1)){
+        is.seekg(0, std::ios::end);
+        int64_t bytes_left = is.tellg() - pos;
+        is.seekg(pos);
+        if(n_blocks > bytes_left / block_bytes) throw std::runtime_error("Error: truncated k-mer prefilter");
+    }
+    bits.resize(n_blocks * words_per_block);
+    is.read((char*)bits.data(), bits.size() * sizeof(uint64_t));
+    if(!is) throw std::runtime_error("Error: truncated k-mer prefilter");
+}
+
+void Kmer_Prefilter::load(const string& filename){
+    throwing_ifstream in(filename, ios::binary);
+    load(in.stream);
+}
+
+template<typename reader_t>
+static void insert_all_sequences(Kmer_Prefilter& prefilter, const string& filename){
+    reader_t reader(filename);
+    while(true){
+        int64_t len = reader.get_next_read_to_buffer();
+        if(len == 0) break;
+        prefilter.insert(reader.read_buf, len);
+    }
+}
+
+Kmer_Prefilter build_kmer_prefilter(const vector<string>& seqfiles, int64_t k, int64_t expected_n_kmers, double bits_per_kmer){
+    Kmer_Prefilter prefilter(k, expected_n_kmers, bits_per_kmer);
+    for(const string& filename : seqfiles){ // The files can be a mix of gzipped and plain files
+        if(seq_io::figure_out_file_format(filename).gzipped)
+            insert_all_sequences<seq_io::Reader<seq_io::Buffered_ifstream<seq_io::zstr::ifstream>>>(prefilter, filename);
+        else
+            insert_all_sequences<seq_io::Reader<seq_io::Buffered_ifstream<std::ifstream>>>(prefilter, filename);
+    }
+    write_log("Built a k-mer prefilter of " + to_string(prefilter.size_in_bytes() / (1 << 20)) + " MB", LogLevel::MAJOR);
+    return prefilter;
+}
@@ -0,0 +1,244 @@
+#include "kmer_set_input.hh"
+#include "globals.hh"
+#include "sbwt/globals.hh"
+#include "sbwt/throwing_streams.hh"
+#include "kmc_file.h"
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <stdexcept>
+
+bool is_kmc_database(const string& path){
+    return std::filesystem::exists(path + ".kmc_pre") && std::filesystem::exists(path + ".kmc_suf");
+}
+
+string kmer_set_data_file(const string& path){
+    return is_kmc_database(path) ? path + ".kmc_suf" : path;
+}
+
+// Upper-cases the k-mer in place and checks it
+static void check_kmer(string& kmer, int64_t k, const string& path){
+    if((int64_t)kmer.size() != k)
+        throw std::runtime_error("K-mer " + kmer + " in " + path + " does not have length " + to_string(k));
+    for(char& c : kmer){
+        c = toupper(c);
+        if(c != 'A' && c != 'C' && c != 'G' && c != 'T')
+            throw std::runtime_error("K-mer " + kmer + " in " + path + " has a character other than ACGT");
+    }
+}
+
+void for_each_kmer_in_set(const string& path, int64_t k, const std::function<void(const string&)>& callback){
+    if(is_kmc_database(path)){
+        CKMCFile db;
+        if(!db.OpenForListing(path)) throw std::runtime_error("Could not open KMC database " + path);
+        CKMCFileInfo info;
+        db.Info(info);
+        if(k == 0) k = info.kmer_length;
+        if((int64_t)info.kmer_length != k)
+            throw std::runtime_error("KMC database " + path + " has k = " + to_string(info.kmer_length) + ", not " + to_string(k));
+
+        CKmerAPI kmer(info.kmer_length);
+        uint64 count;
+        string S;
+        while(db.ReadNextKmer(kmer, count)){
+            S = kmer.to_string();
+            check_kmer(S, k, path);
+            callback(S);
+        }
+        db.Close();
+    } else{
+        std::ifstream in(path);
+        if(!in.good()) throw std::runtime_error("Could not open " + path);
+        string line, S;
+        while(getline(in, line)){
+            S = line.substr(0, line.find_first_of(" \t\r"));
+            if(S.empty()) continue;
+            if(k == 0) k = S.size();
+            check_kmer(S, k, path);
+            callback(S);
+        }
+    }
+}
+
+static string canonical(const string& kmer){
+    return min(kmer, get_reverse_complement(kmer));
+}
+
+// A sorted set of k-mers packed two bits per nucleotide, with a mark for each k-mer. The whole set is
+// in memory.
+class Packed_Kmer_Set{
+
+    int64_t k;
+    int64_t words; // 64-bit words per k-mer
+    vector<uint64_t> data; // The k-mers one after another, most significant bits first
+    vector<bool> used;
+
+    static uint64_t code(char c){
+        switch(c){
+            case 'A': return 0;
+            case 'C': return 1;
+            case 'G': return 2;
+            default: return 3;
+        }
+    }
+
+    const uint64_t* at(int64_t i) const{ return data.data() + i * words; }
+
+    static bool less(const uint64_t* a, const uint64_t* b, int64_t words){
+        return std::lexicographical_compare(a, a + words, b, b + words);
+    }
+
+public:
+
+    Packed_Kmer_Set(int64_t k) : k(k), words((2*k + 63) / 64){}
+
+    // Peak memory per added k-mer: the packed k-mers with up to twice the space from the growth of
+    // the vector, and the sort order and the sorted copy in finalize
+    int64_t bytes_per_kmer() const{ return 24 * words + 8; }
+
+    void reserve(int64_t n_kmers){ data.reserve(n_kmers * words); }
+
+    void encode(const string& kmer, vector<uint64_t>& dest) const{
+        dest.assign(words, 0);
+        for(int64_t i = 0; i < k; i++)
+            dest[2*i / 64] |= code(kmer[i]) << (62 - (2*i % 64));
+    }
+
+    string decode(int64_t i) const{
+        static const char alphabet[] = "ACGT";
+        string S(k, 'A');
+        for(int64_t j = 0; j < k; j++) S[j] = alphabet[(at(i)[2*j / 64] >> (62 - (2*j % 64))) & 3];
+        return S;
+    }
+
+    void add(const string& kmer){
+        vector<uint64_t> x;
+        encode(kmer, x);
+        data.insert(data.end(), x.begin(), x.end());
+    }
+
+    // Sorts the k-mers and removes duplicates. Must be called after all k-mers are added.
+    void finalize(){
+        int64_t n = data.size() / words;
+        vector<int64_t> order(n);
+        for(int64_t i = 0; i < n; i++) order[i] = i;
+        std::sort(order.begin(), order.end(), [&](int64_t a, int64_t b){ return less(at(a), at(b), words); });
+        vector<uint64_t> sorted;
+        sorted.reserve(data.size());
+        for(int64_t i : order){
+            if(!sorted.empty() && std::equal(at(i), at(i) + words, sorted.end() - words)) continue;
+            sorted.insert(sorted.end(), at(i), at(i) + words);
+        }
+        data.swap(sorted);
+        data.shrink_to_fit();
+        used.assign(size(), false);
+    }
+
+    int64_t size() const{ return data.size() / words; }
+
+    // Index of the k-mer, or -1 if it is not in the set
+    int64_t find(const vector<uint64_t>& x) const{
+        int64_t lo = 0, hi = size();
+        while(lo < hi){
+            int64_t mid = (lo + hi) / 2;
+            if(less(at(mid), x.data(), words)) lo = mid + 1;
+            else hi = mid;
+        }
+        if(lo < size() && std::equal(at(lo), at(lo) + words, x.data())) return lo;
+        return -1;
+    }
+
+    bool is_used(int64_t i) const{ return used[i]; }
+    void set_used(int64_t i){ used[i] = true; }
+};
+
+// Appends characters to the end of path as long as the next k-mer is unused in the set. The set has
+// the canonical orientations of the k-mers.
+static void extend_right(string& path, int64_t k, Packed_Kmer_Set& set, vector<uint64_t>& buf){
+    string kmer;
+    while(true){
+        bool extended = false;
+        for(char c : {'A','C','G','T'}){
+            kmer.assign(path.end() - (k-1), path.end());
+            kmer += c;
+            set.encode(canonical(kmer), buf);
+            int64_t i = set.find(buf);
+            if(i != -1 && !set.is_used(i)){
+                set.set_used(i);
+                path += c;
+                extended = true;
+                break;
+            }
+        }
+        if(!extended) return;
+    }
+}
+
+// The length of the k-mers in the set, or 0 if the set is an empty text file
+static int64_t get_k_of_set(const string& path){
+    if(is_kmc_database(path)){
+        CKMCFile db;
+        if(!db.OpenForListing(path)) throw std::runtime_error("Could not open KMC database " + path);
+        CKMCFileInfo info;
+        db.Info(info);
+        db.Close();
+        return info.kmer_length;
+    }
+    std::ifstream in(path);
+    string line;
+    while(getline(in, line)){
+        int64_t len = min(line.size(), line.find_first_of(" \t\r"));
+        if(len > 0) return len;
+    }
+    return 0;
+}
+
+// The number of k-mers in a KMC database, or -1 for a text file
+static int64_t number_of_kmers_in_kmc_database(const string& path){
+    if(!is_kmc_database(path)) return -1;
+    CKMCFile db;
+    if(!db.OpenForListing(path)) throw std::runtime_error("Could not open KMC database " + path);
+    CKMCFileInfo info;
+    db.Info(info);
+    db.Close();
+    return info.total_kmers;
+}
+
+string kmer_set_to_fasta(const string& path, int64_t k, int64_t ram_bytes){
+    if(k == 0) k = get_k_of_set(path);
+    if(k == 0) throw std::runtime_error("K-mer set " + path + " is empty");
+
+    Packed_Kmer_Set set(k);
+    int64_t max_kmers = ram_bytes / set.bytes_per_kmer();
+    string memory_error = "The k-mer set " + path + " does not fit in the memory budget of " + to_string(ram_bytes >> 20)
+                        + " MB. Joining a k-mer set takes about " + to_string(set.bytes_per_kmer()) + " bytes per k-mer. Increase --mem-gigas.";
+
+    // The size of a KMC database is known before reading it
+    int64_t n_kmc_kmers = number_of_kmers_in_kmc_database(path);
+    if(n_kmc_kmers > max_kmers) throw std::runtime_error(memory_error);
+    if(n_kmc_kmers != -1) set.reserve(n_kmc_kmers);
+
+    for_each_kmer_in_set(path, k, [&](const string& kmer){
+        if(set.size() >= max_kmers) throw std::runtime_error(memory_error);
+        set.add(canonical(kmer));
+    });
+    set.finalize();
+
+    string outfile = sbwt::get_temp_file_manager().create_filename("kmer-set-", ".fna");
+    sbwt::throwing_ofstream out(outfile);
+    vector<uint64_t> buf;
+    int64_t n_sequences = 0;
+    for(int64_t i = 0; i < set.size(); i++){
+        if(set.is_used(i)) continue;
+        set.set_used(i);
+        string S = set.decode(i);
+        extend_right(S, k, set, buf);
+        // Extend to the left by extending the reverse complement to the right
+        S = get_reverse_complement(S);
+        extend_right(S, k, set, buf);
+        out.stream << ">\n" << S << "\n";
+        n_sequences++;
+    }
+    sbwt::write_log("Joined " + to_string(set.size()) + " distinct k-mers of " + path + " into " + to_string(n_sequences) + " sequences", sbwt::LogLevel::MINOR);
+    return outfile;
+}
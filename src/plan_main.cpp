@@ -0,0 +1,156 @@
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <filesystem>
+#include "sbwt/globals.hh"
+#include "sbwt/cxxopts.hpp"
+#include "SeqIO/SeqIO.hh"
+#include "globals.hh"
+#include "resource_planner.hh"
+
+using namespace std;
+using namespace sbwt;
+
+static string format_bytes(double bytes){
+    stringstream ss;
+    ss << std::fixed << std::setprecision(2);
+    if(bytes < (1 << 20)) ss << bytes / (1 << 10) << " kB";
+    else if(bytes < (1 << 30)) ss << bytes / (1 << 20) << " MB";
+    else ss << bytes / (1LL << 30) << " GB";
+    return ss.str();
+}
+
+static string format_seconds(double seconds){
+    stringstream ss;
+    ss << std::fixed << std::setprecision(1);
+    if(seconds < 60) ss << seconds << " s";
+    else if(seconds < 3600) ss << seconds / 60 << " min";
+    else ss << seconds / 3600 << " h";
+    return ss.str();
+}
+
+static bool ends_with_dot_txt(const string& S){
+    return S.size() >= 4 && S.substr(S.size()-4) == ".txt";
+}
+
+int plan_main(int argc, char** argv){
+
+    cxxopts::Options options(argv[0], "Predict the memory, temporary disk space and time needed to build an index from the given input, and the memory needed to query it. Takes the same input options as the build command.");
+
+    options.add_options()
+        ("k,node-length", "The k of the k-mers.", cxxopts::value<int64_t>())
+        ("i,input-file", "The input sequences in FASTA or FASTQ format, or a .txt file with a list of filenames, like in the build command.", cxxopts::value<string>())
+        ("f,file-colors", "Plan for one color per file (default with multiple files). This builds the index with GGCAT.", cxxopts::value<bool>()->default_value("false"))
+        ("e,sequence-colors", "Plan for one color per sequence (default with a single file).", cxxopts::value<bool>()->default_value("false"))
+        ("c,manual-colors", "Color file like in the build command.", cxxopts::value<string>())
+        ("forward-strand-only", "Plan for an index without reverse complements.", cxxopts::value<bool>()->default_value("false"))
+        ("d,colorset-pointer-tradeoff", "The -d parameter of the build.", cxxopts::value<int64_t>()->default_value("20"))
+        ("s,coloring-structure-type", "Type of coloring structure (\"sdsl-hybrid\", \"roaring\").", cxxopts::value<string>()->default_value("sdsl-hybrid"))
+        ("mem-gigas", "The memory budget that will be given to the build.", cxxopts::value<int64_t>()->default_value("2"))
+        ("t,n-threads", "Number of threads for the build and for queries. Also used for sampling.", cxxopts::value<int64_t>()->default_value("1"))
+        ("prefilter", "Plan for building the k-mer prefilter.", cxxopts::value<bool>()->default_value("false"))
+        ("prefilter-bits-per-kmer", "Size of the k-mer prefilter in bits per k-mer.", cxxopts::value<double>()->default_value("10"))
+        ("buffer-size-megas", "The query buffer size per thread in megabytes.", cxxopts::value<int64_t>()->default_value("8"))
+        ("temp-dir", "If given, the free space in this directory is compared to the predicted temporary disk usage.", cxxopts::value<string>())
+        ("sample-fraction", "Fraction of distinct k-mers to sample. All of the input is read once, but only the sampled k-mers are stored in memory. Larger fractions give better estimates.", cxxopts::value<double>()->default_value("0.01"))
+        ("calibration", "A statistics file written by `themisto build --stats-out`, or a .txt file with a list of such files. The model is scaled to match the measured runs.", cxxopts::value<string>())
+        ("v,verbose", "More verbose progress reporting into stderr.", cxxopts::value<bool>()->default_value("false"))
+        ("silent", "Print as little as possible to stderr (only errors).", cxxopts::value<bool>()->default_value("false"))
+        ("h,help", "Print usage")
+    ;
+
+    int64_t old_argc = argc; // Must store this because the parser modifies it
+    auto opts = options.parse(argc, argv);
+
+    if (old_argc == 1 || opts.count("help")){
+        std::cerr << options.help() << std::endl;
+        cerr << "Usage example:" << endl;
+        cerr << "./build/bin/themisto plan -k 31 -i example_input/coli_file_list.txt --mem-gigas 2 --n-threads 4 --temp-dir temp" << endl;
+        return 1;
+    }
+
+    if(opts["verbose"].as<bool>() && opts["silent"].as<bool>())
+        throw runtime_error("Can not give both --verbose and --silent");
+    if(opts["verbose"].as<bool>()) set_log_level(LogLevel::MINOR);
+    if(opts["silent"].as<bool>()) set_log_level(LogLevel::OFF);
+
+    check_true(opts.count("node-length"), "Parameter k not set");
+    check_true(opts.count("input-file"), "Input file not set");
+    int64_t k = opts["k"].as<int64_t>();
+    check_true(k >= 1 && k <= MAX_KMER_LENGTH, "k must be between 1 and " + to_string(MAX_KMER_LENGTH));
+
+    string input = opts["input-file"].as<string>();
+    vector<string> seqfiles = ends_with_dot_txt(input) ? readlines(input) : vector<string>{input};
+    for(const string& S : seqfiles) check_readable(S);
+
+    vector<string> colorfiles;
+    if(opts.count("manual-colors")){
+        string colorfile = opts["manual-colors"].as<string>();
+        colorfiles = ends_with_dot_txt(input) ? readlines(colorfile) : vector<string>{colorfile};
+        for(const string& S : colorfiles) check_readable(S);
+    }
+
+    bool file_colors = opts["file-colors"].as<bool>();
+    if(colorfiles.size() == 0 && !file_colors && !opts["sequence-colors"].as<bool>())
+        file_colors = seqfiles.size() > 1; // Same default as in the build command
+
+    Plan_Settings S;
+    S.colorset_sampling_distance = opts["colorset-pointer-tradeoff"].as<int64_t>();
+    S.coloring_structure_type = opts["coloring-structure-type"].as<string>();
+    S.mem_megas = opts["mem-gigas"].as<int64_t>() * 1024;
+    S.n_threads = opts["n-threads"].as<int64_t>();
+    S.reverse_complements = !opts["forward-strand-only"].as<bool>();
+    S.ggcat = file_colors;
+    S.prefilter = opts["prefilter"].as<bool>();
+    S.prefilter_bits_per_kmer = opts["prefilter-bits-per-kmer"].as<double>();
+    S.query_buffer_megas = opts["buffer-size-megas"].as<int64_t>();
+
+    check_true(S.coloring_structure_type == "sdsl-hybrid" || S.coloring_structure_type == "roaring", "Unknown coloring structure type: " + S.coloring_structure_type);
+    check_true(S.colorset_sampling_distance >= 1, "Colorset sampling distance must be positive");
+    check_true(S.n_threads >= 1, "Number of threads must be positive");
+
+    Calibration calibration;
+    if(opts.count("calibration")){
+        string calibration_file = opts["calibration"].as<string>();
+        calibration = load_calibration(ends_with_dot_txt(calibration_file) ? readlines(calibration_file) : vector<string>{calibration_file});
+    }
+
+    Plan_Inputs I = estimate_plan_inputs(seqfiles, colorfiles, file_colors, k, S.reverse_complements, S.coloring_structure_type, opts["sample-fraction"].as<double>(), S.n_threads);
+    Resource_Plan plan = predict_resources(I, S, calibration);
+
+    cout << "== Input ==" << endl;
+    cout << "Input files: " << seqfiles.size() << " (" << format_bytes(I.input_bytes) << ")" << endl;
+    cout << "Sequences: " << I.n_sequences << endl;
+    cout << "Nucleotides: " << I.input_bases << endl;
+    cout << "Colors: " << I.n_colors << endl;
+    cout << "== Estimated index properties ==" << endl;
+    cout << "K-mers in the de Bruijn graph: " << I.n_kmers << endl;
+    cout << "Core k-mers: " << I.n_core_kmers << endl;
+    cout << "Distinct color sets: " << I.n_distinct_color_sets << endl;
+    cout << "Sum of sizes of distinct color sets: " << I.sum_of_distinct_color_set_lengths << endl;
+    cout << "== Predicted build resources" << (calibration.n_runs > 0 ? " (calibrated with " + to_string(calibration.n_runs) + " runs)" : " (uncalibrated)") << " ==" << endl;
+    for(const Stage_Prediction& s : plan.build_stages){
+        cout << s.name << ": RAM " << format_bytes(s.peak_ram_bytes) << ", temporary disk " << format_bytes(s.peak_temp_bytes) << ", time " << format_seconds(s.seconds) << endl;
+    }
+    cout << "Peak RAM: " << format_bytes(plan.peak_build_ram_bytes()) << endl;
+    cout << "Peak temporary disk: " << format_bytes(plan.peak_build_temp_bytes()) << endl;
+    cout << "Total time: " << format_seconds(plan.total_build_seconds()) << endl;
+    cout << "== Predicted index ==" << endl;
+    cout << "[prefix].tdbg: " << format_bytes(plan.index_dbg_bytes) << endl;
+    cout << "[prefix].tcolors: " << format_bytes(plan.index_colors_bytes) << endl;
+    cout << "== Predicted query memory ==" << endl;
+    cout << "Intersection method: " << format_bytes(plan.query_ram_bytes) << endl;
+    cout << "Threshold method: " << format_bytes(plan.query_ram_bytes_threshold) << endl;
+
+    if(opts.count("temp-dir")){
+        string temp_dir = opts["temp-dir"].as<string>();
+        check_dir_exists(temp_dir);
+        double free_bytes = std::filesystem::space(temp_dir).available;
+        if(free_bytes < plan.peak_build_temp_bytes())
+            cout << "Warning: the temporary directory has only " << format_bytes(free_bytes) << " of free space" << endl;
+    }
+
+    return 0;
+}
@@ -1,10 +1,13 @@
 #include <string>
 #include <cstring>
+#include <filesystem>
 #include "zpipe.hh"
 #include "version.h"
 #include "coloring/Coloring.hh"
 #include "globals.hh"
 #include "pseudoalign.hh"
+#include "read_binning.hh"
+#include "kmer_prefilter.hh"
 #include "sbwt/globals.hh"
 #include "sbwt/throwing_streams.hh"
 #include "sbwt/variants.hh"
@@ -19,6 +22,7 @@ struct Pseudoalign_Config{
     vector<string> outfiles;
     string index_dbg_file;
     string index_color_file;
+    string index_prefilter_file;
     string temp_dir;
 
     bool gzipped_output = false;
@@ -32,7 +36,12 @@ struct Pseudoalign_Config{
     double threshold = -1;
     bool ignore_unknown = false;
     bool report_relevant = false;
+    bool use_prefilter = true;
+    bool fast_color_set_lookup = false; // Build the color set descriptor table (see Color_Set_Storage::build_descriptor_table)
     double relevant_kmers_fraction = 0;
+    string bin_prefix; // Empty if read binning is not enabled
+    string bin_groups_file; // Empty if every color is its own bin
+    string color_mask_file; // Empty if all colors are used
 
     void check_valid(){
         for(string query_file : query_files){
@@ -60,6 +69,19 @@ struct Pseudoalign_Config{
         check_true(outfiles.size() > 0, "Can't sort output when printing results");
     }
 
+    if (color_mask_file != "") check_readable(color_mask_file);
+
+    if (bin_prefix != "") {
+        // The bins are shared by all query files, so they are all FASTA or all FASTQ
+        for(const string& query_file : query_files)
+            check_true(seq_io::figure_out_file_format(query_file).format == seq_io::figure_out_file_format(query_files[0]).format, "--bin-prefix requires the query files to be all FASTA or all FASTQ: " + query_file);
+    }
+
+    if (bin_groups_file != "") {
+        check_true(bin_prefix != "", "--bin-groups requires --bin-prefix");
+        check_readable(bin_groups_file);
+    }
+
     check_true(temp_dir != "", "Temp directory not set");
         check_dir_exists(temp_dir);
     }
@@ -78,13 +100,37 @@ vector<string> read_lines(string filename){
 
 // If outputfile is an empty string, prints to stdout
 template<typename coloring_t> 
-void call_pseudoalign(plain_matrix_sbwt_t& SBWT, const coloring_t& coloring, Pseudoalign_Config& C, string inputfile, string outputfile){
+void call_pseudoalign(plain_matrix_sbwt_t& SBWT, const coloring_t& coloring, Pseudoalign_Config& C, string inputfile, string outputfile, Read_Binner* binner, const Color_Mask<coloring_t>* mask, const Kmer_Prefilter* prefilter){
+    // FASTQ reads are binned with their quality strings
+    unique_ptr<Fastq_Quality_Reader> qualities;
+    if(binner != nullptr && seq_io::figure_out_file_format(inputfile).format == seq_io::FASTQ)
+        qualities = make_unique<Fastq_Quality_Reader>(inputfile);
+
     if(seq_io::figure_out_file_format(inputfile).gzipped){
         seq_io::Reader<seq_io::Buffered_ifstream<seq_io::zstr::ifstream>> reader(inputfile);
-        pseudoalign(SBWT, coloring, C.n_threads, reader, outputfile, C.reverse_complements, C.buffer_size_megas * (1 << 20), C.gzipped_output, C.sort_output_lines, C.threshold, C.ignore_unknown, C.report_relevant, C.relevant_kmers_fraction, C.sort_hits); // Buffer size 8 MB
+        pseudoalign(SBWT, coloring, C.n_threads, reader, outputfile, C.reverse_complements, C.buffer_size_megas * (1 << 20), C.gzipped_output, C.sort_output_lines, C.threshold, C.ignore_unknown, C.report_relevant, C.relevant_kmers_fraction, C.sort_hits, binner, mask, prefilter, qualities.get()); // Buffer size 8 MB
     } else{
         seq_io::Reader<seq_io::Buffered_ifstream<std::ifstream>> reader(inputfile);
-        pseudoalign(SBWT, coloring, C.n_threads, reader, outputfile, C.reverse_complements, C.buffer_size_megas * (1 << 20), C.gzipped_output, C.sort_output_lines, C.threshold, C.ignore_unknown, C.report_relevant, C.relevant_kmers_fraction, C.sort_hits); // Buffer size 8 MB
+        pseudoalign(SBWT, coloring, C.n_threads, reader, outputfile, C.reverse_complements, C.buffer_size_megas * (1 << 20), C.gzipped_output, C.sort_output_lines, C.threshold, C.ignore_unknown, C.report_relevant, C.relevant_kmers_fraction, C.sort_hits, binner, mask, prefilter, qualities.get()); // Buffer size 8 MB
+    }
+}
+
+template<typename coloring_t>
+void align_all_query_files(plain_matrix_sbwt_t& SBWT, const coloring_t& coloring, Pseudoalign_Config& C, Read_Binner* binner, const Kmer_Prefilter* prefilter){
+    unique_ptr<Color_Mask<coloring_t>> mask;
+    if(C.color_mask_file != ""){
+        write_log("Restricting color sets to the color mask", LogLevel::MAJOR);
+        mask = make_unique<Color_Mask<coloring_t>>(coloring, read_colorfile(C.color_mask_file), C.n_threads);
+        write_log("The color mask has " + to_string(mask->size()) + " colors and " + to_string(mask->number_of_distinct_masked_sets()) + " distinct masked color sets", LogLevel::MAJOR);
+    }
+
+    for(int64_t i = 0; i < C.query_files.size(); i++){
+        if (C.outfiles.size() > 0) {
+            write_log("Aligning " + C.query_files[i] + " (writing output to " + C.outfiles[i] + ")", LogLevel::MAJOR);
+        } else {
+            write_log("Aligning " + C.query_files[i] + " (printing output)", LogLevel::MAJOR);
+        }
+        call_pseudoalign(SBWT, coloring, C, C.query_files[i], (C.outfiles.size() > 0 ? C.outfiles[i] : ""), binner, mask.get(), prefilter);
     }
 }
 
@@ -120,6 +166,8 @@ int pseudoalign_main(int argc_given, char** argv_given){
         ("sort-output-lines", "Sort the lines in the output files by sequence rank in the input files. To sort the color ids *within* the lines, use --sort-hits.", cxxopts::value<bool>()->default_value("false"))
         ("sort-hits", "Sort the color ids within each line of the output.", cxxopts::value<bool>()->default_value("false"))
         ("v,verbose", "More verbose progress reporting into stderr.", cxxopts::value<bool>()->default_value("false"))
+        ("bin-prefix", "Also write the reads that pseudoalign to each color into a separate file [bin-prefix][color].fna, in the same pass. FASTQ queries are binned with their quality values into [bin-prefix][color].fastq files. The reads keep their original headers. The bin files are gzipped if --gzip-output is given. Existing bin files with the same names are replaced. The query files must be all FASTA or all FASTQ.", cxxopts::value<string>()->default_value(""))
+        ("bin-groups", "Bin the reads by groups of colors instead of single colors. The file should have one line per color, where line i is the name of the group of color i. The group name replaces the color in the bin filenames, so it can not contain '/' or '..'.", cxxopts::value<string>()->default_value(""))
     ;
 
     options.add_options("Algorithm")
@@ -127,6 +175,7 @@ int pseudoalign_main(int argc_given, char** argv_given){
         ("include-unknown-kmers", "Include all k-mers in the pseudoalignment, even those which do not occur in the index.", cxxopts::value<bool>()->default_value("false"))
         ("report-relevant-kmer-count", "Appends to each output line a semicolon followed by a space and then the number of k-mers of the query that had at least 1 color.", cxxopts::value<bool>()->default_value("false"))
         ("relevant-kmers-fraction", "Accept a pseudoalignment only if at least this fraction of k-mers of the read had at least 1 color.", cxxopts::value<double>()->default_value("0.0"))
+        ("color-mask", "A file with one color id per line. Only these colors are considered in the pseudoalignment and reported in the output. This is much faster than a full query if the mask is small. The relevant k-mer count still counts all k-mers that have at least 1 color.", cxxopts::value<string>()->default_value(""))
     ;
 
     options.add_options("Computational resources")
@@ -142,6 +191,8 @@ int pseudoalign_main(int argc_given, char** argv_given){
         ("rc", "Include reverse complement matches in the pseudoalignment. This option only makes sense if the index was built with --forward-strand-only. Otherwise this option has no effect except to slow down the query.", cxxopts::value<bool>()->default_value("false"))
         ("buffer-size-megas", "Size of the input buffer in megabytes in each thread. If this is larger than the number of nucleotides in the input divided by the number of threads, then some threads will be idle. So if your input files are really small and you have a lot of threads, consider using a small buffer.", cxxopts::value<double>()->default_value("8.0"))
         ("silent", "Print as little as possible to stderr (only errors).", cxxopts::value<bool>()->default_value("false"))
+        ("fast-color-set-lookup", "Build a table with the location of every distinct color set in memory when the index is loaded, unless the index already stores it (see themisto build --fast-color-set-lookup). This makes fetching a color set faster, but takes up to 8 bytes of memory per distinct color set.", cxxopts::value<bool>()->default_value("false"))
+        ("no-prefilter", "Do not use the k-mer prefilter even if the index has one (see --prefilter in the build command).", cxxopts::value<bool>()->default_value("false"))
     ;
 
     int64_t old_argc = argc; // Must store this because the parser modifies it
@@ -168,6 +219,7 @@ int pseudoalign_main(int argc_given, char** argv_given){
             C.outfiles.push_back(line);
     C.index_dbg_file = opts["index-prefix"].as<string>() + ".tdbg";
     C.index_color_file = opts["index-prefix"].as<string>() + ".tcolors";
+    C.index_prefilter_file = opts["index-prefix"].as<string>() + ".tprefilter";
     C.temp_dir = opts["temp-dir"].as<string>();
     C.reverse_complements = opts["rc"].as<bool>();
     C.n_threads = opts["n-threads"].as<int64_t>();
@@ -181,6 +233,11 @@ int pseudoalign_main(int argc_given, char** argv_given){
     C.ignore_unknown = !opts["include-unknown-kmers"].as<bool>();
     C.report_relevant = opts["report-relevant-kmer-count"].as<bool>();
     C.relevant_kmers_fraction = opts["relevant-kmers-fraction"].as<double>();
+    C.bin_prefix = opts["bin-prefix"].as<string>();
+    C.bin_groups_file = opts["bin-groups"].as<string>();
+    C.color_mask_file = opts["color-mask"].as<string>();
+    C.use_prefilter = !opts["no-prefilter"].as<bool>();
+    C.fast_color_set_lookup = opts["fast-color-set-lookup"].as<bool>();
 
     if(C.verbose && C.silent) throw runtime_error("Can not give both --verbose and --silent");
     if(C.verbose) set_log_level(LogLevel::MINOR);
@@ -205,26 +262,45 @@ int pseudoalign_main(int argc_given, char** argv_given){
     // Load whichever coloring data structure type is stored on disk
     std::variant<Coloring<SDSL_Variant_Color_Set>,
                  Coloring<Roaring_Color_Set>> coloring;
-    load_coloring(C.index_color_file, SBWT, coloring);
+    load_coloring(C.index_color_file, SBWT, coloring, C.n_threads);
 
     if(std::holds_alternative<Coloring<SDSL_Variant_Color_Set>>(coloring))
         write_log("sdsl coloring structure loaded", LogLevel::MAJOR);
     if(std::holds_alternative<Coloring<Roaring_Color_Set>>(coloring))
         write_log("roaring coloring structure loaded", LogLevel::MAJOR);
 
-    for(int64_t i = 0; i < C.query_files.size(); i++){
-        if (C.outfiles.size() > 0) {
-            write_log("Aligning " + C.query_files[i] + " (writing output to " + C.outfiles[i] + ")", LogLevel::MAJOR);
-        } else {
-            write_log("Aligning " + C.query_files[i] + " (printing output)", LogLevel::MAJOR);
-        }
+    bool has_descriptor_table = std::visit([](auto& c){return c.has_color_set_descriptor_table();}, coloring);
+    if(has_descriptor_table)
+        write_log("Color set descriptor table loaded from the index", LogLevel::MAJOR);
+    else if(C.fast_color_set_lookup){
+        write_log("Building the color set descriptor table", LogLevel::MAJOR);
+        std::visit([](auto& c){c.build_color_set_descriptor_table();}, coloring);
+    }
+
+    unique_ptr<Kmer_Prefilter> prefilter;
+    if(C.use_prefilter && std::filesystem::exists(C.index_prefilter_file)){
+        write_log("Loading the k-mer prefilter", LogLevel::MAJOR);
+        prefilter = make_unique<Kmer_Prefilter>();
+        prefilter->load(C.index_prefilter_file);
+        check_true(prefilter->get_k() == SBWT.get_k(), "The k of the prefilter does not match the index");
+    }
 
-        if(std::holds_alternative<Coloring<SDSL_Variant_Color_Set>>(coloring))
-            call_pseudoalign(SBWT, get<Coloring<SDSL_Variant_Color_Set>>(coloring), C, C.query_files[i], (C.outfiles.size() > 0 ? C.outfiles[i] : ""));
-        if(std::holds_alternative<Coloring<Roaring_Color_Set>>(coloring))
-            call_pseudoalign(SBWT, get<Coloring<Roaring_Color_Set>>(coloring), C, C.query_files[i], (C.outfiles.size() > 0 ? C.outfiles[i] : ""));
+    // The bins are shared by all query files
+    unique_ptr<Read_Binner> binner;
+    if(C.bin_prefix != ""){
+        int64_t n_colors = std::visit([](auto& c){return c.largest_color() + 1;}, coloring);
+        vector<string> color_groups;
+        if(C.bin_groups_file != "") color_groups = read_color_groups(C.bin_groups_file);
+        bool fastq = seq_io::figure_out_file_format(C.query_files[0]).format == seq_io::FASTQ;
+        binner = make_unique<Read_Binner>(C.bin_prefix, n_colors, color_groups, C.gzipped_output, fastq, C.buffer_size_megas * (1 << 20));
+        write_log("Binning reads into " + to_string(binner->number_of_bins()) + " bins", LogLevel::MAJOR);
     }
 
+    if(std::holds_alternative<Coloring<SDSL_Variant_Color_Set>>(coloring))
+        align_all_query_files(SBWT, get<Coloring<SDSL_Variant_Color_Set>>(coloring), C, binner.get(), prefilter.get());
+    if(std::holds_alternative<Coloring<Roaring_Color_Set>>(coloring))
+        align_all_query_files(SBWT, get<Coloring<Roaring_Color_Set>>(coloring), C, binner.get(), prefilter.get());
+
     write_log("Finished", LogLevel::MAJOR);
 
     free(argv);
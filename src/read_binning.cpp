@@ -0,0 +1,156 @@
+#include "read_binning.hh"
+#include "globals.hh"
+#include "SeqIO/SeqIO.hh"
+#include "SeqIO/buffered_streams.hh"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <zlib.h>
+
+// Compresses the data into a single gzip member
+static void gzip_compress(const vector<char>& in, vector<char>& out){
+    z_stream strm = {};
+    if(deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) // +16: gzip wrapper
+        throw std::runtime_error("Error initializing zlib");
+
+    out.resize(deflateBound(&strm, in.size()));
+    strm.next_in = (Bytef*)in.data();
+    strm.avail_in = in.size();
+    strm.next_out = (Bytef*)out.data();
+    strm.avail_out = out.size();
+    int ret = deflate(&strm, Z_FINISH);
+    deflateEnd(&strm);
+    if(ret != Z_STREAM_END) throw std::runtime_error("Error compressing read bin data");
+    out.resize(strm.total_out);
+}
+
+Read_Binner::Read_Binner(const string& out_prefix, int64_t n_colors, const vector<string>& color_groups, bool gzipped, bool fastq, int64_t flush_threshold)
+    : out_prefix(out_prefix), gzipped(gzipped), fastq(fastq), flush_threshold(flush_threshold) {
+
+    if(color_groups.size() == 0){
+        for(int64_t color = 0; color < n_colors; color++){
+            color_to_bin.push_back(color);
+            bin_names.push_back(to_string(color));
+        }
+    } else{
+        if((int64_t)color_groups.size() < n_colors)
+            throw std::runtime_error("The color group file has " + to_string(color_groups.size()) + " lines but the index has " + to_string(n_colors) + " colors");
+        unordered_map<string, int64_t> group_to_bin;
+        for(int64_t color = 0; color < n_colors; color++){
+            const string& group = color_groups[color];
+            if(group.find('/') != string::npos || group.find("..") != string::npos)
+                throw std::runtime_error("Color group name " + group + " can not be used in a filename because it contains '/' or '..'");
+            if(group_to_bin.count(group) == 0){
+                group_to_bin[group] = bin_names.size();
+                bin_names.push_back(group);
+            }
+            color_to_bin.push_back(group_to_bin[group]);
+        }
+    }
+
+    for(int64_t i = 0; i < (int64_t)bin_names.size(); i++)
+        bins.push_back(make_unique<Bin>());
+
+    // Bin files left over from an earlier run with the same prefix would look like output of this run
+    for(int64_t i = 0; i < (int64_t)bin_names.size(); i++)
+        std::filesystem::remove(get_bin_filename(i));
+}
+
+string Read_Binner::get_bin_filename(int64_t bin) const{
+    return out_prefix + bin_names[bin] + (fastq ? ".fastq" : ".fna") + (gzipped ? ".gz" : "");
+}
+
+void Read_Binner::append_to_bin(int64_t bin, const char* data, int64_t data_length){
+    std::lock_guard<std::mutex> lock(bins[bin]->mutex);
+    string filename = get_bin_filename(bin);
+    std::ofstream out(filename, std::ios::binary | (bins[bin]->created ? std::ios::app : std::ios::trunc));
+    if(!out.good()) throw std::runtime_error("Error opening file " + filename);
+    out.write(data, data_length);
+    if(!out.good()) throw std::runtime_error("Error writing to file " + filename);
+    bins[bin]->created = true;
+}
+
+void Read_Binner::add_read(Thread_Buffer& buf, const char* header, int64_t header_length, int64_t read_rank, const char* seq, int64_t seq_length, const char* quality, const vector<int64_t>& colors){
+    if((quality != nullptr) != fastq)
+        throw std::runtime_error(fastq ? "Read without quality values given to FASTQ read bins" : "Read with quality values given to FASTA read bins");
+    if(colors.size() == 0) return;
+
+    // A read goes to each bin only once even if it hits many colors of the same group
+    buf.bins_of_read.clear();
+    for(int64_t color : colors) buf.bins_of_read.push_back(color_to_bin[color]);
+    std::sort(buf.bins_of_read.begin(), buf.bins_of_read.end());
+    buf.bins_of_read.erase(std::unique(buf.bins_of_read.begin(), buf.bins_of_read.end()), buf.bins_of_read.end());
+
+    char rank_buffer[32];
+    if(header_length == 0){
+        header_length = fast_int_to_string(read_rank, rank_buffer);
+        header = rank_buffer;
+    }
+
+    for(int64_t bin : buf.bins_of_read){
+        vector<char>& out = buf.buffers[bin];
+        int64_t old_size = out.size();
+        out.push_back(fastq ? '@' : '>');
+        out.insert(out.end(), header, header + header_length);
+        out.push_back('\n');
+        out.insert(out.end(), seq, seq + seq_length);
+        out.push_back('\n');
+        if(fastq){
+            out.push_back('+');
+            out.push_back('\n');
+            out.insert(out.end(), quality, quality + seq_length);
+            out.push_back('\n');
+        }
+        buf.total_bytes += out.size() - old_size;
+    }
+
+    if(buf.total_bytes > flush_threshold) flush(buf);
+}
+
+void Read_Binner::flush(Thread_Buffer& buf){
+    for(auto& [bin, data] : buf.buffers){
+        if(data.size() == 0) continue;
+        if(gzipped){
+            // Compress outside of the lock of the bin so that threads compress in parallel
+            gzip_compress(data, buf.compressed);
+            append_to_bin(bin, buf.compressed.data(), buf.compressed.size());
+        } else{
+            append_to_bin(bin, data.data(), data.size());
+        }
+    }
+    buf.buffers.clear(); // Releases the memory so that idle bins do not hold on to their capacity
+    buf.total_bytes = 0;
+}
+
+Fastq_Quality_Reader::Fastq_Quality_Reader(const string& filename) : filename(filename){
+    if(seq_io::figure_out_file_format(filename).gzipped)
+        gzipped_in = make_unique<seq_io::Buffered_ifstream<seq_io::zstr::ifstream>>(filename, ios::binary);
+    else
+        plain_in = make_unique<seq_io::Buffered_ifstream<std::ifstream>>(filename, ios::binary);
+}
+
+bool Fastq_Quality_Reader::getline(string& line){
+    bool ok = plain_in != nullptr ? (bool)plain_in->getline(line) : (bool)gzipped_in->getline(line);
+    if(ok && line.size() > 0 && line.back() == '\r') line.pop_back();
+    return ok;
+}
+
+const string& Fastq_Quality_Reader::next(){
+    // A record is the header, the sequence, the separator and the quality string
+    for(int64_t i = 0; i < 4; i++)
+        if(!getline(line)) throw std::runtime_error("FASTQ file " + filename + " ended unexpectedly");
+    return line;
+}
+
+vector<string> read_color_groups(const string& filename){
+    vector<string> groups;
+    seq_io::Buffered_ifstream<> in(filename);
+    string line;
+    while(in.getline(line)){
+        if(line.size() > 0 && line.back() == '\r') line.pop_back();
+        if(line.size() == 0) throw std::runtime_error("Empty line in color group file " + filename);
+        groups.push_back(line);
+    }
+    return groups;
+}
@@ -0,0 +1,620 @@
+#include "resource_planner.hh"
+#include "SeqIO/SeqIO.hh"
+#include "SeqIO/buffered_streams.hh"
+#include "sbwt/globals.hh"
+#include "coloring/Color_Set.hh"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <unistd.h>
+#include <omp.h>
+
+using namespace sbwt;
+
+// Uncalibrated model constants. These are rough figures from builds on a typical server with
+// local SSD storage. Calibration factors from real builds correct for the hardware at hand.
+namespace planner_constants{
+    constexpr double sbwt_bytes_per_kmer = 0.75; // Four bit vectors with rank support plus the streaming support bits
+    constexpr double kmc_temp_bytes_per_base = 0.6; // KMC bins super-k-mers on disk
+    constexpr double dbg_bases_per_second_per_thread = 1.5e7; // KMC and SBWT construction
+    constexpr double ggcat_temp_bytes_per_base = 1.0;
+    constexpr double ggcat_bases_per_second_per_thread = 1e7;
+    constexpr double search_bases_per_second_per_thread = 3e7; // Streaming search while collecting node-color pairs
+    constexpr double disk_bytes_per_second = 3e8; // Sequential I/O of the external memory sorts
+    constexpr double representation_kmers_per_second = 1e7; // Walking unitigs to sample color set pointers
+    constexpr double prefilter_bases_per_second = 5e7;
+    constexpr int64_t dispatcher_buffer_bytes = 1 << 20; // Per thread, see Coloring_Builder
+}
+
+static int64_t bits_needed(uint64_t x){
+    return max((int64_t)std::bit_width(x), (int64_t)1);
+}
+
+static int64_t get_int(const map<string, string>& kv, const string& key, int64_t default_value){
+    auto it = kv.find(key);
+    if(it == kv.end()) return default_value;
+    return std::stoll(it->second);
+}
+
+static double get_double(const map<string, string>& kv, const string& key, double default_value){
+    auto it = kv.find(key);
+    if(it == kv.end()) return default_value;
+    return std::stod(it->second);
+}
+
+void Plan_Inputs::add_to(map<string, string>& kv) const{
+    kv["k"] = to_string(k);
+    kv["input_bytes"] = to_string(input_bytes);
+    kv["input_bases"] = to_string(input_bases);
+    kv["n_sequences"] = to_string(n_sequences);
+    kv["n_colors"] = to_string(n_colors);
+    kv["n_kmers"] = to_string(n_kmers);
+    kv["n_core_kmers"] = to_string(n_core_kmers);
+    kv["n_node_color_pairs"] = to_string(n_node_color_pairs);
+    kv["n_distinct_color_sets"] = to_string(n_distinct_color_sets);
+    kv["sum_of_distinct_color_set_lengths"] = to_string(sum_of_distinct_color_set_lengths);
+    kv["color_set_storage_bytes"] = to_string(color_set_storage_bytes);
+}
+
+Plan_Inputs Plan_Inputs::from_key_values(const map<string, string>& kv){
+    Plan_Inputs I;
+    I.k = get_int(kv, "k", 0);
+    I.input_bytes = get_int(kv, "input_bytes", 0);
+    I.input_bases = get_int(kv, "input_bases", 0);
+    I.n_sequences = get_int(kv, "n_sequences", 0);
+    I.n_colors = get_int(kv, "n_colors", 0);
+    I.n_kmers = get_int(kv, "n_kmers", 0);
+    I.n_core_kmers = get_int(kv, "n_core_kmers", 0);
+    I.n_node_color_pairs = get_int(kv, "n_node_color_pairs", 0);
+    I.n_distinct_color_sets = get_int(kv, "n_distinct_color_sets", 0);
+    I.sum_of_distinct_color_set_lengths = get_int(kv, "sum_of_distinct_color_set_lengths", 0);
+    I.color_set_storage_bytes = get_int(kv, "color_set_storage_bytes", 0);
+    return I;
+}
+
+void Plan_Settings::add_to(map<string, string>& kv) const{
+    kv["colorset_sampling_distance"] = to_string(colorset_sampling_distance);
+    kv["coloring_structure_type"] = coloring_structure_type;
+    kv["mem_megas"] = to_string(mem_megas);
+    kv["n_threads"] = to_string(n_threads);
+    kv["reverse_complements"] = to_string((int)reverse_complements);
+    kv["ggcat"] = to_string((int)ggcat);
+    kv["prefilter"] = to_string((int)prefilter);
+    kv["prefilter_bits_per_kmer"] = to_string(prefilter_bits_per_kmer);
+}
+
+Plan_Settings Plan_Settings::from_key_values(const map<string, string>& kv){
+    Plan_Settings S;
+    S.colorset_sampling_distance = get_int(kv, "colorset_sampling_distance", S.colorset_sampling_distance);
+    if(kv.count("coloring_structure_type")) S.coloring_structure_type = kv.at("coloring_structure_type");
+    S.mem_megas = get_int(kv, "mem_megas", S.mem_megas);
+    S.n_threads = get_int(kv, "n_threads", S.n_threads);
+    S.reverse_complements = get_int(kv, "reverse_complements", S.reverse_complements);
+    S.ggcat = get_int(kv, "ggcat", S.ggcat);
+    S.prefilter = get_int(kv, "prefilter", S.prefilter);
+    S.prefilter_bits_per_kmer = get_double(kv, "prefilter_bits_per_kmer", S.prefilter_bits_per_kmer);
+    return S;
+}
+
+double Resource_Plan::peak_build_ram_bytes() const{
+    double peak = 0;
+    for(const Stage_Prediction& s : build_stages) peak = max(peak, s.peak_ram_bytes);
+    return peak;
+}
+
+double Resource_Plan::peak_build_temp_bytes() const{
+    double peak = 0;
+    for(const Stage_Prediction& s : build_stages) peak = max(peak, s.peak_temp_bytes);
+    return peak;
+}
+
+double Resource_Plan::total_build_seconds() const{
+    double total = 0;
+    for(const Stage_Prediction& s : build_stages) total += s.seconds;
+    return total;
+}
+
+double Calibration::get(const string& key) const{
+    auto it = factors.find(key);
+    return it == factors.end() ? 1.0 : it->second;
+}
+
+/*
+ * Sampling
+ */
+
+namespace{
+
+// A sampled k-mer in canonical orientation
+struct Sampled_Kmer{
+    vector<int64_t> colors;
+    int64_t occurrences = 0;
+    uint8_t left = 0; // Bit c is set if the k-mer is preceded by character c somewhere
+    uint8_t right = 0; // Bit c is set if the k-mer is followed by character c somewhere
+    bool first = false; // First k-mer of a sequence somewhere
+    bool last = false; // Last k-mer of a sequence somewhere
+
+    void merge(const Sampled_Kmer& other){
+        colors.insert(colors.end(), other.colors.begin(), other.colors.end());
+        occurrences += other.occurrences;
+        left |= other.left;
+        right |= other.right;
+        first |= other.first;
+        last |= other.last;
+    }
+};
+
+typedef unordered_map<uint64_t, Sampled_Kmer> Kmer_Sample;
+
+// Rolling hashes in the style of ntHash, which give the hash of the reverse complement for free
+constexpr uint64_t nt_seeds[4] = {0x3c8bfbb395c60474ULL, 0x3193c18562a02b4cULL, 0x20323ed082572324ULL, 0x295549f54be24456ULL};
+
+uint64_t rol(uint64_t x, int64_t s){
+    s %= 64;
+    return s == 0 ? x : (x << s) | (x >> (64 - s));
+}
+
+uint64_t ror(uint64_t x, int64_t s){
+    return rol(x, 64 - (s % 64));
+}
+
+uint64_t mix(uint64_t x){ // Finalizer of splitmix64
+    x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+int64_t char_to_code(char c){
+    switch(c){
+        case 'A': return 0;
+        case 'C': return 1;
+        case 'G': return 2;
+        case 'T': return 3;
+        default: return -1;
+    }
+}
+
+// Adds the sampled k-mers of a run of ACGT characters
+void sample_run(const char* S, int64_t len, int64_t k, bool reverse_complements, uint64_t hash_threshold, bool sample_all, int64_t color, Kmer_Sample& sample){
+    if(len < k) return;
+    uint64_t fw = 0, rc = 0;
+    for(int64_t j = 0; j < k; j++){
+        int64_t c = char_to_code(S[j]);
+        fw = rol(fw, 1) ^ nt_seeds[c];
+        rc ^= rol(nt_seeds[3-c], j);
+    }
+
+    for(int64_t i = 0; i + k <= len; i++){
+        bool forward = !reverse_complements || fw <= rc;
+        uint64_t key = mix(forward ? fw : rc);
+        if(sample_all || key < hash_threshold){
+            Sampled_Kmer& x = sample[key];
+            if(x.colors.size() == 0 || x.colors.back() != color) x.colors.push_back(color);
+            x.occurrences++;
+            int64_t prev = (i > 0) ? char_to_code(S[i-1]) : -1;
+            int64_t next = (i + k < len) ? char_to_code(S[i+k]) : -1;
+            if(forward){
+                if(prev >= 0) x.left |= 1 << prev;
+                if(next >= 0) x.right |= 1 << next;
+                x.first |= (prev < 0);
+                x.last |= (next < 0);
+            } else{
+                if(next >= 0) x.left |= 1 << (3 - next);
+                if(prev >= 0) x.right |= 1 << (3 - prev);
+                x.first |= (next < 0);
+                x.last |= (prev < 0);
+            }
+        }
+
+        if(i + k < len){
+            int64_t out = char_to_code(S[i]);
+            int64_t in = char_to_code(S[i+k]);
+            fw = rol(fw, 1) ^ rol(nt_seeds[out], k) ^ nt_seeds[in];
+            rc = ror(rc ^ nt_seeds[3-out], 1) ^ rol(nt_seeds[3-in], k-1);
+        }
+    }
+}
+
+// Colors of the sequences of one file
+class Color_Source{
+    int64_t mode; // 0: file colors, 1: sequence colors, 2: color file
+    int64_t next_color;
+    unique_ptr<seq_io::Buffered_ifstream<>> in;
+    string line;
+
+public:
+    Color_Source(bool file_colors, int64_t file_idx, int64_t first_seq_idx, const string& colorfile){
+        if(colorfile != ""){
+            mode = 2;
+            in = make_unique<seq_io::Buffered_ifstream<>>(colorfile);
+        } else if(file_colors){
+            mode = 0;
+            next_color = file_idx;
+        } else{
+            mode = 1;
+            next_color = first_seq_idx;
+        }
+    }
+
+    int64_t next(){
+        if(mode == 0) return next_color;
+        if(mode == 1) return next_color++;
+        if(!in->getline(line)) throw std::runtime_error("More sequences than colors in a color file");
+        return std::stoll(line);
+    }
+};
+
+struct File_Sample_Result{
+    int64_t n_sequences = 0;
+    int64_t n_bases = 0;
+    int64_t max_color = -1;
+};
+
+template<typename reader_t>
+File_Sample_Result sample_file(const string& filename, Color_Source& colors, int64_t k, bool reverse_complements, uint64_t hash_threshold, bool sample_all, Kmer_Sample& sample){
+    File_Sample_Result result;
+    reader_t reader(filename);
+    while(true){
+        int64_t len = reader.get_next_read_to_buffer();
+        if(len == 0) break;
+        int64_t color = colors.next();
+        result.n_sequences++;
+        result.n_bases += len;
+        result.max_color = max(result.max_color, color);
+
+        // Non-ACGT characters split the sequence like in the index construction
+        int64_t run_start = 0;
+        for(int64_t i = 0; i <= len; i++){
+            if(i == len || char_to_code(reader.read_buf[i]) < 0){
+                sample_run(reader.read_buf + run_start, i - run_start, k, reverse_complements, hash_threshold, sample_all, color, sample);
+                run_start = i + 1;
+            }
+        }
+    }
+    return result;
+}
+
+// Size of a color set in the coloring structure
+int64_t color_set_bytes(const vector<int64_t>& colors, int64_t n_colors, const string& coloring_structure_type){
+    if(coloring_structure_type == "roaring"){
+        // Array containers take 2 bytes per element and bitmap containers 8 kB
+        int64_t bytes = 16; // Header
+        for(int64_t i = 0; i < (int64_t)colors.size(); ){
+            int64_t j = i;
+            while(j < (int64_t)colors.size() && (colors[j] >> 16) == (colors[i] >> 16)) j++;
+            bytes += 8 + min<int64_t>(2 * (j - i), 8192);
+            i = j;
+        }
+        return bytes;
+    } else{
+        // The smallest encoding, plus the start pointers (see Color_Set_Storage)
+        int64_t max_element = colors.back();
+        int64_t width = bits_needed(n_colors - 1); // Of the values in the concatenations of integers
+        int64_t bits = 0;
+        switch(choose_color_set_encoding(colors)){
+            case Color_Set_Encoding::bitmap: bits = max_element + 1; break;
+            case Color_Set_Encoding::array: bits = colors.size() * width; break;
+            case Color_Set_Encoding::elias_fano: bits = elias_fano_size_in_bits(colors.size(), max_element); break;
+            case Color_Set_Encoding::complement: bits = (max_element + 2 - colors.size()) * width; break;
+            case Color_Set_Encoding::runs: bits = 2 * count_runs(colors) * width; break;
+        }
+        return (bits + 7) / 8 + 6;
+    }
+}
+
+} // End of anonymous namespace
+
+Plan_Inputs estimate_plan_inputs(const vector<string>& seqfiles, const vector<string>& colorfiles, bool file_colors, int64_t k, bool reverse_complements, const string& coloring_structure_type, double sample_fraction, int64_t n_threads){
+    check_true(sample_fraction > 0 && sample_fraction <= 1, "Sample fraction must be in the range (0,1]");
+    check_true(colorfiles.size() == 0 || colorfiles.size() == seqfiles.size(), "The number of color files does not match the number of sequence files");
+
+    bool sample_all = sample_fraction >= 1;
+    uint64_t hash_threshold = sample_all ? ~0ULL : (uint64_t)(sample_fraction * 18446744073709551616.0);
+
+    // With sequence colors, the colors continue from one file to the next
+    vector<int64_t> first_seq_idx(seqfiles.size(), 0);
+    if(!file_colors && colorfiles.size() == 0 && seqfiles.size() > 1){
+        write_log("Counting sequences in input files", LogLevel::MAJOR);
+        for(int64_t i = 1; i < (int64_t)seqfiles.size(); i++)
+            first_seq_idx[i] = first_seq_idx[i-1] + seq_io::count_sequences(seqfiles[i-1]);
+    }
+
+    write_log("Sampling k-mers from the input", LogLevel::MAJOR);
+    vector<Kmer_Sample> thread_samples(n_threads);
+    vector<File_Sample_Result> file_results(seqfiles.size());
+
+    #pragma omp parallel for num_threads(n_threads) schedule(dynamic, 1)
+    for(int64_t i = 0; i < (int64_t)seqfiles.size(); i++){
+        Color_Source colors(file_colors, i, first_seq_idx[i], colorfiles.size() > 0 ? colorfiles[i] : "");
+        Kmer_Sample& sample = thread_samples[omp_get_thread_num()];
+        if(seq_io::figure_out_file_format(seqfiles[i]).gzipped)
+            file_results[i] = sample_file<seq_io::Reader<seq_io::Buffered_ifstream<seq_io::zstr::ifstream>>>(seqfiles[i], colors, k, reverse_complements, hash_threshold, sample_all, sample);
+        else
+            file_results[i] = sample_file<seq_io::Reader<seq_io::Buffered_ifstream<std::ifstream>>>(seqfiles[i], colors, k, reverse_complements, hash_threshold, sample_all, sample);
+    }
+
+    Kmer_Sample sample = std::move(thread_samples[0]);
+    for(int64_t t = 1; t < n_threads; t++){
+        for(auto& [key, x] : thread_samples[t]) sample[key].merge(x);
+        Kmer_Sample().swap(thread_samples[t]);
+    }
+
+    Plan_Inputs I;
+    I.k = k;
+    int64_t max_color = -1;
+    for(int64_t i = 0; i < (int64_t)seqfiles.size(); i++){
+        I.input_bytes += std::filesystem::file_size(seqfiles[i]);
+        I.input_bases += file_results[i].n_bases;
+        I.n_sequences += file_results[i].n_sequences;
+        max_color = max(max_color, file_results[i].max_color);
+    }
+    I.n_colors = max_color + 1;
+
+    // Core k-mers (see core_kmer_marker.hh): a node is a core if it has outdegree at least 2 or it
+    // ends a sequence, and all predecessors of a node are cores if it has indegree at least 2 or
+    // it starts a sequence. Every occurrence of a core k-mer generates a node-color pair.
+    auto core_weight = [](int64_t indeg, int64_t outdeg, bool first, bool last) -> double{
+        return (outdeg >= 2 || last ? 1 : 0) + (indeg >= 2 || first ? indeg : 0);
+    };
+
+    double core_sum = 0, pair_sum = 0;
+    map<vector<int64_t>, int64_t> set_frequencies; // Color set -> number of sampled k-mers with that set
+    for(auto& [key, x] : sample){
+        std::sort(x.colors.begin(), x.colors.end());
+        x.colors.erase(std::unique(x.colors.begin(), x.colors.end()), x.colors.end());
+        int64_t indeg = std::popcount(x.left), outdeg = std::popcount(x.right);
+        double w = core_weight(indeg, outdeg, x.first, x.last);
+        if(reverse_complements) w += core_weight(outdeg, indeg, x.last, x.first); // The reverse complement node
+        core_sum += w;
+        pair_sum += w * x.occurrences;
+        set_frequencies[x.colors]++;
+    }
+
+    double p = sample_all ? 1.0 : sample_fraction;
+    int64_t n_sampled_nodes = sample.size() * (reverse_complements ? 2 : 1);
+    I.n_kmers = std::llround(n_sampled_nodes / p);
+    I.n_core_kmers = min(I.n_kmers, (int64_t)std::llround(core_sum / p));
+    I.n_node_color_pairs = std::llround(pair_sum / p);
+
+    // Chao1 estimator for the number of distinct sets, with the correction term for sampling
+    // without replacement (Chao & Lin 2012). With a complete sample there is nothing to extrapolate.
+    double f1 = 0, f2 = 0, observed_length_sum = 0, observed_bytes_sum = 0;
+    for(const auto& [colors, freq] : set_frequencies){
+        if(freq == 1) f1++;
+        if(freq == 2) f2++;
+        observed_length_sum += colors.size();
+        observed_bytes_sum += color_set_bytes(colors, I.n_colors, coloring_structure_type);
+    }
+    double D_obs = set_frequencies.size();
+    double D = D_obs;
+    if(!sample_all && f1 > 0){
+        double correction = p / (1 - p) * f1;
+        D += (f2 > 0) ? f1 * f1 / (2 * f2 + correction) : f1 * (f1 - 1) / (2 + correction);
+    }
+    I.n_distinct_color_sets = std::llround(D);
+    if(D_obs > 0){
+        I.sum_of_distinct_color_set_lengths = std::llround(observed_length_sum / D_obs * D);
+        I.color_set_storage_bytes = std::llround(observed_bytes_sum / D_obs * D);
+    }
+
+    return I;
+}
+
+/*
+ * Model
+ */
+
+Resource_Plan predict_resources(const Plan_Inputs& I, const Plan_Settings& S, const Calibration& cal){
+    using namespace planner_constants;
+
+    Resource_Plan plan;
+    double n = I.n_kmers;
+    double M = (double)S.mem_megas * (1 << 20);
+    double T = max((int64_t)1, S.n_threads);
+    double indexed_bases = I.input_bases * (S.reverse_complements ? 2 : 1);
+    double kmer_bytes = ((I.k + 31) / 32) * 8; // Packed k-mer in the construction
+    double kmc_ram = max(2.0 * (1 << 30), M); // KMC requires at least 2 GB
+
+    // Index sizes
+    double D = max((int64_t)1, I.n_distinct_color_sets);
+    double pointers = min(n, I.n_core_kmers + n / max((int64_t)1, S.colorset_sampling_distance));
+    double pointer_array_bytes = n / 7 + pointers * bits_needed(D) / 8; // Marks with ranks in 64 bytes per 448 nodes, and the values (see Sparse_Uint_Array)
+    plan.index_dbg_bytes = (n * sbwt_bytes_per_kmer + 4096) * cal.get("index.dbg");
+    plan.index_colors_bytes = (I.color_set_storage_bytes + pointer_array_bytes) * cal.get("index.colors");
+    double sbwt = plan.index_dbg_bytes;
+    double colors = plan.index_colors_bytes;
+
+    auto add_stage = [&](const string& name, double ram, double temp, double seconds){
+        Stage_Prediction s;
+        s.name = name;
+        s.peak_ram_bytes = ram * cal.get(name + ".ram");
+        s.peak_temp_bytes = temp * cal.get(name + ".temp");
+        s.seconds = seconds * cal.get(name + ".seconds");
+        plan.build_stages.push_back(s);
+    };
+
+    if(S.ggcat){
+        // GGCAT writes the unitigs, which are then indexed in both orientations
+        double unitig_bytes = n; // About one character per k-mer in each orientation
+        add_stage("ggcat", kmc_ram, I.input_bytes * ggcat_temp_bytes_per_base + unitig_bytes, I.input_bases / (ggcat_bases_per_second_per_thread * T));
+        add_stage("dbg", kmc_ram + sbwt, unitig_bytes + n * kmc_temp_bytes_per_base + n * (kmer_bytes + 4) + 2 * n * kmer_bytes, n / (dbg_bases_per_second_per_thread * T));
+    } else{
+        double rc_copies = S.reverse_complements ? I.input_bytes : 0;
+        double kmc_temp = max(indexed_bases * kmc_temp_bytes_per_base, n * (kmer_bytes + 4));
+        double sbwt_construction_temp = 2 * n * kmer_bytes; // External memory sort of the k-mers
+        add_stage("dbg", kmc_ram + sbwt, rc_copies + kmc_temp + sbwt_construction_temp, indexed_bases / (dbg_bases_per_second_per_thread * T));
+    }
+
+    if(S.prefilter){
+        double canonical_kmers = S.reverse_complements ? n / 2 : n;
+        double prefilter_bytes = canonical_kmers * S.prefilter_bits_per_kmer / 8;
+        add_stage("prefilter", sbwt + prefilter_bytes, 0, I.input_bases / prefilter_bases_per_second);
+    }
+
+    if(S.ggcat){
+        // Color sets come from GGCAT, so only the pointers go through external memory
+        double pointer_pairs_bytes = 16 * pointers;
+        add_stage("coloring", sbwt + M + colors, 2 * pointer_pairs_bytes + I.input_bytes, n / (representation_kmers_per_second * T) + 2 * pointer_pairs_bytes / disk_bytes_per_second);
+    } else{
+        // Node-color pairs are sorted, deduplicated and grouped by node, and the groups are sorted
+        // by color set. Each external sort needs space for its input, runs and output at the same time,
+        // unless the input fits in about half of the memory budget and is sorted in memory without runs.
+        double pairs_bytes = 16.0 * I.n_node_color_pairs;
+        double sets_bytes = 16.0 * I.n_core_kmers + 8.0 * I.n_node_color_pairs;
+        double temp = (max(pairs_bytes, sets_bytes) <= M / 2 ? 2 : 3) * max(pairs_bytes, sets_bytes);
+        double construction_arrays = 8.0 * I.sum_of_distinct_color_set_lengths; // Colors are buffered as 64-bit integers while adding sets
+        double ram = sbwt + n / 8 * 2 + M + T * 2 * dispatcher_buffer_bytes + colors + construction_arrays;
+        double seconds = indexed_bases / search_bases_per_second_per_thread // Marking core k-mers
+                       + indexed_bases / (search_bases_per_second_per_thread * T) // Node-color pairs
+                       + 4 * (pairs_bytes + sets_bytes) / disk_bytes_per_second // Sorts and scans
+                       + n / representation_kmers_per_second;
+        add_stage("coloring", ram, temp, seconds);
+    }
+
+    // Queries: the index plus the input batch and output buffer of each thread
+    double query_buffers = T * 3.0 * S.query_buffer_megas * (1 << 20);
+    plan.query_ram_bytes = sbwt + colors + query_buffers;
+    plan.query_ram_bytes_threshold = plan.query_ram_bytes + T * 8.0 * I.n_colors;
+
+    return plan;
+}
+
+Calibration load_calibration(const vector<string>& stats_files){
+    Calibration cal;
+    map<string, vector<double>> ratios;
+
+    for(const string& filename : stats_files){
+        map<string, string> kv = read_key_value_file(filename);
+        Plan_Inputs inputs = Plan_Inputs::from_key_values(kv);
+        Plan_Settings settings = Plan_Settings::from_key_values(kv);
+        Resource_Plan predicted = predict_resources(inputs, settings, Calibration());
+
+        auto add_ratio = [&](const string& factor_key, const string& measured_key, double predicted_value){
+            if(kv.count(measured_key) == 0 || predicted_value <= 0) return;
+            double measured = std::stod(kv[measured_key]);
+            if(measured > 0) ratios[factor_key].push_back(measured / predicted_value);
+        };
+
+        for(const Stage_Prediction& s : predicted.build_stages){
+            add_ratio(s.name + ".ram", s.name + ".peak_rss_bytes", s.peak_ram_bytes);
+            add_ratio(s.name + ".temp", s.name + ".peak_temp_bytes", s.peak_temp_bytes);
+            add_ratio(s.name + ".seconds", s.name + ".seconds", s.seconds);
+        }
+        add_ratio("index.dbg", "index_dbg_bytes", predicted.index_dbg_bytes);
+        add_ratio("index.colors", "index_colors_bytes", predicted.index_colors_bytes);
+        cal.n_runs++;
+    }
+
+    for(const auto& [key, values] : ratios){
+        bool is_time = key.size() >= 8 && key.substr(key.size() - 8) == ".seconds";
+        if(is_time){
+            double sum = 0;
+            for(double x : values) sum += x;
+            cal.factors[key] = sum / values.size();
+        } else{
+            cal.factors[key] = *std::max_element(values.begin(), values.end());
+        }
+    }
+
+    return cal;
+}
+
+map<string, string> read_key_value_file(const string& filename){
+    map<string, string> kv;
+    seq_io::Buffered_ifstream<> in(filename);
+    string line;
+    while(in.getline(line)){
+        if(line.size() == 0 || line[0] == '#') continue;
+        size_t space = line.find(' ');
+        if(space == string::npos) throw std::runtime_error("Invalid line in " + filename + ": " + line);
+        kv[line.substr(0, space)] = line.substr(space + 1);
+    }
+    return kv;
+}
+
+void write_key_value_file(const map<string, string>& kv, const string& filename){
+    throwing_ofstream out(filename);
+    for(const auto& [key, value] : kv) out.stream << key << " " << value << "\n";
+}
+
+/*
+ * Measurement
+ */
+
+int64_t current_rss_bytes(){
+    // The second field of /proc/self/statm is the resident set size in pages
+    std::ifstream statm("/proc/self/statm");
+    int64_t total_pages = 0, resident_pages = 0;
+    if(!(statm >> total_pages >> resident_pages)) return 0;
+    return resident_pages * sysconf(_SC_PAGESIZE);
+}
+
+int64_t directory_size_in_bytes(const string& dir){
+    int64_t total = 0;
+    std::error_code ec; // Files may disappear while we iterate, so errors are ignored
+    for(auto it = std::filesystem::recursive_directory_iterator(dir, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)){
+        if(it->is_regular_file(ec)){
+            int64_t size = it->file_size(ec);
+            if(!ec) total += size;
+        }
+    }
+    return total;
+}
+
+Build_Resource_Monitor::Build_Resource_Monitor(const string& temp_dir) : temp_dir(temp_dir){
+    sampler = std::thread([this](){
+        while(!stop_flag){
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            sample();
+        }
+    });
+}
+
+Build_Resource_Monitor::~Build_Resource_Monitor(){
+    stop_flag = true;
+    sampler.join();
+}
+
+void Build_Resource_Monitor::sample(){
+    int64_t rss = current_rss_bytes();
+    int64_t temp = directory_size_in_bytes(temp_dir); // Outside of the lock because this can take a while
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!in_stage) return;
+    stages.back().peak_rss_bytes = max(stages.back().peak_rss_bytes, rss);
+    stages.back().peak_temp_bytes = max(stages.back().peak_temp_bytes, temp);
+}
+
+void Build_Resource_Monitor::start_stage(const string& name){
+    end_stage();
+    std::lock_guard<std::mutex> lock(mutex);
+    Stage_Record record;
+    record.name = name;
+    record.peak_rss_bytes = current_rss_bytes();
+    stages.push_back(record);
+    in_stage = true;
+    stage_start = std::chrono::steady_clock::now();
+}
+
+void Build_Resource_Monitor::end_stage(){
+    sample(); // Catches stages that are shorter than the sampling interval
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!in_stage) return;
+    stages.back().seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - stage_start).count();
+    in_stage = false;
+}
+
+void Build_Resource_Monitor::add_to(map<string, string>& kv){
+    end_stage();
+    std::lock_guard<std::mutex> lock(mutex);
+    for(const Stage_Record& s : stages){
+        kv[s.name + ".seconds"] = to_string(s.seconds);
+        kv[s.name + ".peak_rss_bytes"] = to_string(s.peak_rss_bytes);
+        kv[s.name + ".peak_temp_bytes"] = to_string(s.peak_temp_bytes);
+    }
+}
@@ -40,6 +40,7 @@ int stats_main(int argc, char** argv){
         ("unitigs", "Also compute statistics on unitigs. This takes a while and requires the temporary directory to be set.", cxxopts::value<bool>()->default_value("false"))
         ("space-breakdown", "Also give a space breakdown for the components of the index.", cxxopts::value<bool>()->default_value("false"))
         ("temp-dir", "Directory for temporary files.", cxxopts::value<string>())
+        ("t,n-threads", "Number of parallel threads for extracting the unitigs.", cxxopts::value<int64_t>()->default_value("1"))
         ("v,verbose", "More verbose progress reporting into stderr.", cxxopts::value<bool>()->default_value("false"))
         ("silent", "Print as little as possible to stderr (only errors).", cxxopts::value<bool>()->default_value("false"))
         ("h,help", "Print usage")
@@ -57,6 +58,8 @@ int stats_main(int argc, char** argv){
     string index_color_file = opts["index-prefix"].as<string>() + ".tcolors";
     bool do_unitigs = opts["unitigs"].as<bool>();
     bool space_breakdown = opts["space-breakdown"].as<bool>();
+    int64_t n_threads = opts["n-threads"].as<int64_t>();
+    check_true(n_threads >= 1, "Number of threads must be positive");
 
     if(opts["verbose"].as<bool>() && opts["silent"].as<bool>())
         throw runtime_error("Can not give both --verbose and --silent");
@@ -78,7 +81,7 @@ int stats_main(int argc, char** argv){
     cout << "Number of subsets in the SBWT data structure: " << SBWT.number_of_subsets() << endl;
 
     std::variant<Coloring<SDSL_Variant_Color_Set>, Coloring<Roaring_Color_Set>> coloring;
-    load_coloring(index_color_file, SBWT, coloring);
+    load_coloring(index_color_file, SBWT, coloring, n_threads);
 
     if(std::holds_alternative<Coloring<SDSL_Variant_Color_Set>>(coloring))
         write_log("sdsl coloring structure loaded", LogLevel::MAJOR);
@@ -123,7 +126,7 @@ int stats_main(int argc, char** argv){
 
         auto call_extract_unitigs = [&](auto& obj) {
             UnitigExtractor<decltype(obj)> UE;
-            UE.extract_unitigs(dbg, obj, unitigs_out.stream, false, null_stream, null_stream);
+            UE.extract_unitigs(dbg, obj, unitigs_out.stream, false, null_stream, null_stream, false, 0, n_threads);
         };
 
         std::visit(call_extract_unitigs, coloring);
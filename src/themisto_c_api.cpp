@@ -0,0 +1,223 @@
+// Implementation of the C interface in themisto.h
+
+#include "themisto.h"
+#include "pseudoalign.hh"
+#include "kmer_prefilter.hh"
+#include "coloring/Coloring.hh"
+#include "sbwt/variants.hh"
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <variant>
+
+using namespace sbwt;
+
+struct themisto_index{
+    plain_matrix_sbwt_t SBWT;
+    std::variant<Coloring<SDSL_Variant_Color_Set>, Coloring<Roaring_Color_Set>> coloring; // Points to SBWT, so the index is never moved
+    unique_ptr<Kmer_Prefilter> prefilter;
+};
+
+static thread_local string last_error;
+
+// Read-only seekable stream buffer over a memory region. Seeking is needed because
+// load_coloring peeks at the type id of the coloring before loading it.
+class Memory_Streambuf : public std::streambuf{
+public:
+    Memory_Streambuf(const void* data, size_t size){
+        char* begin = (char*)data;
+        setg(begin, begin, begin + size);
+    }
+
+protected:
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override{
+        if(!(which & std::ios_base::in)) return pos_type(off_type(-1));
+        char* target = (dir == std::ios_base::beg) ? eback() + off : (dir == std::ios_base::cur) ? gptr() + off : egptr() + off;
+        if(target < eback() || target > egptr()) return pos_type(off_type(-1));
+        setg(eback(), target, egptr());
+        return pos_type(target - eback());
+    }
+
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override{
+        return seekoff(off_type(pos), std::ios_base::beg, which);
+    }
+};
+
+// Runs f and converts exceptions to an error code and the thread-local error message
+template<typename F>
+static int catch_errors(F f){
+    try{
+        f();
+        return 0;
+    } catch(const std::exception& e){
+        last_error = e.what();
+    } catch(...){
+        last_error = "Unknown error";
+    }
+    return 1;
+}
+
+// Stores the results of each read into its own slot so that the results come out in input order
+class Collecting_Sink : public Pseudoalignment_Result_Sink{
+public:
+    vector<vector<int64_t>> colors;
+    vector<int64_t> n_relevant_kmers;
+
+    Collecting_Sink(int64_t n_seqs) : colors(n_seqs), n_relevant_kmers(n_seqs, -1) {}
+
+    // Every read has its own slot, so no locking is needed
+    void add_result(int64_t seq_id, const vector<int64_t>& seq_colors, int64_t n_relevant) override{
+        colors[seq_id] = seq_colors;
+        n_relevant_kmers[seq_id] = n_relevant;
+    }
+};
+
+class Callback_Sink : public Pseudoalignment_Result_Sink{
+public:
+    themisto_result_callback callback;
+    void* user_data;
+    std::mutex mutex;
+
+    Callback_Sink(themisto_result_callback callback, void* user_data) : callback(callback), user_data(user_data) {}
+
+    void add_result(int64_t seq_id, const vector<int64_t>& colors, int64_t n_relevant) override{
+        std::lock_guard<std::mutex> lock(mutex);
+        callback(user_data, seq_id, colors.data(), colors.size(), n_relevant);
+    }
+};
+
+static void run_query(const themisto_index* index, const char* const* seqs, const int64_t* lengths, int64_t n_reads, const themisto_query_options* options, Pseudoalignment_Result_Sink* sink){
+    themisto_query_options opts;
+    if(options == nullptr) themisto_default_query_options(&opts);
+    else opts = *options;
+
+    check_true(opts.n_threads >= 1, "Number of threads must be at least 1");
+    check_true(opts.batch_size_bytes >= 1, "Batch size must be at least 1");
+    check_true(opts.threshold > 0 && opts.threshold <= 1, "Threshold must be in the range (0,1]");
+    check_true(opts.relevant_kmers_fraction >= 0 && opts.relevant_kmers_fraction <= 1, "Relevant k-mers fraction must be in the range [0,1]");
+
+    const Kmer_Prefilter* prefilter = opts.use_prefilter ? index->prefilter.get() : nullptr;
+    std::visit([&](const auto& coloring){
+        pseudoalign_to_sink(index->SBWT, coloring, opts.n_threads, seqs, lengths, n_reads, sink, opts.reverse_complements, opts.batch_size_bytes, opts.threshold, opts.ignore_unknown_kmers, opts.relevant_kmers_fraction, opts.sort_hits, nullptr, prefilter);
+    }, index->coloring);
+}
+
+extern "C" {
+
+int themisto_abi_version(void){
+    return THEMISTO_ABI_VERSION;
+}
+
+const char* themisto_last_error(void){
+    return last_error.c_str();
+}
+
+void themisto_default_query_options(themisto_query_options* options){
+    options->threshold = 1;
+    options->relevant_kmers_fraction = 0;
+    options->ignore_unknown_kmers = 0;
+    options->reverse_complements = 0;
+    options->sort_hits = 0;
+    options->use_prefilter = 1;
+    options->n_threads = 1;
+    options->batch_size_bytes = 1 << 20;
+}
+
+themisto_index* themisto_load_index(const char* index_prefix){
+    unique_ptr<themisto_index> index = make_unique<themisto_index>();
+    int ret = catch_errors([&](){
+        string prefix = index_prefix;
+        index->SBWT.load(prefix + ".tdbg");
+        load_coloring(prefix + ".tcolors", index->SBWT, index->coloring);
+        if(std::filesystem::exists(prefix + ".tprefilter")){
+            index->prefilter = make_unique<Kmer_Prefilter>();
+            index->prefilter->load(prefix + ".tprefilter");
+            check_true(index->prefilter->get_k() == index->SBWT.get_k(), "The k of the prefilter does not match the index");
+        }
+    });
+    return ret == 0 ? index.release() : nullptr;
+}
+
+themisto_index* themisto_load_index_from_memory(const void* dbg_data, size_t dbg_size, const void* colors_data, size_t colors_size, const void* prefilter_data, size_t prefilter_size){
+    unique_ptr<themisto_index> index = make_unique<themisto_index>();
+    int ret = catch_errors([&](){
+        Memory_Streambuf dbg_buf(dbg_data, dbg_size);
+        std::istream dbg_stream(&dbg_buf);
+        index->SBWT.load(dbg_stream);
+
+        Memory_Streambuf colors_buf(colors_data, colors_size);
+        std::istream colors_stream(&colors_buf);
+        load_coloring(colors_stream, index->SBWT, index->coloring);
+
+        if(prefilter_data != nullptr){
+            Memory_Streambuf prefilter_buf(prefilter_data, prefilter_size);
+            std::istream prefilter_stream(&prefilter_buf);
+            index->prefilter = make_unique<Kmer_Prefilter>();
+            index->prefilter->load(prefilter_stream);
+            check_true(index->prefilter->get_k() == index->SBWT.get_k(), "The k of the prefilter does not match the index");
+        }
+    });
+    return ret == 0 ? index.release() : nullptr;
+}
+
+void themisto_free_index(themisto_index* index){
+    delete index;
+}
+
+int64_t themisto_get_k(const themisto_index* index){
+    return index->SBWT.get_k();
+}
+
+int64_t themisto_number_of_colors(const themisto_index* index){
+    return std::visit([](const auto& c){return c.largest_color() + 1;}, index->coloring);
+}
+
+int themisto_pseudoalign(const themisto_index* index, const char* const* seqs, const int64_t* lengths, int64_t n_reads, const themisto_query_options* options, themisto_results* out){
+    *out = {};
+    return catch_errors([&](){
+        Collecting_Sink sink(n_reads);
+        run_query(index, seqs, lengths, n_reads, options, &sink);
+
+        int64_t total = 0;
+        for(const vector<int64_t>& v : sink.colors) total += v.size();
+
+        // Allocated with malloc so that callers can also free the arrays themselves
+        out->n_reads = n_reads;
+        out->offsets = (int64_t*)malloc(sizeof(int64_t) * (n_reads + 1));
+        out->colors = (int64_t*)malloc(sizeof(int64_t) * max(total, (int64_t)1));
+        out->n_relevant_kmers = (int64_t*)malloc(sizeof(int64_t) * max(n_reads, (int64_t)1));
+        if(out->offsets == nullptr || out->colors == nullptr || out->n_relevant_kmers == nullptr){
+            themisto_free_results(out);
+            throw std::runtime_error("Out of memory");
+        }
+
+        int64_t offset = 0;
+        for(int64_t i = 0; i < n_reads; i++){
+            out->offsets[i] = offset;
+            std::memcpy(out->colors + offset, sink.colors[i].data(), sizeof(int64_t) * sink.colors[i].size());
+            offset += sink.colors[i].size();
+            out->n_relevant_kmers[i] = sink.n_relevant_kmers[i];
+        }
+        out->offsets[n_reads] = offset;
+    });
+}
+
+int themisto_pseudoalign_stream(const themisto_index* index, const char* const* seqs, const int64_t* lengths, int64_t n_reads, const themisto_query_options* options, themisto_result_callback callback, void* user_data){
+    return catch_errors([&](){
+        Callback_Sink sink(callback, user_data);
+        run_query(index, seqs, lengths, n_reads, options, &sink);
+    });
+}
+
+void themisto_free_results(themisto_results* results){
+    free(results->offsets);
+    free(results->colors);
+    free(results->n_relevant_kmers);
+    *results = {};
+}
+
+} // extern "C"
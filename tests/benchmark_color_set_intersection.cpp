@@ -0,0 +1,101 @@
+// Compares the running intersection of pseudoalignment on the color set types. The baseline is
+// one Roaring64Map per color set, which is how Roaring color sets were stored before they were
+// frozen into one buffer. Each query intersects the sets of a run of k-mers, and the sets of a
+// query are similar to each other like the sets of k-mers of the same genome.
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "coloring/Color_Set_Storage.hh"
+#include "roaring/roaring64map.hh"
+
+using namespace std;
+
+struct Workload{
+    vector<vector<int64_t>> sets;
+    vector<vector<int64_t>> queries; // Color set ids
+};
+
+// Families of similar sets. Each family has a base set and the sets drop a few colors of the base.
+Workload make_workload(int64_t n_colors, double density, int64_t n_families, int64_t sets_per_family, int64_t n_queries, int64_t kmers_per_query){
+    std::mt19937_64 rng(1234);
+    Workload W;
+    for(int64_t f = 0; f < n_families; f++){
+        vector<int64_t> base;
+        for(int64_t c = 0; c < n_colors; c++) if(rng() % 1000000 < density * 1000000) base.push_back(c);
+        for(int64_t s = 0; s < sets_per_family; s++){
+            vector<int64_t> set;
+            for(int64_t c : base) if(rng() % 100 != 0) set.push_back(c);
+            W.sets.push_back(set);
+        }
+    }
+    for(int64_t q = 0; q < n_queries; q++){
+        int64_t family = rng() % n_families;
+        vector<int64_t> ids;
+        for(int64_t i = 0; i < kmers_per_query; i++) ids.push_back(family * sets_per_family + rng() % sets_per_family);
+        W.queries.push_back(ids);
+    }
+    return W;
+}
+
+template<typename f_t>
+void time_it(const string& name, int64_t n_queries, f_t f){
+    auto t0 = std::chrono::steady_clock::now();
+    int64_t checksum = f();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    cout << "  " << name << ": " << seconds / n_queries * 1e6 << " us per query (checksum " << checksum << ")" << endl;
+}
+
+template<typename colorset_t>
+int64_t run_queries(const Color_Set_Storage<colorset_t>& storage, const Workload& W){
+    int64_t checksum = 0;
+    colorset_t result;
+    for(const vector<int64_t>& ids : W.queries){
+        result = storage.get_color_set_by_id(ids[0]);
+        for(int64_t i = 1; i < (int64_t)ids.size(); i++) result.intersection(storage.get_color_set_by_id(ids[i]));
+        checksum += result.size();
+    }
+    return checksum;
+}
+
+int64_t run_queries_roaring64map(const vector<Roaring64Map>& sets, const Workload& W){
+    int64_t checksum = 0;
+    for(const vector<int64_t>& ids : W.queries){
+        Roaring64Map result = sets[ids[0]];
+        for(int64_t i = 1; i < (int64_t)ids.size(); i++) result = result & sets[ids[i]];
+        checksum += result.cardinality();
+    }
+    return checksum;
+}
+
+int main(){
+    int64_t n_queries = 2000;
+    for(auto [n_colors, density] : vector<pair<int64_t, double>>{{1000, 0.5}, {100000, 0.01}, {100000, 0.5}, {1000000, 0.001}}){
+        cout << n_colors << " colors, density " << density << endl;
+        Workload W = make_workload(n_colors, density, 20, 50, n_queries, 30);
+
+        vector<Roaring64Map> roaring64maps;
+        for(const vector<int64_t>& set : W.sets){
+            Roaring64Map r;
+            r.addMany(set.size(), reinterpret_cast<const uint64_t*>(set.data()));
+            r.runOptimize();
+            r.shrinkToFit();
+            roaring64maps.push_back(r);
+        }
+
+        Color_Set_Storage<Roaring_Color_Set> frozen;
+        Color_Set_Storage<SDSL_Variant_Color_Set> sdsl_hybrid;
+        for(const vector<int64_t>& set : W.sets){
+            frozen.add_set(set);
+            sdsl_hybrid.add_set(set);
+        }
+        frozen.prepare_for_queries();
+        sdsl_hybrid.prepare_for_queries();
+
+        time_it("Roaring64Map per set (baseline)", n_queries, [&](){ return run_queries_roaring64map(roaring64maps, W); });
+        time_it("Frozen Roaring", n_queries, [&](){ return run_queries(frozen, W); });
+        time_it("SDSL hybrid", n_queries, [&](){ return run_queries(sdsl_hybrid, W); });
+    }
+}
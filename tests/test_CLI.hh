@@ -1,6 +1,7 @@
 #pragma once
 
 #include <gtest/gtest.h>
+#include <filesystem>
 #include "sbwt/stdlib_printing.hh"
 #include "SeqIO/SeqIO.hh"
 #include "globals.hh"
@@ -75,6 +76,23 @@ TEST_F(CLI_TEST, auto_colors){
     }
 }
 
+// A checkpointed build gives the same index and cleans up its checkpoint directory
+TEST_F(CLI_TEST, checkpointed_build){
+    vector<string> args = {"build", "-k", to_string(k), "-i", fastafile, "-o", indexprefix, "--temp-dir", tempdir, "--forward-strand-only", "--checkpoint", "--checkpoint-checksums"};
+    sbwt::Argv argv(args);
+    build_index_main(argv.size, argv.array);
+    plain_matrix_sbwt_t SBWT; Coloring<> coloring;
+    load_sbwt_and_coloring(SBWT, coloring, indexprefix);
+    for(int64_t seq_id = 0; seq_id < seqs.size(); seq_id++){
+        for(string kmer : get_all_kmers(seqs[seq_id], k)){
+            int64_t node = SBWT.search(kmer);
+            ASSERT_EQ(coloring.get_color_set_of_node_as_vector(node), vector<int64_t>{seq_id});
+        }
+    }
+    for(const auto& entry : std::filesystem::directory_iterator(tempdir))
+        ASSERT_NE(entry.path().filename().string().rfind("themisto-checkpoint-", 0), 0);
+}
+
 TEST_F(CLI_TEST, reverse_complement_construction_with_auto_colors){
     vector<string> args = {"build", "-k", to_string(k), "-i", fastafile, "-o", indexprefix, "--temp-dir", tempdir, "--reverse-complements"};
     cout << args << endl;
@@ -331,6 +349,87 @@ TEST_F(CLI_TEST, test_color_matrix_dump){
     }
 }
 
+TEST_F(CLI_TEST, color_matrix_dump_formats){
+    vector<string> args = {"build", "-k", to_string(k), "-i", fastafile, "-o", indexprefix, "--temp-dir", tempdir, "--color-file", colorfile, "--forward-strand-only"};
+    sbwt::Argv argv(args);
+    build_index_main(argv.size, argv.array);
+
+    auto dump = [&](vector<string> extra_args){
+        string outfile = get_temp_file_manager().create_filename("", ".txt");
+        vector<string> dump_args = {"dump-color-matrix", "-i", indexprefix, "-o", outfile};
+        for(const string& arg : extra_args) dump_args.push_back(arg);
+        sbwt::Argv dump_argv(dump_args);
+        dump_color_matrix_main(dump_argv.size, dump_argv.array);
+        return outfile;
+    };
+
+    auto read_lines = [](const string& filename){
+        vector<string> lines;
+        throwing_ifstream in(filename);
+        string line;
+        while(getline(in.stream, line)) lines.push_back(line);
+        return lines;
+    };
+
+    // The reference: k-mer -> colors
+    vector<string> sparse_lines = read_lines(dump({"--sparse"}));
+    vector<pair<string, vector<int64_t>>> reference;
+    for(const string& line : sparse_lines){
+        vector<string> tokens = split(line);
+        vector<int64_t> colors;
+        for(int64_t i = 1; i < (int64_t)tokens.size(); i++) colors.push_back(stoll(tokens[i]));
+        reference.push_back({tokens[0], colors});
+    }
+
+    // Threads and shards must not change the output
+    string sharded = dump({"--sparse", "--n-threads", "3", "--shards", "4"});
+    vector<string> concatenated;
+    for(int64_t shard = 0; shard < 4; shard++)
+        for(const string& line : read_lines(sharded + "." + to_string(shard))) concatenated.push_back(line);
+    ASSERT_EQ(concatenated, sparse_lines);
+
+    // Color set ids
+    string set_id_file = dump({"--format", "set-ids", "--n-threads", "2"});
+    map<int64_t, vector<int64_t>> sets;
+    for(const string& line : read_lines(set_id_file + ".sets")){
+        vector<string> tokens = split(line);
+        vector<int64_t> colors;
+        for(int64_t i = 1; i < (int64_t)tokens.size(); i++) colors.push_back(stoll(tokens[i]));
+        sets[stoll(tokens[0])] = colors;
+    }
+    vector<string> set_id_lines = read_lines(set_id_file);
+    ASSERT_EQ(set_id_lines.size(), reference.size());
+    for(int64_t i = 0; i < (int64_t)reference.size(); i++){
+        vector<string> tokens = split(set_id_lines[i]);
+        ASSERT_EQ(tokens.size(), 2);
+        ASSERT_EQ(tokens[0], reference[i].first);
+        ASSERT_EQ(sets.at(stoll(tokens[1])), reference[i].second);
+    }
+
+    // MatrixMarket
+    vector<string> mtx_lines = read_lines(dump({"--format", "mtx", "--n-threads", "2"}));
+    ASSERT_EQ(mtx_lines[0], "%%MatrixMarket matrix coordinate pattern general");
+    vector<string> size_tokens = split(mtx_lines[1]);
+    int64_t n_entries = 0;
+    for(const auto& [kmer, colors] : reference) n_entries += colors.size();
+    vector<vector<int64_t>> mtx_rows(reference.size());
+    for(int64_t i = 2; i < (int64_t)mtx_lines.size(); i++){
+        vector<string> tokens = split(mtx_lines[i]);
+        mtx_rows[stoll(tokens[0]) - 1].push_back(stoll(tokens[1]) - 1);
+    }
+    ASSERT_EQ(mtx_lines.size(), 2 + n_entries);
+    ASSERT_EQ(stoll(size_tokens.back()), n_entries);
+    for(int64_t i = 0; i < (int64_t)reference.size(); i++)
+        ASSERT_EQ(mtx_rows[i], reference[i].second);
+
+    // Sharded MatrixMarket: only the first shard has the header, with the global number of entries
+    string mtx_sharded = dump({"--format", "mtx", "--n-threads", "3", "--shards", "4"});
+    vector<string> mtx_concatenated;
+    for(int64_t shard = 0; shard < 4; shard++)
+        for(const string& line : read_lines(mtx_sharded + "." + to_string(shard))) mtx_concatenated.push_back(line);
+    ASSERT_EQ(mtx_concatenated, mtx_lines);
+}
+
 TEST_F(CLI_TEST, multiple_input_files){
     string gzip_outfile = get_temp_file_manager().create_filename("", ".fna.gz");
 
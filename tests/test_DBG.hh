@@ -99,6 +99,19 @@ TEST_F(TEST_DBG, iterate_all_nodes){
     ASSERT_EQ(kmer_idx, ref.colex_kmers.size());
 }
 
+TEST_F(TEST_DBG, batched_node_labels){
+    // All nodes, including dummy nodes
+    vector<DBG::Node> nodes;
+    for(int64_t id = 0; id < SBWT.number_of_subsets(); id++) nodes.push_back(DBG::Node(id));
+    string labels = "prefix";
+    dbg->get_node_labels(nodes, labels);
+    int64_t k = SBWT.get_k();
+    ASSERT_EQ(labels.size(), 6 + nodes.size() * k);
+    for(int64_t i = 0; i < (int64_t)nodes.size(); i++){
+        ASSERT_EQ(labels.substr(6 + i*k, k), dbg->get_node_label(nodes[i]));
+    }
+}
+
 TEST_F(TEST_DBG, indegree){
     for(string kmer : ref.colex_kmers){
         DBG::Node v = dbg->locate(kmer);
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "setup_tests.hh"
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include "globals.hh"
+#include "sbwt/globals.hh"
+#include "build_checkpoint.hh"
+
+using namespace sbwt;
+
+static string make_checkpoint_dir(){
+    string dir = get_temp_file_manager().create_filename("checkpoint-");
+    std::filesystem::create_directories(dir);
+    return dir;
+}
+
+static string write_checkpoint_test_file(const string& contents){
+    string filename = get_temp_file_manager().create_filename("", ".txt");
+    std::ofstream(filename) << contents;
+    return filename;
+}
+
+TEST(BUILD_CHECKPOINT, resume_after_completed_stages){
+    string dir = make_checkpoint_dir();
+    string first, second;
+    {
+        Build_Checkpoint cp(dir, "config", false);
+        first = cp.keep("first", write_checkpoint_test_file("AAAA"));
+        cp.mark_done("first", {first}, {{"count", "4"}});
+        second = cp.keep("second", write_checkpoint_test_file("CCCC"));
+        cp.mark_done("second", {second}, {}, {first}); // Releases the first output
+        ASSERT_FALSE(std::filesystem::exists(first));
+        // The build is interrupted here
+    }
+
+    Build_Checkpoint cp(dir, "config", true);
+    ASSERT_TRUE(cp.is_done("first"));
+    ASSERT_TRUE(cp.is_done("second"));
+    ASSERT_FALSE(cp.is_done("third"));
+    ASSERT_EQ(cp.get_value("first", "count"), "4");
+    ASSERT_EQ(cp.get_file("second", 0), second);
+
+    cp.finish();
+    ASSERT_FALSE(std::filesystem::exists(second));
+    ASSERT_FALSE(Build_Checkpoint(dir, "config", true).is_done("first"));
+}
+
+TEST(BUILD_CHECKPOINT, corrupt_output_is_recomputed){
+    for(bool checksums : {false, true}){
+        string dir = make_checkpoint_dir();
+        string second;
+        {
+            Build_Checkpoint cp(dir, "config", false, checksums);
+            cp.mark_done("first", {cp.keep("first", write_checkpoint_test_file("AAAA"))});
+            second = cp.keep("second", write_checkpoint_test_file("CCCC"));
+            cp.mark_done("second", {second});
+        }
+        // Without checksums, only a change of size is noticed
+        std::ofstream(second) << (checksums ? "CCCG" : "CCC");
+
+        Build_Checkpoint cp(dir, "config", true, checksums);
+        ASSERT_TRUE(cp.is_done("first"));
+        ASSERT_FALSE(cp.is_done("second"));
+        ASSERT_FALSE(std::filesystem::exists(second));
+    }
+}
+
+TEST(BUILD_CHECKPOINT, different_configuration_is_separate){
+    string dir = make_checkpoint_dir();
+    string first;
+    {
+        Build_Checkpoint cp(dir, "config", false);
+        first = cp.keep("first", write_checkpoint_test_file("AAAA"));
+        cp.mark_done("first", {first});
+    }
+    Build_Checkpoint other(dir, "other config", true);
+    ASSERT_NE(other.get_dir(), std::filesystem::path(first).parent_path().string());
+    ASSERT_FALSE(other.is_done("first"));
+    ASSERT_TRUE(std::filesystem::exists(first)); // Not touched by the other build
+
+    // Starting the same configuration again without resume would overwrite the checkpoint
+    ASSERT_THROW(Build_Checkpoint(dir, "config", false), std::runtime_error);
+    ASSERT_TRUE(Build_Checkpoint(dir, "config", true).is_done("first"));
+
+    Build_Checkpoint disabled;
+    ASSERT_FALSE(disabled.enabled());
+    string file = write_checkpoint_test_file("GGGG");
+    ASSERT_EQ(disabled.keep("first", file), file);
+    disabled.mark_done("first", {file});
+    ASSERT_FALSE(disabled.is_done("first"));
+}
+
+TEST(BUILD_CHECKPOINT, files_outside_are_not_deleted){
+    string dir = make_checkpoint_dir();
+    string outside = write_checkpoint_test_file("AAAA"); // Like an index file
+    string unrecorded = write_checkpoint_test_file("CCCC");
+    {
+        Build_Checkpoint cp(dir, "config", false);
+        cp.mark_done("first", {outside});
+        cp.mark_done("second", {cp.keep("second", write_checkpoint_test_file("GGGG"))}, {}, {outside, unrecorded});
+        cp.finish();
+        ASSERT_FALSE(std::filesystem::exists(cp.get_dir()));
+    }
+    ASSERT_TRUE(std::filesystem::exists(outside));
+    ASSERT_TRUE(std::filesystem::exists(unrecorded));
+}
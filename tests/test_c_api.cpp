@@ -0,0 +1,156 @@
+// Tests for the C interface in themisto.h. This is a separate executable linked against
+// libthemisto so that only the exported C symbols are available, like for a user of the library.
+// The index is built with the themisto executable given in THEMISTO_EXECUTABLE.
+
+#include <gtest/gtest.h>
+#include "themisto.h"
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class C_API_TEST : public ::testing::Test {
+    public:
+
+    // Each reference sequence gets its own color. The k-mers of the references are all distinct.
+    vector<string> refs = {"ACGTTGCATGACCGTAGGCTAAC", "TTGACCATGGCAAGTCGATCCGA", "GGATCCTAGCTTAACGGTACGTT"};
+    int64_t k = 6;
+    string dir, prefix;
+
+    void SetUp() override{
+        dir = (std::filesystem::temp_directory_path() / "themisto_c_api_test").string();
+        std::filesystem::create_directories(dir);
+        prefix = dir + "/index";
+
+        ofstream fasta(dir + "/refs.fna");
+        for(const string& s : refs) fasta << ">\n" << s << "\n";
+        fasta.close();
+
+        string command = string(THEMISTO_EXECUTABLE) + " build -k " + to_string(k) + " -i " + dir + "/refs.fna -o " + prefix + " --temp-dir " + dir + " > /dev/null 2>&1";
+        ASSERT_EQ(std::system(command.c_str()), 0);
+    }
+
+    void TearDown() override{
+        std::filesystem::remove_all(dir);
+    }
+
+    static string read_file(const string& filename){
+        ifstream in(filename, ios::binary);
+        return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+
+    // Every reference as a query, and one query that shares no k-mers with the references
+    void run_queries_and_check(themisto_index* index){
+        vector<string> queries = refs;
+        queries.push_back("AAAAAAAAAAAA");
+        vector<const char*> seqs;
+        vector<int64_t> lengths;
+        for(const string& q : queries){
+            seqs.push_back(q.c_str());
+            lengths.push_back(q.size());
+        }
+
+        themisto_results results;
+        ASSERT_EQ(themisto_pseudoalign(index, seqs.data(), lengths.data(), queries.size(), nullptr, &results), 0);
+        ASSERT_EQ(results.n_reads, (int64_t)queries.size());
+        for(int64_t i = 0; i < (int64_t)refs.size(); i++){
+            ASSERT_EQ(results.offsets[i+1] - results.offsets[i], 1);
+            ASSERT_EQ(results.colors[results.offsets[i]], i);
+        }
+        ASSERT_EQ(results.offsets[refs.size()+1], results.offsets[refs.size()]); // No colors for the last query
+        themisto_free_results(&results);
+        ASSERT_EQ(results.offsets, nullptr);
+    }
+};
+
+TEST_F(C_API_TEST, load_query_free){
+    ASSERT_EQ(themisto_abi_version(), THEMISTO_ABI_VERSION);
+
+    themisto_index* index = themisto_load_index(prefix.c_str());
+    ASSERT_NE(index, nullptr) << themisto_last_error();
+    ASSERT_EQ(themisto_get_k(index), k);
+    ASSERT_EQ(themisto_number_of_colors(index), (int64_t)refs.size());
+    run_queries_and_check(index);
+    themisto_free_index(index);
+}
+
+TEST_F(C_API_TEST, load_from_memory){
+    string dbg = read_file(prefix + ".tdbg");
+    string colors = read_file(prefix + ".tcolors");
+    themisto_index* index = themisto_load_index_from_memory(dbg.data(), dbg.size(), colors.data(), colors.size(), nullptr, 0);
+    ASSERT_NE(index, nullptr) << themisto_last_error();
+    run_queries_and_check(index);
+    themisto_free_index(index);
+}
+
+static void collect_result(void* user_data, int64_t read_id, const int64_t* colors, int64_t n_colors, int64_t){
+    auto* results = (map<int64_t, vector<int64_t>>*)user_data;
+    (*results)[read_id] = vector<int64_t>(colors, colors + n_colors);
+}
+
+TEST_F(C_API_TEST, stream){
+    themisto_index* index = themisto_load_index(prefix.c_str());
+    ASSERT_NE(index, nullptr) << themisto_last_error();
+
+    vector<const char*> seqs;
+    vector<int64_t> lengths;
+    for(const string& s : refs){
+        seqs.push_back(s.c_str());
+        lengths.push_back(s.size());
+    }
+
+    themisto_query_options options;
+    themisto_default_query_options(&options);
+    options.n_threads = 2;
+
+    map<int64_t, vector<int64_t>> results;
+    ASSERT_EQ(themisto_pseudoalign_stream(index, seqs.data(), lengths.data(), refs.size(), &options, collect_result, &results), 0);
+    ASSERT_EQ(results.size(), refs.size());
+    for(int64_t i = 0; i < (int64_t)refs.size(); i++)
+        ASSERT_EQ(results[i], vector<int64_t>{i});
+
+    themisto_free_index(index);
+}
+
+TEST_F(C_API_TEST, errors){
+    // Missing index files
+    string missing = dir + "/does_not_exist";
+    ASSERT_EQ(themisto_load_index(missing.c_str()), nullptr);
+    ASSERT_NE(string(themisto_last_error()), "");
+
+    // Corrupt color file
+    string dbg = read_file(prefix + ".tdbg");
+    string garbage = "not a coloring";
+    ASSERT_EQ(themisto_load_index_from_memory(dbg.data(), dbg.size(), garbage.data(), garbage.size(), nullptr, 0), nullptr);
+    ASSERT_NE(string(themisto_last_error()), "");
+
+    // Invalid query options. The output must be left empty.
+    themisto_index* index = themisto_load_index(prefix.c_str());
+    ASSERT_NE(index, nullptr) << themisto_last_error();
+    const char* seqs[] = {refs[0].c_str()};
+    int64_t lengths[] = {(int64_t)refs[0].size()};
+
+    themisto_query_options options;
+    themisto_default_query_options(&options);
+    options.threshold = 0;
+    themisto_results results;
+    ASSERT_NE(themisto_pseudoalign(index, seqs, lengths, 1, &options, &results), 0);
+    ASSERT_NE(string(themisto_last_error()), "");
+    ASSERT_EQ(results.offsets, nullptr);
+    ASSERT_EQ(results.colors, nullptr);
+
+    themisto_default_query_options(&options);
+    options.n_threads = 0;
+    map<int64_t, vector<int64_t>> stream_results;
+    ASSERT_NE(themisto_pseudoalign_stream(index, seqs, lengths, 1, &options, collect_result, &stream_results), 0);
+    ASSERT_TRUE(stream_results.empty());
+
+    // The index still works after the failed calls
+    run_queries_and_check(index);
+    themisto_free_index(index);
+}
@@ -232,6 +232,93 @@ TEST(TEST_COLOR_SET, sparse_serialization){
     // The SDSL variant color set does not have serialization for individual color sets
 }
 
+TEST(TEST_COLOR_SET, elias_fano_intersections){
+    srand(1234);
+    auto random_set = [](int64_t universe, int64_t n){
+        set<int64_t> S;
+        while((int64_t)S.size() < n) S.insert(rand() % universe);
+        return vector<int64_t>(S.begin(), S.end());
+    };
+
+    // Sets of medium density are Elias-Fano encoded, and the others are bitmaps or arrays
+    vector<vector<int64_t>> sets = {random_set(100000, 1000), random_set(100000, 3000), random_set(50000, 2000),
+                                    random_set(1000, 600), random_set(100000, 5), {0}, {99999}};
+    ASSERT_TRUE(SDSL_Variant_Color_Set(sets[0]).is_elias_fano());
+    ASSERT_TRUE(SDSL_Variant_Color_Set(sets[3]).is_bitmap());
+    ASSERT_FALSE(SDSL_Variant_Color_Set(sets[4]).is_bitmap() || SDSL_Variant_Color_Set(sets[4]).is_elias_fano());
+
+    // Add some elements of the first set to the others so that the intersections are not empty
+    for(int64_t i = 1; i < 3; i++){
+        for(int64_t j = 0; j < (int64_t)sets[0].size(); j += 3) sets[i].push_back(sets[0][j]);
+        std::sort(sets[i].begin(), sets[i].end());
+        sets[i].erase(std::unique(sets[i].begin(), sets[i].end()), sets[i].end());
+    }
+
+    for(const vector<int64_t>& A : sets){
+        SDSL_Variant_Color_Set cs(A);
+        ASSERT_EQ(cs.get_colors_as_vector(), A);
+        ASSERT_EQ(cs.size(), A.size());
+        for(int64_t x = 0; x <= A.back() + 10; x++){
+            ASSERT_EQ(cs.contains(x), std::binary_search(A.begin(), A.end(), x));
+        }
+
+        for(const vector<int64_t>& B : sets){
+            vector<int64_t> correct;
+            std::set_intersection(A.begin(), A.end(), B.begin(), B.end(), std::back_inserter(correct));
+
+            SDSL_Variant_Color_Set AB(A);
+            AB.intersection(SDSL_Variant_Color_Set(B));
+            ASSERT_EQ(AB.get_colors_as_vector(), correct);
+        }
+    }
+}
+
+TEST(TEST_COLOR_SET, complement_and_runs){
+    srand(4321);
+    vector<int64_t> near_full, clustered;
+    for(int64_t x = 0; x < 5000; x++) if(rand() % 500 != 0) near_full.push_back(x);
+    for(int64_t x = 0; x < 20000; x++) if((x / 1000) % 3 == 1 || (x >= 13500 && x < 13600)) clustered.push_back(x);
+    ASSERT_TRUE(SDSL_Variant_Color_Set(near_full).is_complement());
+    ASSERT_TRUE(SDSL_Variant_Color_Set(clustered).is_runs());
+
+    // The other encodings and sets that share parts with the two above
+    vector<int64_t> medium, sparse = {3, 1000, 1001, 4999, 13550, 19999}, dense;
+    for(int64_t x = 0; x < 20000; x += 37) medium.push_back(x);
+    for(int64_t x = 0; x < 3000; x++) if(rand() % 2) dense.push_back(x);
+    vector<int64_t> near_full_shorter(near_full.begin(), near_full.begin() + near_full.size() / 2);
+    vector<int64_t> full = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20};
+
+    vector<vector<int64_t>> sets = {near_full, clustered, medium, sparse, dense, near_full_shorter, full, {7}};
+    for(const vector<int64_t>& A : sets){
+        SDSL_Variant_Color_Set cs(A);
+        ASSERT_EQ(cs.get_colors_as_vector(), A);
+        ASSERT_EQ(cs.size(), A.size());
+        for(int64_t x = 0; x <= A.back() + 10; x++){
+            ASSERT_EQ(cs.contains(x), std::binary_search(A.begin(), A.end(), x));
+        }
+
+        for(const vector<int64_t>& B : sets){
+            vector<int64_t> correct_inter, correct_union;
+            std::set_intersection(A.begin(), A.end(), B.begin(), B.end(), std::back_inserter(correct_inter));
+            std::set_union(A.begin(), A.end(), B.begin(), B.end(), std::back_inserter(correct_union));
+
+            SDSL_Variant_Color_Set AB(A);
+            AB.intersection(SDSL_Variant_Color_Set(B));
+            ASSERT_EQ(AB.get_colors_as_vector(), correct_inter);
+            ASSERT_EQ(AB.size(), correct_inter.size());
+            ASSERT_EQ(AB.empty(), correct_inter.empty());
+
+            // Intersect again to start from the encodings that the intersections produce
+            AB.intersection(SDSL_Variant_Color_Set(A));
+            ASSERT_EQ(AB.get_colors_as_vector(), correct_inter);
+
+            SDSL_Variant_Color_Set A_or_B(A);
+            A_or_B.do_union(SDSL_Variant_Color_Set(B));
+            ASSERT_EQ(A_or_B.get_colors_as_vector(), correct_union);
+        }
+    }
+}
+
 TEST(TEST_COLOR_SET, test_bitmap_vs_bitmap_intersection){
     int64_t n = 200; // Not powers of two to test special case in end
     int64_t m = 220; // Not powers of two to test special case in end
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <iostream>
+#include <cstring>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <stack>
@@ -9,6 +11,8 @@
 #include <set>
 #include <unordered_map>
 #include <map>
+#include <random>
+#include <iterator>
 #include <gtest/gtest.h>
 #include <cassert>
 #include "test_tools.hh"
@@ -39,15 +43,30 @@ TEST(NEW_NEW_COLORING_TEST, storage){
                                      get_dense_colorset(2,1000),
                                      {1,5,7,8},
                                      {0,1,2,3,4,5,6},
-                                     get_dense_colorset(3,1000)};
+                                     get_dense_colorset(3,1000),
+                                     get_dense_colorset(50,10000), // Medium density -> Elias-Fano
+                                     {2,3,5,7,11,13,17,19,23,29,31,37,41,43,47,53,59,61,67,71,73,79,83,89,97},
+                                     get_dense_colorset(1,9000), // Near full -> complement
+                                     get_dense_colorset(1,400)}; // Clustered -> runs
+    sets[10].erase(sets[10].begin() + 4321);
+    for(int64_t x = 2000; x < 2300; x++) sets[11].push_back(x);
 
     for(const vector<int64_t>& set : sets)
         css.add_set(set);
     css.prepare_for_queries();
 
-    // Check that we can get back the same color sets as what we put in
+    ASSERT_TRUE(css.get_color_set_by_id(8).is_elias_fano());
+    ASSERT_TRUE(css.get_color_set_by_id(10).is_complement());
+    ASSERT_TRUE(css.get_color_set_by_id(11).is_runs());
+    ASSERT_TRUE(css.get_color_set_by_id(1).is_complement()); // All colors up to the largest one
+    ASSERT_TRUE(css.get_color_set_by_id(4).is_bitmap());
+    ASSERT_FALSE(css.get_color_set_by_id(0).is_bitmap() || css.get_color_set_by_id(0).is_elias_fano());
+
+    // Check that we can get back the same color sets as what we put in, also after serialization
     vector<SDSL_Variant_Color_Set::view_t> retrieved_views = css.get_all_sets();
+    Color_Set_Storage<SDSL_Variant_Color_Set> css_loaded = to_disk_and_back(css);
     for(int64_t i = 0; i < retrieved_views.size(); i++){
+        ASSERT_EQ(css_loaded.get_color_set_by_id(i).get_colors_as_vector(), sets[i]);
         ASSERT_EQ(retrieved_views[i].get_colors_as_vector(), sets[i]);
         ASSERT_FALSE(retrieved_views[i].empty());
         ASSERT_EQ(retrieved_views[i].size(), sets[i].size());
@@ -77,10 +96,365 @@ TEST(NEW_NEW_COLORING_TEST, storage){
         ASSERT_EQ(cs.empty(), cs2.empty());
         ASSERT_EQ(cs.size(), cs2.size());
         for(int64_t j = 0; j < 10000; j++){
-            ASSERT_EQ(cs.contains(j), cs2.contains(j));            
+            ASSERT_EQ(cs.contains(j), cs2.contains(j));
+        }
+    }
+
+    // The descriptor table gives the same sets as the marks and the starts
+    css_loaded.build_descriptor_table();
+    ASSERT_TRUE(css_loaded.has_descriptor_table());
+    Color_Set_Storage<SDSL_Variant_Color_Set> css_copy = css_loaded;
+    for(int64_t i = 0; i < sets.size(); i++){
+        SDSL_Variant_Color_Set::view_t view = css_copy.get_color_set_by_id(i);
+        ASSERT_EQ(view.data_ptr.index(), css.get_color_set_by_id(i).data_ptr.index());
+        ASSERT_EQ(view.get_colors_as_vector(), sets[i]);
+    }
+
+    // The descriptor table is serialized with the sets, and a corrupt table is not loaded
+    std::stringstream table_ss;
+    css_copy.serialize(table_ss);
+    const string table_bytes = table_ss.str();
+    auto load_from = [](const string& data){
+        std::stringstream in(data);
+        Color_Set_Storage<SDSL_Variant_Color_Set> loaded;
+        loaded.load(in);
+        return loaded;
+    };
+    Color_Set_Storage<SDSL_Variant_Color_Set> css_with_table = load_from(table_bytes);
+    ASSERT_TRUE(css_with_table.has_descriptor_table());
+    for(int64_t i = 0; i < sets.size(); i++)
+        ASSERT_EQ(css_with_table.get_color_set_by_id(i).get_colors_as_vector(), sets[i]);
+    ASSERT_THROW(load_from(table_bytes.substr(0, table_bytes.size() - 4)), std::runtime_error);
+    for(int64_t length_bits : {61, 60}){ // Too wide, and descriptors read with the wrong width point out of bounds
+        string corrupt = table_bytes;
+        memcpy(corrupt.data() + corrupt.size() - sizeof(int64_t), &length_bits, sizeof(int64_t));
+        ASSERT_THROW(load_from(corrupt), std::runtime_error);
+    }
+
+    // A moved storage, with or without the descriptor table, has its rank supports on its own marks
+    Color_Set_Storage<SDSL_Variant_Color_Set> css_moved(std::move(css));
+    Color_Set_Storage<SDSL_Variant_Color_Set> css_copy_moved;
+    css_copy_moved = std::move(css_copy);
+    for(int64_t i = 0; i < sets.size(); i++){
+        ASSERT_EQ(css_moved.get_color_set_by_id(i).get_colors_as_vector(), sets[i]);
+        ASSERT_EQ(css_copy_moved.get_color_set_by_id(i).get_colors_as_vector(), sets[i]);
+    }
+
+}
+
+// Sets that are small variations of a few base sets should be stored as differences on disk
+TEST(NEW_NEW_COLORING_TEST, delta_encoded_storage){
+    std::mt19937_64 rng(1234);
+    int64_t n_colors = 2000;
+    vector<vector<int64_t>> bases;
+    for(int64_t b = 0; b < 3; b++){
+        vector<int64_t> base;
+        for(int64_t c = 0; c < n_colors; c++) if(rng() % 3 == 0) base.push_back(c);
+        bases.push_back(base);
+    }
+
+    vector<vector<int64_t>> sets;
+    std::set<vector<int64_t>> distinct;
+    while(sets.size() < 300){
+        const vector<int64_t>& base = bases[rng() % 3];
+        std::set<int64_t> S(base.begin(), base.end());
+        for(int64_t i = 0; i < 5; i++){ // Flip a few colors
+            int64_t c = rng() % n_colors;
+            if(S.count(c)) S.erase(c); else S.insert(c);
+        }
+        vector<int64_t> set(S.begin(), S.end());
+        if(distinct.insert(set).second) sets.push_back(set);
+    }
+    sets.push_back({}); // Empty sets do not have a parent
+
+    Color_Set_Storage<SDSL_Variant_Color_Set> css;
+    for(const vector<int64_t>& set : sets) css.add_set(set);
+    css.prepare_for_queries();
+
+    seq_io::NullStream ns;
+    int64_t full_bytes = css.serialize(ns);
+    css.choose_delta_parents(n_colors - 1, 3, 4);
+    int64_t delta_bytes = css.serialize(ns);
+    ASSERT_LT(delta_bytes * 4, full_bytes);
+
+    Color_Set_Storage<SDSL_Variant_Color_Set> css_loaded = to_disk_and_back(css);
+    ASSERT_EQ(css_loaded.number_of_sets_stored(), sets.size());
+    for(int64_t i = 0; i < sets.size(); i++)
+        ASSERT_EQ(css_loaded.get_color_set_by_id(i).get_colors_as_vector(), sets[i]);
+
+    // The descriptor table of delta encoded sets is built again after decoding
+    css.build_descriptor_table();
+    css_loaded = to_disk_and_back(css);
+    ASSERT_TRUE(css_loaded.has_descriptor_table());
+    for(int64_t i = 0; i < sets.size(); i++)
+        ASSERT_EQ(css_loaded.get_color_set_by_id(i).get_colors_as_vector(), sets[i]);
+
+    // Decoding follows at most max_depth differences, also for a long chain of similar sets
+    vector<std::tuple<int64_t, int64_t, int64_t>> chain;
+    for(int64_t i = 0; i + 1 < 100; i++) chain.push_back({i, i+1, 1});
+    vector<int64_t> parents = delta_parents_from_candidates(chain, vector<int64_t>(100, 50), 4);
+    int64_t n_full = 0;
+    for(int64_t i = 0; i < 100; i++){
+        int64_t depth = 0;
+        for(int64_t x = i; parents[x] != -1; x = parents[x]) depth++;
+        ASSERT_LE(depth, 4);
+        n_full += parents[i] == -1;
+    }
+    ASSERT_EQ(n_full, 20);
+}
+
+// The delta encoded sets are written in blocks of consecutive ids, and parents can be in other blocks
+TEST(NEW_NEW_COLORING_TEST, delta_encoded_storage_blocks){
+    std::mt19937_64 rng(2345);
+    int64_t n_colors = 600;
+    vector<vector<int64_t>> bases(3);
+    for(vector<int64_t>& base : bases)
+        for(int64_t c = 0; c < n_colors; c++) if(rng() % 4 == 0) base.push_back(c);
+
+    // Distinct sets: each base with a different pair of colors flipped
+    vector<vector<int64_t>> sets;
+    for(int64_t i = 0; i < 70000; i++){
+        std::set<int64_t> S(bases[i % 3].begin(), bases[i % 3].end());
+        for(int64_t c : {(i / 3) % 300, 300 + (i / 900)}){
+            if(S.count(c)) S.erase(c); else S.insert(c);
+        }
+        sets.push_back(vector<int64_t>(S.begin(), S.end()));
+    }
+
+    Color_Set_Storage<SDSL_Variant_Color_Set> css;
+    for(const vector<int64_t>& set : sets) css.add_set(set);
+    css.prepare_for_queries();
+    css.choose_delta_parents(n_colors - 1, 4, 4);
+
+    std::stringstream ss;
+    css.serialize(ss);
+    for(int64_t n_threads : {1, 4}){
+        std::stringstream in(ss.str());
+        Color_Set_Storage<SDSL_Variant_Color_Set> css_loaded;
+        css_loaded.load(in, 5, n_threads);
+        ASSERT_EQ(css_loaded.number_of_sets_stored(), sets.size());
+        for(int64_t i = 0; i < sets.size(); i++)
+            ASSERT_EQ(css_loaded.get_color_set_by_id(i).get_colors_as_vector(), sets[i]);
+    }
+}
+
+// Parents that do not lead to a full set within the maximum depth are rejected before decoding
+TEST(NEW_NEW_COLORING_TEST, delta_encoded_storage_corrupt_parents){
+    auto load_with_parents = [](const vector<int64_t>& parents){ // Set i has parent parents[i]-1, or none if 0
+        sdsl::int_vector<> delta_parents(parents.size(), 0, 64);
+        for(int64_t i = 0; i < parents.size(); i++) delta_parents[i] = parents[i];
+        std::stringstream ss;
+        ss.put(1); // Delta encoded
+        delta_parents.serialize(ss);
+        Color_Set_Storage<SDSL_Variant_Color_Set> css;
+        try{
+            css.load(ss, 5, 1);
+        } catch(const std::runtime_error& e){
+            return string(e.what());
+        }
+        return string();
+    };
+    auto is_parent_error = [](const string& message){
+        return message.find("parent") != string::npos;
+    };
+
+    ASSERT_TRUE(is_parent_error(load_with_parents({2, 1}))); // Cycle
+    ASSERT_TRUE(is_parent_error(load_with_parents({0, 1, 4}))); // Self loop
+    ASSERT_TRUE(is_parent_error(load_with_parents({0, 5}))); // Not a set id
+    int64_t max_depth = Color_Set_Storage<SDSL_Variant_Color_Set>::max_delta_depth;
+    vector<int64_t> chain = {0};
+    for(int64_t i = 1; i <= max_depth + 1; i++) chain.push_back(i); // Set i has parent i-1
+    ASSERT_TRUE(is_parent_error(load_with_parents(chain))); // Too deep
+    chain.pop_back();
+    string message = load_with_parents(chain); // Deep enough, but the blocks are missing
+    ASSERT_NE(message, "");
+    ASSERT_FALSE(is_parent_error(message));
+}
+
+// Roaring sets are stored frozen in one buffer. Every container type and sets with many containers.
+TEST(NEW_NEW_COLORING_TEST, frozen_roaring_storage){
+    vector<vector<int64_t>> sets = {get_sparse_colorset(),
+                                    get_dense_colorset(2, 20000), // Bitmap
+                                    get_dense_colorset(1, 5000), // One run
+                                    {},
+                                    get_dense_colorset(1000, 300000), // Arrays in many containers
+                                    {0, 65535, 65536, 131071, 1LL << 40}};
+    for(int64_t x = 70000; x < 140000; x += 3) sets[4].push_back(x); // A bitmap among arrays
+    std::sort(sets[4].begin(), sets[4].end());
+    sets[4].erase(std::unique(sets[4].begin(), sets[4].end()), sets[4].end());
+
+    Color_Set_Storage<Roaring_Color_Set> css;
+    css.add_set(sets[0]);
+    css.add_sets({sets.begin() + 1, sets.end()}, 3);
+    css.prepare_for_queries();
+    Color_Set_Storage<Roaring_Color_Set> css_loaded = to_disk_and_back(css);
+    ASSERT_EQ(css_loaded.number_of_sets_stored(), sets.size());
+
+    for(int64_t i = 0; i < sets.size(); i++){
+        Roaring_Color_Set::view_t view = css_loaded.get_color_set_by_id(i);
+        ASSERT_EQ(view.get_colors_as_vector(), sets[i]);
+        ASSERT_EQ(view.size(), sets[i].size());
+        ASSERT_EQ(view.empty(), sets[i].empty());
+        std::set<int64_t> S(sets[i].begin(), sets[i].end());
+        for(int64_t x : {0LL, 4LL, 5LL, 4999LL, 5000LL, 65535LL, 65536LL, 70000LL, 70001LL, 131071LL, 1LL << 40})
+            ASSERT_EQ(view.contains(x), (bool)S.count(x));
+
+        // Intersection and union with a frozen set
+        for(int64_t j = 0; j < sets.size(); j++){
+            vector<int64_t> inter, uni;
+            std::set_intersection(sets[i].begin(), sets[i].end(), sets[j].begin(), sets[j].end(), std::back_inserter(inter));
+            std::set_union(sets[i].begin(), sets[i].end(), sets[j].begin(), sets[j].end(), std::back_inserter(uni));
+
+            Roaring_Color_Set cs(sets[j]);
+            cs.intersection(view);
+            ASSERT_EQ(cs.get_colors_as_vector(), inter);
+
+            Roaring_Color_Set cs2(css.get_color_set_by_id(j));
+            cs2.do_union(view);
+            ASSERT_EQ(cs2.get_colors_as_vector(), uni);
+        }
+    }
+}
+
+// Intersections and unions of frozen Roaring sets go container by container. The results must be the
+// same words as freezing the colors directly, so that every container has the smallest type.
+TEST(NEW_NEW_COLORING_TEST, frozen_roaring_set_operations){
+    std::mt19937_64 rng(1234);
+    auto random_container = [&](int64_t key, vector<int64_t>& colors){
+        int64_t base = key << 16;
+        int64_t kind = rng() % 5;
+        if(kind == 0) return; // No container
+        if(kind == 1) for(int64_t i = 0; i < 20; i++) colors.push_back(base + rng() % 65536); // Array
+        if(kind == 2) for(int64_t x = 0; x < 65536; x++) if(rng() % 3 == 0) colors.push_back(base + x); // Bitmap
+        if(kind == 3){ // Runs
+            for(int64_t r = 0; r < 5; r++){
+                int64_t first = rng() % 60000;
+                for(int64_t x = first; x < first + 1 + (int64_t)(rng() % 5000); x++) colors.push_back(base + x);
+            }
+        }
+        if(kind == 4) for(int64_t x = 0; x < 65536; x++) colors.push_back(base + x); // One run over the whole container
+    };
+
+    vector<vector<int64_t>> sets(20);
+    for(vector<int64_t>& colors : sets){
+        for(int64_t key : {0, 1, 3, 1 << 20}) random_container(key, colors);
+        std::sort(colors.begin(), colors.end());
+        colors.erase(std::unique(colors.begin(), colors.end()), colors.end());
+    }
+    sets.push_back({}); // Empty
+
+    Color_Set_Storage<Roaring_Color_Set> css;
+    css.add_sets(sets, 2);
+    css.prepare_for_queries();
+
+    auto assert_frozen_as = [](const Roaring_Color_Set& cs, const vector<int64_t>& colors){
+        ASSERT_EQ(cs.get_colors_as_vector(), colors);
+        Roaring_Color_Set expected(colors);
+        Roaring_Color_Set::view_t v(cs), e(expected);
+        ASSERT_EQ(vector<uint64_t>(v.frozen, v.frozen + v.frozen_words), vector<uint64_t>(e.frozen, e.frozen + e.frozen_words));
+    };
+
+    Roaring_Color_Set running(css.get_color_set_by_id(0)); // A running intersection, like in pseudoalignment
+    vector<int64_t> running_colors = sets[0];
+    for(int64_t i = 0; i < sets.size(); i++){
+        for(int64_t j = 0; j < sets.size(); j++){
+            vector<int64_t> inter, uni;
+            std::set_intersection(sets[i].begin(), sets[i].end(), sets[j].begin(), sets[j].end(), std::back_inserter(inter));
+            std::set_union(sets[i].begin(), sets[i].end(), sets[j].begin(), sets[j].end(), std::back_inserter(uni));
+
+            Roaring_Color_Set cs;
+            cs = css.get_color_set_by_id(i);
+            cs.intersection(css.get_color_set_by_id(j));
+            assert_frozen_as(cs, inter);
+
+            cs = css.get_color_set_by_id(i);
+            cs.do_union(css.get_color_set_by_id(j));
+            assert_frozen_as(cs, uni);
         }
+
+        // Unions keep the running intersection from becoming empty right away
+        Roaring_Color_Set u(css.get_color_set_by_id(i));
+        u.do_union(css.get_color_set_by_id((i + 1) % sets.size()));
+        vector<int64_t> u_colors;
+        std::set_union(sets[i].begin(), sets[i].end(), sets[(i + 1) % sets.size()].begin(), sets[(i + 1) % sets.size()].end(), std::back_inserter(u_colors));
+        running.intersection(u);
+        vector<int64_t> next;
+        std::set_intersection(running_colors.begin(), running_colors.end(), u_colors.begin(), u_colors.end(), std::back_inserter(next));
+        running_colors = next;
+        assert_frozen_as(running, running_colors);
     }
-    
+
+    // Adding colors is a union
+    Roaring_Color_Set added(sets[1]);
+    added.add({5, 1, 70000, 5});
+    vector<int64_t> added_colors = sets[1];
+    for(int64_t x : {1, 5, 70000}) added_colors.push_back(x);
+    std::sort(added_colors.begin(), added_colors.end());
+    added_colors.erase(std::unique(added_colors.begin(), added_colors.end()), added_colors.end());
+    assert_frozen_as(added, added_colors);
+}
+
+// Colors must fit in the container keys, and loading checks the buffer and every set
+TEST(NEW_NEW_COLORING_TEST, frozen_roaring_validation){
+    int64_t max_color = Frozen_Roaring::max_color;
+    ASSERT_EQ(Roaring_Color_Set(vector<int64_t>{0, max_color}).get_colors_as_vector(), (vector<int64_t>{0, max_color}));
+    ASSERT_THROW(Roaring_Color_Set(vector<int64_t>{0, max_color + 1}), std::runtime_error);
+    ASSERT_THROW(Roaring_Color_Set(vector<int64_t>{-1, 5}), std::runtime_error);
+    Color_Set_Storage<Roaring_Color_Set> css;
+    ASSERT_THROW(css.add_sets({{1, 2}, {max_color + 1}}, 2), std::runtime_error);
+
+    css.add_sets({{1, 2, 3}, get_dense_colorset(2, 20000), {}, {70000, 1LL << 40}}, 2);
+    css.prepare_for_queries();
+    std::stringstream ss;
+    css.serialize(ss);
+    const string bytes = ss.str();
+    int64_t n_sets = css.number_of_sets_stored();
+
+    auto load_from = [](const string& s){
+        std::stringstream in(s);
+        Color_Set_Storage<Roaring_Color_Set> loaded;
+        loaded.load(in);
+        return loaded;
+    };
+    auto with_word = [&](int64_t word_index, uint64_t value){ // The serialized storage with one word replaced
+        string s = bytes;
+        std::memcpy(s.data() + 8 * word_index, &value, 8);
+        return s;
+    };
+    int64_t data_start = 2 + n_sets + 1; // Words n_sets, n_words and starts come first
+
+    ASSERT_EQ(load_from(bytes).get_color_set_by_id(3).get_colors_as_vector(), (vector<int64_t>{70000, 1LL << 40}));
+    ASSERT_THROW(load_from(bytes.substr(0, bytes.size() - 8)), std::runtime_error); // Truncated
+    ASSERT_THROW(load_from(with_word(0, 1LL << 60)), std::runtime_error); // Too many sets for the stream
+    ASSERT_THROW(load_from(with_word(1, 1LL << 60)), std::runtime_error); // Too many words for the stream
+    ASSERT_THROW(load_from(with_word(2 + n_sets, 5)), std::runtime_error); // Last start is not the number of words
+    ASSERT_THROW(load_from(with_word(2 + 2, 1)), std::runtime_error); // Starts are not increasing
+    ASSERT_THROW(load_from(with_word(data_start + 1, 1000)), std::runtime_error); // Number of containers of set 0
+    ASSERT_THROW(load_from(with_word(data_start + 2 + 1, 1000)), std::runtime_error); // Offset of the container of set 0
+    ASSERT_THROW(load_from(with_word(data_start, 4)), std::runtime_error); // Size of set 0
+    ASSERT_THROW(load_from(with_word(data_start + 2, 3 << 16)), std::runtime_error); // Container type of set 0
+
+    // Run containers: one set with the runs 0..99 and 200..299. The (first, length - 1) pairs are
+    // in the word after the header words, the container descriptor and offset, and the number of runs.
+    Color_Set_Storage<Roaring_Color_Set> run_css;
+    vector<int64_t> runs = get_dense_colorset(1, 100);
+    for(int64_t x = 200; x < 300; x++) runs.push_back(x);
+    run_css.add_sets({runs}, 1);
+    run_css.prepare_for_queries();
+    std::stringstream run_ss;
+    run_css.serialize(run_ss);
+    const string run_bytes = run_ss.str();
+    auto with_runs = [&](uint64_t first_0, uint64_t first_1){ // Replace the starts of the runs
+        string s = run_bytes;
+        uint64_t pairs = first_0 | (99ULL << 16) | (first_1 << 32) | (99ULL << 48);
+        std::memcpy(s.data() + 8 * (2 + 2 + 5), &pairs, 8); // After the two starts and 5 words of the set
+        return s;
+    };
+    ASSERT_EQ(load_from(with_runs(0, 200)).get_color_set_by_id(0).get_colors_as_vector(), runs);
+    ASSERT_EQ(load_from(with_runs(0, 65436)).get_color_set_by_id(0).size(), 200); // Last run ends at 65535
+    ASSERT_THROW(load_from(with_runs(0, 65437)), std::runtime_error); // Run past the end of the container
+    ASSERT_THROW(load_from(with_runs(0, 50)), std::runtime_error); // Overlapping runs
+    ASSERT_THROW(load_from(with_runs(200, 0)), std::runtime_error); // Runs out of order
 }
 
 TEST(NEW_NEW_COLORING_TEST, prefix_sums){
@@ -119,6 +119,200 @@ TEST(COLORING_TESTS, random_testcases){
     }
 }
 
+// The color sets and the color set pointers are built in parallel. The result must not depend on the number of threads.
+TEST(COLORING_TESTS, same_result_with_any_number_of_threads){
+    for(ColoringTestCase tcase : generate_testcases()){
+        string fastafilename = get_temp_file_manager().create_filename("ctest",".fna");
+        sbwt::throwing_ofstream fastafile(fastafilename);
+        fastafile << tcase.fasta_data;
+        fastafile.close();
+        plain_matrix_sbwt_t SBWT;
+        build_nodeboss_in_memory<plain_matrix_sbwt_t>(tcase.references, SBWT, tcase.k, true);
+
+        Coloring<Roaring_Color_Set> serial, parallel;
+        Coloring_Builder<Roaring_Color_Set> cb1, cb2;
+        seq_io::Reader<> reader1(fastafilename);
+        seq_io::Reader<> reader2(fastafilename);
+        cb1.build_coloring(serial, SBWT, reader1, tcase.seq_id_to_color_id, 1<<20, 1, 2);
+        cb2.build_coloring(parallel, SBWT, reader2, tcase.seq_id_to_color_id, 1<<20, 4, 2);
+
+        ASSERT_EQ(serial.number_of_distinct_color_sets(), parallel.number_of_distinct_color_sets());
+        for(int64_t node = 0; node < SBWT.number_of_subsets(); node++){
+            ASSERT_EQ(serial.get_node_id_to_colorset_id_structure().get(node), parallel.get_node_id_to_colorset_id_structure().get(node));
+        }
+        for(int64_t id = 0; id < serial.number_of_distinct_color_sets(); id++){
+            ASSERT_EQ(serial.get_color_set_as_vector_by_color_set_id(id), parallel.get_color_set_as_vector_by_color_set_id(id));
+        }
+    }
+}
+
+// Reordering the colors permutes the color ids stored in the sets, but the colors must still be
+// reported in the original ids, also after serialization.
+TEST(COLORING_TESTS, reorder_colors){
+    for(ColoringTestCase tcase : generate_testcases()){
+        string fastafilename = get_temp_file_manager().create_filename("ctest",".fna");
+        sbwt::throwing_ofstream fastafile(fastafilename);
+        fastafile << tcase.fasta_data;
+        fastafile.close();
+        plain_matrix_sbwt_t SBWT;
+        build_nodeboss_in_memory<plain_matrix_sbwt_t>(tcase.references, SBWT, tcase.k, true);
+
+        Coloring<> coloring;
+        Coloring_Builder<> cb;
+        seq_io::Reader<> reader(fastafilename);
+        cb.build_coloring(coloring, SBWT, reader, tcase.seq_id_to_color_id, 2048, 3, 1);
+
+        Coloring<> reordered = coloring;
+        reordered.reorder_colors(3);
+        reordered.reorder_colors(2); // Reordering again composes the permutations
+        ASSERT_TRUE(reordered.has_color_permutation());
+
+        stringstream ss;
+        reordered.serialize(ss);
+        Coloring<> loaded;
+        loaded.load(ss, SBWT);
+
+        ASSERT_EQ(coloring.number_of_distinct_color_sets(), loaded.number_of_distinct_color_sets());
+        for(int64_t c = 0; c <= loaded.largest_color(); c++)
+            ASSERT_EQ(loaded.get_original_color(loaded.get_internal_color(c)), c);
+        for(int64_t id = 0; id < coloring.number_of_distinct_color_sets(); id++){
+            ASSERT_EQ(coloring.get_color_set_as_vector_by_color_set_id(id), reordered.get_color_set_as_vector_by_color_set_id(id));
+            ASSERT_EQ(coloring.get_color_set_as_vector_by_color_set_id(id), loaded.get_color_set_as_vector_by_color_set_id(id));
+        }
+    }
+}
+
+// Colorings written by the previous release (sdsl-hybrid-v4 and roaring-v0) can still be loaded. Both
+// files have the color sets {0, 40}, {1, ..., 6} and {9}, and pointers from nodes 1, 3, 4 and 8 of
+// a 10-node graph to sets 0, 1, 2 and 1.
+template<typename colorset_t>
+void check_previous_release_coloring(const string& filename){
+    plain_matrix_sbwt_t SBWT; // Not accessed
+    std::variant<Coloring<SDSL_Variant_Color_Set>, Coloring<Roaring_Color_Set>> variant;
+    load_coloring(filename, SBWT, variant);
+    ASSERT_TRUE(std::holds_alternative<Coloring<colorset_t>>(variant));
+    const Coloring<colorset_t>& coloring = std::get<Coloring<colorset_t>>(variant);
+
+    ASSERT_FALSE(coloring.has_color_permutation());
+    ASSERT_EQ(coloring.largest_color(), 40);
+    ASSERT_EQ(coloring.sum_of_all_distinct_color_set_lengths(), 9);
+    ASSERT_EQ(coloring.number_of_distinct_color_sets(), 3);
+    ASSERT_EQ(coloring.get_color_set_as_vector_by_color_set_id(0), vector<int64_t>({0, 40}));
+    ASSERT_EQ(coloring.get_color_set_as_vector_by_color_set_id(1), vector<int64_t>({1, 2, 3, 4, 5, 6}));
+    ASSERT_EQ(coloring.get_color_set_as_vector_by_color_set_id(2), vector<int64_t>({9}));
+
+    const Sparse_Uint_Array& pointers = coloring.get_node_id_to_colorset_id_structure();
+    vector<int64_t> expected_pointers = {-1, 0, -1, 1, 2, -1, -1, -1, 1, -1};
+    ASSERT_EQ(pointers.size(), expected_pointers.size());
+    for(int64_t v = 0; v < (int64_t)expected_pointers.size(); v++)
+        ASSERT_EQ(pointers.get(v), expected_pointers[v]);
+
+    // Saving writes the current format, which loads back to the same coloring
+    stringstream ss;
+    coloring.serialize(ss);
+    Coloring<colorset_t> reloaded;
+    reloaded.load(ss, SBWT);
+    for(int64_t id = 0; id < 3; id++)
+        ASSERT_EQ(reloaded.get_color_set_as_vector_by_color_set_id(id), coloring.get_color_set_as_vector_by_color_set_id(id));
+    for(int64_t v = 0; v < (int64_t)expected_pointers.size(); v++)
+        ASSERT_EQ(reloaded.get_node_id_to_colorset_id_structure().get(v), expected_pointers[v]);
+}
+
+TEST(COLORING_TESTS, load_previous_release_format){
+    check_previous_release_coloring<SDSL_Variant_Color_Set>("testcases/previous_release_sdsl_hybrid.tcolors");
+    check_previous_release_coloring<Roaring_Color_Set>("testcases/previous_release_roaring.tcolors");
+}
+
+// Sorting the color sets by popularity renumbers the sets, but every node must keep its color set
+TEST(COLORING_TESTS, order_color_sets_by_popularity){
+    for(ColoringTestCase tcase : generate_testcases()){
+        string fastafilename = get_temp_file_manager().create_filename("ctest",".fna");
+        sbwt::throwing_ofstream fastafile(fastafilename);
+        fastafile << tcase.fasta_data;
+        fastafile.close();
+        plain_matrix_sbwt_t SBWT;
+        build_nodeboss_in_memory<plain_matrix_sbwt_t>(tcase.references, SBWT, tcase.k, true);
+
+        Coloring<> coloring;
+        Coloring_Builder<> cb;
+        seq_io::Reader<> reader(fastafilename);
+        cb.build_coloring(coloring, SBWT, reader, tcase.seq_id_to_color_id, 2048, 3, 1);
+
+        Coloring<> sorted = coloring;
+        sorted.order_color_sets_by_popularity(3);
+
+        stringstream ss;
+        sorted.serialize(ss);
+        Coloring<> loaded;
+        loaded.load(ss, SBWT);
+
+        ASSERT_EQ(coloring.number_of_distinct_color_sets(), loaded.number_of_distinct_color_sets());
+        vector<int64_t> counts = loaded.get_node_id_to_colorset_id_structure().value_counts();
+        for(int64_t id = 1; id < counts.size(); id++) ASSERT_GE(counts[id-1], counts[id]);
+
+        for(int64_t v = 0; v < SBWT.number_of_subsets(); v++){
+            ASSERT_EQ(coloring.is_core_kmer(v), loaded.is_core_kmer(v));
+            if(!coloring.is_core_kmer(v)) continue;
+            vector<int64_t> expected = coloring.get_color_set_as_vector_by_color_set_id(coloring.get_color_set_id(v));
+            ASSERT_EQ(sorted.get_color_set_as_vector_by_color_set_id(sorted.get_color_set_id(v)), expected);
+            ASSERT_EQ(loaded.get_color_set_as_vector_by_color_set_id(loaded.get_color_set_id(v)), expected);
+        }
+    }
+}
+
+// K-mers with fewer than two colors are filtered out of the graph, and the coloring is built from the
+// unfiltered sequences. The sequences must be split at the missing k-mers when core k-mers are marked.
+TEST(COLORING_TESTS, kmers_filtered_by_number_of_colors){
+    srand(4321);
+    for(int64_t rep = 0; rep < 10; rep++){
+        int64_t k = 5 + rep;
+        // References made of shared pieces and unique pieces, so that many k-mers have one color
+        vector<string> pieces;
+        for(int64_t i = 0; i < 4; i++) pieces.push_back(get_random_dna_string(30, 2));
+        vector<string> refs;
+        for(int64_t i = 0; i < 8; i++)
+            refs.push_back(get_random_dna_string(15, 2) + pieces[rand() % 4] + get_random_dna_string(15, 2) + pieces[rand() % 4]);
+        ColoringTestCase tcase = generate_testcase(refs, k);
+
+        string fastafilename = get_temp_file_manager().create_filename("ctest",".fna");
+        sbwt::throwing_ofstream fastafile(fastafilename);
+        fastafile << tcase.fasta_data;
+        fastafile.close();
+
+        // The colors are counted on the unfiltered graph
+        plain_matrix_sbwt_t unfiltered;
+        build_nodeboss_in_memory<plain_matrix_sbwt_t>(tcase.references, unfiltered, k, true);
+        Coloring_Builder<> counter;
+        seq_io::Reader<> counting_reader(fastafilename);
+        In_Memory_Color_Stream counting_colors(tcase.seq_id_to_color_id);
+        sdsl::bit_vector marks = counter.mark_nodes_with_enough_colors(unfiltered, counting_reader, &counting_colors, 2, 1 << 20, 3);
+
+        vector<string> kept_kmers;
+        for(int64_t kmer_id = 0; kmer_id < tcase.colex_kmers.size(); kmer_id++){
+            bool enough_colors = tcase.color_sets[kmer_id].size() >= 2;
+            ASSERT_EQ((bool)marks[unfiltered.search(tcase.colex_kmers[kmer_id])], enough_colors);
+            if(enough_colors) kept_kmers.push_back(tcase.colex_kmers[kmer_id]);
+        }
+        if(kept_kmers.empty()) continue;
+
+        plain_matrix_sbwt_t SBWT;
+        build_nodeboss_in_memory<plain_matrix_sbwt_t>(kept_kmers, SBWT, k, true);
+        Coloring<> coloring;
+        Coloring_Builder<> cb;
+        cb.all_kmers_indexed = false;
+        seq_io::Reader<> reader(fastafilename);
+        cb.build_coloring(coloring, SBWT, reader, tcase.seq_id_to_color_id, 1 << 20, 3, rand() % 3 + 1);
+
+        for(int64_t kmer_id = 0; kmer_id < tcase.colex_kmers.size(); kmer_id++){
+            int64_t node_id = SBWT.search(tcase.colex_kmers[kmer_id]);
+            ASSERT_EQ(node_id >= 0, tcase.color_sets[kmer_id].size() >= 2);
+            if(node_id < 0) continue;
+            vector<int64_t> colorvec = coloring.get_color_set_of_node_as_vector(node_id);
+            ASSERT_EQ(set<int64_t>(colorvec.begin(), colorvec.end()), tcase.color_sets[kmer_id]);
+        }
+    }
+}
+
 bool is_valid_kmer(const char* S, int64_t k){
     for(int64_t i = 0; i < k; i++){
         char c = S[i];
@@ -198,7 +392,7 @@ void test_construction_from_colored_unitigs(plain_matrix_sbwt_t& SBWT, const vec
     sbwt::throwing_ofstream unitig_colors_out(unitig_colors_outfile);
 
     seq_io::NullStream gfa_null_stream;
-    UE.extract_unitigs(dbg, coloring, unitigs_out.stream, true, unitig_colors_out.stream, gfa_null_stream, 0);
+    UE.extract_unitigs(dbg, coloring, unitigs_out.stream, true, unitig_colors_out.stream, gfa_null_stream, false, 0);
 
     unitigs_out.close();
     unitig_colors_out.close();
@@ -244,6 +438,51 @@ void test_construction_from_colored_unitigs(plain_matrix_sbwt_t& SBWT, const vec
         ASSERT_EQ(c1, c2);
     }
 
+    // Tiny batches, so that many color sets continue from one batch of a GGCAT thread to the next
+    const int64_t tiny_batch_bytes = 64;
+    std::atomic<int64_t> n_continued_batches = 0; // The callback runs in the GGCAT threads
+    db.iterate_batches([&](Colored_Unitig_Batch& batch){
+        if(batch.color_set_idx[0] == -1) n_continued_batches++;
+    }, tiny_batch_bytes);
+    ASSERT_GT(n_continued_batches, 0);
+
+    Coloring<SDSL_Variant_Color_Set> coloring3;
+    Coloring_Builder_From_GGCAT<SDSL_Variant_Color_Set> cb3;
+    cb3.batch_bytes = tiny_batch_bytes;
+    cb3.build_from_colored_unitigs(coloring3, SBWT, 1<<30, 3, 3, db);
+
+    ASSERT_EQ(coloring.largest_color(), coloring3.largest_color());
+    for(DBG::Node v : dbg.all_nodes()){
+        vector<int64_t> c1 = coloring.get_color_set_of_node(v.id).get_colors_as_vector();
+        vector<int64_t> c3 = coloring3.get_color_set_of_node(v.id).get_colors_as_vector();
+        ASSERT_EQ(c1, c3);
+    }
+
+    // With a minimum number of colors, the index has only the k-mers with at least that many colors,
+    // and the color sets of the dropped unitigs are skipped (Coloring_Builder_From_GGCAT::filtered_set_id)
+    const int64_t min_colors = 2;
+    vector<string> kept_kmers;
+    for(DBG::Node v : dbg.all_nodes())
+        if(coloring.get_color_set_of_node(v.id).size() >= min_colors) kept_kmers.push_back(dbg.get_node_label(v));
+    ASSERT_GT(kept_kmers.size(), 0);
+    ASSERT_LT(kept_kmers.size(), SBWT.number_of_kmers());
+
+    plain_matrix_sbwt_t filtered_SBWT;
+    build_nodeboss_in_memory<plain_matrix_sbwt_t>(kept_kmers, filtered_SBWT, k, true);
+    ASSERT_EQ(filtered_SBWT.number_of_kmers(), kept_kmers.size());
+
+    Coloring<SDSL_Variant_Color_Set> coloring4;
+    Coloring_Builder_From_GGCAT<SDSL_Variant_Color_Set> cb4;
+    cb4.batch_bytes = tiny_batch_bytes;
+    cb4.build_from_colored_unitigs(coloring4, filtered_SBWT, 1<<30, 3, 3, db, min_colors);
+
+    for(DBG::Node v : dbg.all_nodes()){
+        vector<int64_t> c1 = coloring.get_color_set_of_node(v.id).get_colors_as_vector();
+        int64_t filtered_node = filtered_SBWT.search(dbg.get_node_label(v));
+        ASSERT_EQ(filtered_node >= 0, (int64_t)c1.size() >= min_colors);
+        if(filtered_node >= 0) ASSERT_EQ(c1, coloring4.get_color_set_of_node(filtered_node).get_colors_as_vector());
+    }
+
 }
 
 TEST(COLORING_TESTS, coli3) {
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "setup_tests.hh"
+#include <gtest/gtest.h>
+#include <filesystem>
+#include "globals.hh"
+#include "sbwt/globals.hh"
+#include "external_sort.hh"
+
+using namespace sbwt;
+
+static const vector<external_sort::Temp_Compression> all_temp_compressions =
+    {external_sort::Temp_Compression::none, external_sort::Temp_Compression::delta, external_sort::Temp_Compression::delta_zlib};
+
+// Reads a record file into strings, one per record
+template<typename format_t>
+static vector<string> read_records(const string& filename, format_t format){
+    external_sort::Record_File_Reader<format_t> in(filename, format);
+    vector<string> records;
+    string R(format.min_record_size(), '\0');
+    while(in.read(R.data(), format.min_record_size())){
+        R.resize(format.size_of(R.data()));
+        in.read(R.data() + format.min_record_size(), R.size() - format.min_record_size());
+        records.push_back(R);
+        R.resize(format.min_record_size());
+    }
+    return records;
+}
+
+// Writes the records in pieces that do not end at record boundaries
+template<typename format_t>
+static void write_records(const vector<string>& records, const string& filename, format_t format){
+    string data;
+    for(const string& R : records) data += R;
+    external_sort::Record_File_Writer<format_t> out(filename, format, -1, 1 << 16);
+    for(int64_t i = 0; i < (int64_t)data.size(); i += 1000)
+        out.write(data.data() + i, min((int64_t)1000, (int64_t)data.size() - i));
+    out.finish();
+}
+
+TEST(EXTERNAL_SORT, constant_size_records){
+    // Pairs of big-endian integers with many duplicates. The small memory budget gives many runs and
+    // several merge rounds, and the large one sorts in memory.
+    srand(3141);
+    vector<string> records;
+    for(int64_t i = 0; i < 300000; i++){
+        char buf[16];
+        write_big_endian_LL(buf, rand() % 1000);
+        write_big_endian_LL(buf + 8, rand() % 10);
+        records.push_back(string(buf, 16));
+    }
+    external_sort::Constant_Size_Records format{16};
+
+    auto cmp = [](const char* A, const char* B){
+        return make_pair(parse_big_endian_LL(A), parse_big_endian_LL(A+8)) < make_pair(parse_big_endian_LL(B), parse_big_endian_LL(B+8));
+    };
+    vector<string> sorted = records;
+    std::sort(sorted.begin(), sorted.end(), [&](const string& A, const string& B){ return cmp(A.data(), B.data()); });
+
+    for(external_sort::Temp_Compression compression : all_temp_compressions){
+        external_sort::set_temp_compression(compression);
+        string infile = get_temp_file_manager().create_filename("", ".bin");
+        write_records(records, infile, format);
+        ASSERT_EQ(read_records(infile, format), records);
+        for(int64_t ram_bytes : {1 << 20, 1 << 28}){
+            for(int64_t n_threads : {1, 3}){
+                string outfile = get_temp_file_manager().create_filename("", ".bin");
+                external_sort::sort_constant_binary(infile, outfile, cmp, ram_bytes, 16, n_threads);
+                ASSERT_EQ(read_records(outfile, format), sorted);
+            }
+        }
+    }
+    external_sort::set_temp_compression(external_sort::Temp_Compression::delta); // Back to the default
+}
+
+TEST(EXTERNAL_SORT, variable_length_records){
+    // Length, then a random payload over a small alphabet, compared lexicographically by the payload
+    srand(2718);
+    vector<string> records;
+    for(int64_t i = 0; i < 40000; i++){
+        int64_t payload_len = rand() % 200;
+        string R(8 + payload_len, '\0');
+        write_big_endian_LL(R.data(), R.size());
+        for(int64_t j = 0; j < payload_len; j++) R[8+j] = 'a' + rand() % 2;
+        records.push_back(R);
+    }
+    external_sort::Variable_Size_Records format;
+
+    auto cmp = [](const char* A, const char* B){
+        int64_t nA = parse_big_endian_LL(A);
+        int64_t nB = parse_big_endian_LL(B);
+        return std::lexicographical_compare(A + 8, A + nA, B + 8, B + nB);
+    };
+    vector<string> sorted = records;
+    std::sort(sorted.begin(), sorted.end(), [&](const string& A, const string& B){ return cmp(A.data(), B.data()); });
+
+    for(external_sort::Temp_Compression compression : all_temp_compressions){
+        external_sort::set_temp_compression(compression);
+        string infile = get_temp_file_manager().create_filename("", ".bin");
+        write_records(records, infile, format);
+        for(int64_t ram_bytes : {1 << 20, 1 << 28}){
+            for(int64_t n_threads : {1, 4}){
+                string outfile = get_temp_file_manager().create_filename("", ".bin");
+                external_sort::sort_variable_length_records(infile, outfile, cmp, ram_bytes, n_threads);
+                ASSERT_EQ(read_records(outfile, format), sorted);
+            }
+        }
+    }
+    external_sort::set_temp_compression(external_sort::Temp_Compression::delta); // Back to the default
+}
+
+TEST(EXTERNAL_SORT, delta_coding_compresses_sorted_pairs){
+    // Sorted pairs of small integers should code into a fraction of their raw size
+    vector<string> records;
+    for(int64_t node = 0; node < 100000; node++){
+        char buf[16];
+        write_big_endian_LL(buf, node);
+        write_big_endian_LL(buf + 8, node % 7);
+        records.push_back(string(buf, 16));
+    }
+    external_sort::set_temp_compression(external_sort::Temp_Compression::delta);
+    string filename = get_temp_file_manager().create_filename("", ".bin");
+    external_sort::Constant_Size_Records format{16};
+    write_records(records, filename, format);
+    ASSERT_LT(std::filesystem::file_size(filename) * 4, records.size() * 16);
+    ASSERT_EQ(read_records(filename, format), records);
+}
+
+TEST(EXTERNAL_SORT, empty_input){
+    string infile = get_temp_file_manager().create_filename("", ".bin");
+    external_sort::Constant_Size_Records format{16};
+    write_records({}, infile, format);
+    string outfile = get_temp_file_manager().create_filename("", ".bin");
+    auto cmp = [](const char* A, const char* B){ return memcmp(A, B, 16) < 0; };
+    external_sort::sort_constant_binary(infile, outfile, cmp, 1 << 20, 16, 2);
+    ASSERT_TRUE(std::filesystem::exists(outfile));
+    ASSERT_EQ(read_records(outfile, format).size(), 0);
+}
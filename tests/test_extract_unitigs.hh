@@ -415,6 +415,23 @@ TEST_F(EXTRACT_UNITIGS_TEST, partition_with_colorsplit){
     }
 }
 
+// The output must not depend on the number of threads
+TEST_F(EXTRACT_UNITIGS_TEST, deterministic_in_parallel){
+    auto extract = [&](int64_t n_threads, bool split_by_colors){
+        UnitigExtractor<Coloring<SDSL_Variant_Color_Set>> UE;
+        UE.block_size = 64; // Many blocks, so that the blocks are split between threads
+        stringstream unitigs_out, colors_out, gfa_out;
+        UE.extract_unitigs(*dbg, coloring, unitigs_out, split_by_colors, colors_out, gfa_out, true, 0, n_threads);
+        return unitigs_out.str() + colors_out.str() + gfa_out.str();
+    };
+
+    for(bool split_by_colors : {false, true}){
+        string serial = extract(1, split_by_colors);
+        ASSERT_EQ(serial, extract(4, split_by_colors));
+        ASSERT_EQ(serial, extract(7, split_by_colors));
+    }
+}
+
 // Returns pair (unitigs, color sets)
 pair<vector<string>, vector<vector<int64_t>>> get_colored_unitigs_with_themisto(string input_file_listfile, int64_t k){
     // Build Themisto with file colors
@@ -438,7 +455,7 @@ pair<vector<string>, vector<vector<int64_t>>> get_colored_unitigs_with_themisto(
     sbwt::throwing_ofstream unitig_colors_out(unitig_colors_outfile);
 
     seq_io::NullStream gfa_null_stream;
-    UE.extract_unitigs(dbg, coloring, unitigs_out.stream, true, unitig_colors_out.stream, gfa_null_stream, 0);
+    UE.extract_unitigs(dbg, coloring, unitigs_out.stream, true, unitig_colors_out.stream, gfa_null_stream, false, 0);
 
     unitigs_out.close();
     unitig_colors_out.close();
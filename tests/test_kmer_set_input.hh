@@ -0,0 +1,178 @@
+#pragma once
+
+#include "setup_tests.hh"
+#include <gtest/gtest.h>
+#include <fstream>
+#include "globals.hh"
+#include "sbwt/globals.hh"
+#include "kmer_set_input.hh"
+#include "commands.hh"
+#include "test_tools.hh"
+#include "sbwt/SBWT.hh"
+#include "sbwt/variants.hh"
+#include "coloring/Coloring.hh"
+#include "KMC/include/kmc_runner.h"
+
+using namespace sbwt;
+
+// Canonical k-mers of the sequences of a FASTA file with a count for each
+static map<string, int64_t> canonical_kmer_counts_in_fasta(const string& filename, int64_t k){
+    map<string, int64_t> counts;
+    std::ifstream in(filename);
+    string line;
+    while(getline(in, line)){
+        if(line.size() > 0 && line[0] == '>') continue;
+        for(int64_t i = 0; i + k <= (int64_t)line.size(); i++){
+            string x = line.substr(i, k);
+            counts[min(x, get_reverse_complement(x))]++;
+        }
+    }
+    return counts;
+}
+
+TEST(KMER_SET_INPUT, joined_sequences_have_each_kmer_once){
+    srand(1234);
+    for(int64_t k : {5, 40}){
+        // K-mers of random sequences in both orientations, some in lower case and some with a count after
+        // them like in kmc_dump output
+        set<string> canonical_kmers;
+        string kmer_file = get_temp_file_manager().create_filename("", ".kmers");
+        {
+            std::ofstream out(kmer_file);
+            for(int64_t seq = 0; seq < 20; seq++){
+                string S;
+                for(int64_t i = 0; i < 200; i++) S += "ACGT"[rand() % 4];
+                for(int64_t i = 0; i + k <= (int64_t)S.size(); i++){
+                    string x = S.substr(i, k);
+                    canonical_kmers.insert(min(x, get_reverse_complement(x)));
+                    if(rand() % 2) x = get_reverse_complement(x);
+                    if(rand() % 5 == 0) for(char& c : x) c = tolower(c);
+                    out << x;
+                    if(rand() % 2) out << "\t" << 1 + rand() % 10;
+                    out << "\n";
+                }
+            }
+        }
+
+        string fasta = kmer_set_to_fasta(kmer_file, 0, 1 << 30); // k is taken from the set
+        map<string, int64_t> counts = canonical_kmer_counts_in_fasta(fasta, k);
+        ASSERT_EQ(counts.size(), canonical_kmers.size());
+        for(const auto& [x, count] : counts){
+            ASSERT_TRUE(canonical_kmers.count(x));
+            ASSERT_EQ(count, 1);
+        }
+
+        // The joined sequences are much shorter than the k-mers written one per line
+        ASSERT_LT(std::filesystem::file_size(fasta) * 2, std::filesystem::file_size(kmer_file));
+    }
+}
+
+TEST(KMER_SET_INPUT, invalid_kmers){
+    string kmer_file = get_temp_file_manager().create_filename("", ".kmers");
+    { std::ofstream out(kmer_file); out << "ACGTA\nACGT\n"; }
+    ASSERT_THROW(kmer_set_to_fasta(kmer_file, 0, 1 << 30), std::runtime_error); // Different lengths
+
+    { std::ofstream out(kmer_file); out << "ACGTA\nACNTA\n"; }
+    ASSERT_THROW(kmer_set_to_fasta(kmer_file, 5, 1 << 30), std::runtime_error); // Not ACGT
+
+    ASSERT_THROW(kmer_set_to_fasta(kmer_file, 4, 1 << 30), std::runtime_error); // Wrong k
+}
+
+TEST(KMER_SET_INPUT, memory_budget){
+    string kmer_file = get_temp_file_manager().create_filename("", ".kmers");
+    {
+        std::ofstream out(kmer_file);
+        for(int64_t i = 0; i < 100; i++){
+            string x;
+            for(int64_t j = 0; j < 10; j++) x += "ACGT"[(i >> (j % 7)) % 4];
+            out << x << "\n";
+        }
+    }
+    ASSERT_THROW(kmer_set_to_fasta(kmer_file, 10, 50 * 32), std::runtime_error);
+    kmer_set_to_fasta(kmer_file, 10, 100 * 32); // Fits
+}
+
+static vector<string> random_sequences(int64_t n_seqs, int64_t length){
+    vector<string> seqs;
+    for(int64_t i = 0; i < n_seqs; i++){
+        string S;
+        for(int64_t j = 0; j < length; j++) S += "ACGT"[rand() % 4];
+        seqs.push_back(S);
+    }
+    return seqs;
+}
+
+// Counts the canonical k-mers of the sequences into a KMC database and returns its path
+static string count_with_kmc(const vector<string>& seqs, int64_t k){
+    string fasta = get_temp_file_manager().create_filename("", ".fna");
+    write_as_fasta(seqs, fasta);
+    string db = get_temp_file_manager().create_filename("kmc-");
+
+    KMC::Runner runner;
+    KMC::Stage1Params stage1;
+    stage1.SetInputFiles({fasta}).SetKmerLen(k).SetInputFileType(KMC::InputFileType::MULTILINE_FASTA)
+          .SetCanonicalKmers(true).SetTmpPath(get_temp_file_manager().get_dir() + "/").SetNThreads(1).SetMaxRamGB(2);
+    runner.RunStage1(stage1);
+    KMC::Stage2Params stage2;
+    stage2.SetOutputFileName(db).SetCutoffMin(1).SetNThreads(1).SetMaxRamGB(2);
+    runner.RunStage2(stage2);
+    return db;
+}
+
+static set<string> canonical_kmers_of(const vector<string>& seqs, int64_t k){
+    set<string> kmers;
+    for(const string& S : seqs){
+        for(int64_t i = 0; i + k <= (int64_t)S.size(); i++){
+            string x = S.substr(i, k);
+            kmers.insert(min(x, get_reverse_complement(x)));
+        }
+    }
+    return kmers;
+}
+
+TEST(KMER_SET_INPUT, kmc_databases){
+    srand(4321);
+    int64_t k = 21;
+    vector<string> shared = random_sequences(3, 100);
+    vector<vector<string>> set_seqs = {random_sequences(5, 100), random_sequences(5, 100)};
+    for(vector<string>& seqs : set_seqs) seqs.insert(seqs.end(), shared.begin(), shared.end());
+
+    vector<string> dbs;
+    vector<set<string>> expected;
+    for(const vector<string>& seqs : set_seqs){
+        dbs.push_back(count_with_kmc(seqs, k));
+        expected.push_back(canonical_kmers_of(seqs, k));
+    }
+
+    // Reading a database
+    ASSERT_TRUE(is_kmc_database(dbs[0]));
+    set<string> read_kmers;
+    for_each_kmer_in_set(dbs[0], 0, [&](const string& x){ read_kmers.insert(min(x, get_reverse_complement(x))); });
+    ASSERT_EQ(read_kmers, expected[0]);
+
+    // Building an index from the databases. Each database gets its own color.
+    string listfile = get_temp_file_manager().create_filename("", ".txt");
+    write_lines(dbs, listfile);
+    string indexprefix = get_temp_file_manager().create_filename();
+    vector<string> args = {"build", "-k", to_string(k), "-i", listfile, "-o", indexprefix, "--temp-dir", get_temp_file_manager().get_dir(), "--kmer-sets"};
+    sbwt::Argv argv(args);
+    build_index_main(argv.size, argv.array);
+
+    plain_matrix_sbwt_t SBWT;
+    SBWT.load(indexprefix + ".tdbg");
+    Coloring<> coloring;
+    coloring.load(indexprefix + ".tcolors", SBWT);
+
+    set<string> all_kmers = expected[0];
+    all_kmers.insert(expected[1].begin(), expected[1].end());
+    ASSERT_EQ(SBWT.number_of_kmers(), 2 * all_kmers.size()); // Both orientations. Random k-mers are not their own reverse complements.
+    for(const string& x : all_kmers){
+        vector<int64_t> colors;
+        for(int64_t c = 0; c < 2; c++) if(expected[c].count(x)) colors.push_back(c);
+        for(const string& y : {x, get_reverse_complement(x)}){
+            int64_t node = SBWT.search(y);
+            ASSERT_GE(node, 0);
+            ASSERT_EQ(coloring.get_color_set_of_node_as_vector(node), colors);
+        }
+    }
+}
@@ -24,6 +24,10 @@
 #include "test_coloring.hh"
 #include "test_color_set.hh"
 #include "test_color_set_storage.hh"
+#include "test_resource_planner.hh"
+#include "test_external_sort.hh"
+#include "test_build_checkpoint.hh"
+#include "test_kmer_set_input.hh"
 
 int main(int argc, char **argv) {
     try{
@@ -3,6 +3,8 @@
 #include <iostream>
 #include <vector>
 #include <unordered_map>
+#include <map>
+#include <filesystem>
 #include "globals.hh"
 #include "sbwt/globals.hh"
 #include "sbwt/throwing_streams.hh"
@@ -344,3 +346,243 @@ TEST(TEST_PSEUDOALIGN, thresholded){
 
     //void pseudoalign_thresholded(const plain_matrix_sbwt_t& SBWT, const coloring_t& coloring, int64_t n_threads, sequence_reader_t& reader, std::string outfile, bool reverse_complements, int64_t buffer_size, bool gzipped, bool sorted_output)
 }
+
+TEST(TEST_PSEUDOALIGN, read_binning){
+    vector<string> seqs = {"ACATGACGACACATGCTGTAC", "AACTATGGTGCTAACGTAGCAC", "GTGTAGTAGTGTGTAGTAGCATGGGCAC"};
+    vector<string> queries = {"ACATGACGACACATGCTGTAC", "AACTATGGTGCTAACGTAGCAC", "TTTTTTTTTTTTTT", "GTGTAGTAGTGTGTAG", "ACATGACGACA"};
+    int64_t k = 6;
+
+    string ref_fastafile = get_temp_file_manager().create_filename("", ".fna");
+    string query_fastafile = get_temp_file_manager().create_filename("", ".fna");
+    string indexprefix = get_temp_file_manager().create_filename();
+    string tempdir = get_temp_file_manager().get_dir();
+    write_as_fasta(seqs, ref_fastafile);
+    write_as_fasta(queries, query_fastafile);
+
+    vector<string> args = {"build", "-k", to_string(k), "-i", ref_fastafile, "-o", indexprefix, "--temp-dir", tempdir};
+    sbwt::Argv argv(args);
+    ASSERT_EQ(build_index_main(argv.size, argv.array), 0);
+
+    for(bool gzipped : {false, true}){
+        string resultfile = get_temp_file_manager().create_filename("", ".txt");
+        string binprefix = get_temp_file_manager().create_filename("bin-");
+        string bin_suffix = gzipped ? ".fna.gz" : ".fna";
+
+        // Leftovers of an earlier run must not end up in the bins
+        for(int64_t color = 0; color < seqs.size(); color++)
+            write_as_fasta({"GGGGGGGGGGGG"}, binprefix + to_string(color) + ".fna");
+
+        vector<string> args2 = {"pseudoalign", "-q", query_fastafile, "-i", indexprefix, "-o", resultfile, "--temp-dir", tempdir, "--threshold", "0.5", "--sort-output", "--n-threads", "3", "--bin-prefix", binprefix};
+        if(gzipped) args2.push_back("--gzip-output");
+        sbwt::Argv argv2(args2);
+        ASSERT_EQ(pseudoalign_main(argv2.size, argv2.array), 0);
+
+        // The text output of the gzipped run is compared in the other tests, so the bins are
+        // compared against a run without gzip
+        if(gzipped){
+            vector<string> args3 = {"pseudoalign", "-q", query_fastafile, "-i", indexprefix, "-o", resultfile, "--temp-dir", tempdir, "--threshold", "0.5", "--sort-output"};
+            sbwt::Argv argv3(args3);
+            ASSERT_EQ(pseudoalign_main(argv3.size, argv3.array), 0);
+        }
+
+        vector<vector<int64_t> > results = parse_pseudoalignment_output_format_from_disk(resultfile);
+        ASSERT_EQ(results.size(), queries.size());
+
+        for(int64_t color = 0; color < seqs.size(); color++){
+            // Reads that the text output assigns to this color, keyed by rank
+            map<string, string> expected;
+            for(int64_t i = 0; i < queries.size(); i++)
+                if(std::find(results[i].begin(), results[i].end(), color) != results[i].end())
+                    expected[to_string(i)] = queries[i];
+
+            map<string, string> binned;
+            string binfile = binprefix + to_string(color) + bin_suffix;
+            if(std::filesystem::exists(binfile)){
+                seq_io::Reader<> reader(binfile);
+                while(true){
+                    int64_t len = reader.get_next_read_to_buffer();
+                    if(len == 0) break;
+                    binned[string(reader.header_buf)] = string(reader.read_buf, len);
+                }
+            }
+            ASSERT_EQ(binned, expected);
+        }
+    }
+
+    // FASTQ queries are binned with their quality values
+    string fastq_file = get_temp_file_manager().create_filename("", ".fastq");
+    vector<string> qualities;
+    {
+        sbwt::throwing_ofstream out(fastq_file);
+        for(int64_t i = 0; i < queries.size(); i++){
+            string quality;
+            for(int64_t j = 0; j < queries[i].size(); j++) quality += (char)('!' + (i * 7 + j) % 40);
+            qualities.push_back(quality);
+            out << "@\n" << queries[i] << "\n+\n" << quality << "\n";
+        }
+    }
+    string binprefix = get_temp_file_manager().create_filename("bin-");
+    string resultfile = get_temp_file_manager().create_filename("", ".txt");
+    vector<string> args4 = {"pseudoalign", "-q", fastq_file, "-i", indexprefix, "-o", resultfile, "--temp-dir", tempdir, "--threshold", "0.5", "--sort-output", "--n-threads", "3", "--bin-prefix", binprefix};
+    sbwt::Argv argv4(args4);
+    ASSERT_EQ(pseudoalign_main(argv4.size, argv4.array), 0);
+    vector<vector<int64_t> > results = parse_pseudoalignment_output_format_from_disk(resultfile);
+    for(int64_t color = 0; color < seqs.size(); color++){
+        map<string, pair<string, string>> expected; // Header -> (read, quality)
+        for(int64_t i = 0; i < queries.size(); i++)
+            if(std::find(results[i].begin(), results[i].end(), color) != results[i].end())
+                expected[to_string(i)] = {queries[i], qualities[i]};
+
+        map<string, pair<string, string>> binned;
+        string binfile = binprefix + to_string(color) + ".fastq";
+        if(std::filesystem::exists(binfile)){
+            sbwt::throwing_ifstream in(binfile);
+            string header, read, plus, quality;
+            while(getline(in.stream, header)){
+                ASSERT_TRUE(getline(in.stream, read) && getline(in.stream, plus) && getline(in.stream, quality));
+                ASSERT_EQ(header[0], '@');
+                ASSERT_EQ(plus, "+");
+                binned[header.substr(1)] = {read, quality};
+            }
+        }
+        ASSERT_EQ(binned, expected);
+    }
+
+    // Group names must not lead out of the bin prefix
+    string groupfile = get_temp_file_manager().create_filename("", ".txt");
+    write_lines({"a", "../b", "a"}, groupfile);
+    vector<string> args5 = {"pseudoalign", "-q", query_fastafile, "-i", indexprefix, "-o", resultfile, "--temp-dir", tempdir, "--bin-prefix", binprefix, "--bin-groups", groupfile};
+    sbwt::Argv argv5(args5);
+    ASSERT_THROW(pseudoalign_main(argv5.size, argv5.array), std::runtime_error);
+}
+
+TEST(TEST_PSEUDOALIGN, color_mask){
+    vector<string> seqs = {"ACATGACGACACATGCTGTAC", "AACTATGGTGCTAACGTAGCAC", "GTGTAGTAGTGTGTAGTAGCATGGGCAC",
+                           "GTGTAGTAGTGTGTTGTAGCATGGGCAC", "GTGCCCATGCTACTACACACTACTACAC", "ACATGACGACACATGCTGTAC"};
+    vector<string> queries = {"ACATGACGACACATGCTGTAC", "GTACAGCATGTGTCGTCATGT", "AACTATGGTGCTAACGTAGCAC",
+                              "GTGTAGTAGTGTGTAGTAGCATGGGCAC", "GTGTAGTAGTGTGTTGTAGCATGGGCAC", "GTGCCCATGCTACTACAC", "AC"};
+    vector<int64_t> mask = {0, 3, 4};
+    int64_t k = 6;
+
+    string ref_fastafile = get_temp_file_manager().create_filename("", ".fna");
+    string query_fastafile = get_temp_file_manager().create_filename("", ".fna");
+    string maskfile = get_temp_file_manager().create_filename("", ".txt");
+    string indexprefix = get_temp_file_manager().create_filename();
+    string tempdir = get_temp_file_manager().get_dir();
+    write_as_fasta(seqs, ref_fastafile);
+    write_as_fasta(queries, query_fastafile);
+    {
+        throwing_ofstream mask_out(maskfile);
+        for(int64_t c : mask) mask_out << c << "\n";
+    }
+
+    vector<string> args = {"build", "-k", to_string(k), "-i", ref_fastafile, "-o", indexprefix, "--temp-dir", tempdir, "--forward-strand-only"};
+    sbwt::Argv argv(args);
+    ASSERT_EQ(build_index_main(argv.size, argv.array), 0);
+
+    for(string threshold : {"1", "0.5"}){
+        for(bool rc : {false, true}){
+            string full_resultfile = get_temp_file_manager().create_filename("", ".txt");
+            string masked_resultfile = get_temp_file_manager().create_filename("", ".txt");
+            vector<string> full_args = {"pseudoalign", "-q", query_fastafile, "-i", indexprefix, "-o", full_resultfile, "--temp-dir", tempdir, "--threshold", threshold, "--sort-output"};
+            if(rc) full_args.push_back("--rc");
+            vector<string> masked_args = full_args;
+            masked_args[6] = masked_resultfile;
+            masked_args.push_back("--color-mask");
+            masked_args.push_back(maskfile);
+
+            sbwt::Argv full_argv(full_args);
+            ASSERT_EQ(pseudoalign_main(full_argv.size, full_argv.array), 0);
+            sbwt::Argv masked_argv(masked_args);
+            ASSERT_EQ(pseudoalign_main(masked_argv.size, masked_argv.array), 0);
+
+            vector<vector<int64_t> > full_results = parse_pseudoalignment_output_format_from_disk(full_resultfile);
+            vector<vector<int64_t> > masked_results = parse_pseudoalignment_output_format_from_disk(masked_resultfile);
+            ASSERT_EQ(full_results.size(), masked_results.size());
+            for(int64_t i = 0; i < full_results.size(); i++){
+                vector<int64_t> expected;
+                for(int64_t c : full_results[i])
+                    if(std::find(mask.begin(), mask.end(), c) != mask.end()) expected.push_back(c);
+                std::sort(expected.begin(), expected.end());
+                std::sort(masked_results[i].begin(), masked_results[i].end());
+                ASSERT_EQ(masked_results[i], expected);
+            }
+        }
+    }
+}
+
+TEST(TEST_PSEUDOALIGN, prefilter){
+    vector<string> seqs = {"ACATGACGACACATGCTGTAC", "AACTATGGTGCTAACGTAGCAC", "GTGTAGTAGTGTGTAGTAGCATGGGCAC"};
+    vector<string> queries = {"ACATGACGACACATGCTGTAC", "GTACAGCATGTGTCGTCATGT", "TTTTTTTTTTTTTTTTTTTT",
+                              "ACATGACGTTTTTTTTTTTTTTTTTT", "GTGTAGTAGNGTGTAGTAGCATGGGCAC", "AC", "CCCCCCCCCCCACATGACGACA"};
+    int64_t k = 6;
+
+    string ref_fastafile = get_temp_file_manager().create_filename("", ".fna");
+    string query_fastafile = get_temp_file_manager().create_filename("", ".fna");
+    string indexprefix = get_temp_file_manager().create_filename();
+    string tempdir = get_temp_file_manager().get_dir();
+    write_as_fasta(seqs, ref_fastafile);
+    write_as_fasta(queries, query_fastafile);
+
+    vector<string> args = {"build", "-k", to_string(k), "-i", ref_fastafile, "-o", indexprefix, "--temp-dir", tempdir, "--prefilter"};
+    sbwt::Argv argv(args);
+    ASSERT_EQ(build_index_main(argv.size, argv.array), 0);
+    ASSERT_TRUE(std::filesystem::exists(indexprefix + ".tprefilter"));
+
+    // The prefilter must not change the output in any mode
+    vector<vector<string>> extra_args = {{"--threshold", "1"}, {"--threshold", "0.5"}, {"--threshold", "0.5", "--include-unknown-kmers"},
+                                         {"--relevant-kmers-fraction", "0.5"}, {"--threshold", "0.5", "--relevant-kmers-fraction", "0.3"},
+                                         {"--report-relevant-kmer-count"}};
+    for(const vector<string>& extra : extra_args){
+        string resultfile = get_temp_file_manager().create_filename("", ".txt");
+        string no_prefilter_resultfile = get_temp_file_manager().create_filename("", ".txt");
+        vector<string> args2 = {"pseudoalign", "-q", query_fastafile, "-i", indexprefix, "-o", resultfile, "--temp-dir", tempdir, "--sort-output", "--sort-hits"};
+        for(const string& x : extra) args2.push_back(x);
+        vector<string> args3 = args2;
+        args3[6] = no_prefilter_resultfile;
+        args3.push_back("--no-prefilter");
+
+        sbwt::Argv argv2(args2);
+        ASSERT_EQ(pseudoalign_main(argv2.size, argv2.array), 0);
+        sbwt::Argv argv3(args3);
+        ASSERT_EQ(pseudoalign_main(argv3.size, argv3.array), 0);
+        ASSERT_TRUE(files_are_equal(resultfile, no_prefilter_resultfile));
+    }
+}
+
+TEST(TEST_PSEUDOALIGN, prefilter_files){
+    vector<string> seqs = {"ACATGACGACACATGCTGTAC", "AACTATGGTGCTAACGTAGCAC", "GTGTAGTAGTGTGTAGTAGCATGGGCAC"};
+    int64_t k = 6;
+
+    // Plain and gzipped files in both orders
+    string plain_file = get_temp_file_manager().create_filename("", ".fna");
+    string gzip_file = get_temp_file_manager().create_filename("", ".fna.gz");
+    write_as_fasta({seqs[0]}, plain_file);
+    { // Artifical scope to make the gz writer go out of scope to flush the stream
+        seq_io::Writer<seq_io::zstr::ofstream> gzip_out(gzip_file);
+        for(int64_t i = 1; i < seqs.size(); i++) gzip_out.write_sequence(seqs[i].c_str(), seqs[i].size());
+    }
+    for(vector<string> files : vector<vector<string>>{{plain_file, gzip_file}, {gzip_file, plain_file}}){
+        Kmer_Prefilter prefilter = build_kmer_prefilter(files, k, 100, 16);
+        for(const string& S : seqs) ASSERT_EQ(prefilter.count_possible_hits(S.c_str(), S.size()), S.size() - k + 1);
+    }
+
+    // Truncated and corrupt prefilters are not loaded
+    Kmer_Prefilter prefilter = build_kmer_prefilter({plain_file}, k, 100, 16);
+    stringstream ss;
+    prefilter.serialize(ss);
+    string bytes = ss.str();
+    auto load_from = [](const string& data){
+        stringstream in(data);
+        Kmer_Prefilter loaded;
+        loaded.load(in);
+        return loaded;
+    };
+    ASSERT_EQ(load_from(bytes).count_possible_hits(seqs[0].c_str(), seqs[0].size()), seqs[0].size() - k + 1);
+    ASSERT_THROW(load_from(bytes.substr(0, bytes.size() - 8)), std::runtime_error);
+    ASSERT_THROW(load_from(bytes.substr(0, bytes.size() - prefilter.size_in_bytes() - 4)), std::runtime_error);
+    string corrupt = bytes;
+    int64_t huge = 1LL << 50;
+    memcpy(corrupt.data() + bytes.size() - prefilter.size_in_bytes() - sizeof(int64_t), &huge, sizeof(int64_t)); // Number of blocks
+    ASSERT_THROW(load_from(corrupt), std::runtime_error);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <gtest/gtest.h>
+#include "resource_planner.hh"
+#include "test_tools.hh"
+#include "globals.hh"
+
+TEST(RESOURCE_PLANNER, full_sample_is_exact){
+    // With a sample fraction of 1, the k-mer and color set counts must match the true values
+    int64_t k = 11;
+    vector<string> seqs;
+    string shared = get_random_dna_string(200, 4);
+    for(int64_t i = 0; i < 10; i++){
+        string S = get_random_dna_string(100, 4);
+        if(i % 3 == 0) S += shared; // Some k-mers in multiple colors
+        if(i == 5) S[50] = 'N'; // Splits the sequence
+        seqs.push_back(S);
+    }
+    string fastafile = get_temp_file_manager().create_filename("", ".fna");
+    write_as_fasta(seqs, fastafile);
+
+    // One color per sequence. Canonical k-mer -> colors.
+    map<string, set<int64_t>> true_colors;
+    for(int64_t color = 0; color < (int64_t)seqs.size(); color++){
+        for(string kmer : get_all_kmers(seqs[color], k)){
+            if(kmer.find('N') != string::npos) continue;
+            string rc = get_reverse_complement(kmer);
+            true_colors[min(kmer, rc)].insert(color);
+        }
+    }
+    set<set<int64_t>> true_distinct_sets;
+    for(const auto& [kmer, colors] : true_colors) true_distinct_sets.insert(colors);
+    int64_t true_length_sum = 0;
+    for(const set<int64_t>& colors : true_distinct_sets) true_length_sum += colors.size();
+
+    Plan_Inputs I = estimate_plan_inputs({fastafile}, {}, false, k, true, "sdsl-hybrid", 1.0, 2);
+    ASSERT_EQ(I.n_sequences, seqs.size());
+    ASSERT_EQ(I.n_colors, seqs.size());
+    ASSERT_EQ(I.n_kmers, 2 * true_colors.size()); // Odd k, so no palindromes
+    ASSERT_EQ(I.n_distinct_color_sets, true_distinct_sets.size());
+    ASSERT_EQ(I.sum_of_distinct_color_set_lengths, true_length_sum);
+    ASSERT_LE(I.n_core_kmers, I.n_kmers);
+    ASSERT_GT(I.n_core_kmers, 0);
+}
+
+TEST(RESOURCE_PLANNER, calibration){
+    Plan_Inputs I;
+    I.k = 31;
+    I.input_bytes = 1e9;
+    I.input_bases = 1e9;
+    I.n_colors = 1000;
+    I.n_kmers = 5e8;
+    I.n_core_kmers = 5e7;
+    I.n_node_color_pairs = 2e8;
+    I.n_distinct_color_sets = 1e5;
+    I.sum_of_distinct_color_set_lengths = 1e7;
+    I.color_set_storage_bytes = 2e6;
+    Plan_Settings S;
+
+    // A run that took twice the predicted memory, disk and time in every stage
+    Resource_Plan uncalibrated = predict_resources(I, S, Calibration());
+    map<string, string> stats;
+    I.add_to(stats);
+    S.add_to(stats);
+    for(const Stage_Prediction& s : uncalibrated.build_stages){
+        stats[s.name + ".seconds"] = to_string(2 * s.seconds);
+        stats[s.name + ".peak_rss_bytes"] = to_string((int64_t)(2 * s.peak_ram_bytes));
+        stats[s.name + ".peak_temp_bytes"] = to_string((int64_t)(2 * s.peak_temp_bytes));
+    }
+    string stats_file = get_temp_file_manager().create_filename("", ".txt");
+    write_key_value_file(stats, stats_file);
+
+    Calibration cal = load_calibration({stats_file});
+    ASSERT_EQ(cal.n_runs, 1);
+    Resource_Plan calibrated = predict_resources(I, S, cal);
+    ASSERT_EQ(calibrated.build_stages.size(), uncalibrated.build_stages.size());
+    for(int64_t i = 0; i < (int64_t)calibrated.build_stages.size(); i++){
+        const Stage_Prediction& a = uncalibrated.build_stages[i];
+        const Stage_Prediction& b = calibrated.build_stages[i];
+        ASSERT_NEAR(b.seconds, 2 * a.seconds, 1e-3 * a.seconds);
+        ASSERT_NEAR(b.peak_ram_bytes, 2 * a.peak_ram_bytes, 1e-3 * a.peak_ram_bytes);
+        ASSERT_NEAR(b.peak_temp_bytes, 2 * a.peak_temp_bytes, 1e-3 * a.peak_temp_bytes);
+    }
+}
@@ -5,13 +5,15 @@
 #include "globals.hh"
 #include "sbwt/globals.hh"
 #include "coloring/Sparse_Uint_Array.hh"
+#include "test_tools.hh"
+#include <sstream>
 
 using namespace sbwt;
 
-TEST(TEST_SPARSE_UINT_ARRAY, random_test){
+void run_sparse_uint_array_random_test(int64_t ram_bytes){
     int64_t length = 1000;
     int64_t max_value = 8; // power of 2
-    Sparse_Uint_Array_Builder builder(length, 2048, 3);
+    Sparse_Uint_Array_Builder builder(length, ram_bytes, 3);
     
     int64_t NOTFOUND = 1e9;
     vector<int64_t> reference(length, NOTFOUND);
@@ -30,13 +32,117 @@ TEST(TEST_SPARSE_UINT_ARRAY, random_test){
     }
 
     Sparse_Uint_Array A = builder.finish();
+    Sparse_Uint_Array A_loaded = to_disk_and_back(A);
 
     // Check
     for(int64_t i = 0; i < length; i++){
         logger << i << " " << reference[i] << endl;
-        if(reference[i] == NOTFOUND)
+        if(reference[i] == NOTFOUND){
             ASSERT_EQ(A.get(i), -1);
-        else
+            ASSERT_EQ(A_loaded.get(i), -1);
+            ASSERT_FALSE(A.has_index(i));
+        } else{
             ASSERT_EQ(A.get(i), reference[i]);
+            ASSERT_EQ(A_loaded.get(i), reference[i]);
+            ASSERT_TRUE(A.has_index(i));
+        }
     }
-}
\ No newline at end of file
+}
+
+TEST(TEST_SPARSE_UINT_ARRAY, random_test){
+    run_sparse_uint_array_random_test(2048); // Spills to disk
+}
+
+TEST(TEST_SPARSE_UINT_ARRAY, random_test_in_memory){
+    run_sparse_uint_array_random_test(1 << 20);
+}
+
+// Marks at and around the block and word boundaries, and loading the layout of older index versions
+TEST(TEST_SPARSE_UINT_ARRAY, block_boundaries_and_old_layout){
+    int64_t length = 3000;
+    sdsl::bit_vector marks(length, 0);
+    vector<int64_t> reference(length, -1);
+    vector<int64_t> marked_values;
+    for(int64_t i = 0; i < length; i++){
+        if(i % 448 <= 1 || i % 448 == 447 || i % 64 == 63 || i % 5 == 0 || i >= length - 70){
+            marks[i] = 1;
+            reference[i] = i % 1000;
+            marked_values.push_back(i % 1000);
+        }
+    }
+    sdsl::int_vector<> values(marked_values.size(), 0, 10);
+    for(int64_t i = 0; i < marked_values.size(); i++) values[i] = marked_values[i];
+
+    Sparse_Uint_Array A(marks, values, 999);
+    ASSERT_EQ(A.size(), length);
+    ASSERT_EQ(A.number_of_values(), marked_values.size());
+    for(int64_t i = 0; i < length; i++){
+        ASSERT_EQ(A.get(i), reference[i]);
+        ASSERT_EQ(A.has_index(i), reference[i] != -1);
+    }
+    ASSERT_THROW(A.get(length), std::runtime_error);
+
+    // The layout of sdsl-hybrid-v4 and roaring-v0
+    std::stringstream ss;
+    sdsl::rank_support_v5<> marks_rs(&marks);
+    marks.serialize(ss);
+    marks_rs.serialize(ss);
+    values.serialize(ss);
+    uint64_t max_value = 999;
+    ss.write((char*)&max_value, sizeof(max_value));
+
+    Sparse_Uint_Array B;
+    B.load(ss, 0);
+    ASSERT_EQ(B.size(), length);
+    ASSERT_EQ(B.get_max_value(), 999);
+    for(int64_t i = 0; i < length; i++) ASSERT_EQ(B.get(i), reference[i]);
+}
+
+// Most values are small, so most of them get a short code and the array gets smaller
+TEST(TEST_SPARSE_UINT_ARRAY, short_codes_with_escapes){
+    int64_t length = 10000;
+    srand(2345);
+    sdsl::bit_vector marks(length, 0);
+    vector<int64_t> reference(length, -1);
+    vector<int64_t> marked_values;
+    for(int64_t i = 0; i < length; i++){
+        if(rand() % 2 == 0) continue;
+        int64_t value = rand() % 10 == 0 ? rand() % 100000 : rand() % 3;
+        marks[i] = 1;
+        reference[i] = value;
+        marked_values.push_back(value);
+    }
+    marked_values.push_back(99999); // The largest value
+    reference[length-1] = 99999;
+    marks[length-1] = 1;
+    sdsl::int_vector<> values(marked_values.size(), 0, 17);
+    for(int64_t i = 0; i < marked_values.size(); i++) values[i] = marked_values[i];
+
+    Sparse_Uint_Array A(marks, values, 99999);
+    int64_t plain_bytes = A.space_breakdown()["values"];
+    A.encode_values_with_escapes();
+    ASSERT_LT(A.space_breakdown()["values"] + A.space_breakdown()["escaped-values"], plain_bytes / 2);
+
+    Sparse_Uint_Array A_loaded = to_disk_and_back(A);
+    Sparse_Uint_Array A_copy = A_loaded;
+    Sparse_Uint_Array A_moved = std::move(A_loaded); // The rank support of the escape marks must move along
+    Sparse_Uint_Array A_move_assigned;
+    A_move_assigned = std::move(A_moved);
+    for(int64_t i = 0; i < length; i++){
+        ASSERT_EQ(A.get(i), reference[i]);
+        ASSERT_EQ(A_copy.get(i), reference[i]);
+        ASSERT_EQ(A_move_assigned.get(i), reference[i]);
+    }
+
+    vector<int64_t> counts = A_copy.value_counts();
+    ASSERT_EQ(counts.size(), 100000);
+    ASSERT_EQ(counts[99999], 1);
+
+    // Renumbering goes through the short codes
+    vector<int64_t> new_value(100000);
+    for(int64_t x = 0; x < 100000; x++) new_value[x] = 99999 - x;
+    A_copy.renumber_values(new_value);
+    ASSERT_EQ(A_copy.get_max_value(), 99999);
+    for(int64_t i = 0; i < length; i++)
+        ASSERT_EQ(A_copy.get(i), reference[i] == -1 ? -1 : 99999 - reference[i]);
+}